@@ -180,11 +180,14 @@ void audio_list(void)
 
 int audio_open(const char* name)
 {
+    (void)name;
     return -1;
 }
 
 int audio_read(float* buffer, int num_samples)
 {
+    (void)buffer;
+    (void)num_samples;
     return -1;
 }
 
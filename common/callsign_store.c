@@ -0,0 +1,440 @@
+#define _DEFAULT_SOURCE
+#include "callsign_store.h"
+
+#define LOG_LEVEL LOG_INFO
+#include <ft8/debug.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STORE_MAGIC "FTXCALLS"
+#define STORE_BYTE_ORDER 0x01020304u
+
+#define NUM_BUCKETS_10 1024
+#define NUM_BUCKETS_12 4096
+
+/// File header
+struct callsign_store_header_s
+{
+    char magic[8];          ///< STORE_MAGIC (written last when a file is created)
+    uint32_t version;       ///< CALLSIGN_STORE_VERSION
+    uint32_t byte_order;    ///< STORE_BYTE_ORDER as written by the creating machine
+    uint32_t header_size;   ///< sizeof(struct callsign_store_header_s)
+    uint32_t record_size;   ///< sizeof(struct callsign_store_record_s)
+    uint32_t capacity;      ///< Number of records the file has room for
+    uint32_t num_buckets22; ///< Number of buckets of the 22-bit index (a power of two)
+    atomic_uint count;      ///< Number of committed records
+    atomic_uint indexed;    ///< Number of records linked into the indexes
+    uint8_t reserved[24];
+};
+
+/// Record of a callsign. All fields but last_heard are written once, before the record is committed.
+struct callsign_store_record_s
+{
+    char callsign[12];         ///< Up to 11 symbols of callsign + trailing zeros
+    uint32_t n22;              ///< 22-bit hash of the callsign
+    uint32_t next[3];          ///< Next (older) record + 1 in the chain of each index, 0 at the end
+    uint32_t checksum;         ///< Checksum of the fields above
+    _Atomic int64_t last_heard; ///< Time the callsign was last heard (seconds since the epoch)
+};
+
+_Static_assert(sizeof(struct callsign_store_header_s) == 64, "unexpected store header layout");
+_Static_assert(sizeof(struct callsign_store_record_s) == 40, "unexpected store record layout");
+
+typedef struct callsign_store_header_s store_header_t;
+typedef struct callsign_store_record_s store_record_t;
+
+// Shift from a 22-bit hash to the hash of each index (by ftx_callsign_hash_type_t)
+static const int kHash_shift[3] = { 0, 10, 12 };
+
+static uint32_t get_bucket(const callsign_store_t* store, int hash_type, uint32_t hash)
+{
+    switch (hash_type)
+    {
+    case FTX_CALLSIGN_HASH_10_BITS:
+        return hash & (NUM_BUCKETS_10 - 1);
+    case FTX_CALLSIGN_HASH_12_BITS:
+        return hash & (NUM_BUCKETS_12 - 1);
+    default:
+        return hash & store->mask22;
+    }
+}
+
+/// FNV-1a hash of the write-once fields of a record
+static uint32_t record_checksum(const store_record_t* record)
+{
+    const uint8_t* bytes = (const uint8_t*)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(store_record_t, checksum); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t get_file_size(int capacity, uint32_t num_buckets22)
+{
+    return sizeof(store_header_t) + (NUM_BUCKETS_10 + NUM_BUCKETS_12 + num_buckets22) * sizeof(atomic_uint) + (size_t)capacity * sizeof(store_record_t);
+}
+
+/// Set up the pointers into the mapping
+static void map_layout(callsign_store_t* store)
+{
+    store_header_t* header = (store_header_t*)store->map;
+    atomic_uint* heads = (atomic_uint*)(header + 1);
+    store->header = header;
+    store->capacity = (int)header->capacity;
+    store->mask22 = header->num_buckets22 - 1;
+    store->heads[FTX_CALLSIGN_HASH_22_BITS] = heads;
+    store->heads[FTX_CALLSIGN_HASH_12_BITS] = heads + header->num_buckets22;
+    store->heads[FTX_CALLSIGN_HASH_10_BITS] = heads + header->num_buckets22 + NUM_BUCKETS_12;
+    store->records = (store_record_t*)(heads + header->num_buckets22 + NUM_BUCKETS_12 + NUM_BUCKETS_10);
+}
+
+/// Link record idx (which must be committed) at the start of its chains
+static void link_record(callsign_store_t* store, uint32_t idx)
+{
+    uint32_t n22 = store->records[idx].n22;
+    for (int k = 0; k < 3; ++k)
+    {
+        atomic_store_explicit(&store->heads[k][get_bucket(store, k, n22 >> kHash_shift[k])], idx + 1, memory_order_release);
+    }
+}
+
+/// Relink the first count records from scratch, leaving out those that fail their checksum. Needed once records
+/// have been dropped, as heads and links may point at them.
+static void rebuild_indexes(callsign_store_t* store, uint32_t count)
+{
+    const uint32_t num_buckets[3] = { store->mask22 + 1, NUM_BUCKETS_12, NUM_BUCKETS_10 };
+    for (int k = 0; k < 3; ++k)
+    {
+        for (uint32_t bucket = 0; bucket < num_buckets[k]; ++bucket)
+        {
+            atomic_store_explicit(&store->heads[k][bucket], 0, memory_order_relaxed);
+        }
+    }
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        store_record_t* record = &store->records[idx];
+        if (record->checksum != record_checksum(record))
+            continue;
+        for (int k = 0; k < 3; ++k)
+        {
+            record->next[k] = atomic_load_explicit(&store->heads[k][get_bucket(store, k, record->n22 >> kHash_shift[k])], memory_order_relaxed);
+        }
+        record->checksum = record_checksum(record);
+        link_record(store, idx);
+    }
+}
+
+/// Finish what a crash interrupted: drop a torn last record and link the committed records that are not linked yet
+static void recover(callsign_store_t* store)
+{
+    store_header_t* header = store->header;
+    uint32_t count = atomic_load(&header->count);
+    uint32_t indexed = atomic_load(&header->indexed);
+    bool dropped = false;
+    if (count > (uint32_t)store->capacity)
+    {
+        count = store->capacity;
+        dropped = true;
+    }
+    if (indexed > count)
+        indexed = count;
+    for (uint32_t idx = indexed; idx < count; ++idx)
+    {
+        if (store->records[idx].checksum != record_checksum(&store->records[idx]))
+        {
+            LOG(LOG_WARN, "Callsign store: dropping %u torn record(s)\n", count - idx);
+            count = idx;
+            dropped = true;
+            break;
+        }
+        link_record(store, idx);
+    }
+    if (dropped)
+    {
+        rebuild_indexes(store, count);
+    }
+    atomic_store(&header->count, count);
+    atomic_store(&header->indexed, count);
+}
+
+bool callsign_store_open(callsign_store_t* store, const char* path, int capacity)
+{
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+    atomic_flag_clear(&store->write_lock);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        LOG(LOG_ERROR, "Callsign store: cannot open %s\n", path);
+        return false;
+    }
+    if (0 != flock(fd, LOCK_EX | LOCK_NB))
+    {
+        LOG(LOG_ERROR, "Callsign store: %s is in use\n", path);
+        close(fd);
+        return false;
+    }
+
+    // A file without the magic is new (or its creation was interrupted) and is initialized from scratch
+    store_header_t header;
+    struct stat st;
+    bool is_new = (0 != fstat(fd, &st)) || ((size_t)st.st_size < sizeof(header)) || (sizeof(header) != pread(fd, &header, sizeof(header), 0)) || (0 != memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)));
+    size_t file_size;
+    if (is_new)
+    {
+        uint32_t num_buckets22 = 16;
+        while (num_buckets22 < (uint32_t)capacity)
+        {
+            num_buckets22 *= 2;
+        }
+        file_size = get_file_size(capacity, num_buckets22);
+        // Truncating to zero first clears the heads and counts of an interrupted creation
+        if ((0 != ftruncate(fd, 0)) || (0 != ftruncate(fd, (off_t)file_size)))
+        {
+            LOG(LOG_ERROR, "Callsign store: cannot size %s\n", path);
+            close(fd);
+            return false;
+        }
+        memset(&header, 0, sizeof(header));
+        header.version = CALLSIGN_STORE_VERSION;
+        header.byte_order = STORE_BYTE_ORDER;
+        header.header_size = sizeof(store_header_t);
+        header.record_size = sizeof(store_record_t);
+        header.capacity = capacity;
+        header.num_buckets22 = num_buckets22;
+    }
+    else
+    {
+        file_size = get_file_size(header.capacity, header.num_buckets22);
+        if ((header.version != CALLSIGN_STORE_VERSION) || (header.byte_order != STORE_BYTE_ORDER) || (header.header_size != sizeof(store_header_t)) || (header.record_size != sizeof(store_record_t)) || (header.num_buckets22 == 0) || (header.num_buckets22 & (header.num_buckets22 - 1)) || ((size_t)st.st_size != file_size))
+        {
+            LOG(LOG_ERROR, "Callsign store: %s has an unsupported layout\n", path);
+            close(fd);
+            return false;
+        }
+    }
+
+    void* map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG(LOG_ERROR, "Callsign store: cannot map %s\n", path);
+        close(fd);
+        return false;
+    }
+    if (is_new)
+    {
+        // The magic goes in after the rest of the header and is flushed last
+        memcpy(map, &header, sizeof(header));
+        msync(map, file_size, MS_SYNC);
+        memcpy(((store_header_t*)map)->magic, STORE_MAGIC, sizeof(header.magic));
+        msync(map, sizeof(header), MS_SYNC);
+    }
+
+    store->fd = fd;
+    store->path = strdup(path);
+    store->map = map;
+    store->map_size = file_size;
+    map_layout(store);
+    recover(store);
+    LOG(LOG_DEBUG, "Callsign store %s: %d of %d records\n", path, callsign_store_size(store), store->capacity);
+    return true;
+}
+
+void callsign_store_close(callsign_store_t* store)
+{
+    if (store->map != NULL)
+    {
+        msync(store->map, store->map_size, MS_SYNC);
+        munmap(store->map, store->map_size);
+    }
+    if (store->fd >= 0)
+    {
+        close(store->fd); // also releases the lock
+    }
+    free(store->path);
+    store->path = NULL;
+    store->map = NULL;
+    store->header = NULL;
+    store->records = NULL;
+    store->fd = -1;
+    store->capacity = 0;
+}
+
+int callsign_store_size(const callsign_store_t* store)
+{
+    if (store->map == NULL)
+        return 0;
+    return (int)atomic_load_explicit(&store->header->count, memory_order_acquire);
+}
+
+bool callsign_store_add(callsign_store_t* store, const char* callsign, uint32_t n22, int64_t time)
+{
+    if (store->map == NULL)
+        return false;
+    n22 &= 0x3FFFFFu;
+    bool saved = true;
+    while (atomic_flag_test_and_set_explicit(&store->write_lock, memory_order_acquire))
+    {
+        // spin
+    }
+
+    uint32_t ref = atomic_load_explicit(&store->heads[FTX_CALLSIGN_HASH_22_BITS][get_bucket(store, FTX_CALLSIGN_HASH_22_BITS, n22)], memory_order_relaxed);
+    uint32_t count = atomic_load_explicit(&store->header->count, memory_order_relaxed);
+    for (uint32_t steps = 0; (ref > 0) && (ref <= count) && (steps < count); ++steps)
+    {
+        store_record_t* record = &store->records[ref - 1];
+        if ((record->n22 == n22) && (0 == strncmp(record->callsign, callsign, 11)) && (record->checksum == record_checksum(record)))
+            break;
+        ref = record->next[FTX_CALLSIGN_HASH_22_BITS];
+    }
+
+    if ((ref > 0) && (ref <= count))
+    {
+        atomic_store_explicit(&store->records[ref - 1].last_heard, time, memory_order_relaxed);
+    }
+    else if (count >= (uint32_t)store->capacity)
+    {
+        saved = false;
+    }
+    else
+    {
+        // Write the record, then commit it, then link it
+        store_record_t* record = &store->records[count];
+        memset(record->callsign, 0, sizeof(record->callsign));
+        strncpy(record->callsign, callsign, 11);
+        record->n22 = n22;
+        for (int k = 0; k < 3; ++k)
+        {
+            record->next[k] = atomic_load_explicit(&store->heads[k][get_bucket(store, k, n22 >> kHash_shift[k])], memory_order_relaxed);
+        }
+        record->checksum = record_checksum(record);
+        atomic_store_explicit(&record->last_heard, time, memory_order_relaxed);
+        atomic_store_explicit(&store->header->count, count + 1, memory_order_release);
+        link_record(store, count);
+        atomic_store_explicit(&store->header->indexed, count + 1, memory_order_release);
+    }
+
+    atomic_flag_clear_explicit(&store->write_lock, memory_order_release);
+    return saved;
+}
+
+bool callsign_store_lookup(const callsign_store_t* store, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    if (store->map == NULL)
+    {
+        callsign[0] = '\0';
+        return false;
+    }
+    const int shift = kHash_shift[hash_type];
+    // The head is read first: a record it links to is committed, so the count covers it
+    uint32_t ref = atomic_load_explicit(&store->heads[hash_type][get_bucket(store, hash_type, hash)], memory_order_acquire);
+    uint32_t count = atomic_load_explicit(&store->header->count, memory_order_acquire);
+    const store_record_t* found = NULL;
+    int64_t found_time = 0;
+    for (uint32_t steps = 0; (ref > 0) && (ref <= count) && (steps < count); ++steps)
+    {
+        const store_record_t* record = &store->records[ref - 1];
+        if (((record->n22 >> shift) == hash) && (record->checksum == record_checksum(record)))
+        {
+            int64_t time = atomic_load_explicit(&record->last_heard, memory_order_relaxed);
+            if ((found == NULL) || (time > found_time))
+            {
+                found = record;
+                found_time = time;
+            }
+        }
+        ref = record->next[hash_type];
+    }
+
+    if (found == NULL)
+    {
+        callsign[0] = '\0';
+        return false;
+    }
+    memcpy(callsign, found->callsign, 11);
+    callsign[11] = '\0';
+    return true;
+}
+
+bool callsign_store_compact(callsign_store_t* store, int64_t min_time)
+{
+    const size_t tmp_size = strlen(store->path) + sizeof(".tmp");
+    char* tmp_path = (char*)malloc(tmp_size);
+    if (tmp_path == NULL)
+        return false;
+    int tmp_len = snprintf(tmp_path, tmp_size, "%s.tmp", store->path);
+    if ((tmp_len < 0) || ((size_t)tmp_len >= tmp_size))
+    {
+        free(tmp_path);
+        return false;
+    }
+    unlink(tmp_path);
+
+    callsign_store_t compacted;
+    if (!callsign_store_open(&compacted, tmp_path, store->capacity))
+    {
+        free(tmp_path);
+        return false;
+    }
+    // Oldest records first, so that the chains keep their order
+    int count = callsign_store_size(store);
+    int num_kept = 0;
+    for (int idx = 0; idx < count; ++idx)
+    {
+        const store_record_t* record = &store->records[idx];
+        int64_t time = atomic_load(&record->last_heard);
+        if ((time >= min_time) && (record->checksum == record_checksum(record)))
+        {
+            callsign_store_add(&compacted, record->callsign, record->n22, time);
+            ++num_kept;
+        }
+    }
+
+    // Both files stay locked until the new one has replaced the old one, so that no other process can open
+    // either in between; the new one is flushed first, so that a crash leaves either complete file
+    msync(compacted.map, compacted.map_size, MS_SYNC);
+    if (0 != rename(tmp_path, store->path))
+    {
+        LOG(LOG_ERROR, "Callsign store: cannot replace %s\n", store->path);
+        callsign_store_close(&compacted);
+        unlink(tmp_path);
+        free(tmp_path);
+        return false;
+    }
+    free(tmp_path);
+    free(compacted.path);
+    compacted.path = store->path;
+    store->path = NULL;
+    callsign_store_close(store);
+    *store = compacted;
+    LOG(LOG_INFO, "Callsign store %s compacted: kept %d of %d records\n", store->path, num_kept, count);
+    return true;
+}
+
+static bool lookup_hash(void* ctx, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    return callsign_store_lookup((const callsign_store_t*)ctx, hash_type, hash, callsign);
+}
+
+static void save_hash(void* ctx, const char* callsign, uint32_t n22)
+{
+    callsign_store_add((callsign_store_t*)ctx, callsign, n22, (int64_t)time(NULL));
+}
+
+void callsign_store_interface(callsign_store_t* store, ftx_callsign_hash_interface_t* hash_if)
+{
+    hash_if->lookup_hash = lookup_hash;
+    hash_if->save_hash = save_hash;
+    hash_if->ctx = store;
+}
@@ -0,0 +1,83 @@
+#ifndef _INCLUDE_CALLSIGN_STORE_H_
+#define _INCLUDE_CALLSIGN_STORE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <ft8/message.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Version of the store file layout (files of other versions are not opened)
+#define CALLSIGN_STORE_VERSION 1
+
+/// Persistent callsign cache in a memory-mapped file, so that hashed callsigns heard before a restart are still
+/// resolved after it. Opening maps the file and uses it in place: nothing is parsed or loaded.
+///
+/// The file holds a header, the bucket heads of three indexes (10, 12 and 22 bit hashes, as ftx_callsign_table_t)
+/// and an array of fixed-size records (callsign, 22-bit hash, index links, checksum, last-heard time). Records are
+/// only ever appended: a record is written and checksummed first, then committed by the record count in the
+/// header, then linked into the indexes. After a crash, open links the committed records that were not linked yet
+/// and drops a torn last record, and lookups skip records that fail their checksum.
+///
+/// Changes are made in the shared mapping, so they survive a crash of the process at once, but they reach the disk
+/// only as the system writes the mapping back, or when the store is closed (which flushes it). A power loss may
+/// therefore lose recently added callsigns, and may leave records torn out of order.
+///
+/// Lookups never block and may run from several threads while one thread adds. A file is used by one process at a
+/// time (it is locked while open).
+typedef struct
+{
+    int fd;                                 ///< File descriptor of the store file
+    char* path;                             ///< Path of the store file (for callsign_store_compact())
+    void* map;                              ///< Mapped file
+    size_t map_size;                        ///< Size of the mapping (the whole file)
+    int capacity;                           ///< Maximum number of records
+    uint32_t mask22;                        ///< Bucket mask of the 22-bit index
+    struct callsign_store_header_s* header; ///< File header (in the mapping)
+    struct callsign_store_record_s* records; ///< Record array (in the mapping)
+    atomic_uint* heads[3];                  ///< Bucket heads of each index (by ftx_callsign_hash_type_t, in the mapping)
+    atomic_flag write_lock;                 ///< Serializes the writers
+} callsign_store_t;
+
+/// Open a store file, creating it with room for capacity callsigns if it does not exist (an existing file keeps
+/// its own capacity)
+/// @return False if the file cannot be created, mapped or locked, or has a different layout
+bool callsign_store_open(callsign_store_t* store, const char* path, int capacity);
+
+/// Flush the mapping to disk and close the file
+void callsign_store_close(callsign_store_t* store);
+
+/// Number of callsigns in the store
+int callsign_store_size(const callsign_store_t* store);
+
+/// Save a callsign heard at a time (seconds since the epoch), or update the time of a callsign already stored
+/// @return False if the callsign is new and the store is full
+bool callsign_store_add(callsign_store_t* store, const char* callsign, uint32_t n22, int64_t time);
+
+/// Look up a callsign by its 22, 12 or 10 bit hash. Of several callsigns sharing the hash, the one heard last is
+/// found.
+/// @param[out] callsign Callsign found (up to 11 characters and a terminating zero), empty if none
+/// @return True if a callsign was found
+bool callsign_store_lookup(const callsign_store_t* store, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign);
+
+/// Rewrite the store file with only the callsigns heard at or after min_time, then reopen it.
+/// The new file replaces the old one atomically, so a crash leaves either of them, and both stay locked throughout.
+/// Must not run concurrently with any other use of the store.
+/// @return False if the new file cannot be written or cannot replace the old one (the store stays as it was)
+bool callsign_store_compact(callsign_store_t* store, int64_t min_time);
+
+/// Fill a hash interface for the message codec that saves callsigns (with the current time) to and looks them up
+/// in the store
+void callsign_store_interface(callsign_store_t* store, ftx_callsign_hash_interface_t* hash_if);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_CALLSIGN_STORE_H_
@@ -0,0 +1,295 @@
+#include "channel.h"
+#include <common/common.h>
+
+#define LOG_LEVEL LOG_INFO
+#include <ft8/debug.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+#define CHANNEL_FADING_OSR   16   ///< Fading gain samples per Hertz of Doppler spread
+#define CHANNEL_FADING_SIGMA 4.0f ///< Extent of the Gaussian fading filter on either side, in standard deviations
+#define CHANNEL_HILBERT_RATE 190  ///< Sample rate per tap of half the Hilbert transformer
+
+/// SplitMix64 generator
+static uint64_t channel_rng(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/// Complex Gaussian sample of unit power (Box-Muller)
+static void channel_gauss(uint64_t* state, float* re, float* im)
+{
+    float u1 = ((channel_rng(state) >> 40) + 1.0f) / 16777216.0f; // (0, 1]
+    float u2 = (channel_rng(state) >> 40) / 16777216.0f;
+    float r = sqrtf(-logf(u1));
+    *re = r * cosf(2 * (float)M_PI * u2);
+    *im = r * sinf(2 * (float)M_PI * u2);
+}
+
+static float blackman(int i, int N)
+{
+    const float alpha = 0.16f;
+    float x = 2 * (float)M_PI * i / N;
+    return (1 - alpha) / 2 - cosf(x) / 2 + alpha / 2 * cosf(2 * x);
+}
+
+/// Filter the white noise of every path into the fading gain at the next gain sample, after drawing a new noise sample
+static void channel_next_gain(channel_t* me)
+{
+    const int L = me->fading_taps;
+    for (int p = 0; p < me->num_paths; ++p)
+    {
+        float* noise = me->fading_noise + 2 * p * L;
+        channel_gauss(&me->rng, &noise[2 * me->fading_head], &noise[2 * me->fading_head + 1]);
+    }
+    if (++me->fading_head == L)
+        me->fading_head = 0;
+
+    for (int p = 0; p < me->num_paths; ++p)
+    {
+        const float* noise = me->fading_noise + 2 * p * L;
+        float g_r = 0;
+        float g_i = 0;
+        for (int k = 0, j = me->fading_head; k < L; ++k)
+        {
+            g_r += me->fading_fir[k] * noise[2 * j];
+            g_i += me->fading_fir[k] * noise[2 * j + 1];
+            if (++j == L)
+                j = 0;
+        }
+        me->gain[p][0][0] = me->gain[p][1][0];
+        me->gain[p][0][1] = me->gain[p][1][1];
+        me->gain[p][1][0] = g_r;
+        me->gain[p][1][1] = g_i;
+    }
+}
+
+void channel_init(channel_t* me, const channel_config_t* cfg)
+{
+    me->cfg = *cfg;
+    me->num_paths = (cfg->delay_spread > 0) ? 2 : 1;
+    me->path_delay = (me->num_paths > 1) ? (int)(0.5f + cfg->delay_spread * 1e-3f * cfg->sample_rate) : 0;
+    me->hilbert_half = (cfg->sample_rate / CHANNEL_HILBERT_RATE) | 1;
+    // The clock offset is resampled with a 4 point cubic, which looks 2 samples ahead
+    me->latency = me->hilbert_half + 2;
+
+    // Windowed ideal Hilbert transformer, 2 / (pi k) at odd offsets k from the center. Its taps at odd offsets all
+    // fall on input samples of the same parity, so the input is kept as two histories (even and odd samples), each
+    // spanning the whole transformer with M + 1 samples, and the taps are laid out over such a history, oldest first.
+    const int M = me->hilbert_half;
+    me->hilbert = (float*)malloc((M + 1) * sizeof(float));
+    for (int j = 0; j <= M; ++j)
+    {
+        const int k = 2 * j - M; // offset from the center
+        me->hilbert[j] = -2 / ((float)M_PI * k) * blackman(M + k + 1, 2 * M + 2);
+    }
+    me->x_hist = (float*)malloc(2 * 2 * (M + 1) * sizeof(float));
+    me->a_size = me->path_delay + 1;
+    me->a_hist = (float*)malloc(2 * me->a_size * sizeof(float));
+
+    // Gaussian Doppler spectrum of standard deviation s_f = spread / 2: the filter is a Gaussian of standard deviation
+    // 1 / (2 sqrt(2) pi s_f) seconds (its square has the spectrum), which is a constant number of gain samples as
+    // their rate follows the spread; it is normalized to unit power gain
+    const float sigma = CHANNEL_FADING_OSR / (sqrtf(2) * (float)M_PI);
+    me->fading_taps = 1;
+    me->gain_step = 0;
+    if (cfg->doppler_spread > 0)
+    {
+        me->fading_taps = 2 * (int)ceilf(CHANNEL_FADING_SIGMA * sigma) + 1;
+        me->gain_step = CHANNEL_FADING_OSR * cfg->doppler_spread / cfg->sample_rate;
+    }
+    me->fading_fir = (float*)malloc(me->fading_taps * sizeof(float));
+    me->fading_noise = (float*)malloc(2 * CHANNEL_MAX_PATHS * me->fading_taps * sizeof(float));
+    float sum2 = 0;
+    for (int k = 0; k < me->fading_taps; ++k)
+    {
+        const float t = k - (me->fading_taps - 1) / 2;
+        me->fading_fir[k] = (me->fading_taps > 1) ? expf(-t * t / (2 * sigma * sigma)) : 1.0f;
+        sum2 += me->fading_fir[k] * me->fading_fir[k];
+    }
+    // Every path gets an equal share of the power
+    for (int k = 0; k < me->fading_taps; ++k)
+    {
+        me->fading_fir[k] /= sqrtf(sum2 * me->num_paths);
+    }
+
+    me->read_step = 1.0 / (1.0 + 1e-6 * cfg->clock_ppm);
+    channel_reset(me, cfg->seed);
+
+    LOG(LOG_DEBUG, "Channel: %d path(s) %d samples apart, spread %.2f Hz (%d fading taps), %d Hilbert taps\n",
+        me->num_paths, me->path_delay, cfg->doppler_spread, me->fading_taps, 2 * M + 1);
+}
+
+void channel_reset(channel_t* me, uint64_t seed)
+{
+    const int M = me->hilbert_half;
+    for (int i = 0; i < 2 * 2 * (M + 1); ++i)
+    {
+        me->x_hist[i] = 0;
+    }
+    me->x_head[0] = me->x_head[1] = 0;
+    me->num_x = 0;
+    for (int i = 0; i < 2 * me->a_size; ++i)
+    {
+        me->a_hist[i] = 0;
+    }
+    me->a_head = 0;
+
+    me->rng = seed;
+    if (me->gain_step > 0)
+    {
+        // Fill the noise history, so that the gains are stationary from the start
+        me->fading_head = 0;
+        for (int k = 0; k < me->fading_taps; ++k)
+        {
+            channel_next_gain(me);
+        }
+        channel_next_gain(me);
+    }
+    else
+    {
+        // Static paths with random phases (a single path passes unchanged)
+        for (int p = 0; p < me->num_paths; ++p)
+        {
+            float phi = (me->num_paths > 1) ? 2 * (float)M_PI * (channel_rng(&me->rng) >> 40) / 16777216.0f : 0;
+            for (int j = 0; j < 2; ++j)
+            {
+                me->gain[p][j][0] = cosf(phi) / sqrtf(me->num_paths);
+                me->gain[p][j][1] = sinf(phi) / sqrtf(me->num_paths);
+            }
+        }
+    }
+    me->gain_frac = 0;
+
+    // The phase advances by 2 pi (offset + drift t) / rate per sample, t = n / rate
+    const double w = 2 * M_PI * me->cfg.freq_offset / me->cfg.sample_rate;
+    const double w_chirp = 2 * M_PI * me->cfg.drift / ((double)me->cfg.sample_rate * me->cfg.sample_rate);
+    me->shift[0] = 1;
+    me->shift[1] = 0;
+    me->shift_step[0] = cos(w);
+    me->shift_step[1] = sin(w);
+    me->shift_chirp[0] = cos(w_chirp);
+    me->shift_chirp[1] = sin(w_chirp);
+    for (int i = 0; i < 4; ++i)
+    {
+        me->y_hist[i] = 0;
+    }
+    me->read_pos = 1; // the first output is y_hist[1] once one sample is in (so 2 samples late)
+}
+
+void channel_free(channel_t* me)
+{
+    free(me->hilbert);
+    free(me->x_hist);
+    free(me->a_hist);
+    free(me->fading_fir);
+    free(me->fading_noise);
+}
+
+/// Pass one input sample through the channel up to the resampling, returning the real part of the faded, shifted signal
+static float channel_step(channel_t* me, float x)
+{
+    // Analytic signal at the center of the Hilbert transformer, M samples back, whose imaginary part only depends
+    // on the history of the newest sample's parity
+    const int M = me->hilbert_half;
+    const int S = M + 1;
+    const int p = (int)(me->num_x++ & 1);
+    float* hist = me->x_hist + 2 * S * p;
+    hist[me->x_head[p]] = x;
+    hist[me->x_head[p] + S] = x;
+    if (++me->x_head[p] == S)
+        me->x_head[p] = 0;
+    const float* xs = hist + me->x_head[p]; // oldest first
+    const float x_center = me->x_hist[2 * S * (p ^ 1) + me->x_head[p ^ 1] + S / 2];
+
+    // Four independent partial sums, so that the additions need not wait for each other
+    float acc[4] = { 0 };
+    int j = 0;
+    for (; j + 4 <= S; j += 4)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            acc[lane] += me->hilbert[j + lane] * xs[j + lane];
+        }
+    }
+    for (; j < S; ++j)
+    {
+        acc[0] += me->hilbert[j] * xs[j];
+    }
+    const float a_i = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    if (++me->a_head == me->a_size)
+        me->a_head = 0;
+    me->a_hist[2 * me->a_head] = x_center;
+    me->a_hist[2 * me->a_head + 1] = a_i;
+
+    // Sum of the paths, each with its fading gain interpolated between the gain samples
+    float y_r = 0;
+    float y_i = 0;
+    for (int p = 0; p < me->num_paths; ++p)
+    {
+        int idx = me->a_head - ((p > 0) ? me->path_delay : 0);
+        idx += (idx < 0) ? me->a_size : 0;
+        const float s_r = me->a_hist[2 * idx];
+        const float s_i = me->a_hist[2 * idx + 1];
+        const float g_r = me->gain[p][0][0] + me->gain_frac * (me->gain[p][1][0] - me->gain[p][0][0]);
+        const float g_i = me->gain[p][0][1] + me->gain_frac * (me->gain[p][1][1] - me->gain[p][0][1]);
+        y_r += g_r * s_r - g_i * s_i;
+        y_i += g_r * s_i + g_i * s_r;
+    }
+    if (me->gain_step > 0)
+    {
+        me->gain_frac += me->gain_step;
+        if (me->gain_frac >= 1)
+        {
+            me->gain_frac -= 1;
+            channel_next_gain(me);
+        }
+    }
+
+    // Frequency offset and drift: the phasor turns by a step, which itself turns by the chirp (in double precision,
+    // so that both stay on the unit circle over any practical length)
+    if ((me->cfg.freq_offset == 0) && (me->cfg.drift == 0))
+        return y_r;
+    const float out = y_r * (float)me->shift[0] - y_i * (float)me->shift[1];
+    const double shift_r = me->shift[0] * me->shift_step[0] - me->shift[1] * me->shift_step[1];
+    me->shift[1] = me->shift[0] * me->shift_step[1] + me->shift[1] * me->shift_step[0];
+    me->shift[0] = shift_r;
+    const double step_r = me->shift_step[0] * me->shift_chirp[0] - me->shift_step[1] * me->shift_chirp[1];
+    me->shift_step[1] = me->shift_step[0] * me->shift_chirp[1] + me->shift_step[1] * me->shift_chirp[0];
+    me->shift_step[0] = step_r;
+    return out;
+}
+
+int channel_process(channel_t* me, const float* input, int num_input, int* num_used, float* output, int max_output)
+{
+    int in_pos = 0;
+    int out_pos = 0;
+    while (out_pos < max_output)
+    {
+        // Output samples between y_hist[1] and y_hist[2] (Catmull-Rom cubic through all four)
+        while ((out_pos < max_output) && (me->read_pos < 1))
+        {
+            const float* y = me->y_hist;
+            const float t = (float)me->read_pos;
+            output[out_pos++] = y[1] + 0.5f * t * (y[2] - y[0] + t * (2 * y[0] - 5 * y[1] + 4 * y[2] - y[3] + t * (3 * (y[1] - y[2]) + y[3] - y[0])));
+            me->read_pos += me->read_step;
+        }
+        if ((out_pos == max_output) || (in_pos == num_input))
+            break;
+
+        float y_new = channel_step(me, input[in_pos++]);
+        me->y_hist[0] = me->y_hist[1];
+        me->y_hist[1] = me->y_hist[2];
+        me->y_hist[2] = me->y_hist[3];
+        me->y_hist[3] = y_new;
+        me->read_pos -= 1;
+    }
+
+    if (num_used != NULL)
+        *num_used = in_pos;
+    return out_pos;
+}
@@ -0,0 +1,87 @@
+#ifndef _INCLUDE_CHANNEL_H_
+#define _INCLUDE_CHANNEL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define CHANNEL_MAX_PATHS 2
+
+/// Impairments of a simulated HF/EME channel
+typedef struct
+{
+    int sample_rate;      ///< Sample rate of the audio in Hertz
+    float doppler_spread; ///< Doppler spread (twice the standard deviation of the Gaussian Doppler spectrum) in Hertz, 0 for no fading
+    float delay_spread;   ///< Delay of the second path in milliseconds, 0 for a single path
+    float freq_offset;    ///< Constant frequency offset in Hertz
+    float drift;          ///< Frequency drift in Hertz per second
+    float clock_ppm;      ///< Receiver sample clock against the transmitter's, parts per million (positive: more samples)
+    uint64_t seed;        ///< Seed of the random fading
+} channel_config_t;
+
+/// Watterson channel model acting on real audio. The audio is made analytic with a Hilbert transformer, then each
+/// path (one, or two delay_spread apart) is multiplied by its own complex gain, a Gaussian process with the Doppler
+/// spectrum of the configuration and equal mean power. The sum is shifted in frequency by the offset and drift,
+/// its real part is taken, and finally it is resampled by the clock offset. The mean power is kept, so a signal
+/// keeps its average SNR.
+///
+/// The fading gains are computed at a rate of 16 samples per Hertz of spread (filtering white noise with a
+/// Gaussian) and interpolated in between, so fading costs a few operations per sample at any spread. The Hilbert
+/// transformer (about sample_rate / 190 taps on either side, so flat above 200 Hz) dominates the cost with half as
+/// many multiply-adds per sample, as only its odd taps are nonzero.
+typedef struct
+{
+    channel_config_t cfg;
+    int latency;            ///< Delay of the output against the input (first path, no clock offset) in samples
+    int num_paths;          ///< 1 or 2
+    int path_delay;         ///< Delay of the second path in samples
+    int hilbert_half;       ///< Hilbert transformer half length in taps (odd)
+    float* hilbert;         ///< Hilbert transformer taps at the odd offsets -hilbert_half, ..., hilbert_half
+    float* x_hist;          ///< Histories of the even and odd input samples, hilbert_half + 1 each (written twice to avoid wrapping)
+    int x_head[2];          ///< Position of the oldest sample in either history
+    long num_x;             ///< Number of input samples so far
+    float* a_hist;          ///< Analytic signal history for the path delay, interleaved real, imaginary
+    int a_head;             ///< Position of the newest sample in a_hist
+    int a_size;             ///< Number of complex samples in a_hist
+    float* fading_fir;      ///< Gaussian filter shaping white noise into the Doppler spectrum
+    int fading_taps;        ///< Length of fading_fir
+    float* fading_noise;    ///< White noise history of every path, interleaved real, imaginary
+    int fading_head;        ///< Position of the oldest white noise sample
+    float gain[CHANNEL_MAX_PATHS][2][2]; ///< Fading gain of every path at the previous and next gain sample (real, imaginary)
+    float gain_step;        ///< Gain samples per audio sample
+    float gain_frac;        ///< Position between the previous and next gain sample
+    uint64_t rng;           ///< State of the random generator
+    double shift[2];        ///< Phasor of the frequency shift (real, imaginary)
+    double shift_step[2];   ///< Rotation of the phasor for the next sample
+    double shift_chirp[2];  ///< Rotation of the step per sample (drift)
+    float y_hist[4];        ///< Last 4 samples before resampling
+    double read_pos;        ///< Position of the next output sample after y_hist[1], in samples before resampling
+    double read_step;       ///< Samples before resampling per output sample
+} channel_t;
+
+void channel_init(channel_t* me, const channel_config_t* cfg);
+void channel_free(channel_t* me);
+
+/// Restart the channel with empty history and a new fading realization
+void channel_reset(channel_t* me, uint64_t seed);
+
+/// Pass a chunk of audio through the channel. Stops when either the input is exhausted or the output is full;
+/// the state is kept, so the next call continues seamlessly from where this one stopped.
+/// The output lags the input by latency samples (feed that many zeros after the end to flush it); without a clock
+/// offset there is one output sample per input sample.
+/// @param[in] input Input samples
+/// @param[in] num_input Number of input samples available
+/// @param[out] num_used Number of input samples consumed (can be NULL)
+/// @param[out] output Output samples
+/// @param[in] max_output Space available in the output array
+/// @return Number of output samples produced
+int channel_process(channel_t* me, const float* input, int num_input, int* num_used, float* output, int max_output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_CHANNEL_H_
@@ -0,0 +1,39 @@
+#define _DEFAULT_SOURCE
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool mapped_file_open(mapped_file_t* file, const char* path)
+{
+    file->data = NULL;
+    file->size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if ((0 != fstat(fd, &st)) || (st.st_size <= 0))
+    {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (data == MAP_FAILED)
+        return false;
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    return true;
+}
+
+void mapped_file_close(mapped_file_t* file)
+{
+    if (file->data != NULL)
+    {
+        munmap((void*)file->data, file->size);
+    }
+    file->data = NULL;
+    file->size = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _INCLUDE_MAPPED_FILE_H_
+#define _INCLUDE_MAPPED_FILE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Read-only memory mapping of a whole file. Pages are read in on first access, so opening costs the same for
+/// any file size.
+typedef struct
+{
+    const void* data; ///< Contents of the file (page aligned), NULL if not open
+    size_t size;      ///< Size of the file in bytes
+} mapped_file_t;
+
+/// Map a file for reading
+/// @return False if the file cannot be opened or mapped, or is empty
+bool mapped_file_open(mapped_file_t* file, const char* path);
+
+/// Unmap the file
+void mapped_file_close(mapped_file_t* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_MAPPED_FILE_H_
@@ -1,10 +1,12 @@
 #include "monitor.h"
 #include <common/common.h>
+#include <ft8/encode.h>
 
 #define LOG_LEVEL LOG_INFO
 #include <ft8/debug.h>
 
 #include <stdlib.h>
+#include <stdatomic.h>
 
 static float hann_i(int i, int N)
 {
@@ -34,68 +36,235 @@ static float hann_i(int i, int N)
 //     return a0 - a1 * x1 + a2 * x2;
 // }
 
-static void waterfall_init(ftx_waterfall_t* me, int max_blocks, int num_bins, int time_osr, int freq_osr)
+/// Read-only analysis window and FFT plan, shared by all monitors with the same FFT size.
+/// The FFT size is the whole key: it follows from proc_rate, protocol and freq_osr, and the window
+/// (Hann scaled by 2 / nfft) depends on nothing else.
+struct monitor_plan_s
+{
+    int nfft;                     ///< FFT size (cache key)
+    int refcount;                 ///< Number of monitors using the plan (guarded by plan_cache_lock)
+    float* window;                ///< Window function for STFT analysis (nfft samples)
+    kiss_fftr_cfg fft_cfg;        ///< Kiss FFT plan; monitors derive their own states from it
+    struct monitor_plan_s* next;  ///< Next cached plan
+};
+
+static struct monitor_plan_s* plan_cache = NULL;
+static atomic_flag plan_cache_lock = ATOMIC_FLAG_INIT;
+
+static void plan_cache_lock_acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&plan_cache_lock, memory_order_acquire))
+    {
+    }
+}
+
+static void plan_cache_lock_release(void)
+{
+    atomic_flag_clear_explicit(&plan_cache_lock, memory_order_release);
+}
+
+static void window_fill(float* window, int nfft)
+{
+    const float fft_norm = 2.0f / nfft;
+    // const int len_window = 1.8f * block_size; // hand-picked and optimized
+    for (int i = 0; i < nfft; ++i)
+    {
+        // window[i] = 1;
+        window[i] = fft_norm * hann_i(i, nfft);
+        // window[i] = blackman_i(i, nfft);
+        // window[i] = hamming_i(i, nfft);
+        // window[i] = (i < len_window) ? hann_i(i, len_window) : 0;
+    }
+}
+
+static struct monitor_plan_s* plan_create(int nfft)
+{
+    struct monitor_plan_s* plan = (struct monitor_plan_s*)malloc(sizeof(struct monitor_plan_s));
+    plan->nfft = nfft;
+    plan->refcount = 0;
+    plan->window = (float*)malloc(nfft * sizeof(plan->window[0]));
+    window_fill(plan->window, nfft);
+    plan->fft_cfg = kiss_fftr_alloc(nfft, 0, NULL, NULL);
+    plan->next = NULL;
+    return plan;
+}
+
+static void plan_destroy(struct monitor_plan_s* plan)
+{
+    kiss_fftr_free(plan->fft_cfg);
+    free(plan->window);
+    free(plan);
+}
+
+/// Find the plan for the FFT size in the cache (the caller holds plan_cache_lock)
+static struct monitor_plan_s* plan_find(int nfft)
+{
+    struct monitor_plan_s* plan = plan_cache;
+    while (plan != NULL && plan->nfft != nfft)
+    {
+        plan = plan->next;
+    }
+    return plan;
+}
+
+/// Find the plan for the FFT size in the cache or create it, and take a reference
+static struct monitor_plan_s* plan_acquire(int nfft)
+{
+    plan_cache_lock_acquire();
+    struct monitor_plan_s* plan = plan_find(nfft);
+    if (plan != NULL)
+        ++plan->refcount;
+    plan_cache_lock_release();
+    if (plan != NULL)
+        return plan;
+
+    // Built outside the lock, which only guards the list, so that other monitors are not held up meanwhile.
+    // If another thread has published the same plan in the meantime, theirs is used and this one dropped.
+    struct monitor_plan_s* created = plan_create(nfft);
+    plan_cache_lock_acquire();
+    plan = plan_find(nfft);
+    if (plan == NULL)
+    {
+        created->next = plan_cache;
+        plan_cache = created;
+        plan = created;
+        created = NULL;
+    }
+    ++plan->refcount;
+    plan_cache_lock_release();
+    if (created != NULL)
+    {
+        plan_destroy(created);
+    }
+    else
+    {
+        LOG(LOG_DEBUG, "Cached FFT plan for N_FFT = %d\n", nfft);
+    }
+    return plan;
+}
+
+static void plan_release(struct monitor_plan_s* plan)
+{
+    plan_cache_lock_acquire();
+    --plan->refcount;
+    plan_cache_lock_release();
+}
+
+int monitor_plan_cache_purge(void)
+{
+    // Unlink the unused plans under the lock, free them after it
+    struct monitor_plan_s* unused = NULL;
+    plan_cache_lock_acquire();
+    struct monitor_plan_s** link = &plan_cache;
+    while (*link != NULL)
+    {
+        struct monitor_plan_s* plan = *link;
+        if (plan->refcount == 0)
+        {
+            *link = plan->next;
+            plan->next = unused;
+            unused = plan;
+        }
+        else
+        {
+            link = &plan->next;
+        }
+    }
+    plan_cache_lock_release();
+
+    int num_released = 0;
+    while (unused != NULL)
+    {
+        struct monitor_plan_s* next = unused->next;
+        plan_destroy(unused);
+        unused = next;
+        ++num_released;
+    }
+    return num_released;
+}
+
+/// Reserve size bytes at *pos in the arena, keeping every piece aligned to MONITOR_ARENA_ALIGN.
+/// With a NULL arena only the size is accounted for.
+static void* arena_take(uint8_t* arena, size_t* pos, size_t size)
+{
+    void* ptr = (arena != NULL) ? (arena + *pos) : NULL;
+    *pos += (size + MONITOR_ARENA_ALIGN - 1) & ~(size_t)(MONITOR_ARENA_ALIGN - 1);
+    return ptr;
+}
+
+static void waterfall_init(ftx_waterfall_t* me, int max_blocks, int num_bins, int time_osr, int freq_osr, ftx_waterfall_layout_t layout, ftx_waterfall_format_t format)
 {
-    size_t mag_size = max_blocks * time_osr * freq_osr * num_bins * sizeof(me->mag[0]);
     me->max_blocks = max_blocks;
     me->num_blocks = 0;
     me->num_bins = num_bins;
     me->time_osr = time_osr;
     me->freq_osr = freq_osr;
-    me->block_stride = (time_osr * freq_osr * num_bins);
-    me->mag = (WF_ELEM_T*)malloc(mag_size);
-    LOG(LOG_DEBUG, "Waterfall size = %zu\n", mag_size);
+    me->layout = layout;
+    if (layout == FTX_WATERFALL_FREQ_MAJOR)
+    {
+        me->block_stride = 1;
+        me->bin_stride = max_blocks;
+        me->freq_sub_stride = num_bins * max_blocks;
+        me->time_sub_stride = freq_osr * num_bins * max_blocks;
+    }
+    else
+    {
+        me->bin_stride = 1;
+        me->freq_sub_stride = num_bins;
+        me->time_sub_stride = freq_osr * num_bins;
+        me->block_stride = time_osr * freq_osr * num_bins;
+    }
+    me->format = format;
 }
 
-static void waterfall_free(ftx_waterfall_t* me)
+/// Assign the waterfall storage from the arena
+static void waterfall_carve(ftx_waterfall_t* me, uint8_t* arena, size_t* pos)
 {
-    free(me->mag);
+    const int num_elements = me->max_blocks * me->time_osr * me->freq_osr * me->num_bins;
+    me->mag = NULL;
+    me->mag4 = NULL;
+    me->block_offset = NULL;
+    me->block_scale = NULL;
+    if (me->format == FTX_WATERFALL_U4)
+    {
+        me->mag4 = (uint8_t*)arena_take(arena, pos, (num_elements + 1) / 2);
+        me->block_offset = (uint8_t*)arena_take(arena, pos, me->max_blocks);
+        me->block_scale = (uint8_t*)arena_take(arena, pos, me->max_blocks);
+    }
+    else
+    {
+        me->mag = (uint8_t*)arena_take(arena, pos, num_elements * sizeof(me->mag[0]));
+    }
 }
 
-void monitor_init(monitor_t* me, const monitor_config_t* cfg)
+/// Compute the DSP parameters that do not need any memory
+static void monitor_setup(monitor_t* me, const monitor_config_t* cfg)
 {
     float slot_time = (cfg->protocol == FTX_PROTOCOL_FT4) ? FT4_SLOT_TIME : FT8_SLOT_TIME;
     float symbol_period = (cfg->protocol == FTX_PROTOCOL_FT4) ? FT4_SYMBOL_PERIOD : FT8_SYMBOL_PERIOD;
-    // Compute DSP parameters that depend on the sample rate
-    me->block_size = (int)(cfg->sample_rate * symbol_period); // samples corresponding to one FSK symbol
+    me->sample_rate = cfg->sample_rate;
+    me->proc_rate = (cfg->proc_rate > 0) ? cfg->proc_rate : cfg->sample_rate;
+    // Compute DSP parameters that depend on the (processing) sample rate
+    me->block_size = (int)(me->proc_rate * symbol_period); // samples corresponding to one FSK symbol
     me->subblock_size = me->block_size / cfg->time_osr;
     me->nfft = me->block_size * cfg->freq_osr;
     me->fft_norm = 2.0f / me->nfft;
-    // const int len_window = 1.8f * me->block_size; // hand-picked and optimized
-
-    me->window = (float*)malloc(me->nfft * sizeof(me->window[0]));
-    for (int i = 0; i < me->nfft; ++i)
+    me->keep_phase = cfg->wf_phase;
+    me->keep_audio = cfg->keep_audio;
+    if (me->keep_phase)
     {
-        // window[i] = 1;
-        me->window[i] = me->fft_norm * hann_i(i, me->nfft);
-        // me->window[i] = blackman_i(i, me->nfft);
-        // me->window[i] = hamming_i(i, me->nfft);
-        // me->window[i] = (i < len_window) ? hann_i(i, len_window) : 0;
+        // Inverse FFT just wide enough for a signal and its surroundings (about 64 bins), and a multiple of
+        // the number of frames per analysis window so that frames map to whole baseband samples.
+        // E.g. 64 points give 200 Hz baseband for FT8 with time_osr = freq_osr = 2.
+        const int frames_per_window = cfg->time_osr * cfg->freq_osr;
+        me->nifft = frames_per_window * ((64 + frames_per_window - 1) / frames_per_window);
+        me->resynth_rate = (float)me->proc_rate * me->nifft / me->nfft;
+    }
+    else
+    {
+        me->nifft = 0;
+        me->resynth_rate = 0;
     }
-    me->last_frame = (float*)calloc(me->nfft, sizeof(me->last_frame[0]));
-
-    LOG(LOG_INFO, "Block size = %d\n", me->block_size);
-    LOG(LOG_INFO, "Subblock size = %d\n", me->subblock_size);
-
-    size_t fft_work_size = 0;
-    kiss_fftr_alloc(me->nfft, 0, 0, &fft_work_size);
-    me->fft_work = malloc(fft_work_size);
-    me->fft_cfg = kiss_fftr_alloc(me->nfft, 0, me->fft_work, &fft_work_size);
-
-    LOG(LOG_INFO, "N_FFT = %d\n", me->nfft);
-    LOG(LOG_DEBUG, "FFT work area = %zu\n", fft_work_size);
-
-#ifdef WATERFALL_USE_PHASE
-    me->nifft = 64; // Gives 200 Hz sample rate for FT8 (160ms symbol period)
-
-    size_t ifft_work_size = 0;
-    kiss_fft_alloc(me->nifft, 1, 0, &ifft_work_size);
-    me->ifft_work = malloc(ifft_work_size);
-    me->ifft_cfg = kiss_fft_alloc(me->nifft, 1, me->ifft_work, &ifft_work_size);
-
-    LOG(LOG_INFO, "N_iFFT = %d\n", me->nifft);
-    LOG(LOG_DEBUG, "iFFT work area = %zu\n", ifft_work_size);
-#endif
 
     // Allocate enough blocks to fit the entire FT8/FT4 slot in memory
     const int max_blocks = (int)(slot_time / symbol_period);
@@ -104,26 +273,210 @@ void monitor_init(monitor_t* me, const monitor_config_t* cfg)
     me->max_bin = (int)(cfg->f_max * symbol_period) + 1;
     const int num_bins = me->max_bin - me->min_bin;
 
-    waterfall_init(&me->wf, max_blocks, num_bins, cfg->time_osr, cfg->freq_osr);
+    waterfall_init(&me->wf, max_blocks, num_bins, cfg->time_osr, cfg->freq_osr, cfg->wf_layout, cfg->wf_format);
     me->wf.protocol = cfg->protocol;
 
     me->symbol_period = symbol_period;
 
+    // Convert the input to the processing rate, if they differ, so that FFT sizes do not depend on the sound card
+    me->use_resampler = (me->sample_rate != me->proc_rate);
+    me->input_block_size = (int)(0.5f + (float)me->block_size * me->sample_rate / me->proc_rate);
+}
+
+/// Assign all buffers of a set up monitor from the arena (or only compute the arena size if it is NULL).
+/// With a shared plan, the window and FFT twiddles are taken from it instead of the arena.
+/// @return Number of arena bytes used
+static size_t monitor_carve(monitor_t* me, uint8_t* arena, struct monitor_plan_s* plan)
+{
+    size_t pos = 0;
+    me->plan = plan;
+    me->last_frame = (float*)arena_take(arena, &pos, me->nfft * sizeof(me->last_frame[0]));
+    me->timedata = (kiss_fft_scalar*)arena_take(arena, &pos, me->nfft * sizeof(me->timedata[0]));
+    me->freqdata = (kiss_fft_cpx*)arena_take(arena, &pos, (me->nfft / 2 + 1) * sizeof(me->freqdata[0]));
+
+    size_t fft_work_size = 0;
+    if (plan != NULL)
+    {
+        me->window = plan->window;
+        kiss_fftr_alloc_shared(plan->fft_cfg, 0, &fft_work_size);
+        me->fft_work = arena_take(arena, &pos, fft_work_size);
+        me->fft_cfg = (arena != NULL) ? kiss_fftr_alloc_shared(plan->fft_cfg, me->fft_work, &fft_work_size) : NULL;
+    }
+    else
+    {
+        float* window = (float*)arena_take(arena, &pos, me->nfft * sizeof(window[0]));
+        kiss_fftr_alloc(me->nfft, 0, 0, &fft_work_size);
+        me->fft_work = arena_take(arena, &pos, fft_work_size);
+        me->fft_cfg = (arena != NULL) ? kiss_fftr_alloc(me->nfft, 0, me->fft_work, &fft_work_size) : NULL;
+        if (arena != NULL)
+            window_fill(window, me->nfft);
+        me->window = window;
+    }
+    LOG(LOG_DEBUG, "FFT work area = %zu\n", fft_work_size);
+
+    me->ifft_work = NULL;
+    me->ifft_cfg = NULL;
+    me->ifft_freqdata = NULL;
+    me->ifft_timedata = NULL;
+    if (me->keep_phase)
+    {
+        size_t ifft_work_size = 0;
+        kiss_fft_alloc(me->nifft, 1, 0, &ifft_work_size);
+        me->ifft_work = arena_take(arena, &pos, ifft_work_size);
+        me->ifft_cfg = (arena != NULL) ? kiss_fft_alloc(me->nifft, 1, me->ifft_work, &ifft_work_size) : NULL;
+        LOG(LOG_DEBUG, "iFFT work area = %zu\n", ifft_work_size);
+        me->ifft_freqdata = (kiss_fft_cpx*)arena_take(arena, &pos, me->nifft * sizeof(me->ifft_freqdata[0]));
+        me->ifft_timedata = (kiss_fft_cpx*)arena_take(arena, &pos, me->nifft * sizeof(me->ifft_timedata[0]));
+    }
+
+    size_t wf_start = pos;
+    waterfall_carve(&me->wf, arena, &pos);
+    me->wf.cpx = NULL;
+    if (me->keep_phase)
+    {
+        const int num_elements = me->wf.max_blocks * me->wf.time_osr * me->wf.freq_osr * me->wf.num_bins;
+        me->wf.cpx = (ftx_waterfall_cpx_t*)arena_take(arena, &pos, num_elements * sizeof(me->wf.cpx[0]));
+    }
+    me->wf.noise = (uint8_t*)arena_take(arena, &pos, me->wf.freq_osr * me->wf.num_bins);
+    me->noise_median = (uint8_t*)arena_take(arena, &pos, me->wf.freq_osr * me->wf.num_bins);
+    const int num_dirty_tiles = (me->wf.num_bins + FTX_DIRTY_TILE_BINS - 1) / FTX_DIRTY_TILE_BINS;
+    me->wf.dirty = (uint32_t*)arena_take(arena, &pos, num_dirty_tiles * sizeof(me->wf.dirty[0]));
+    LOG(LOG_DEBUG, "Waterfall size = %zu\n", pos - wf_start);
+    const int block_values = me->wf.time_osr * me->wf.freq_osr * me->wf.num_bins;
+    me->block_mag = (me->wf.format == FTX_WATERFALL_U4) ? (uint8_t*)arena_take(arena, &pos, block_values) : NULL;
+
+    me->proc_frame = (float*)arena_take(arena, &pos, me->block_size * sizeof(me->proc_frame[0]));
+    me->audio = NULL;
+    me->subtract_audio = NULL;
+    me->subtract_amp = NULL;
+    me->subtract_seg = NULL;
+    if (me->keep_audio)
+    {
+        const int max_tones = (me->wf.protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
+        const int max_wave = max_tones * me->block_size;
+        me->audio = (float*)arena_take(arena, &pos, me->wf.max_blocks * me->block_size * sizeof(me->audio[0]));
+        me->subtract_audio = (float*)arena_take(arena, &pos, max_wave * sizeof(me->subtract_audio[0]));
+        me->subtract_amp = (kiss_fft_cpx*)arena_take(arena, &pos, max_wave * sizeof(me->subtract_amp[0]));
+        me->subtract_seg = (kiss_fft_cpx*)arena_take(arena, &pos, max_tones * sizeof(me->subtract_seg[0]));
+        void* enc_mem = arena_take(arena, &pos, ftx_encoder_get_memory_size(me->wf.protocol, me->proc_rate));
+        if (arena != NULL)
+        {
+            ftx_encoder_init_static(&me->subtract_enc, me->wf.protocol, me->proc_rate, enc_mem);
+        }
+    }
+    void* resampler_mem = NULL;
+    if (me->use_resampler)
+    {
+        resampler_mem = arena_take(arena, &pos, resampler_get_memory_size(me->sample_rate, me->proc_rate));
+    }
+    if (arena != NULL && me->use_resampler)
+    {
+        resampler_init_static(&me->resampler, me->sample_rate, me->proc_rate, resampler_mem);
+    }
+    return pos;
+}
+
+/// Reset the streaming state of a freshly carved monitor
+static void monitor_start(monitor_t* me)
+{
+    for (int i = 0; i < me->nfft; ++i)
+    {
+        me->last_frame[i] = 0;
+    }
+
+    LOG(LOG_INFO, "Block size = %d\n", me->block_size);
+    LOG(LOG_INFO, "Subblock size = %d\n", me->subblock_size);
+    LOG(LOG_INFO, "N_FFT = %d\n", me->nfft);
+    if (me->keep_phase)
+    {
+        LOG(LOG_INFO, "N_iFFT = %d\n", me->nifft);
+    }
+
     me->max_mag = -120.0f;
+    me->proc_frame_len = 0;
+    me->noise_valid = false;
+    ftx_waterfall_clear_dirty(&me->wf);
+}
+
+size_t monitor_get_memory_size(const monitor_config_t* cfg)
+{
+    monitor_t tmp;
+    monitor_setup(&tmp, cfg);
+    return monitor_carve(&tmp, NULL, NULL);
+}
+
+void monitor_init_static(monitor_t* me, const monitor_config_t* cfg, void* buffer)
+{
+    monitor_setup(me, cfg);
+    me->arena = NULL;
+    me->arena_size = monitor_carve(me, (uint8_t*)buffer, NULL);
+    monitor_start(me);
+}
+
+void monitor_init(monitor_t* me, const monitor_config_t* cfg)
+{
+    monitor_setup(me, cfg);
+    struct monitor_plan_s* plan = plan_acquire(me->nfft);
+    me->arena_size = monitor_carve(me, NULL, plan);
+    me->arena = aligned_alloc(MONITOR_ARENA_ALIGN, me->arena_size);
+    monitor_carve(me, (uint8_t*)me->arena, plan);
+    monitor_start(me);
 }
 
 void monitor_free(monitor_t* me)
 {
-    waterfall_free(&me->wf);
-    free(me->fft_work);
-    free(me->last_frame);
-    free(me->window);
+    // Everything else lives in the arena; nothing to release for monitor_init_static() instances
+    if (me->plan != NULL)
+    {
+        plan_release(me->plan);
+    }
+    free(me->arena);
 }
 
 void monitor_reset(monitor_t* me)
 {
     me->wf.num_blocks = 0;
     me->max_mag = -120.0f;
+    me->proc_frame_len = 0;
+    ftx_waterfall_clear_dirty(&me->wf);
+    if (me->use_resampler)
+    {
+        resampler_reset(&me->resampler);
+    }
+}
+
+/// Windowed FFT of one analysis frame (nfft samples) into freqdata
+static void monitor_fft(monitor_t* me, const float* frame)
+{
+    for (int pos = 0; pos < me->nfft; ++pos)
+    {
+        me->timedata[pos] = me->window[pos] * frame[pos];
+    }
+    kiss_fftr(me->fft_cfg, me->timedata, me->freqdata);
+}
+
+/// Magnitude of FFT bin src_bin in dB, also stored with its phase at element offset of the complex waterfall (if kept)
+static float monitor_bin_db(monitor_t* me, int src_bin, int offset)
+{
+    const kiss_fft_cpx* freqdata = me->freqdata;
+    float mag2 = (freqdata[src_bin].i * freqdata[src_bin].i) + (freqdata[src_bin].r * freqdata[src_bin].r);
+    float db = 10.0f * log10f(1E-12f + mag2);
+
+    if (me->wf.cpx != NULL)
+    {
+        // Save the magnitude in 0.01 dB and phase in pi/32768 radians
+        float phase = atan2f(freqdata[src_bin].i, freqdata[src_bin].r);
+        me->wf.cpx[offset].mag = (int16_t)lrintf(db * FTX_WATERFALL_CPX_MAG_SCALE);
+        me->wf.cpx[offset].phase = (int16_t)lrintf(phase * (32767.0f / (float)M_PI));
+    }
+    return db;
+}
+
+/// Scale decibels to unsigned 8-bit range and clamp the value: range 0-240 covers -120..0 dB in 0.5 dB steps
+static int scale_db(float db)
+{
+    int scaled = (int)(2 * db + 240);
+    return (scaled < 0) ? 0 : ((scaled > 255) ? 255 : scaled);
 }
 
 // Compute FFT magnitudes (log wf) for a frame in the signal and update waterfall data
@@ -133,15 +486,21 @@ void monitor_process(monitor_t* me, const float* frame)
     if (me->wf.num_blocks >= me->wf.max_blocks)
         return;
 
-    int offset = me->wf.num_blocks * me->wf.block_stride;
+    if (me->audio != NULL)
+    {
+        float* dst = me->audio + me->wf.num_blocks * me->block_size;
+        for (int pos = 0; pos < me->block_size; ++pos)
+        {
+            dst[pos] = frame[pos];
+        }
+    }
+
     int frame_pos = 0;
+    int block_pos = 0;
 
     // Loop over block subdivisions
     for (int time_sub = 0; time_sub < me->wf.time_osr; ++time_sub)
     {
-        kiss_fft_scalar timedata[me->nfft];
-        kiss_fft_cpx freqdata[me->nfft / 2 + 1];
-
         // Shift the new data into analysis frame
         for (int pos = 0; pos < me->nfft - me->subblock_size; ++pos)
         {
@@ -154,33 +513,30 @@ void monitor_process(monitor_t* me, const float* frame)
         }
 
         // Do DFT of windowed analysis frame
-        for (int pos = 0; pos < me->nfft; ++pos)
-        {
-            timedata[pos] = me->window[pos] * me->last_frame[pos];
-        }
-        kiss_fftr(me->fft_cfg, timedata, freqdata);
+        monitor_fft(me, me->last_frame);
 
         // Loop over possible frequency OSR offsets
         for (int freq_sub = 0; freq_sub < me->wf.freq_osr; ++freq_sub)
         {
+            int offset = (me->wf.num_blocks * me->wf.block_stride) + (time_sub * me->wf.time_sub_stride) + (freq_sub * me->wf.freq_sub_stride);
+            uint8_t* noise = me->noise_median + freq_sub * me->wf.num_bins - me->min_bin;
             for (int bin = me->min_bin; bin < me->max_bin; ++bin)
             {
-                int src_bin = (bin * me->wf.freq_osr) + freq_sub;
-                float mag2 = (freqdata[src_bin].i * freqdata[src_bin].i) + (freqdata[src_bin].r * freqdata[src_bin].r);
-                float db = 10.0f * log10f(1E-12f + mag2);
-
-#ifdef WATERFALL_USE_PHASE
-                // Save the magnitude in dB and phase in radians
-                float phase = atan2f(freqdata[src_bin].i, freqdata[src_bin].r);
-                me->wf.mag[offset].mag = db;
-                me->wf.mag[offset].phase = phase;
-#else
-                // Scale decibels to unsigned 8-bit range and clamp the value
-                // Range 0-240 covers -120..0 dB in 0.5 dB steps
-                int scaled = (int)(2 * db + 240);
-                me->wf.mag[offset] = (scaled < 0) ? 0 : ((scaled > 255) ? 255 : scaled);
-#endif
-                ++offset;
+                float db = monitor_bin_db(me, (bin * me->wf.freq_osr) + freq_sub, offset);
+                int scaled = scale_db(db);
+                if (me->block_mag != NULL)
+                    me->block_mag[block_pos++] = scaled; // packed once the whole block is known
+                else
+                    me->wf.mag[offset] = scaled;
+                offset += me->wf.bin_stride;
+
+                // Streaming median of the bin: step the estimate by 0.5 dB towards every new value
+                if (!me->noise_valid)
+                    noise[bin] = scaled;
+                else if (scaled > noise[bin])
+                    ++noise[bin];
+                else if (scaled < noise[bin])
+                    --noise[bin];
 
                 if (db > me->max_mag)
                     me->max_mag = db;
@@ -188,76 +544,388 @@ void monitor_process(monitor_t* me, const float* frame)
         }
     }
 
+    if (me->block_mag != NULL)
+    {
+        ftx_waterfall_pack_block(&me->wf, me->wf.num_blocks, me->block_mag);
+    }
+    // The first block still has the empty start of the analysis frame; seed the noise medians from the next one
+    me->noise_valid = (me->wf.num_blocks > 0) || me->noise_valid;
+    ftx_waterfall_set_noise(&me->wf, me->noise_median);
     ++me->wf.num_blocks;
 }
 
-#ifdef WATERFALL_USE_PHASE
-void monitor_resynth(const monitor_t* me, const candidate_t* candidate, float* signal)
+/// Windowed FFT of analysis frame 'frame' of the kept audio into freqdata
+static void reanalyze_fft(monitor_t* me, int frame)
 {
-    const int num_ifft = me->nifft;
-    const int num_shift = num_ifft / 2;
-    const int taper_width = 4;
-    const int num_tones = 8;
+    // The analysis frame ends after sample (frame + 1) * subblock_size of the slot; silence before its start
+    int start = (frame + 1) * me->subblock_size - me->nfft;
+    for (int pos = 0; pos < me->nfft; ++pos)
+    {
+        me->timedata[pos] = (start + pos >= 0) ? me->window[pos] * me->audio[start + pos] : 0;
+    }
+    kiss_fftr(me->fft_cfg, me->timedata, me->freqdata);
+}
+
+/// Store a range of bins of analysis frame 'frame' from freqdata into the waterfall
+static void reanalyze_store(monitor_t* me, int frame, int first_bin, int last_bin)
+{
+    const int block = frame / me->wf.time_osr;
+    const int time_sub = frame % me->wf.time_osr;
+    for (int freq_sub = 0; freq_sub < me->wf.freq_osr; ++freq_sub)
+    {
+        int offset = (block * me->wf.block_stride) + (time_sub * me->wf.time_sub_stride) + (freq_sub * me->wf.freq_sub_stride);
+        for (int bin = first_bin; bin <= last_bin; ++bin)
+        {
+            int idx = offset + bin * me->wf.bin_stride;
+            float db = monitor_bin_db(me, ((me->min_bin + bin) * me->wf.freq_osr) + freq_sub, idx);
+            ftx_waterfall_set(&me->wf, block, idx, scale_db(db));
+        }
+    }
+}
 
-    // Starting offset is 3 subblocks due to analysis buffer loading
-    int offset = 1;                          // candidate->time_offset;
-    offset = (offset * me->wf.time_osr) + 1; // + candidate->time_sub;
-    offset = (offset * me->wf.freq_osr);     // + candidate->freq_sub;
-    offset = (offset * me->wf.num_bins);     // + candidate->freq_offset;
+void monitor_reanalyze(monitor_t* me, int first_frame, int last_frame, int first_bin, int last_bin)
+{
+    if (me->audio == NULL)
+        return;
 
-    WF_ELEM_T* el = me->wf.mag + offset;
+    const int num_frames = me->wf.num_blocks * me->wf.time_osr;
+    first_frame = (first_frame < 0) ? 0 : first_frame;
+    last_frame = (last_frame >= num_frames) ? (num_frames - 1) : last_frame;
+    first_bin = (first_bin < 0) ? 0 : first_bin;
+    last_bin = (last_bin >= me->wf.num_bins) ? (me->wf.num_bins - 1) : last_bin;
 
-    // DFT frequency data - initialize to zero
-    kiss_fft_cpx freqdata[num_ifft];
-    for (int i = 0; i < num_ifft; ++i)
+    for (int frame = first_frame; frame <= last_frame; ++frame)
     {
-        freqdata[i].r = 0;
-        freqdata[i].i = 0;
+        reanalyze_fft(me, frame);
+        reanalyze_store(me, frame, first_bin, last_bin);
     }
+}
 
-    int pos = 0;
-    for (int num_block = 1; num_block < me->wf.num_blocks; ++num_block)
+void monitor_refresh(monitor_t* me)
+{
+    ftx_waterfall_t* wf = &me->wf;
+    if ((me->audio == NULL) || (wf->dirty == NULL))
+        return;
+
+    // One FFT per analysis frame in a dirty time tile, storing the bins of the dirty frequency tiles only
+    const int num_tiles = (wf->num_bins + FTX_DIRTY_TILE_BINS - 1) / FTX_DIRTY_TILE_BINS;
+    const int num_frames = wf->num_blocks * wf->time_osr;
+    for (int frame = 0; frame < num_frames; ++frame)
     {
-        // Extract frequency data around the selected candidate only
-        for (int i = candidate->freq_offset - taper_width - 1; i < candidate->freq_offset + 8 + taper_width - 1; ++i)
+        const uint32_t time_bit = ftx_waterfall_dirty_bit(frame / wf->time_osr);
+        bool analyzed = false;
+        for (int tile = 0; tile < num_tiles; ++tile)
         {
-            if ((i >= 0) && (i < me->wf.num_bins))
+            if (!(wf->dirty[tile] & time_bit))
+                continue;
+            if (!analyzed)
             {
-                int tgt_bin = (me->wf.freq_osr * (i - candidate->freq_offset) + num_ifft) % num_ifft;
-                float weight = 1.0f;
-                if (i < candidate->freq_offset)
-                {
-                    weight = ((i - candidate->freq_offset) + taper_width) / (float)taper_width;
-                }
-                else if (i > candidate->freq_offset + 7)
-                {
-                    weight = ((candidate->freq_offset + 7 - i) + taper_width) / (float)taper_width;
-                }
-
-                // Convert (dB magnitude, phase) to (real, imaginary)
-                float mag = powf(10.0f, el[i].mag / 20) / 2 * weight;
-                freqdata[tgt_bin].r = mag * cosf(el[i].phase);
-                freqdata[tgt_bin].i = mag * sinf(el[i].phase);
-
-                int i2 = i + me->wf.num_bins;
-                tgt_bin = (tgt_bin + 1) % num_ifft;
-                float mag2 = powf(10.0f, el[i2].mag / 20) / 2 * weight;
-                freqdata[tgt_bin].r = mag2 * cosf(el[i2].phase);
-                freqdata[tgt_bin].i = mag2 * sinf(el[i2].phase);
+                reanalyze_fft(me, frame);
+                analyzed = true;
             }
+            int first_bin = tile * FTX_DIRTY_TILE_BINS;
+            int last_bin = first_bin + FTX_DIRTY_TILE_BINS - 1;
+            reanalyze_store(me, frame, first_bin, (last_bin < wf->num_bins) ? last_bin : (wf->num_bins - 1));
         }
+    }
+}
+
+// Time alignment search of monitor_subtract(): up to one subblock on either side of the nominal start, first in
+// steps of a quarter subblock, then refined twice by halving the step (down to subblock_size / 16)
+#define SUBTRACT_TIME_COARSE 4
+#define SUBTRACT_TIME_REFINE 2
+
+// Bins refreshed on either side of a subtracted signal's tones (GFSK sidebands)
+#define SUBTRACT_BIN_MARGIN 2
+
+/// Fill ref with exp(-j phase), the conjugate of a unit GFSK reference of the tones at f0
+static void subtract_reference(ftx_encoder_t* enc, const uint8_t* tones, float f0, int n_wave, kiss_fft_cpx* ref)
+{
+    ftx_encoder_set_tones(enc, tones, f0);
+    int n_ref = ftx_encoder_generate_iq(enc, (float*)ref, n_wave);
+    for (int k = 0; k < n_wave; ++k)
+    {
+        ref[k].r = (k < n_ref) ? ref[k].r : 0;
+        ref[k].i = (k < n_ref) ? -ref[k].i : 0;
+    }
+}
+
+/// Shift the frequency of the conjugate reference ref by w radians per sample
+static void subtract_shift(kiss_fft_cpx* ref, int n_wave, float w)
+{
+    // Rotating phasor exp(j w k), in double precision so that it stays on the unit circle over a whole message
+    const double step_r = cos(w);
+    const double step_i = sin(w);
+    double rot_r = 1;
+    double rot_i = 0;
+    for (int k = 0; k < n_wave; ++k)
+    {
+        float a = ref[k].r;
+        float b = ref[k].i;
+        ref[k].r = (float)(a * rot_r + b * rot_i);
+        ref[k].i = (float)(b * rot_r - a * rot_i);
+        double next_r = rot_r * step_r - rot_i * step_i;
+        rot_i = rot_r * step_i + rot_i * step_r;
+        rot_r = next_r;
+    }
+}
+
+/// Complex amplitude of the signal in the retained audio against the conjugate reference starting at sample start,
+/// summed over every symbol: seg[i] = sum of audio * ref over symbol i (the audio reads as zero outside the slot)
+static void subtract_correlate(const monitor_t* me, const kiss_fft_cpx* ref, long start, int num_tones, kiss_fft_cpx* seg)
+{
+    const long audio_len = (long)me->wf.num_blocks * me->block_size;
+    for (int i = 0; i < num_tones; ++i)
+    {
+        long k_begin = i * me->block_size;
+        long k_end = k_begin + me->block_size;
+        k_begin = (start + k_begin < 0) ? -start : k_begin;
+        k_end = (start + k_end > audio_len) ? audio_len - start : k_end;
+        // Four independent partial sums, so that the additions need not wait for each other
+        const float* x = me->audio + start;
+        float re[4] = { 0 };
+        float im[4] = { 0 };
+        long k = k_begin;
+        for (; k + 4 <= k_end; k += 4)
+        {
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                re[lane] += x[k + lane] * ref[k + lane].r;
+                im[lane] += x[k + lane] * ref[k + lane].i;
+            }
+        }
+        for (; k < k_end; ++k)
+        {
+            re[0] += x[k] * ref[k].r;
+            im[0] += x[k] * ref[k].i;
+        }
+        seg[i].r = (re[0] + re[1]) + (re[2] + re[3]);
+        seg[i].i = (im[0] + im[1]) + (im[2] + im[3]);
+    }
+}
+
+bool monitor_subtract(monitor_t* me, const ftx_candidate_t* candidate, const uint8_t* tones)
+{
+    if (me->audio == NULL)
+        return false;
+
+    const ftx_waterfall_t* wf = &me->wf;
+    const bool is_ft4 = (wf->protocol == FTX_PROTOCOL_FT4);
+    const int num_tones = is_ft4 ? FT4_NN : FT8_NN;
+    const int num_levels = is_ft4 ? 4 : 8;
+    const int n_wave = num_tones * me->block_size;
+    const long audio_len = (long)wf->num_blocks * me->block_size;
+    kiss_fft_cpx* amp = me->subtract_amp;
+    kiss_fft_cpx* seg = me->subtract_seg;
+
+    // Nominal start: the analysis frame of the candidate's first symbol is centered on it
+    const int frame0 = candidate->time_offset * wf->time_osr + candidate->time_sub;
+    const long start0 = (long)(frame0 + 1) * me->subblock_size - me->nfft / 2 - me->block_size / 2;
+    float f0 = (me->min_bin + candidate->freq_offset + (float)candidate->freq_sub / wf->freq_osr) / me->symbol_period;
+
+    // Fine time alignment: the start with the most energy in the per-symbol correlations
+    subtract_reference(&me->subtract_enc, tones, f0, n_wave, amp);
+    long start = start0;
+    float best_energy = -1;
+    int time_step = me->subblock_size / SUBTRACT_TIME_COARSE;
+    for (int level = 0; level <= SUBTRACT_TIME_REFINE; ++level)
+    {
+        const long center = start;
+        const int num_steps = (level == 0) ? SUBTRACT_TIME_COARSE : 1;
+        for (int step = -num_steps; step <= num_steps; ++step)
+        {
+            if ((level > 0) && (step == 0))
+                continue; // already measured at the previous level
+            long trial = center + step * time_step;
+            subtract_correlate(me, amp, trial, num_tones, seg);
+            float energy = 0;
+            for (int i = 0; i < num_tones; ++i)
+                energy += seg[i].r * seg[i].r + seg[i].i * seg[i].i;
+            if (energy > best_energy)
+            {
+                best_energy = energy;
+                start = trial;
+            }
+        }
+        time_step /= 2;
+    }
+
+    // Fine frequency: the mean phase advance from one symbol to the next
+    subtract_correlate(me, amp, start, num_tones, seg);
+    float adv_r = 0;
+    float adv_i = 0;
+    for (int i = 0; i + 1 < num_tones; ++i)
+    {
+        adv_r += seg[i + 1].r * seg[i].r + seg[i + 1].i * seg[i].i;
+        adv_i += seg[i + 1].i * seg[i].r - seg[i + 1].r * seg[i].i;
+    }
+    subtract_shift(amp, n_wave, atan2f(adv_i, adv_r) / (me->symbol_period * me->proc_rate));
+
+    // Complex amplitude (and so phase) at every sample: downconvert by the reference, then smooth with a moving
+    // average of one symbol, which rejects the image at twice the signal frequency and follows slow fading.
+    // The running sums read the audio under the signal from a copy, as it is subtracted right behind them.
+    float* x = me->subtract_audio;
+    for (int k = 0; k < n_wave; ++k)
+    {
+        long t = start + k;
+        x[k] = ((t >= 0) && (t < audio_len)) ? me->audio[t] : 0;
+    }
+    const int half = me->block_size / 2;
+    const int n_ramp = me->block_size / 8; // amplitude ramps of ftx_gfsk_envelope()
+    float sum_r = 0;
+    float sum_i = 0;
+    int lo = 0; // running sum covers amp[lo..hi)
+    int hi = 0;
+    for (int k = 0; k < n_wave; ++k)
+    {
+        while (hi < n_wave && hi <= k + half)
+        {
+            sum_r += x[hi] * amp[hi].r;
+            sum_i += x[hi] * amp[hi].i;
+            ++hi;
+        }
+        while (lo < k - half)
+        {
+            sum_r -= x[lo] * amp[lo].r;
+            sum_i -= x[lo] * amp[lo].i;
+            ++lo;
+        }
+        float count = (float)(hi - lo);
+        float c_r = sum_r / count;
+        float c_i = sum_i / count;
+
+        // Subtract 2 Re(c exp(j phase)) = 2 Re(c conj(ref)), with the amplitude ramps of the transmitted waveform
+        long t = start + k;
+        if ((t >= 0) && (t < audio_len))
+        {
+            float env = ((k < n_ramp) || (k >= n_wave - n_ramp)) ? ftx_gfsk_envelope(k, n_wave, me->block_size) : 1.0f;
+            me->audio[t] -= 2 * env * (c_r * amp[k].r + c_i * amp[k].i);
+        }
+    }
+
+    // The waterfall is stale wherever the analysis frames saw the signal, over its tones and a margin for the sidebands
+    const int first_frame = (int)((start + me->subblock_size - 1) / me->subblock_size) - 1;
+    const int last_frame = (int)((start + n_wave + me->nfft) / me->subblock_size);
+    ftx_waterfall_mark_dirty(&me->wf, first_frame / wf->time_osr, last_frame / wf->time_osr,
+        candidate->freq_offset - SUBTRACT_BIN_MARGIN, candidate->freq_offset + num_levels - 1 + SUBTRACT_BIN_MARGIN);
+    return true;
+}
+
+int monitor_feed(monitor_t* me, const float* samples, int num_samples)
+{
+    int num_processed = 0;
+    while (num_samples > 0)
+    {
+        // Fill up the pending block with (resampled) input data
+        int space = me->block_size - me->proc_frame_len;
+        int num_used;
+        if (me->use_resampler)
+        {
+            me->proc_frame_len += resampler_process(&me->resampler, samples, num_samples, &num_used, me->proc_frame + me->proc_frame_len, space);
+        }
+        else
+        {
+            num_used = (num_samples < space) ? num_samples : space;
+            for (int i = 0; i < num_used; ++i)
+            {
+                me->proc_frame[me->proc_frame_len + i] = samples[i];
+            }
+            me->proc_frame_len += num_used;
+        }
+        samples += num_used;
+        num_samples -= num_used;
+
+        if (me->proc_frame_len < me->block_size)
+            break; // All input consumed, wait for more data
+
+        monitor_process(me, me->proc_frame);
+        me->proc_frame_len = 0;
+        ++num_processed;
+    }
+    return num_processed;
+}
+
+int monitor_resynth(monitor_t* me, const ftx_candidate_t* candidate, kiss_fft_cpx* signal)
+{
+    const ftx_waterfall_t* wf = &me->wf;
+    if (wf->cpx == NULL)
+        return 0;
+
+    const int num_ifft = me->nifft;
+    const int frames_per_window = wf->time_osr * wf->freq_osr; // analysis windows overlapping each sample
+    const int hop = num_ifft / frames_per_window;              // baseband samples per analysis frame
+    const int num_tones = (wf->protocol == FTX_PROTOCOL_FT4) ? 4 : 8;
+    const int taper_width = 2 * wf->freq_osr; // bins faded out on either side of the signal
+
+    // FFT bin of tone 0, which becomes 0 Hz, and the range of bins that make up the signal
+    const int base_bin = (me->min_bin + candidate->freq_offset) * wf->freq_osr + candidate->freq_sub;
+    const int first_bin = base_bin - taper_width;
+    const int last_bin = base_bin + (num_tones - 1) * wf->freq_osr + taper_width;
+    const int num_frames = wf->num_blocks * wf->time_osr;
+    const int num_samples = num_frames * hop;
+
+    for (int i = 0; i < num_samples; ++i)
+    {
+        signal[i].r = 0;
+        signal[i].i = 0;
+    }
+
+    // Hann windows (scaled by 2 / nfft) at this overlap sum to frames_per_window / 2, while the band-limited inverse
+    // DFT brings back a factor of nfft / 2 for the positive frequencies: normalize so the output amplitude matches
+    // the amplitude of the real input tone
+    const float norm = 2.0f / frames_per_window;
+
+    kiss_fft_cpx* freqdata = me->ifft_freqdata;
+    kiss_fft_cpx* timedata = me->ifft_timedata;
+    for (int frame = 0; frame < num_frames; ++frame)
+    {
+        const int block = frame / wf->time_osr;
+        const int time_sub = frame % wf->time_osr;
 
-        // Compute inverse DFT and overlap-add the waveform
-        kiss_fft_cpx timedata[num_ifft];
-        kiss_fft(me->ifft_cfg, freqdata, timedata);
         for (int i = 0; i < num_ifft; ++i)
         {
-            signal[pos + i] += timedata[i].i;
+            freqdata[i].r = 0;
+            freqdata[i].i = 0;
+        }
+        for (int bin = first_bin; bin <= last_bin; ++bin)
+        {
+            int wf_bin = bin / wf->freq_osr - me->min_bin;
+            if ((bin < 0) || (wf_bin < 0) || (wf_bin >= wf->num_bins))
+                continue;
+
+            float weight = 1.0f;
+            if (bin < base_bin)
+                weight = (float)(bin - first_bin + 1) / (taper_width + 1);
+            else if (bin > last_bin - taper_width)
+                weight = (float)(last_bin - bin + 1) / (taper_width + 1);
+
+            int idx = (block * wf->block_stride) + (time_sub * wf->time_sub_stride) + ((bin % wf->freq_osr) * wf->freq_sub_stride) + (wf_bin * wf->bin_stride);
+            const ftx_waterfall_cpx_t* el = &wf->cpx[idx];
+            float mag = weight * powf(10.0f, el->mag / (20.0f * FTX_WATERFALL_CPX_MAG_SCALE));
+            float phase = el->phase * ((float)M_PI / 32767.0f);
+            int tgt_bin = (bin - base_bin + num_ifft) % num_ifft;
+            freqdata[tgt_bin].r = mag * cosf(phase);
+            freqdata[tgt_bin].i = mag * sinf(phase);
         }
+        kiss_fft(me->ifft_cfg, freqdata, timedata);
 
-        // Move to the next symbol
-        el += me->wf.block_stride;
-        pos += num_shift;
+        // The frame ends after sample (frame + 1) * subblock_size of the input and spans nfft samples. Shifting it down
+        // by base_bin leaves a phase of -2 pi base_bin start / nfft relative to a continuous downconversion; undo it.
+        long start = (long)(frame + 1) * me->subblock_size - me->nfft;
+        long cycles = ((long)base_bin * start) % me->nfft;
+        float rot = -2.0f * (float)M_PI * (float)cycles / me->nfft;
+        float rot_r = norm * cosf(rot);
+        float rot_i = norm * sinf(rot);
+
+        // Overlap-add into the output, which starts with the first input sample
+        int pos = (frame + 1) * hop - num_ifft;
+        for (int i = 0; i < num_ifft; ++i, ++pos)
+        {
+            if (pos < 0)
+                continue;
+            signal[pos].r += timedata[i].r * rot_r - timedata[i].i * rot_i;
+            signal[pos].i += timedata[i].r * rot_i + timedata[i].i * rot_r;
+        }
     }
+    return num_samples;
 }
-#endif
@@ -7,53 +7,148 @@ extern "C"
 #endif
 
 #include <ft8/decode.h>
+#include <ft8/encode.h>
 #include <fft/kiss_fftr.h>
+#include <common/resample.h>
+
+#include <stddef.h>
+
+/// Alignment (in bytes) of the arena passed to monitor_init_static() and of every buffer carved from it
+#define MONITOR_ARENA_ALIGN 64
 
 /// Configuration options for FT4/FT8 monitor
 typedef struct
 {
-    float f_min;             ///< Lower frequency bound for analysis
-    float f_max;             ///< Upper frequency bound for analysis
-    int sample_rate;         ///< Sample rate in Hertz
-    int time_osr;            ///< Number of time subdivisions
-    int freq_osr;            ///< Number of frequency subdivisions
-    ftx_protocol_t protocol; ///< Protocol: FT4 or FT8
+    float f_min;                      ///< Lower frequency bound for analysis
+    float f_max;                      ///< Upper frequency bound for analysis
+    int sample_rate;                  ///< Sample rate in Hertz
+    int proc_rate;                    ///< Internal processing rate in Hertz (0 = same as sample_rate, no resampling)
+    int time_osr;                     ///< Number of time subdivisions
+    int freq_osr;                     ///< Number of frequency subdivisions
+    ftx_protocol_t protocol;          ///< Protocol: FT4 or FT8
+    ftx_waterfall_layout_t wf_layout; ///< Waterfall memory layout (default: time-major)
+    ftx_waterfall_format_t wf_format; ///< Waterfall storage format (default: 8 bits per element)
+    bool wf_phase;                    ///< Also keep the complex spectra (needed by monitor_resynth())
+    bool keep_audio;                  ///< Keep the audio of the slot (needed by monitor_subtract())
 } monitor_config_t;
 
 /// FT4/FT8 monitor object that manages DSP processing of incoming audio data
 /// and prepares a waterfall object
 typedef struct
 {
-    float symbol_period; ///< FT4/FT8 symbol period in seconds
-    int min_bin;         ///< First FFT bin in the frequency range (begin)
-    int max_bin;         ///< First FFT bin outside the frequency range (end)
-    int block_size;      ///< Number of samples per symbol (block)
-    int subblock_size;   ///< Analysis shift size (number of samples)
-    int nfft;            ///< FFT size
-    float fft_norm;      ///< FFT normalization factor
-    float* window;       ///< Window function for STFT analysis (nfft samples)
-    float* last_frame;   ///< Current STFT analysis frame (nfft samples)
-    ftx_waterfall_t wf;  ///< Waterfall object
-    float max_mag;       ///< Maximum detected magnitude (debug stats)
+    float symbol_period;       ///< FT4/FT8 symbol period in seconds
+    int sample_rate;           ///< Input sample rate in Hertz
+    int proc_rate;             ///< Processing sample rate in Hertz (block and FFT sizes are derived from it)
+    int min_bin;               ///< First FFT bin in the frequency range (begin)
+    int max_bin;               ///< First FFT bin outside the frequency range (end)
+    int block_size;            ///< Number of samples per symbol (block)
+    int subblock_size;         ///< Analysis shift size (number of samples)
+    int nfft;                  ///< FFT size
+    float fft_norm;            ///< FFT normalization factor
+    const float* window;       ///< Window function for STFT analysis (nfft samples)
+    float* last_frame;         ///< Current STFT analysis frame (nfft samples)
+    kiss_fft_scalar* timedata; ///< FFT input scratch (nfft samples)
+    kiss_fft_cpx* freqdata;    ///< FFT output scratch (nfft / 2 + 1 bins)
+    uint8_t* block_mag;        ///< Magnitudes of the current block before packing (only for FTX_WATERFALL_U4)
+    ftx_waterfall_t wf;        ///< Waterfall object
+    float max_mag;             ///< Maximum detected magnitude (debug stats)
+    uint8_t* noise_median;     ///< Streaming median of every bin (freq_osr * num_bins), feeds wf.noise
+    bool noise_valid;          ///< True once noise_median holds an estimate (it carries over monitor_reset())
+
+    // Input rate conversion (only used with monitor_feed())
+    int input_block_size;   ///< Approximate number of input samples per block (block_size at sample_rate)
+    bool use_resampler;     ///< True if sample_rate differs from proc_rate
+    resampler_t resampler;  ///< Rational resampler from sample_rate to proc_rate
+    float* proc_frame;      ///< Processing-rate samples waiting for a complete block (block_size samples)
+    int proc_frame_len;     ///< Number of valid samples in proc_frame
+
+    void* arena;                 ///< Single block holding all buffers if allocated by monitor_init() (NULL after monitor_init_static())
+    size_t arena_size;           ///< Number of bytes used from the arena
+    struct monitor_plan_s* plan; ///< Shared window and FFT plan (monitor_init() only, NULL after monitor_init_static())
 
     // KISS FFT housekeeping variables
     void* fft_work;        ///< Work area required by Kiss FFT
     kiss_fftr_cfg fft_cfg; ///< Kiss FFT housekeeping object
-#ifdef WATERFALL_USE_PHASE
+
+    // Signal reconstruction from the complex spectra (only with wf_phase)
+    bool keep_phase;       ///< True if the waterfall keeps complex spectra
     int nifft;             ///< iFFT size
+    float resynth_rate;    ///< Sample rate of monitor_resynth() output in Hertz
     void* ifft_work;       ///< Work area required by inverse Kiss FFT
     kiss_fft_cfg ifft_cfg; ///< Inverse Kiss FFT housekeeping object
-#endif
+    kiss_fft_cpx* ifft_freqdata; ///< iFFT input scratch (nifft bins)
+    kiss_fft_cpx* ifft_timedata; ///< iFFT output scratch (nifft samples)
+
+    // Signal subtraction (only with keep_audio)
+    bool keep_audio;             ///< True if the audio of the slot is kept
+    float* audio;                ///< Audio of the slot at proc_rate (max_blocks * block_size samples)
+    ftx_encoder_t subtract_enc;  ///< Synthesizer of the reference waveform at proc_rate (tables in the arena)
+    float* subtract_audio;       ///< Scratch: the audio under a subtracted signal (one message of samples)
+    kiss_fft_cpx* subtract_amp;  ///< Scratch: conjugate reference waveform (one message of samples)
+    kiss_fft_cpx* subtract_seg;  ///< Scratch: correlation of the audio with every symbol of the reference (one message of symbols)
 } monitor_t;
 
+/// Initialize the monitor, allocating all of its buffers as a single memory block.
+/// The analysis window and FFT twiddles are shared (read-only, reference counted) with all other
+/// monitors of the same FFT size, so only the first monitor of a given configuration computes them.
+/// Safe to call from several threads at once; a plan is computed without holding up other threads, and if several
+/// threads compute the same plan at once, one copy is kept and the others are dropped.
 void monitor_init(monitor_t* me, const monitor_config_t* cfg);
+
+/// Number of bytes monitor_init_static() needs for the given configuration
+size_t monitor_get_memory_size(const monitor_config_t* cfg);
+
+/// Initialize the monitor without any heap allocation. All buffers (waterfall, FFT state and scratch,
+/// resampler) are carved from the caller-provided arena, which must be aligned to MONITOR_ARENA_ALIGN
+/// and hold monitor_get_memory_size(cfg) bytes. The arena stays owned by the caller and must outlive
+/// the monitor; monitor_free() is a no-op for such monitors.
+void monitor_init_static(monitor_t* me, const monitor_config_t* cfg, void* buffer);
 void monitor_reset(monitor_t* me);
+
+/// Process one block (block_size samples at proc_rate) into the next waterfall block. Also updates the noise floor
+/// map wf.noise incrementally, from streaming medians of the bins that carry over between slots; for a one-off
+/// exact estimate call ftx_waterfall_update_noise() once the slot is complete.
 void monitor_process(monitor_t* me, const float* frame);
+
+/// Feed an arbitrary number of samples at the input sample rate. The samples are converted to the processing rate
+/// (if needed) and monitor_process() is called for every complete block.
+/// @return Number of blocks processed
+int monitor_feed(monitor_t* me, const float* samples, int num_samples);
 void monitor_free(monitor_t* me);
 
-#ifdef WATERFALL_USE_PHASE
-void monitor_resynth(const monitor_t* me, const candidate_t* candidate, float* signal);
-#endif
+/// Release the shared windows and FFT plans that no monitor currently uses.
+/// Unused plans are otherwise kept, so that monitors created later start without recomputing them.
+/// @return Number of plans released
+int monitor_plan_cache_purge(void);
+
+/// Reconstruct a candidate's signal from the complex spectra kept in the waterfall (requires wf_phase).
+/// The output is complex baseband at resynth_rate, with the candidate's tone 0 at 0 Hz and with the amplitude
+/// of the real input signal. Sample 0 corresponds to the first input sample of the slot. Only the bins of the
+/// candidate's tones (with a short taper on either side) are used, so other signals are left out.
+/// @param[in] candidate Candidate whose frequency band is reconstructed (time position is not used)
+/// @param[out] signal Output samples, room for max_blocks * time_osr * nifft / (time_osr * freq_osr) entries
+/// @return Number of samples written (0 if the monitor does not keep phase)
+int monitor_resynth(monitor_t* me, const ftx_candidate_t* candidate, kiss_fft_cpx* signal);
+
+/// Remove a decoded signal from the kept audio (requires keep_audio).
+/// The tone sequence is synthesized as GFSK; its start time and frequency are refined against the audio, then its
+/// complex amplitude is tracked over the message (so slow fading and phase drift are followed) and subtracted.
+/// The waterfall is not touched: the tiles that saw the signal are marked dirty (see ftx_waterfall_mark_dirty()),
+/// so that several signals can be subtracted before a single monitor_refresh().
+/// @param[in] candidate Candidate the message was decoded from
+/// @param[in] tones Tone sequence of the message (FT8_NN or FT4_NN tones, see ft8_encode() / ft4_encode())
+/// @return False if the monitor does not keep audio
+bool monitor_subtract(monitor_t* me, const ftx_candidate_t* candidate, const uint8_t* tones);
+
+/// Recompute waterfall elements (magnitudes, and phases if kept) from the kept audio (requires keep_audio)
+/// @param[in] first_frame, last_frame Range of analysis frames (block * time_osr + time_sub), inclusive
+/// @param[in] first_bin, last_bin Range of waterfall bins (0..num_bins-1), inclusive
+void monitor_reanalyze(monitor_t* me, int first_frame, int last_frame, int first_bin, int last_bin);
+
+/// Recompute the waterfall tiles marked dirty from the kept audio (the noise floor map is left as is).
+/// Every analysis frame of a dirty time tile takes one FFT, and only the bins of its dirty tiles are stored.
+/// The marks stay, for ftx_update_candidates(), until ftx_waterfall_clear_dirty().
+void monitor_refresh(monitor_t* me);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,158 @@
+#include "resample.h"
+#include <common/common.h>
+
+#define LOG_LEVEL LOG_INFO
+#include <ft8/debug.h>
+
+#include <stdlib.h>
+#include <math.h>
+
+#define RESAMPLER_ZEROS  8     ///< Zero crossings of the sinc kernel on each side (per output sample spacing)
+#define RESAMPLER_CUTOFF 0.90f ///< Passband edge relative to the lower Nyquist frequency
+
+static int gcd(int a, int b)
+{
+    while (b != 0)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static float blackman_i(int i, int N)
+{
+    const float alpha = 0.16f;
+    const float a0 = (1 - alpha) / 2;
+    const float a1 = 1.0f / 2;
+    const float a2 = alpha / 2;
+
+    float x1 = cosf(2 * (float)M_PI * i / N);
+    float x2 = 2 * x1 * x1 - 1; // Use double angle formula
+
+    return a0 - a1 * x1 + a2 * x2;
+}
+
+/// Rational factors and filter length for the given rates
+static void resampler_setup(resampler_t* me, int in_rate, int out_rate)
+{
+    int g = gcd(in_rate, out_rate);
+    me->in_rate = in_rate;
+    me->out_rate = out_rate;
+    me->up = out_rate / g;
+    me->down = in_rate / g;
+
+    // Widen the kernel proportionally when decimating, so the transition band stays the same in output terms
+    int ratio = (me->down + me->up - 1) / me->up;
+    me->taps_per_phase = 2 * RESAMPLER_ZEROS * ratio;
+}
+
+/// Prototype low-pass filter tap i out of num_taps (unnormalized)
+static float resampler_proto(int i, int num_taps, float fc)
+{
+    const float center = 0.5f * (num_taps - 1);
+    float x = 2 * fc * (i - center);
+    float sinc = (fabsf(x) < 1e-6f) ? 1.0f : sinf((float)M_PI * x) / ((float)M_PI * x);
+    // Window spans num_taps + 1 points so that both ends are nonzero
+    return 2 * fc * sinc * blackman_i(i + 1, num_taps + 1);
+}
+
+size_t resampler_get_memory_size(int in_rate, int out_rate)
+{
+    resampler_t tmp;
+    resampler_setup(&tmp, in_rate, out_rate);
+    return (size_t)(tmp.up + 2) * tmp.taps_per_phase * sizeof(float);
+}
+
+void resampler_init_static(resampler_t* me, int in_rate, int out_rate, void* buffer)
+{
+    resampler_setup(me, in_rate, out_rate);
+
+    const int num_taps = me->up * me->taps_per_phase;
+    const int max_factor = (me->up > me->down) ? me->up : me->down;
+    const float fc = RESAMPLER_CUTOFF * 0.5f / max_factor; // cutoff in cycles per interpolated sample
+
+    float sum = 0;
+    for (int i = 0; i < num_taps; ++i)
+    {
+        sum += resampler_proto(i, num_taps, fc);
+    }
+
+    // Split into polyphase components (time-reversed), normalizing the passband gain of each phase to 1
+    me->coeffs = (float*)buffer;
+    me->history = me->coeffs + num_taps;
+    for (int p = 0; p < me->up; ++p)
+    {
+        for (int k = 0; k < me->taps_per_phase; ++k)
+        {
+            me->coeffs[p * me->taps_per_phase + k] = resampler_proto(p + (me->taps_per_phase - 1 - k) * me->up, num_taps, fc) * me->up / sum;
+        }
+    }
+    resampler_reset(me);
+
+    LOG(LOG_INFO, "Resampler %d -> %d Hz (x%d/%d), %d taps per phase\n", in_rate, out_rate, me->up, me->down, me->taps_per_phase);
+}
+
+void resampler_init(resampler_t* me, int in_rate, int out_rate)
+{
+    resampler_init_static(me, in_rate, out_rate, malloc(resampler_get_memory_size(in_rate, out_rate)));
+}
+
+void resampler_reset(resampler_t* me)
+{
+    for (int i = 0; i < 2 * me->taps_per_phase; ++i)
+    {
+        me->history[i] = 0;
+    }
+    me->head = 0;
+    me->phase = 0;
+    me->need = 1;
+}
+
+void resampler_free(resampler_t* me)
+{
+    free(me->coeffs);
+}
+
+int resampler_process(resampler_t* me, const float* input, int num_input, int* num_used, float* output, int max_output)
+{
+    const int T = me->taps_per_phase;
+    int in_pos = 0;
+    int out_pos = 0;
+
+    while (out_pos < max_output)
+    {
+        // Shift in the input samples required for the next output sample
+        while ((me->need > 0) && (in_pos < num_input))
+        {
+            float x = input[in_pos++];
+            me->history[me->head] = x;
+            me->history[me->head + T] = x;
+            if (++me->head == T)
+                me->head = 0;
+            --me->need;
+        }
+        if (me->need > 0)
+            break; // Input exhausted
+
+        // history[head .. head + T - 1] holds the last T input samples, oldest first
+        const float* h = me->coeffs + me->phase * T;
+        const float* x = me->history + me->head;
+        float acc = 0;
+        for (int k = 0; k < T; ++k)
+        {
+            acc += h[k] * x[k];
+        }
+        output[out_pos++] = acc;
+
+        // Advance the interpolated time index by 'down' and find out how many inputs it spans
+        me->phase += me->down;
+        me->need = me->phase / me->up;
+        me->phase -= me->need * me->up;
+    }
+
+    if (num_used != NULL)
+        *num_used = in_pos;
+    return out_pos;
+}
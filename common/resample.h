@@ -0,0 +1,53 @@
+#ifndef _INCLUDE_RESAMPLE_H_
+#define _INCLUDE_RESAMPLE_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Rational polyphase resampler (interpolate by up, low-pass filter, decimate by down).
+/// Only the filter phases that contribute to an output sample are evaluated,
+/// so the cost is taps_per_phase multiply-adds per output sample.
+typedef struct
+{
+    int in_rate;        ///< Input sample rate in Hertz
+    int out_rate;       ///< Output sample rate in Hertz
+    int up;             ///< Interpolation factor (out_rate / gcd)
+    int down;           ///< Decimation factor (in_rate / gcd)
+    int taps_per_phase; ///< Number of filter taps evaluated per output sample
+    float* coeffs;      ///< Polyphase filter bank, up * taps_per_phase coefficients (each phase stored time-reversed)
+    float* history;     ///< Input history, 2 * taps_per_phase samples (written twice to avoid wrapping), follows coeffs
+    int head;           ///< Position of the oldest sample in history
+    int phase;          ///< Current filter phase (0..up-1)
+    int need;           ///< Number of input samples to consume before the next output sample
+} resampler_t;
+
+void resampler_init(resampler_t* me, int in_rate, int out_rate);
+void resampler_reset(resampler_t* me);
+void resampler_free(resampler_t* me);
+
+/// Number of bytes needed by resampler_init_static() for the given rates
+size_t resampler_get_memory_size(int in_rate, int out_rate);
+
+/// Initialize the resampler in a caller-provided buffer (float-aligned, resampler_get_memory_size() bytes).
+/// The buffer is owned by the caller; do not call resampler_free() on a resampler initialized this way.
+void resampler_init_static(resampler_t* me, int in_rate, int out_rate, void* buffer);
+
+/// Convert a chunk of input samples. Stops when either the input is exhausted or the output is full;
+/// the filter state is kept, so the next call continues seamlessly from where this one stopped.
+/// @param[in] input Input samples
+/// @param[in] num_input Number of input samples available
+/// @param[out] num_used Number of input samples consumed (can be NULL)
+/// @param[out] output Output samples
+/// @param[in] max_output Space available in the output array
+/// @return Number of output samples produced
+int resampler_process(resampler_t* me, const float* input, int num_input, int* num_used, float* output, int max_output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_RESAMPLE_H_
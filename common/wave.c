@@ -65,69 +65,168 @@ int save_wav(const float* signal, int num_samples, int sample_rate, const char*
     return 0;
 }
 
-// Load signal in floating point format (-1 .. +1) as a WAVE file using 16-bit signed integers.
-int load_wav(float* signal, int* num_samples, int* sample_rate, const char* path)
-{
-    char subChunk1ID[4];    // = {'f', 'm', 't', ' '};
-    uint32_t subChunk1Size; // = 16;    // 16 for PCM
-    uint16_t audioFormat;   // = 1;     // PCM = 1
-    uint16_t numChannels;   // = 1;
-    uint16_t bitsPerSample; // = 16;
-    uint32_t sampleRate;
-    uint16_t blockAlign; // = numChannels * bitsPerSample / 8;
-    uint32_t byteRate;   // = sampleRate * blockAlign;
-
-    char subChunk2ID[4];    // = {'d', 'a', 't', 'a'};
-    uint32_t subChunk2Size; // = num_samples * blockAlign;
-
-    char chunkID[4];    // = {'R', 'I', 'F', 'F'};
-    uint32_t chunkSize; // = 4 + (8 + subChunk1Size) + (8 + subChunk2Size);
-    char format[4];     // = {'W', 'A', 'V', 'E'};
-
-    FILE* f = fopen(path, "rb");
-    if (f == NULL)
-        return -1;
-
-    // NOTE: works only on little-endian architecture
-    fread((void*)chunkID, sizeof(chunkID), 1, f);
-    fread((void*)&chunkSize, sizeof(chunkSize), 1, f);
-    fread((void*)format, sizeof(format), 1, f);
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
 
-    fread((void*)subChunk1ID, sizeof(subChunk1ID), 1, f);
-    fread((void*)&subChunk1Size, sizeof(subChunk1Size), 1, f);
-    if (subChunk1Size != 16)
-        return -2;
-
-    fread((void*)&audioFormat, sizeof(audioFormat), 1, f);
-    fread((void*)&numChannels, sizeof(numChannels), 1, f);
-    fread((void*)&sampleRate, sizeof(sampleRate), 1, f);
-    fread((void*)&byteRate, sizeof(byteRate), 1, f);
-    fread((void*)&blockAlign, sizeof(blockAlign), 1, f);
-    fread((void*)&bitsPerSample, sizeof(bitsPerSample), 1, f);
-
-    if (audioFormat != 1 || numChannels != 1 || bitsPerSample != 16)
-        return -3;
+// Little-endian fields of the file
+static uint16_t get_u16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
 
-    fread((void*)subChunk2ID, sizeof(subChunk2ID), 1, f);
-    fread((void*)&subChunk2Size, sizeof(subChunk2Size), 1, f);
+static uint32_t get_u32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    if (subChunk2Size / blockAlign > *num_samples)
-        return -4;
+bool wav_reader_init(wav_reader_t* me, const void* data, size_t size, int channel)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    me->samples = NULL;
+    me->num_samples = 0;
+    me->pos = 0;
+    me->file.data = NULL;
+    me->file.size = 0;
+    if ((size < 12) || (0 != memcmp(bytes, "RIFF", 4)) || (0 != memcmp(bytes + 8, "WAVE", 4)))
+        return false;
+
+    // Walk the chunks (each padded to an even size) for the format and the samples
+    const uint8_t* fmt = NULL;
+    uint32_t fmt_size = 0;
+    size_t data_offset = 0;
+    size_t data_size = 0;
+    size_t offset = 12;
+    while ((offset + 8 <= size) && ((fmt == NULL) || (data_offset == 0)))
+    {
+        uint32_t chunk_size = get_u32(bytes + offset + 4);
+        size_t available = size - (offset + 8);
+        if (0 == memcmp(bytes + offset, "fmt ", 4))
+        {
+            fmt = bytes + offset + 8;
+            fmt_size = (chunk_size < available) ? chunk_size : (uint32_t)available;
+        }
+        else if (0 == memcmp(bytes + offset, "data", 4))
+        {
+            data_offset = offset + 8;
+            // A truncated recording, or one written as a stream (size left 0 or 0xFFFFFFFF), ends with the file
+            data_size = ((chunk_size == 0) || (chunk_size > available)) ? available : chunk_size;
+        }
+        if (chunk_size >= available)
+            break; // last chunk of the file
+        offset += 8 + (size_t)chunk_size + (chunk_size & 1);
+    }
+    if ((fmt == NULL) || (fmt_size < 16) || (data_offset == 0))
+        return false;
+
+    uint16_t format = get_u16(fmt);
+    me->num_channels = get_u16(fmt + 2);
+    me->sample_rate = (int)get_u32(fmt + 4);
+    uint16_t block_align = get_u16(fmt + 12);
+    me->bits_per_sample = get_u16(fmt + 14);
+    if ((format == WAVE_FORMAT_EXTENSIBLE) && (fmt_size >= 40))
+    {
+        format = get_u16(fmt + 24); // first bytes of the SubFormat GUID
+    }
+    me->is_float = (format == WAVE_FORMAT_IEEE_FLOAT);
+    if ((format != WAVE_FORMAT_PCM) && !me->is_float)
+        return false;
+    if (me->is_float ? (me->bits_per_sample != 32) : ((me->bits_per_sample % 8 != 0) || (me->bits_per_sample < 8) || (me->bits_per_sample > 32)))
+        return false;
+    int sample_size = me->bits_per_sample / 8;
+    if ((me->num_channels < 1) || (block_align < me->num_channels * sample_size) || (me->sample_rate <= 0))
+        return false;
+    if ((channel < 0) || (channel >= me->num_channels))
+        return false;
+
+    me->frame_size = block_align;
+    me->samples = bytes + data_offset + channel * sample_size;
+    me->num_samples = (long)(data_size / block_align);
+    return true;
+}
 
-    *num_samples = subChunk2Size / blockAlign;
-    *sample_rate = sampleRate;
+bool wav_reader_open(wav_reader_t* me, const char* path, int channel)
+{
+    mapped_file_t file;
+    if (!mapped_file_open(&file, path))
+        return false;
+    if (!wav_reader_init(me, file.data, file.size, channel))
+    {
+        mapped_file_close(&file);
+        return false;
+    }
+    me->file = file;
+    return true;
+}
 
-    int16_t* raw_data = (int16_t*)malloc(*num_samples * blockAlign);
+void wav_reader_close(wav_reader_t* me)
+{
+    mapped_file_close(&me->file);
+    me->samples = NULL;
+    me->num_samples = 0;
+    me->pos = 0;
+}
 
-    fread((void*)raw_data, blockAlign, *num_samples, f);
-    for (int i = 0; i < *num_samples; i++)
+int wav_reader_read(wav_reader_t* me, float* block, int block_size)
+{
+    long remaining = me->num_samples - me->pos;
+    int n = (block_size < remaining) ? block_size : (int)remaining;
+    if (n <= 0)
+        return 0;
+
+    // One loop per format, the samples are assembled byte by byte as they need not be aligned
+    const uint8_t* src = me->samples + me->pos * me->frame_size;
+    const int stride = me->frame_size;
+    if (me->is_float)
     {
-        signal[i] = raw_data[i] / 32768.0f;
+        for (int i = 0; i < n; ++i, src += stride)
+        {
+            uint32_t bits = get_u32(src);
+            memcpy(&block[i], &bits, sizeof(float));
+        }
     }
+    else if (me->bits_per_sample == 8)
+    {
+        for (int i = 0; i < n; ++i, src += stride)
+        {
+            block[i] = (src[0] - 128) / 128.0f;
+        }
+    }
+    else if (me->bits_per_sample == 16)
+    {
+        for (int i = 0; i < n; ++i, src += stride)
+        {
+            block[i] = (int16_t)get_u16(src) / 32768.0f;
+        }
+    }
+    else
+    {
+        // 24 and 32 bits: place the sample in the top bits of an int32_t
+        const int shift = 32 - me->bits_per_sample;
+        for (int i = 0; i < n; ++i, src += stride)
+        {
+            uint32_t bits = (shift == 0) ? get_u32(src) : (((uint32_t)src[0] << 8) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 24));
+            block[i] = (int32_t)bits * (1.0f / 2147483648.0f);
+        }
+    }
+    me->pos += n;
+    return n;
+}
 
-    free(raw_data);
-
-    fclose(f);
+// Load signal in floating point format (-1 .. +1) from a WAVE file (first channel, any format wav_reader_t reads).
+int load_wav(float* signal, int* num_samples, int* sample_rate, const char* path)
+{
+    wav_reader_t reader;
+    if (!wav_reader_open(&reader, path, 0))
+        return -1;
+    if (reader.num_samples > *num_samples)
+    {
+        wav_reader_close(&reader);
+        return -4;
+    }
 
+    *num_samples = wav_reader_read(&reader, signal, (int)reader.num_samples);
+    *sample_rate = reader.sample_rate;
+    wav_reader_close(&reader);
     return 0;
 }
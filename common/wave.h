@@ -1,15 +1,55 @@
 #ifndef _INCLUDE_WAVE_H_
 #define _INCLUDE_WAVE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mapped_file.h"
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+/// Streaming reader of a WAVE file held in memory (usually a mapped file). Any RIFF chunk layout is accepted
+/// (unknown chunks are skipped, the fmt chunk may have any size, WAVE_FORMAT_EXTENSIBLE is understood) with
+/// unsigned 8-bit, signed 16/24/32-bit integer or 32-bit float samples and any number of channels. One channel
+/// is converted to floating point (-1 .. +1) block by block, straight from the file contents.
+typedef struct
+{
+    int sample_rate;     ///< Sample rate in Hertz
+    int num_channels;    ///< Number of interleaved channels in the file
+    int bits_per_sample; ///< Bits per sample (8, 16, 24 or 32)
+    bool is_float;       ///< True for IEEE float samples, false for integers
+    long num_samples;    ///< Number of samples per channel
+    long pos;            ///< Number of samples read so far
+
+    const uint8_t* samples; ///< First sample of the selected channel
+    int frame_size;         ///< Bytes from one sample to the next of the same channel
+    mapped_file_t file;     ///< Mapping owned by the reader (wav_reader_open() only)
+} wav_reader_t;
+
+/// Parse a WAVE file in memory. The data must stay valid while the reader is used.
+/// @param[in] channel Channel to read (0 for the first/left one)
+/// @return False if the data is not a WAVE file, the format is not supported or the channel does not exist
+bool wav_reader_init(wav_reader_t* me, const void* data, size_t size, int channel);
+
+/// Map a WAVE file and parse it (see wav_reader_init())
+bool wav_reader_open(wav_reader_t* me, const char* path, int channel);
+
+/// Unmap the file opened by wav_reader_open() (nothing to do after wav_reader_init())
+void wav_reader_close(wav_reader_t* me);
+
+/// Convert the next samples of the selected channel to floating point (-1 .. +1)
+/// @return Number of samples written, less than block_size only at the end of the file
+int wav_reader_read(wav_reader_t* me, float* block, int block_size);
+
 // Save signal in floating point format (-1 .. +1) as a WAVE file using 16-bit signed integers.
 int save_wav(const float* signal, int num_samples, int sample_rate, const char* path);
 
-// Load signal in floating point format (-1 .. +1) as a WAVE file using 16-bit signed integers.
+// Load signal in floating point format (-1 .. +1) from a WAVE file (first channel, any format wav_reader_t reads).
+// On input num_samples is the space in signal, on output the number of samples loaded.
 int load_wav(float* signal, int* num_samples, int* sample_rate, const char* path);
 
 #ifdef __cplusplus
@@ -10,11 +10,14 @@
 #include <ft8/encode.h>
 #include <ft8/message.h>
 #include <ft8/hashtable.h>
+#include <ft8/dedup.h>
+#include <ft8/callsign_index.h>
 
 #include <common/common.h>
 #include <common/wave.h>
 #include <common/monitor.h>
 #include <common/audio.h>
+#include <common/mapped_file.h>
 
 #define LOG_LEVEL LOG_INFO
 #include <ft8/debug.h>
@@ -23,22 +26,26 @@ const int kMin_score = 10; // Minimum sync score threshold for candidates
 const int kMax_candidates = 200;
 const int kLDPC_iterations = 25;
 
-const int kMax_decoded_messages = 50;
+const int kMax_ap_hypotheses = 6;
+
+const int kMax_decoded_messages = 64; // Initial size of the decoded message set (it grows as needed)
+
+const int kMax_decode_rounds = 3;          // Decoding passes with signal subtraction
+const float kDecode_time_budget = 0.1f;    // Time for decoding passes after the first one, as a fraction of the slot
 
 const int kFreq_osr = 2; // Frequency oversampling rate (bin subdivision)
 const int kTime_osr = 4; // Time oversampling rate (symbol subdivision)
 
+const int kProc_rate = 12000;       // Internal processing rate, input at other rates is resampled
 
-static int get_message_snr(const ftx_waterfall_t* wf, const ftx_candidate_t *candidate, ftx_message_t *msg) {
-    uint8_t n_tones = (wf->protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
-    uint8_t tones[n_tones];
 
+static int get_message_tones(const ftx_waterfall_t* wf, const ftx_message_t *msg, uint8_t* tones) {
     if (wf->protocol == FTX_PROTOCOL_FT4) {
         ft4_encode(msg->payload, tones);
-    } else {
-        ft8_encode(msg->payload, tones);
+        return FT4_NN;
     }
-    return ftx_get_snr(wf, candidate, tones, n_tones);
+    ft8_encode(msg->payload, tones);
+    return FT8_NN;
 }
 
 static int get_message_snr_and_mute(ftx_waterfall_t* wf, const ftx_candidate_t *candidate, ftx_message_t *msg) {
@@ -54,117 +61,242 @@ static int get_message_snr_and_mute(ftx_waterfall_t* wf, const ftx_candidate_t *
 }
 
 
+// True if the candidate lies within a symbol and a bin of an already decoded one (same signal)
+static bool is_near_decoded(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, const ftx_candidate_t* decoded, int num_decoded)
+{
+    int time_pos = cand->time_offset * wf->time_osr + cand->time_sub;
+    int freq_pos = cand->freq_offset * wf->freq_osr + cand->freq_sub;
+    for (int i = 0; i < num_decoded; ++i)
+    {
+        int dt = decoded[i].time_offset * wf->time_osr + decoded[i].time_sub - time_pos;
+        int df = decoded[i].freq_offset * wf->freq_osr + decoded[i].freq_sub - freq_pos;
+        if ((abs(dt) <= wf->time_osr) && (abs(df) <= wf->freq_osr))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void usage(const char* error_msg)
 {
     if (error_msg != NULL)
     {
         fprintf(stderr, "ERROR: %s\n", error_msg);
     }
-    fprintf(stderr, "Usage: decode_ft8 [-list|([-ft4] [INPUT|-dev DEVICE])]\n\n");
+    fprintf(stderr, "Usage: decode_ft8 [-list|([-ft4] [-packed] [-multi] [-subtract] [-calls INDEX] [-mycall CALL [-dxcall CALL]] [[-channel N] INPUT|-dev DEVICE])]\n\n");
     fprintf(stderr, "Decode a 15-second (or slighly shorter) WAV file.\n");
+    fprintf(stderr, "  -channel decode channel N of a multi-channel WAV file (0, the first, by default)\n");
+    fprintf(stderr, "  -packed  store the waterfall with 4 bits per element (half the memory)\n");
+    fprintf(stderr, "  -multi   retry failed FT8 candidates with multi-symbol metrics (keeps phase)\n");
+    fprintf(stderr, "  -subtract  subtract decoded signals from the audio and decode again (up to %d passes)\n", kMax_decode_rounds);
+    fprintf(stderr, "  -calls   resolve hashed callsigns not heard yet from a known-callsign index (see index_callsigns)\n");
+    fprintf(stderr, "  -mycall  retry failed candidates as CQs and replies to CALL (a-priori decoding)\n");
+    fprintf(stderr, "  -dxcall  also retry them as messages from CALL to us (with -mycall)\n");
 }
 
-void decode(const monitor_t* mon, struct tm* tm_slot_start)
+/// Make the AP hypotheses for the messages we expect: CQs and replies to us, and once we work a station, its messages
+static int make_ap_hypotheses(const char* mycall, const char* dxcall, ftx_ap_hypothesis_t* hyps)
 {
-    ftx_waterfall_t* wf = &mon->wf;
-    // Find top candidates by Costas sync score and localize them in time and frequency
-    ftx_candidate_t candidate_list[kMax_candidates];
-    int num_candidates = ftx_find_candidates(wf, kMax_candidates, candidate_list, kMin_score);
-    printf("num_candidates: %i\n", num_candidates);
+    int num_hyps = 0;
+    if (mycall == NULL)
+    {
+        return 0;
+    }
+    if (FTX_MESSAGE_RC_OK == ftx_ap_hypothesis_std(&hyps[num_hyps], NULL, "CQ", NULL, NULL))
+        ++num_hyps;
+    if (FTX_MESSAGE_RC_OK == ftx_ap_hypothesis_std(&hyps[num_hyps], NULL, mycall, NULL, NULL))
+        ++num_hyps;
+    if (dxcall != NULL)
+    {
+        const char* extras[] = { NULL, "RRR", "RR73", "73" };
+        for (int i = 0; i < 4; ++i)
+        {
+            if (FTX_MESSAGE_RC_OK == ftx_ap_hypothesis_std(&hyps[num_hyps], NULL, mycall, dxcall, extras[i]))
+                ++num_hyps;
+        }
+    }
+    return num_hyps;
+}
+
+/// Callsigns heard so far, backed by an index of known callsigns for the hashes not heard yet
+typedef struct
+{
+    ftx_callsign_hash_interface_t* heard;
+    const ftx_callsign_index_t* known;
+} callsign_lookup_t;
+
+static bool lookup_heard_or_known(void* ctx, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    callsign_lookup_t* lookup = (callsign_lookup_t*)ctx;
+    return lookup->heard->lookup_hash(lookup->heard->ctx, hash_type, hash, callsign) || ftx_callsign_index_lookup(lookup->known, hash_type, hash, callsign);
+}
 
-    // Hash table for decoded messages (to check for duplicates)
+static void save_heard(void* ctx, const char* callsign, uint32_t n22)
+{
+    callsign_lookup_t* lookup = (callsign_lookup_t*)ctx;
+    lookup->heard->save_hash(lookup->heard->ctx, callsign, n22);
+}
+
+static double now_sec(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (double)spec.tv_sec + (spec.tv_nsec / 1e9);
+}
+
+void decode(monitor_t* mon, struct tm* tm_slot_start, bool multi, const ftx_ap_hypothesis_t* hyps, int num_hyps, ftx_decoded_set_t* decoded,
+    ftx_callsign_hash_interface_t* hash_if)
+{
+    ftx_waterfall_t* wf = &mon->wf;
     int num_decoded = 0;
-    ftx_message_t decoded[kMax_decoded_messages];
-    ftx_message_t* decoded_hashtable[kMax_decoded_messages];
 
-    // Initialize hash table pointers
-    for (int i = 0; i < kMax_decoded_messages; ++i)
-    {
-        decoded_hashtable[i] = NULL;
-    }
+    // Candidates decoded so far (the multi-symbol pass leaves their neighbourhood alone)
+    int num_decoded_cands = 0;
+    ftx_candidate_t decoded_cands[kMax_candidates];
 
-    // Go over candidates and attempt to decode messages
-    for (int idx = 0; idx < num_candidates; ++idx)
+    // With the audio kept, decoded signals are also subtracted from the audio. Once a pass is through, the waterfall
+    // is refreshed where they were, and the search runs again there while it finds new messages.
+    const bool subtract = (mon->audio != NULL);
+    const int num_rounds = subtract ? kMax_decode_rounds : 1;
+    const float slot_period = (wf->protocol == FTX_PROTOCOL_FT4) ? FT4_SLOT_TIME : FT8_SLOT_TIME;
+    const double deadline = now_sec() + kDecode_time_budget * slot_period;
+    ftx_candidate_t candidate_list[kMax_candidates];
+    int num_candidates = 0;
+    for (int round = 0; round < num_rounds; ++round)
     {
-        const ftx_candidate_t* cand = &candidate_list[idx];
-
-        float freq_hz = (mon->min_bin + cand->freq_offset + (float)cand->freq_sub / wf->freq_osr) / mon->symbol_period;
-        float time_sec = (cand->time_offset + (float)(cand->time_sub + 0.5) / wf->time_osr) * mon->symbol_period;
-
-#ifdef WATERFALL_USE_PHASE
-        // int resynth_len = 12000 * 16;
-        // float resynth_signal[resynth_len];
-        // for (int pos = 0; pos < resynth_len; ++pos)
-        // {
-        //     resynth_signal[pos] = 0;
-        // }
-        // monitor_resynth(mon, cand, resynth_signal);
-        // char resynth_path[80];
-        // sprintf(resynth_path, "resynth_%04f_%02.1f.wav", freq_hz, time_sec);
-        // save_wav(resynth_signal, resynth_len, 12000, resynth_path);
-#endif
-
-        ftx_message_t message;
-        ftx_decode_status_t status;
-        if (!ftx_decode_candidate(wf, cand, kLDPC_iterations, &message, &status))
+        bool retry[kMax_candidates];
+        if (round == 0)
         {
-            if (status.ldpc_errors > 0)
+            // Find top candidates by Costas sync score and localize them in time and frequency
+            num_candidates = ftx_find_candidates(wf, kMax_candidates, candidate_list, kMin_score);
+            for (int i = 0; i < num_candidates; ++i)
             {
-                LOG(LOG_DEBUG, "LDPC decode: %d errors\n", status.ldpc_errors);
+                retry[i] = true;
             }
-            else if (status.crc_calculated != status.crc_extracted)
+        }
+        else
+        {
+            if (now_sec() > deadline)
+            {
+                LOG(LOG_INFO, "Out of time after %d decoding passes\n", round);
+                break;
+            }
+
+            // Analyze the audio again where decoded signals were removed, and score again only the candidates there.
+            // Elsewhere nothing changed, so the candidates that failed still would.
+            monitor_refresh(mon);
+            num_candidates = ftx_update_candidates(wf, kMax_candidates, candidate_list, num_candidates, kMin_score);
+            for (int i = 0; i < num_candidates; ++i)
             {
-                LOG(LOG_DEBUG, "CRC mismatch!\n");
+                retry[i] = ftx_candidate_is_dirty(wf, &candidate_list[i]);
             }
-            continue;
+            ftx_waterfall_clear_dirty(wf);
         }
-        float snr = get_message_snr_and_mute(wf, cand, &message);
-        LOG(LOG_DEBUG, "Checking hash table for %4.1fs / %4.1fHz [%d]...\n", time_sec, freq_hz, cand->score);
-        int idx_hash = message.hash % kMax_decoded_messages;
-        bool found_empty_slot = false;
-        bool found_duplicate = false;
-        do
+        printf("num_candidates: %i\n", num_candidates);
+        int num_new = 0;
+
+        bool decoded_first[kMax_candidates];
+
+        // Go over candidates and attempt to decode messages. With multi, a second pass retries the remaining
+        // candidates with noncoherent detection over blocks of 2, then 3 symbols. With AP hypotheses, a last pass
+        // retries them knowing parts of the messages we expect.
+        for (int k = 0; k < 3 * num_candidates; ++k)
         {
-            if (decoded_hashtable[idx_hash] == NULL)
+            int pass = k / num_candidates;
+            int idx = k % num_candidates;
+            const ftx_candidate_t* cand = &candidate_list[idx];
+            if (!retry[idx] || ((pass == 1) && !(multi && (wf->cpx != NULL))) || ((pass == 2) && (num_hyps == 0)))
             {
-                LOG(LOG_DEBUG, "Found an empty slot\n");
-                found_empty_slot = true;
+                continue;
             }
-            else if ((decoded_hashtable[idx_hash]->hash == message.hash) && (0 == memcmp(decoded_hashtable[idx_hash]->payload, message.payload, sizeof(message.payload))))
+
+            float freq_hz = (mon->min_bin + cand->freq_offset + (float)cand->freq_sub / wf->freq_osr) / mon->symbol_period;
+            float time_sec = (cand->time_offset + (float)(cand->time_sub + 0.5) / wf->time_osr) * mon->symbol_period;
+
+            ftx_message_t message;
+            ftx_decode_status_t status;
+            bool ok = false;
+            if (pass == 0)
             {
-                LOG(LOG_DEBUG, "Found a duplicate!\n");
-                found_duplicate = true;
+                ok = ftx_decode_candidate(wf, cand, kLDPC_iterations, &message, &status);
+                decoded_first[idx] = ok;
+            }
+            else if (decoded_first[idx] || is_near_decoded(wf, cand, decoded_cands, num_decoded_cands))
+            {
+                continue;
+            }
+            else if (pass == 1)
+            {
+                for (int n_syms = 2; !ok && (n_syms <= 3); ++n_syms)
+                {
+                    ok = ftx_decode_candidate_multi(wf, cand, n_syms, kLDPC_iterations, &message, &status);
+                    if (ok)
+                    {
+                        LOG(LOG_DEBUG, "Decoded with %d-symbol metrics\n", n_syms);
+                    }
+                }
             }
             else
             {
-                LOG(LOG_DEBUG, "Hash table clash!\n");
-                // Move on to check the next entry in hash table
-                idx_hash = (idx_hash + 1) % kMax_decoded_messages;
+                int hyp_idx = ftx_decode_candidate_ap(wf, cand, hyps, num_hyps, kLDPC_iterations, &message, &status);
+                ok = (hyp_idx >= 0);
+                if (ok)
+                {
+                    LOG(LOG_DEBUG, "Decoded with AP hypothesis %d\n", hyp_idx);
+                }
             }
-        } while (!found_empty_slot && !found_duplicate);
-
-        if (found_empty_slot)
-        {
-            // Fill the empty hashtable slot
-            memcpy(&decoded[idx_hash], &message, sizeof(message));
-            decoded_hashtable[idx_hash] = &decoded[idx_hash];
-            ++num_decoded;
-
-            char text[FTX_MAX_MESSAGE_LENGTH];
-            ftx_message_rc_t unpack_status = ftx_message_decode(&message, &hash_if, text);
-            if (unpack_status != FTX_MESSAGE_RC_OK)
+            if (!ok)
             {
-                snprintf(text, sizeof(text), "Error [%d] while unpacking!", (int)unpack_status);
+                if (status.ldpc_errors > 0)
+                {
+                    LOG(LOG_DEBUG, "LDPC decode: %d errors\n", status.ldpc_errors);
+                }
+                else if (status.crc_calculated != status.crc_extracted)
+                {
+                    LOG(LOG_DEBUG, "CRC mismatch!\n");
+                }
+                continue;
+            }
+            if (num_decoded_cands < kMax_candidates)
+            {
+                decoded_cands[num_decoded_cands++] = *cand;
+            }
+            float snr = get_message_snr_and_mute(wf, cand, &message);
+            LOG(LOG_DEBUG, "Checking decoded messages for %4.1fs / %4.1fHz [%d]...\n", time_sec, freq_hz, cand->score);
+            if (ftx_decoded_set_insert(decoded, &message) == FTX_DECODED_DUPLICATE)
+            {
+                LOG(LOG_DEBUG, "Found a duplicate!\n");
             }
+            else
+            {
+                ++num_decoded;
+                ++num_new;
 
-            // Fake WSJT-X-like output for now
-            // snr = cand->score * 0.5f; // TODO: compute better approximation of SNR
-            // snr = get_message_snr(wf, cand, &message);
-            // mute_decoded(wf, cand, &message);
-            printf("%02d%02d%02d %5.0f %4.1f %4.0f ~  %s\n",
-                tm_slot_start->tm_hour, tm_slot_start->tm_min, tm_slot_start->tm_sec,
-                snr, time_sec - 0.65f, freq_hz, text);
+                if (subtract)
+                {
+                    uint8_t tones[FT4_NN]; // enough for either protocol
+                    get_message_tones(wf, &message, tones);
+                    monitor_subtract(mon, cand, tones);
+                }
+
+                char text[FTX_MAX_MESSAGE_LENGTH];
+                ftx_message_rc_t unpack_status = ftx_message_decode(&message, hash_if, text);
+                if (unpack_status != FTX_MESSAGE_RC_OK)
+                {
+                    snprintf(text, sizeof(text), "Error [%d] while unpacking!", (int)unpack_status);
+                }
 
+                // Fake WSJT-X-like output for now
+                printf("%02d%02d%02d %5.0f %4.1f %4.0f ~  %s\n",
+                    tm_slot_start->tm_hour, tm_slot_start->tm_min, tm_slot_start->tm_sec,
+                    snr, time_sec - 0.65f, freq_hz, text);
+            }
+        }
+        LOG(LOG_DEBUG, "Pass %d: %d new messages\n", round + 1, num_new);
+        if (num_new == 0)
+        {
+            break;
         }
     }
     LOG(LOG_INFO, "Decoded %d messages, callsign hashtable size %d\n", num_decoded, hashtable_get_size());
@@ -176,8 +308,15 @@ int main(int argc, char** argv)
     // Accepted arguments
     const char* wav_path = NULL;
     const char* dev_name = NULL;
+    const char* calls_path = NULL;
+    const char* mycall = NULL;
+    const char* dxcall = NULL;
     ftx_protocol_t protocol = FTX_PROTOCOL_FT8;
+    ftx_waterfall_format_t wf_format = FTX_WATERFALL_U8;
+    bool multi = false;
+    bool subtract = false;
     float time_shift = 0.8;
+    int channel = 0;
 
     // Parse arguments one by one
     int arg_idx = 1;
@@ -191,6 +330,18 @@ int main(int argc, char** argv)
             {
                 protocol = FTX_PROTOCOL_FT4;
             }
+            else if (0 == strcmp(argv[arg_idx], "-packed"))
+            {
+                wf_format = FTX_WATERFALL_U4;
+            }
+            else if (0 == strcmp(argv[arg_idx], "-multi"))
+            {
+                multi = true;
+            }
+            else if (0 == strcmp(argv[arg_idx], "-subtract"))
+            {
+                subtract = true;
+            }
             else if (0 == strcmp(argv[arg_idx], "-list"))
             {
                 audio_init();
@@ -210,6 +361,58 @@ int main(int argc, char** argv)
                     return -1;
                 }
             }
+            else if (0 == strcmp(argv[arg_idx], "-channel"))
+            {
+                if (arg_idx + 1 < argc)
+                {
+                    ++arg_idx;
+                    channel = atoi(argv[arg_idx]);
+                }
+                else
+                {
+                    usage("Expected a channel number after -channel");
+                    return -1;
+                }
+            }
+            else if (0 == strcmp(argv[arg_idx], "-calls"))
+            {
+                if (arg_idx + 1 < argc)
+                {
+                    ++arg_idx;
+                    calls_path = argv[arg_idx];
+                }
+                else
+                {
+                    usage("Expected an index file path after -calls");
+                    return -1;
+                }
+            }
+            else if (0 == strcmp(argv[arg_idx], "-mycall"))
+            {
+                if (arg_idx + 1 < argc)
+                {
+                    ++arg_idx;
+                    mycall = argv[arg_idx];
+                }
+                else
+                {
+                    usage("Expected a callsign after -mycall");
+                    return -1;
+                }
+            }
+            else if (0 == strcmp(argv[arg_idx], "-dxcall"))
+            {
+                if (arg_idx + 1 < argc)
+                {
+                    ++arg_idx;
+                    dxcall = argv[arg_idx];
+                }
+                else
+                {
+                    usage("Expected a callsign after -dxcall");
+                    return -1;
+                }
+            }
             else
             {
                 usage("Unknown command line option");
@@ -239,19 +442,22 @@ int main(int argc, char** argv)
 
     float slot_period = ((protocol == FTX_PROTOCOL_FT8) ? FT8_SLOT_TIME : FT4_SLOT_TIME);
     int sample_rate = 12000;
-    int num_samples = slot_period * sample_rate;
-    float signal[num_samples];
+    long num_samples = 0;
     bool is_live = false;
+    wav_reader_t wav = { 0 };
 
     if (wav_path != NULL)
     {
-        int rc = load_wav(signal, &num_samples, &sample_rate, wav_path);
-        if (rc < 0)
+        // The file is mapped and converted block by block as it is fed to the monitor
+        if (!wav_reader_open(&wav, wav_path, channel))
         {
-            LOG(LOG_ERROR, "ERROR: cannot load wave file %s\n", wav_path);
+            LOG(LOG_ERROR, "ERROR: cannot load wave file %s (or channel %d)\n", wav_path, channel);
             return -1;
         }
-        LOG(LOG_INFO, "Sample rate %d Hz, %d samples, %.3f seconds\n", sample_rate, num_samples, (double)num_samples / sample_rate);
+        sample_rate = wav.sample_rate;
+        num_samples = wav.num_samples;
+        LOG(LOG_INFO, "Sample rate %d Hz, %d channel(s) of %d-bit %s, %ld samples, %.3f seconds\n", sample_rate,
+            wav.num_channels, wav.bits_per_sample, wav.is_float ? "float" : "PCM", num_samples, (double)num_samples / sample_rate);
     }
     else if (dev_name != NULL)
     {
@@ -267,15 +473,52 @@ int main(int argc, char** argv)
         .f_min = 200,
         .f_max = 3000,
         .sample_rate = sample_rate,
+        .proc_rate = kProc_rate,
         .time_osr = kTime_osr,
         .freq_osr = kFreq_osr,
-        .protocol = protocol
+        .protocol = protocol,
+        .wf_format = wf_format,
+        .wf_phase = multi,
+        .keep_audio = subtract
     };
 
     hashtable_init(256);
+    ftx_callsign_hash_interface_t* callsign_if = &hash_if;
+
+    // Known callsigns, mapped from the index file
+    mapped_file_t calls_file = { 0 };
+    ftx_callsign_index_t calls_index;
+    callsign_lookup_t calls_lookup = { .heard = &hash_if, .known = &calls_index };
+    ftx_callsign_hash_interface_t calls_if = { .lookup_hash = lookup_heard_or_known, .save_hash = save_heard, .ctx = &calls_lookup };
+    if (calls_path != NULL)
+    {
+        if (!mapped_file_open(&calls_file, calls_path) || !ftx_callsign_index_init(&calls_index, calls_file.data, calls_file.size))
+        {
+            LOG(LOG_ERROR, "ERROR: cannot load callsign index %s\n", calls_path);
+            mapped_file_close(&calls_file);
+            wav_reader_close(&wav);
+            return -1;
+        }
+        LOG(LOG_INFO, "Callsign index %s: %u callsign hashes\n", calls_path, calls_index.num_keys);
+        callsign_if = &calls_if;
+    }
+
+    ftx_ap_hypothesis_t ap_hyps[kMax_ap_hypotheses];
+    int num_ap_hyps = make_ap_hypotheses(mycall, dxcall, ap_hyps);
+
+    // Decoded messages of the current slot (to check for duplicates)
+    ftx_decoded_set_t decoded;
+    if (!ftx_decoded_set_init(&decoded, kMax_decoded_messages, 0))
+    {
+        LOG(LOG_ERROR, "Out of memory\n");
+        mapped_file_close(&calls_file);
+        wav_reader_close(&wav);
+        return -1;
+    }
 
     monitor_init(&mon, &mon_cfg);
     LOG(LOG_DEBUG, "Waterfall allocated %d symbols\n", mon.wf.max_blocks);
+    float* signal = (float*)malloc(mon.input_block_size * sizeof(signal[0]));
 
     do
     {
@@ -291,7 +534,7 @@ int main(int argc, char** argv)
                 double time_within_slot = fmod(time - time_shift, slot_period);
                 if (time_within_slot > slot_period / 4)
                 {
-                    audio_read(signal, mon.block_size);
+                    audio_read(signal, mon.input_block_size);
                 }
                 else
                 {
@@ -304,30 +547,45 @@ int main(int argc, char** argv)
             }
         }
 
-        // Process and accumulate audio data in a monitor/waterfall instance
-        for (int frame_pos = 0; frame_pos + mon.block_size <= num_samples; frame_pos += mon.block_size)
+        // Process and accumulate audio data in a monitor/waterfall instance (a file is read up to the end of the waterfall)
+        for (long frame_pos = 0; (frame_pos + mon.input_block_size <= num_samples) && (mon.wf.num_blocks < mon.wf.max_blocks); frame_pos += mon.input_block_size)
         {
-            if (dev_name != NULL)
+            if (is_live)
+            {
+                audio_read(signal, mon.input_block_size);
+            }
+            else
             {
-                audio_read(signal + frame_pos, mon.block_size);
+                wav_reader_read(&wav, signal, mon.input_block_size);
             }
             // LOG(LOG_DEBUG, "Frame pos: %.3fs\n", (float)(frame_pos + mon.block_size) / sample_rate);
             fprintf(stderr, "#");
             // Process the waveform data frame by frame - you could have a live loop here with data from an audio device
-            monitor_process(&mon, signal + frame_pos);
+            monitor_feed(&mon, signal, mon.input_block_size);
         }
         fprintf(stderr, "\n");
         LOG(LOG_DEBUG, "Waterfall accumulated %d symbols\n", mon.wf.num_blocks);
         LOG(LOG_INFO, "Max magnitude: %.1f dB\n", mon.max_mag);
 
+        // A recorded slot is complete: replace the streaming noise floor by the exact median over the slot
+        if (!is_live)
+        {
+            ftx_waterfall_update_noise(&mon.wf);
+        }
+
         // Decode accumulated data (containing slightly less than a full time slot)
-        decode(&mon, &tm_slot_start);
+        decode(&mon, &tm_slot_start, multi, ap_hyps, num_ap_hyps, &decoded, callsign_if);
+        ftx_decoded_set_next_slot(&decoded);
 
         // Reset internal variables for the next time slot
         monitor_reset(&mon);
     } while (is_live);
 
+    mapped_file_close(&calls_file);
+    wav_reader_close(&wav);
+    ftx_decoded_set_free(&decoded);
     monitor_free(&mon);
+    free(signal);
 
     return 0;
 }
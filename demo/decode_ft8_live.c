@@ -10,11 +10,13 @@
 #include <ft8/encode.h>
 #include <ft8/message.h>
 #include <ft8/hashtable.h>
+#include <ft8/dedup.h>
 
 #include <common/common.h>
 #include <common/wave.h>
 #include <common/monitor.h>
 #include <common/audio.h>
+#include <common/callsign_store.h>
 
 #define LOG_LEVEL LOG_INFO
 #include <ft8/debug.h>
@@ -23,11 +25,17 @@ const int kMin_score = 10; // Minimum sync score threshold for candidates
 const int kMax_candidates = 200;
 const int kLDPC_iterations = 25;
 
-const int kMax_decoded_messages = 50;
+const int kMax_decoded_messages = 64; // Initial size of the decoded message set (it grows as needed)
+
+const int kCallsign_cache_size = 65536;                  // Capacity of a new callsign cache file
+const int64_t kCallsign_cache_max_age = 30 * 24 * 3600; // Callsigns not heard for this long are dropped when the cache fills up
 
 const int kFreq_osr = 2; // Frequency oversampling rate (bin subdivision)
 const int kTime_osr = 4; // Time oversampling rate (symbol subdivision)
 
+const int kProc_rate = 12000;       // Internal processing rate, input at other rates is resampled
+const int kMax_sample_rate = 48000; // Highest supported input sample rate (WAV files)
+
 
 static int get_message_snr(const ftx_waterfall_t* wf, const ftx_candidate_t *candidate, ftx_message_t *msg) {
     uint8_t n_tones = (wf->protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
@@ -41,27 +49,15 @@ static int get_message_snr(const ftx_waterfall_t* wf, const ftx_candidate_t *can
     return ftx_get_snr(wf, candidate, tones, n_tones);
 }
 
-static int get_message_snr_and_mute(ftx_waterfall_t* wf, const ftx_candidate_t *candidate, ftx_message_t *msg) {
-    uint8_t n_tones = (wf->protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
-    uint8_t tones[n_tones];
-
-    if (wf->protocol == FTX_PROTOCOL_FT4) {
-        ft4_encode(msg->payload, tones);
-    } else {
-        ft8_encode(msg->payload, tones);
-    }
-    return ftx_get_snr_and_mute(wf, candidate, tones, n_tones);
-}
-
-
 void usage(const char* error_msg)
 {
     if (error_msg != NULL)
     {
         fprintf(stderr, "ERROR: %s\n", error_msg);
     }
-    fprintf(stderr, "Usage: decode_ft8 [-list|([-ft4] [INPUT|-dev DEVICE])]\n\n");
+    fprintf(stderr, "Usage: decode_ft8 [-list|([-ft4] [-cache FILE] [INPUT|-dev DEVICE])]\n\n");
     fprintf(stderr, "Decode a 15-second (or slighly shorter) WAV file.\n");
+    fprintf(stderr, "With -cache, hashed callsigns are resolved from (and saved to) a persistent callsign cache file.\n");
 }
 
 int find_candidates(const monitor_t* mon, ftx_candidate_t *candidate_list, int maxCandidates) {
@@ -69,7 +65,7 @@ int find_candidates(const monitor_t* mon, ftx_candidate_t *candidate_list, int m
     return ftx_find_candidates(wf, maxCandidates, candidate_list, kMin_score);
 }
 
-int decode_messages(const monitor_t* mon, int *num_candidates, ftx_candidate_t *candidate_list, ftx_message_t *decoded, ftx_message_t **decoded_hashtable, int ldpc_iterations, struct tm* tm_slot_start) {
+int decode_messages(const monitor_t* mon, int *num_candidates, ftx_candidate_t *candidate_list, ftx_decoded_set_t* decoded, ftx_callsign_hash_interface_t* hash_if, int ldpc_iterations, struct tm* tm_slot_start) {
     // Go over candidates and attempt to decode messages
     const ftx_waterfall_t* wf = &mon->wf;
     int to_delete_idx[*num_candidates];
@@ -105,38 +101,15 @@ int decode_messages(const monitor_t* mon, int *num_candidates, ftx_candidate_t *
         float freq_hz = (mon->min_bin + cand->freq_offset + (float)cand->freq_sub / wf->freq_osr) / mon->symbol_period;
         float time_sec = (cand->time_offset + (float)cand->time_sub / wf->time_osr) * mon->symbol_period;
 
-        LOG(LOG_DEBUG, "Checking hash table for %4.1fs / %4.1fHz [%d]...\n", time_sec, freq_hz, cand->score);
-        int idx_hash = message.hash % kMax_decoded_messages;
-        bool found_empty_slot = false;
-        bool found_duplicate = false;
-        do
+        LOG(LOG_DEBUG, "Checking decoded messages for %4.1fs / %4.1fHz [%d]...\n", time_sec, freq_hz, cand->score);
+        if (ftx_decoded_set_insert(decoded, &message) == FTX_DECODED_DUPLICATE)
         {
-            if (decoded_hashtable[idx_hash] == NULL)
-            {
-                LOG(LOG_DEBUG, "Found an empty slot\n");
-                found_empty_slot = true;
-            }
-            else if ((decoded_hashtable[idx_hash]->hash == message.hash) && (0 == memcmp(decoded_hashtable[idx_hash]->payload, message.payload, sizeof(message.payload))))
-            {
-                LOG(LOG_DEBUG, "Found a duplicate!\n");
-                found_duplicate = true;
-            }
-            else
-            {
-                LOG(LOG_DEBUG, "Hash table clash!\n");
-                // Move on to check the next entry in hash table
-                idx_hash = (idx_hash + 1) % kMax_decoded_messages;
-            }
-        } while (!found_empty_slot && !found_duplicate);
-
-        if (found_empty_slot)
+            LOG(LOG_DEBUG, "Found a duplicate!\n");
+        }
+        else
         {
-            // Fill the empty hashtable slot
-            memcpy(&decoded[idx_hash], &message, sizeof(message));
-            decoded_hashtable[idx_hash] = &decoded[idx_hash];
-
             char text[FTX_MAX_MESSAGE_LENGTH];
-            ftx_message_rc_t unpack_status = ftx_message_decode(&message, &hash_if, text);
+            ftx_message_rc_t unpack_status = ftx_message_decode(&message, hash_if, text);
             if (unpack_status != FTX_MESSAGE_RC_OK)
             {
                 snprintf(text, sizeof(text), "Error [%d] while unpacking!", (int)unpack_status);
@@ -159,6 +132,7 @@ int main(int argc, char** argv)
     // Accepted arguments
     const char* wav_path = NULL;
     const char* dev_name = NULL;
+    const char* cache_path = NULL;
     ftx_protocol_t protocol = FTX_PROTOCOL_FT8;
     float time_shift = 0.8;
 
@@ -193,6 +167,19 @@ int main(int argc, char** argv)
                     return -1;
                 }
             }
+            else if (0 == strcmp(argv[arg_idx], "-cache"))
+            {
+                if (arg_idx + 1 < argc)
+                {
+                    ++arg_idx;
+                    cache_path = argv[arg_idx];
+                }
+                else
+                {
+                    usage("Expected a file path after -cache");
+                    return -1;
+                }
+            }
             else
             {
                 usage("Unknown command line option");
@@ -222,15 +209,13 @@ int main(int argc, char** argv)
 
     float slot_period = ((protocol == FTX_PROTOCOL_FT8) ? FT8_SLOT_TIME : FT4_SLOT_TIME);
     int sample_rate = 12000;
-    int num_samples = slot_period * sample_rate;
-    float signal[num_samples];
+    int num_samples = slot_period * kMax_sample_rate;
+    float* signal = (float*)malloc(num_samples * sizeof(signal[0]));
 
     int decode_block_stride = 2;
     int early_ldpc_iterations = 25;
     float find_candidates_at_frac = ((FT8_NN - FT8_LENGTH_SYNC - 5) * FT8_SYMBOL_PERIOD) / FT8_SLOT_TIME;
     printf("find_candidates_at_frac: %f\n", find_candidates_at_frac);
-    int find_candidates_at = (float)num_samples * find_candidates_at_frac;
-    int num_decoded = 0;
     bool is_live = false;
 
     if (wav_path != NULL)
@@ -239,6 +224,7 @@ int main(int argc, char** argv)
         if (rc < 0)
         {
             LOG(LOG_ERROR, "ERROR: cannot load wave file %s\n", wav_path);
+            free(signal);
             return -1;
         }
         LOG(LOG_INFO, "Sample rate %d Hz, %d samples, %.3f seconds\n", sample_rate, num_samples, (double)num_samples / sample_rate);
@@ -257,12 +243,42 @@ int main(int argc, char** argv)
         .f_min = 200,
         .f_max = 3000,
         .sample_rate = sample_rate,
+        .proc_rate = kProc_rate,
         .time_osr = kTime_osr,
         .freq_osr = kFreq_osr,
         .protocol = protocol
     };
 
     hashtable_init(256);
+    ftx_callsign_hash_interface_t* callsign_if = &hash_if;
+
+    // Persistent callsign cache, used instead of the in-memory table
+    callsign_store_t callsign_store;
+    ftx_callsign_hash_interface_t callsign_store_if;
+    if (cache_path != NULL)
+    {
+        if (!callsign_store_open(&callsign_store, cache_path, kCallsign_cache_size))
+        {
+            free(signal);
+            return -1;
+        }
+        LOG(LOG_INFO, "Callsign cache %s: %d callsigns\n", cache_path, callsign_store_size(&callsign_store));
+        callsign_store_interface(&callsign_store, &callsign_store_if);
+        callsign_if = &callsign_store_if;
+    }
+
+    // Decoded messages of the current slot (to check for duplicates between the early and the final decodes)
+    ftx_decoded_set_t decoded;
+    if (!ftx_decoded_set_init(&decoded, kMax_decoded_messages, 0))
+    {
+        LOG(LOG_ERROR, "Out of memory\n");
+        if (cache_path != NULL)
+        {
+            callsign_store_close(&callsign_store);
+        }
+        free(signal);
+        return -1;
+    }
 
     monitor_init(&mon, &mon_cfg);
     LOG(LOG_DEBUG, "Waterfall allocated %d symbols\n", mon.wf.max_blocks);
@@ -281,7 +297,7 @@ int main(int argc, char** argv)
                 double time_within_slot = fmod(time - time_shift, slot_period);
                 if (time_within_slot > slot_period / 4)
                 {
-                    audio_read(signal, mon.block_size);
+                    audio_read(signal, mon.input_block_size);
                 }
                 else
                 {
@@ -296,37 +312,27 @@ int main(int argc, char** argv)
 
         ftx_candidate_t candidate_list[kMax_candidates];
         int num_candidates = 0;
-
-        // Hash table for decoded messages (to check for duplicates)
         int num_decoded = 0;
-        ftx_message_t decoded[kMax_decoded_messages];
-        ftx_message_t* decoded_hashtable[kMax_decoded_messages];
-
-        // Initialize hash table pointers
-        for (int i = 0; i < kMax_decoded_messages; ++i)
-        {
-            decoded_hashtable[i] = NULL;
-        }
 
         // Process and accumulate audio data in a monitor/waterfall instance
         int block_n = 0;
-        for (int frame_pos = 0; frame_pos + mon.block_size <= num_samples; frame_pos += mon.block_size)
+        for (int frame_pos = 0; frame_pos + mon.input_block_size <= num_samples; frame_pos += mon.input_block_size)
         {
             block_n = (block_n + 1) % decode_block_stride;
             if (dev_name != NULL)
             {
-                audio_read(signal + frame_pos, mon.block_size);
+                audio_read(signal + frame_pos, mon.input_block_size);
             }
             // LOG(LOG_DEBUG, "Frame pos: %.3fs\n", (float)(frame_pos + mon.block_size) / sample_rate);
             // fprintf(stderr, "#");
             // Process the waveform data frame by frame - you could have a live loop here with data from an audio device
-            monitor_process(&mon, signal + frame_pos);
+            monitor_feed(&mon, signal + frame_pos, mon.input_block_size);
 
             if (mon.wf.num_blocks > 79-7) {
                 if (num_candidates == 0) {
                     num_candidates = find_candidates(&mon, candidate_list, kMax_candidates);
                 } else if (block_n == 0) {
-                    int early_decoded = decode_messages(&mon, &num_candidates, candidate_list, decoded, decoded_hashtable, early_ldpc_iterations, &tm_slot_start);
+                    int early_decoded = decode_messages(&mon, &num_candidates, candidate_list, &decoded, callsign_if, early_ldpc_iterations, &tm_slot_start);
                     num_decoded += early_decoded;
                     // printf("early decoded: %i\n", early_decoded);
                 }
@@ -334,18 +340,40 @@ int main(int argc, char** argv)
         }
         // printf("early decode end===============\n");
         // printf("Early decoded: %i\n", num_decoded);
-        num_decoded += decode_messages(&mon, &num_candidates, candidate_list, decoded, decoded_hashtable, kLDPC_iterations, &tm_slot_start);
+        num_decoded += decode_messages(&mon, &num_candidates, candidate_list, &decoded, callsign_if, kLDPC_iterations, &tm_slot_start);
         fprintf(stderr, "\n");
         LOG(LOG_DEBUG, "Waterfall accumulated %d symbols\n", mon.wf.num_blocks);
         LOG(LOG_INFO, "Max magnitude: %.1f dB\n", mon.max_mag);
 
-        LOG(LOG_INFO, "Decoded %d messages, callsign hashtable size %d\n", num_decoded, hashtable_get_size());
-        hashtable_cleanup(10);
+        if (cache_path != NULL)
+        {
+            LOG(LOG_INFO, "Decoded %d messages, callsign cache size %d\n", num_decoded, callsign_store_size(&callsign_store));
+            // Drop the callsigns not heard for a while, sooner if the cache is still too full
+            int64_t max_age = kCallsign_cache_max_age;
+            while ((4 * callsign_store_size(&callsign_store) > 3 * callsign_store.capacity) && (max_age > 0))
+            {
+                if (!callsign_store_compact(&callsign_store, (int64_t)time(NULL) - max_age))
+                    break;
+                max_age /= 2;
+            }
+        }
+        else
+        {
+            LOG(LOG_INFO, "Decoded %d messages, callsign hashtable size %d\n", num_decoded, hashtable_get_size());
+            hashtable_cleanup(10);
+        }
         // Reset internal variables for the next time slot
+        ftx_decoded_set_next_slot(&decoded);
         monitor_reset(&mon);
     } while (is_live);
 
+    if (cache_path != NULL)
+    {
+        callsign_store_close(&callsign_store);
+    }
+    ftx_decoded_set_free(&decoded);
     monitor_free(&mon);
+    free(signal);
 
     return 0;
 }
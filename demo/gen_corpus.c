@@ -0,0 +1,444 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common/common.h"
+#include "common/wave.h"
+#include "common/channel.h"
+#include "ft8/message.h"
+#include "ft8/encode.h"
+#include "ft8/constants.h"
+
+#define LOG_LEVEL LOG_INFO
+#include "ft8/debug.h"
+
+#define MAX_SIGNALS 200
+
+// Noise level of the generated slots: its standard deviation at full scale (1.0), low enough that a few dozen
+// strong signals rarely clip in 16 bits
+#define NOISE_RMS 0.02f
+
+// WSJT-X reports the SNR against the noise power in a 2500 Hz bandwidth
+#define SNR_BANDWIDTH 2500.0f
+
+/// Settings of a corpus
+typedef struct
+{
+    ftx_protocol_t protocol;
+    int num_slots;
+    int num_signals;
+    uint64_t seed;
+    float snr_min, snr_max;   ///< SNR range (dB in 2500 Hz)
+    float dt_min, dt_max;     ///< Range of the start time relative to 0.5 s into the slot, seconds
+    float freq_min, freq_max; ///< Range of the base frequency (tone 0), Hertz
+    bool raw;                 ///< Write raw float samples instead of WAV files
+    bool use_channel;         ///< Pass every signal through its own realization of the channel
+    channel_config_t channel; ///< Channel impairments (the seed is drawn per signal)
+} corpus_config_t;
+
+/// Ground truth of one generated signal
+typedef struct
+{
+    char text[FTX_MAX_MESSAGE_LENGTH];
+    int snr;
+    float dt;
+    float freq;
+} corpus_signal_t;
+
+void usage(const char* error_msg)
+{
+    if (error_msg != NULL)
+    {
+        fprintf(stderr, "ERROR: %s\n", error_msg);
+    }
+    printf("Generate slots of simultaneous FT8/FT4 signals with random messages, frequencies, time offsets and SNRs\n");
+    printf("in white Gaussian noise, each with a ground truth .txt file in the format of utils/run_tests.py.\n");
+    printf("Usage:\n");
+    printf("\n");
+    printf("gen_corpus OUT_DIR [-ft4] [-slots N] [-signals N] [-seed N] [-snr MIN MAX] [-dt MIN MAX] [-freq MIN MAX] [-raw]\n");
+    printf("           [-spread HZ] [-delay MS] [-drift HZ_PER_S] [-ppm PPM]\n");
+    printf("\n");
+    printf("Defaults: 100 slots of 20 signals, seed 1, SNR -20..0 dB, DT -0.5..1.5 s, frequency 200..2800 Hz.\n");
+    printf("The slots are 12000 Hz WAV files OUT_DIR/slot_NNNNNN.wav, or with -raw native 32-bit floats (.raw).\n");
+    printf("A slot depends only on the settings, the seed and its index.\n");
+    printf("The channel options (as in gen_ft8) pass every signal through its own fading realization.\n");
+}
+
+/// SplitMix64 generator: fast, seedable with any value and good enough for test signals
+static uint64_t rng_next(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/// Uniform in [0, 1)
+static float rng_uniform(uint64_t* state)
+{
+    return (rng_next(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+static int rng_int(uint64_t* state, int n)
+{
+    return (int)((rng_next(state) >> 33) % (uint64_t)n);
+}
+
+/// Fill signal with Gaussian noise of the given standard deviation (Box-Muller, two samples per pair of uniforms)
+static void add_noise(uint64_t* state, float* signal, int num_samples, float sigma)
+{
+    for (int i = 0; i < num_samples; i += 2)
+    {
+        float u1 = 1.0f - rng_uniform(state); // (0, 1]
+        float u2 = rng_uniform(state);
+        float r = sigma * sqrtf(-2.0f * logf(u1));
+        signal[i] = r * cosf(2 * (float)M_PI * u2);
+        if (i + 1 < num_samples)
+            signal[i + 1] = r * sinf(2 * (float)M_PI * u2);
+    }
+}
+
+/// Random standard callsign: a one or two letter prefix, a digit and a one to three letter suffix
+static void make_callsign(uint64_t* state, char* callsign)
+{
+    // No Q first: with a letter after it, it is transmitted as the prefix 3X
+    const char* first = "ABCDEFGHIJKLMNOPRSTUVWXYZ";
+    const char* letters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    int n = 0;
+    callsign[n++] = first[rng_int(state, 25)];
+    if (rng_int(state, 2))
+        callsign[n++] = letters[rng_int(state, 26)];
+    callsign[n++] = '0' + rng_int(state, 10);
+    int suffix_length = 1 + rng_int(state, 3);
+    for (int i = 0; i < suffix_length; ++i)
+    {
+        callsign[n++] = letters[rng_int(state, 26)];
+    }
+    callsign[n] = '\0';
+}
+
+/// Random 4 character grid locator (but not RR73, which is the acknowledgement)
+static void make_grid(uint64_t* state, char* grid)
+{
+    do
+    {
+        grid[0] = 'A' + rng_int(state, 18);
+        grid[1] = 'A' + rng_int(state, 18);
+        grid[2] = '0' + rng_int(state, 10);
+        grid[3] = '0' + rng_int(state, 10);
+        grid[4] = '\0';
+    } while (0 == strcmp(grid, "RR73"));
+}
+
+/// Random message of a typical QSO: CQs, replies with a grid, signal reports and acknowledgements
+static void make_message(uint64_t* state, char* text)
+{
+    char call_to[12];
+    char call_de[12];
+    char grid[5];
+    make_callsign(state, call_to);
+    make_callsign(state, call_de);
+    int kind = rng_int(state, 20);
+    int report = rng_int(state, 51) - 30; // -30..+20
+    if (kind < 8)
+    {
+        make_grid(state, grid);
+        sprintf(text, "CQ %s %s", call_de, grid);
+    }
+    else if (kind < 12)
+    {
+        make_grid(state, grid);
+        sprintf(text, "%s %s %s", call_to, call_de, grid);
+    }
+    else if (kind < 15)
+        sprintf(text, "%s %s %+03d", call_to, call_de, report);
+    else if (kind < 17)
+        sprintf(text, "%s %s R%+03d", call_to, call_de, report);
+    else if (kind < 19)
+        sprintf(text, "%s %s RR73", call_to, call_de);
+    else
+        sprintf(text, "%s %s 73", call_to, call_de);
+}
+
+/// Generate one slot into signal (slot_samples samples at sample_rate), returning the ground truth of its signals.
+/// The scratch buffer holds a message, or with a channel two slots.
+static void make_slot(const corpus_config_t* cfg, int slot_idx, ftx_encoder_t* enc, channel_t* channel, float* signal,
+    int slot_samples, float* scratch, corpus_signal_t* truth)
+{
+    const int sample_rate = enc->signal_rate;
+    const int num_tones = enc->num_tones;
+    uint64_t key = cfg->seed ^ ((uint64_t)slot_idx * 0xD1B54A32D192ED03ull);
+    uint64_t state = rng_next(&key);
+
+    uint8_t payloads[MAX_SIGNALS * FTX_PAYLOAD_LENGTH_BYTES];
+    uint8_t tones[MAX_SIGNALS * FT4_NN];
+    for (int i = 0; i < cfg->num_signals; ++i)
+    {
+        ftx_message_t msg;
+        do
+        {
+            make_message(&state, truth[i].text);
+        } while (ftx_message_encode(&msg, NULL, truth[i].text) != FTX_MESSAGE_RC_OK);
+        memcpy(payloads + i * FTX_PAYLOAD_LENGTH_BYTES, msg.payload, FTX_PAYLOAD_LENGTH_BYTES);
+        truth[i].snr = (int)lrintf(cfg->snr_min + (cfg->snr_max - cfg->snr_min) * rng_uniform(&state));
+        truth[i].dt = cfg->dt_min + (cfg->dt_max - cfg->dt_min) * rng_uniform(&state);
+        truth[i].freq = cfg->freq_min + (cfg->freq_max - cfg->freq_min) * rng_uniform(&state);
+    }
+    if (cfg->protocol == FTX_PROTOCOL_FT4)
+        ft4_encode_many(payloads, cfg->num_signals, tones);
+    else
+        ft8_encode_many(payloads, cfg->num_signals, tones);
+
+    add_noise(&state, signal, slot_samples, NOISE_RMS);
+
+    // A sinusoid of amplitude A has the power A^2 / 2; the noise power in the SNR bandwidth is its share of the band
+    const float noise_power = NOISE_RMS * NOISE_RMS * SNR_BANDWIDTH / (sample_rate / 2);
+    for (int i = 0; i < cfg->num_signals; ++i)
+    {
+        float amplitude = sqrtf(2 * noise_power * powf(10.0f, truth[i].snr / 10.0f));
+        int start = (int)lrintf((0.5f + truth[i].dt) * sample_rate);
+        ftx_encoder_set_tones(enc, tones + i * num_tones, truth[i].freq);
+        if (channel == NULL)
+        {
+            int n_wave = ftx_encoder_generate(enc, scratch, enc->num_samples);
+            for (int k = (start < 0) ? -start : 0; (k < n_wave) && (start + k < slot_samples); ++k)
+            {
+                signal[start + k] += amplitude * scratch[k];
+            }
+            continue;
+        }
+
+        // Synthesize the slot early by the latency of the channel, so that its output starts on time
+        float* clean = scratch;
+        float* faded = scratch + slot_samples;
+        memset(clean, 0, slot_samples * sizeof(float));
+        start -= channel->latency;
+        int n_wave = ftx_encoder_generate(enc, faded, enc->num_samples);
+        for (int k = (start < 0) ? -start : 0; (k < n_wave) && (start + k < slot_samples); ++k)
+        {
+            clean[start + k] = faded[k];
+        }
+        channel_reset(channel, rng_next(&state));
+        int num_out = channel_process(channel, clean, slot_samples, NULL, faded, slot_samples);
+        for (int k = 0; k < num_out; ++k)
+        {
+            signal[k] += amplitude * faded[k];
+        }
+    }
+}
+
+static bool write_slot(const corpus_config_t* cfg, const char* out_dir, int slot_idx, const float* signal,
+    int slot_samples, int sample_rate, const corpus_signal_t* truth)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/slot_%06d.%s", out_dir, slot_idx, cfg->raw ? "raw" : "wav");
+    if (cfg->raw)
+    {
+        FILE* f = fopen(path, "wb");
+        bool ok = (f != NULL) && (1 == fwrite(signal, slot_samples * sizeof(float), 1, f));
+        if ((f == NULL) || (0 != fclose(f)) || !ok)
+            return false;
+    }
+    else if (0 != save_wav(signal, slot_samples, sample_rate, path))
+    {
+        return false;
+    }
+
+    // Same columns as the decoders print (and run_tests.py parses): time, SNR, DT, frequency, ~, message
+    snprintf(path, sizeof(path), "%s/slot_%06d.txt", out_dir, slot_idx);
+    FILE* f = fopen(path, "w");
+    if (f == NULL)
+        return false;
+    for (int i = 0; i < cfg->num_signals; ++i)
+    {
+        fprintf(f, "000000 %3d %4.1f %4d ~  %s\n", truth[i].snr, truth[i].dt, (int)lrintf(truth[i].freq), truth[i].text);
+    }
+    return 0 == fclose(f);
+}
+
+static bool parse_range(int argc, char** argv, int* arg_idx, float* min, float* max)
+{
+    if (*arg_idx + 2 >= argc)
+        return false;
+    *min = atof(argv[*arg_idx + 1]);
+    *max = atof(argv[*arg_idx + 2]);
+    *arg_idx += 2;
+    return *min <= *max;
+}
+
+int main(int argc, char** argv)
+{
+    // Accepted arguments
+    const char* out_dir = NULL;
+    corpus_config_t cfg = {
+        .protocol = FTX_PROTOCOL_FT8,
+        .num_slots = 100,
+        .num_signals = 20,
+        .seed = 1,
+        .snr_min = -20,
+        .snr_max = 0,
+        .dt_min = -0.5f,
+        .dt_max = 1.5f,
+        .freq_min = 200,
+        .freq_max = 2800,
+        .raw = false
+    };
+
+    // Parse arguments one by one
+    int arg_idx = 1;
+    while (arg_idx < argc)
+    {
+        // Check if the current argument is an option (-xxx)
+        if (argv[arg_idx][0] == '-')
+        {
+            // Check agaist valid options
+            if (0 == strcmp(argv[arg_idx], "-ft4"))
+            {
+                cfg.protocol = FTX_PROTOCOL_FT4;
+            }
+            else if (0 == strcmp(argv[arg_idx], "-raw"))
+            {
+                cfg.raw = true;
+            }
+            else if ((0 == strcmp(argv[arg_idx], "-slots")) || (0 == strcmp(argv[arg_idx], "-signals")) || (0 == strcmp(argv[arg_idx], "-seed")))
+            {
+                if (arg_idx + 1 >= argc)
+                {
+                    usage("Expected a number after -slots, -signals or -seed");
+                    return -1;
+                }
+                if (0 == strcmp(argv[arg_idx], "-slots"))
+                    cfg.num_slots = atoi(argv[arg_idx + 1]);
+                else if (0 == strcmp(argv[arg_idx], "-signals"))
+                    cfg.num_signals = atoi(argv[arg_idx + 1]);
+                else
+                    cfg.seed = strtoull(argv[arg_idx + 1], NULL, 10);
+                ++arg_idx;
+            }
+            else if (0 == strcmp(argv[arg_idx], "-snr"))
+            {
+                if (!parse_range(argc, argv, &arg_idx, &cfg.snr_min, &cfg.snr_max))
+                {
+                    usage("Expected MIN MAX after -snr");
+                    return -1;
+                }
+            }
+            else if (0 == strcmp(argv[arg_idx], "-dt"))
+            {
+                if (!parse_range(argc, argv, &arg_idx, &cfg.dt_min, &cfg.dt_max))
+                {
+                    usage("Expected MIN MAX after -dt");
+                    return -1;
+                }
+            }
+            else if ((0 == strcmp(argv[arg_idx], "-spread")) || (0 == strcmp(argv[arg_idx], "-delay")) || (0 == strcmp(argv[arg_idx], "-drift")) || (0 == strcmp(argv[arg_idx], "-ppm")))
+            {
+                if (arg_idx + 1 >= argc)
+                {
+                    usage("Expected a value after -spread, -delay, -drift or -ppm");
+                    return -1;
+                }
+                float value = atof(argv[arg_idx + 1]);
+                if (0 == strcmp(argv[arg_idx], "-spread"))
+                    cfg.channel.doppler_spread = value;
+                else if (0 == strcmp(argv[arg_idx], "-delay"))
+                    cfg.channel.delay_spread = value;
+                else if (0 == strcmp(argv[arg_idx], "-drift"))
+                    cfg.channel.drift = value;
+                else
+                    cfg.channel.clock_ppm = value;
+                cfg.use_channel = true;
+                ++arg_idx;
+            }
+            else if (0 == strcmp(argv[arg_idx], "-freq"))
+            {
+                if (!parse_range(argc, argv, &arg_idx, &cfg.freq_min, &cfg.freq_max))
+                {
+                    usage("Expected MIN MAX after -freq");
+                    return -1;
+                }
+            }
+            else
+            {
+                usage("Unknown command line option");
+                return -1;
+            }
+        }
+        else
+        {
+            if (out_dir == NULL)
+            {
+                out_dir = argv[arg_idx];
+            }
+            else
+            {
+                usage("Multiple output directories specified");
+                return -1;
+            }
+        }
+        ++arg_idx;
+    }
+
+    if (out_dir == NULL)
+    {
+        usage("Expected an output directory");
+        return -1;
+    }
+    if ((cfg.num_signals < 1) || (cfg.num_signals > MAX_SIGNALS))
+    {
+        usage("The number of signals must be from 1 to 200");
+        return -1;
+    }
+
+    const int sample_rate = 12000;
+    const float slot_time = (cfg.protocol == FTX_PROTOCOL_FT4) ? FT4_SLOT_TIME : FT8_SLOT_TIME;
+    const int slot_samples = (int)(0.5f + slot_time * sample_rate);
+    ftx_encoder_t enc;
+    if (!ftx_encoder_init(&enc, cfg.protocol, sample_rate))
+    {
+        LOG(LOG_ERROR, "Out of memory\n");
+        return -1;
+    }
+    channel_t channel;
+    if (cfg.use_channel)
+    {
+        cfg.channel.sample_rate = sample_rate;
+        channel_init(&channel, &cfg.channel);
+    }
+    float* signal = (float*)malloc(slot_samples * sizeof(float));
+    float* scratch = (float*)malloc((cfg.use_channel ? 2 * slot_samples : enc.num_samples) * sizeof(float));
+    corpus_signal_t* truth = (corpus_signal_t*)malloc(cfg.num_signals * sizeof(corpus_signal_t));
+    if ((signal == NULL) || (scratch == NULL) || (truth == NULL))
+    {
+        LOG(LOG_ERROR, "Out of memory\n");
+        return -1;
+    }
+
+    clock_t t0 = clock();
+    for (int slot_idx = 0; slot_idx < cfg.num_slots; ++slot_idx)
+    {
+        make_slot(&cfg, slot_idx, &enc, cfg.use_channel ? &channel : NULL, signal, slot_samples, scratch, truth);
+        if (!write_slot(&cfg, out_dir, slot_idx, signal, slot_samples, sample_rate, truth))
+        {
+            LOG(LOG_ERROR, "Cannot write slot %d to %s\n", slot_idx, out_dir);
+            return -1;
+        }
+    }
+    float dt = (float)(clock() - t0) / CLOCKS_PER_SEC;
+    printf("%d slots of %d signals in %.2f s (%.0f slots per minute)\n", cfg.num_slots, cfg.num_signals, dt,
+        (dt > 0) ? 60 * cfg.num_slots / dt : 0.0f);
+
+    if (cfg.use_channel)
+    {
+        channel_free(&channel);
+    }
+    ftx_encoder_free(&enc);
+    free(truth);
+    free(scratch);
+    free(signal);
+    return 0;
+}
@@ -6,6 +6,7 @@
 
 #include "common/common.h"
 #include "common/wave.h"
+#include "common/channel.h"
 #include "ft8/message.h"
 #include "ft8/encode.h"
 #include "ft8/constants.h"
@@ -13,121 +14,90 @@
 #define LOG_LEVEL LOG_INFO
 #include "ft8/debug.h"
 
-#define FT8_SYMBOL_BT 2.0f ///< symbol smoothing filter bandwidth factor (BT)
-#define FT4_SYMBOL_BT 1.0f ///< symbol smoothing filter bandwidth factor (BT)
-
-#define GFSK_CONST_K 5.336446f ///< == pi * sqrt(2 / log(2))
-
-/// Computes a GFSK smoothing pulse.
-/// The pulse is theoretically infinitely long, however, here it's truncated at 3 times the symbol length.
-/// This means the pulse array has to have space for 3*n_spsym elements.
-/// @param[in] n_spsym Number of samples per symbol
-/// @param[in] b Shape parameter (values defined for FT8/FT4)
-/// @param[out] pulse Output array of pulse samples
-///
-void gfsk_pulse(int n_spsym, float symbol_bt, float* pulse)
-{
-    for (int i = 0; i < 3 * n_spsym; ++i)
-    {
-        float t = i / (float)n_spsym - 1.5f;
-        float arg1 = GFSK_CONST_K * symbol_bt * (t + 0.5f);
-        float arg2 = GFSK_CONST_K * symbol_bt * (t - 0.5f);
-        pulse[i] = (erff(arg1) - erff(arg2)) / 2;
-    }
-}
-
-/// Synthesize waveform data using GFSK phase shaping.
-/// The output waveform will contain n_sym symbols.
-/// @param[in] symbols Array of symbols (tones) (0-7 for FT8)
-/// @param[in] n_sym Number of symbols in the symbol array
-/// @param[in] f0 Audio frequency in Hertz for the symbol 0 (base frequency)
-/// @param[in] symbol_bt Symbol smoothing filter bandwidth (2 for FT8, 1 for FT4)
-/// @param[in] symbol_period Symbol period (duration), seconds
-/// @param[in] signal_rate Sample rate of synthesized signal, Hertz
-/// @param[out] signal Output array of signal waveform samples (should have space for n_sym*n_spsym samples)
-///
-void synth_gfsk(const uint8_t* symbols, int n_sym, float f0, float symbol_bt, float symbol_period, int signal_rate, float* signal)
+void usage(const char* error_msg)
 {
-    int n_spsym = (int)(0.5f + signal_rate * symbol_period); // Samples per symbol
-    int n_wave = n_sym * n_spsym;                            // Number of output samples
-    float hmod = 1.0f;
-
-    LOG(LOG_DEBUG, "n_spsym = %d\n", n_spsym);
-    // Compute the smoothed frequency waveform.
-    // Length = (nsym+2)*n_spsym samples, first and last symbols extended
-    float dphi_peak = 2 * M_PI * hmod / n_spsym;
-    float dphi[n_wave + 2 * n_spsym];
-
-    // Shift frequency up by f0
-    for (int i = 0; i < n_wave + 2 * n_spsym; ++i)
-    {
-        dphi[i] = 2 * M_PI * f0 / signal_rate;
-    }
-
-    float pulse[3 * n_spsym];
-    gfsk_pulse(n_spsym, symbol_bt, pulse);
-
-    for (int i = 0; i < n_sym; ++i)
-    {
-        int ib = i * n_spsym;
-        for (int j = 0; j < 3 * n_spsym; ++j)
-        {
-            dphi[j + ib] += dphi_peak * symbols[i] * pulse[j];
-        }
-    }
-
-    // Add dummy symbols at beginning and end with tone values equal to 1st and last symbol, respectively
-    for (int j = 0; j < 2 * n_spsym; ++j)
-    {
-        dphi[j] += dphi_peak * pulse[j + n_spsym] * symbols[0];
-        dphi[j + n_sym * n_spsym] += dphi_peak * pulse[j] * symbols[n_sym - 1];
-    }
-
-    // Calculate and insert the audio waveform
-    float phi = 0;
-    for (int k = 0; k < n_wave; ++k)
-    { // Don't include dummy symbols
-        signal[k] = sinf(phi);
-        phi = fmodf(phi + dphi[k + n_spsym], 2 * M_PI);
-    }
-
-    // Apply envelope shaping to the first and last symbols
-    int n_ramp = n_spsym / 8;
-    for (int i = 0; i < n_ramp; ++i)
+    if (error_msg != NULL)
     {
-        float env = (1 - cosf(2 * M_PI * i / (2 * n_ramp))) / 2;
-        signal[i] *= env;
-        signal[n_wave - 1 - i] *= env;
+        fprintf(stderr, "ERROR: %s\n", error_msg);
     }
-}
-
-void usage()
-{
     printf("Generate a 15-second WAV file encoding a given message.\n");
     printf("Usage:\n");
     printf("\n");
-    printf("gen_ft8 MESSAGE WAV_FILE [FREQUENCY]\n");
+    printf("gen_ft8 MESSAGE WAV_FILE [FREQUENCY] [-ft4] [-spread HZ] [-delay MS] [-drift HZ_PER_S] [-ppm PPM] [-seed N]\n");
     printf("\n");
     printf("(Note that you might have to enclose your message in quote marks if it contains spaces)\n");
+    printf("The options other than -ft4 pass the signal through a simulated channel: Rayleigh fading with the given\n");
+    printf("Doppler spread, a second path delayed by MS milliseconds, frequency drift, and a receiver sample clock\n");
+    printf("offset in parts per million; -seed selects the fading realization.\n");
 }
 
 int main(int argc, char** argv)
 {
-    // Expect two command-line arguments
-    if (argc < 3)
+    // Accepted arguments
+    const char* message = NULL;
+    const char* wav_path = NULL;
+    float frequency = 1000.0;
+    bool is_ft4 = false;
+    bool use_channel = false;
+    channel_config_t channel_cfg = { 0 };
+
+    // Parse arguments one by one
+    int num_positional = 0;
+    for (int arg_idx = 1; arg_idx < argc; ++arg_idx)
     {
-        usage();
-        return -1;
+        // Check if the current argument is an option (-xxx)
+        if (argv[arg_idx][0] == '-')
+        {
+            if (0 == strcmp(argv[arg_idx], "-ft4"))
+            {
+                is_ft4 = true;
+                continue;
+            }
+            if (arg_idx + 1 >= argc)
+            {
+                usage("Expected a value after the option");
+                return -1;
+            }
+            float value = atof(argv[arg_idx + 1]);
+            if (0 == strcmp(argv[arg_idx], "-spread"))
+                channel_cfg.doppler_spread = value;
+            else if (0 == strcmp(argv[arg_idx], "-delay"))
+                channel_cfg.delay_spread = value;
+            else if (0 == strcmp(argv[arg_idx], "-drift"))
+                channel_cfg.drift = value;
+            else if (0 == strcmp(argv[arg_idx], "-ppm"))
+                channel_cfg.clock_ppm = value;
+            else if (0 == strcmp(argv[arg_idx], "-seed"))
+                channel_cfg.seed = strtoull(argv[arg_idx + 1], NULL, 10);
+            else
+            {
+                usage("Unknown command line option");
+                return -1;
+            }
+            use_channel = true;
+            ++arg_idx;
+        }
+        else
+        {
+            if (num_positional == 0)
+                message = argv[arg_idx];
+            else if (num_positional == 1)
+                wav_path = argv[arg_idx];
+            else if (num_positional == 2)
+                frequency = atof(argv[arg_idx]);
+            else
+            {
+                usage("Too many arguments");
+                return -1;
+            }
+            ++num_positional;
+        }
     }
-
-    const char* message = argv[1];
-    const char* wav_path = argv[2];
-    float frequency = 1000.0;
-    if (argc > 3)
+    if (wav_path == NULL)
     {
-        frequency = atof(argv[3]);
+        usage(NULL);
+        return -1;
     }
-    bool is_ft4 = (argc > 4) && (0 == strcmp(argv[4], "-ft4"));
 
     // First, pack the text data into binary message
     ftx_message_t msg;
@@ -148,7 +118,6 @@ int main(int argc, char** argv)
 
     int num_tones = (is_ft4) ? FT4_NN : FT8_NN;
     float symbol_period = (is_ft4) ? FT4_SYMBOL_PERIOD : FT8_SYMBOL_PERIOD;
-    float symbol_bt = (is_ft4) ? FT4_SYMBOL_BT : FT8_SYMBOL_BT;
     float slot_time = (is_ft4) ? FT4_SLOT_TIME : FT8_SLOT_TIME;
 
     // Second, encode the binary message as a sequence of FSK tones
@@ -182,7 +151,34 @@ int main(int argc, char** argv)
     }
 
     // Synthesize waveform data (signal) and save it as WAV file
-    synth_gfsk(tones, num_tones, frequency, symbol_bt, symbol_period, sample_rate, signal + num_silence);
+    ftx_encoder_t enc;
+    if (!ftx_encoder_init(&enc, is_ft4 ? FTX_PROTOCOL_FT4 : FTX_PROTOCOL_FT8, sample_rate))
+    {
+        LOG(LOG_ERROR, "Out of memory\n");
+        return -1;
+    }
+    ftx_encoder_set_tones(&enc, tones, frequency);
+    if (!use_channel)
+    {
+        ftx_encoder_generate(&enc, signal + num_silence, num_samples);
+    }
+    else
+    {
+        // Synthesize early by the latency of the channel, so that its output starts on time
+        channel_t channel;
+        channel_cfg.sample_rate = sample_rate;
+        channel_init(&channel, &channel_cfg);
+        float* clean = (float*)calloc(num_total_samples, sizeof(float));
+        ftx_encoder_generate(&enc, clean + num_silence - channel.latency, num_samples);
+        int num_out = channel_process(&channel, clean, num_total_samples, NULL, signal, num_total_samples);
+        for (int i = num_out; i < num_total_samples; ++i)
+        {
+            signal[i] = 0;
+        }
+        free(clean);
+        channel_free(&channel);
+    }
+    ftx_encoder_free(&enc);
     save_wav(signal, num_total_samples, sample_rate, wav_path);
 
     return 0;
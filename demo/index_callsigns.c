@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "ft8/callsign_index.h"
+
+#define LOG_LEVEL LOG_INFO
+#include "ft8/debug.h"
+
+void usage()
+{
+    printf("Build an index of known callsigns, to resolve hashed callsigns when decoding (decode_ft8 -calls).\n");
+    printf("Usage:\n");
+    printf("\n");
+    printf("index_callsigns LIST_FILE INDEX_FILE\n");
+    printf("\n");
+    printf("LIST_FILE has one callsign per line (the first word of the line); empty lines and lines starting with '#' are skipped.\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        usage();
+        return -1;
+    }
+    const char* list_path = argv[1];
+    const char* index_path = argv[2];
+
+    FILE* f_list = fopen(list_path, "r");
+    if (f_list == NULL)
+    {
+        LOG(LOG_ERROR, "Cannot open %s\n", list_path);
+        return -1;
+    }
+
+    // Read all callsigns (uppercased) into one buffer of 12 characters per callsign
+    int num_callsigns = 0;
+    int max_callsigns = 1024;
+    char(*buffer)[12] = malloc(max_callsigns * sizeof(buffer[0]));
+    char line[256];
+    int num_skipped = 0;
+    while (fgets(line, sizeof(line), f_list) != NULL)
+    {
+        char word[256];
+        if ((line[0] == '#') || (1 != sscanf(line, "%255s", word)))
+            continue;
+        if (strlen(word) > 11)
+        {
+            ++num_skipped;
+            continue;
+        }
+        if (num_callsigns == max_callsigns)
+        {
+            max_callsigns *= 2;
+            buffer = realloc(buffer, max_callsigns * sizeof(buffer[0]));
+        }
+        for (int i = 0; i < 12; ++i)
+        {
+            buffer[num_callsigns][i] = (char)toupper((unsigned char)word[i]);
+            if (word[i] == '\0')
+                break;
+        }
+        uint32_t n22;
+        if (ftx_callsign_hash22(buffer[num_callsigns], &n22))
+            ++num_callsigns;
+        else
+            ++num_skipped;
+    }
+    fclose(f_list);
+
+    const char** callsigns = malloc((num_callsigns + 1) * sizeof(callsigns[0]));
+    for (int i = 0; i < num_callsigns; ++i)
+    {
+        callsigns[i] = buffer[i];
+    }
+    size_t size;
+    void* image = ftx_callsign_index_build(callsigns, num_callsigns, &size);
+    free(callsigns);
+    free(buffer);
+    if (image == NULL)
+    {
+        LOG(LOG_ERROR, "Out of memory\n");
+        return -1;
+    }
+
+    ftx_callsign_index_t index;
+    ftx_callsign_index_init(&index, image, size);
+    int num_ambiguous = 0;
+    for (uint32_t i = 0; i < index.num_keys; ++i)
+    {
+        if (index.entries[i].key & FTX_CALLSIGN_INDEX_AMBIGUOUS)
+            ++num_ambiguous;
+    }
+
+    FILE* f_index = fopen(index_path, "wb");
+    bool written = (f_index != NULL) && (1 == fwrite(image, size, 1, f_index));
+    if (f_index != NULL)
+    {
+        written = (0 == fclose(f_index)) && written;
+    }
+    if (!written)
+    {
+        LOG(LOG_ERROR, "Cannot write %s\n", index_path);
+        free(image);
+        return -1;
+    }
+    free(image);
+
+    printf("%d callsigns (%d invalid ones skipped), %u distinct 22-bit hashes (%d ambiguous), %zu bytes\n",
+        num_callsigns, num_skipped, index.num_keys, num_ambiguous, size);
+    return 0;
+}
@@ -33,6 +33,14 @@ kiss_fftr_cfg kiss_fftr_alloc(int nfft,int inverse_fft,void * mem, size_t * lenm
  If you don't care to allocate space, use mem = lenmem = NULL 
 */
 
+kiss_fftr_cfg kiss_fftr_alloc_shared(kiss_fftr_cfg plan,void * mem, size_t * lenmem);
+/*
+ Creates a state of the same size and direction as plan that references the
+ read-only twiddle factors of plan and only owns its scratch buffer, so several
+ states (e.g. one per thread) can run transforms concurrently off one plan.
+ plan must outlive the new state. mem and lenmem are used as in kiss_fftr_alloc.
+*/
+
 
 void kiss_fftr(kiss_fftr_cfg cfg,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata);
 /*
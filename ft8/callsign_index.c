@@ -0,0 +1,294 @@
+#include "callsign_index.h"
+#include "text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_MAGIC "FTXCIDX"
+#define INDEX_BYTE_ORDER 0x01020304u
+
+/// Header of an index image
+typedef struct
+{
+    char magic[8];       ///< INDEX_MAGIC
+    uint32_t version;    ///< FTX_CALLSIGN_INDEX_VERSION
+    uint32_t byte_order; ///< INDEX_BYTE_ORDER as written by the building machine
+    uint32_t num_keys;   ///< Number of distinct 22-bit hashes
+    uint32_t dir_bits;   ///< log2 of the number of directory buckets
+    uint8_t reserved[40];
+} index_header_t;
+
+/// Byte offsets of the sections of an image
+typedef struct
+{
+    size_t dir;
+    size_t short12;
+    size_t short10;
+    size_t entries;
+    size_t size;
+} index_layout_t;
+
+/// Callsign of the list during the build
+typedef struct
+{
+    uint32_t n22;
+    uint64_t n58;
+} build_entry_t;
+
+static void get_layout(uint32_t num_keys, int dir_bits, index_layout_t* layout)
+{
+    size_t pos = sizeof(index_header_t);
+    layout->dir = pos;
+    pos += (((size_t)1 << dir_bits) + 1) * sizeof(uint32_t);
+    layout->short12 = pos;
+    pos += 4096 * sizeof(uint32_t);
+    layout->short10 = pos;
+    pos += 1024 * sizeof(uint32_t);
+    layout->entries = pos;
+    pos += (size_t)num_keys * sizeof(ftx_callsign_index_entry_t);
+    layout->size = pos;
+}
+
+/// Pack a callsign in base 38, left aligned in 11 characters (as it is hashed)
+static bool pack_callsign(const char* callsign, uint64_t* n58)
+{
+    uint64_t result = 0;
+    int i = 0;
+    for (; callsign[i] != '\0'; ++i)
+    {
+        int j = (i < 11) ? nchar(callsign[i], FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH) : -1;
+        if (j < 0)
+            return false;
+        result = (38 * result) + j;
+    }
+    if (i == 0)
+        return false;
+    for (; i < 11; ++i)
+    {
+        result = 38 * result;
+    }
+    *n58 = result;
+    return true;
+}
+
+static void unpack_callsign(uint64_t n58, char* callsign)
+{
+    for (int i = 10; i >= 0; --i)
+    {
+        callsign[i] = charn(n58 % 38, FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH);
+        n58 /= 38;
+    }
+    int length = 11;
+    while ((length > 0) && (callsign[length - 1] == ' '))
+    {
+        --length;
+    }
+    callsign[length] = '\0';
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const build_entry_t* ea = (const build_entry_t*)a;
+    const build_entry_t* eb = (const build_entry_t*)b;
+    if (ea->n22 != eb->n22)
+        return (ea->n22 < eb->n22) ? -1 : 1;
+    if (ea->n58 != eb->n58)
+        return (ea->n58 < eb->n58) ? -1 : 1;
+    return 0;
+}
+
+/// Point a short hash to a key, or mark it ambiguous if it already points to another one
+static void add_short_key(uint32_t* short_keys, uint32_t hash, uint32_t key_ref, bool ambiguous)
+{
+    if (ambiguous || ((short_keys[hash] != 0) && (short_keys[hash] != key_ref)))
+        short_keys[hash] = FTX_CALLSIGN_INDEX_AMBIGUOUS;
+    else
+        short_keys[hash] = key_ref;
+}
+
+void* ftx_callsign_index_build(const char* const* callsigns, int num_callsigns, size_t* size)
+{
+    build_entry_t* entries = (build_entry_t*)malloc((num_callsigns > 0 ? num_callsigns : 1) * sizeof(build_entry_t));
+    if (entries == NULL)
+        return NULL;
+    int num_entries = 0;
+    for (int i = 0; i < num_callsigns; ++i)
+    {
+        build_entry_t* entry = &entries[num_entries];
+        if (pack_callsign(callsigns[i], &entry->n58) && ftx_callsign_hash22(callsigns[i], &entry->n22))
+            ++num_entries;
+    }
+    qsort(entries, num_entries, sizeof(entries[0]), compare_entries);
+
+    // Merge duplicate callsigns, then count the distinct hashes
+    int num_unique = 0;
+    for (int i = 0; i < num_entries; ++i)
+    {
+        if ((num_unique == 0) || (compare_entries(&entries[i], &entries[num_unique - 1]) != 0))
+            entries[num_unique++] = entries[i];
+    }
+    uint32_t num_keys = 0;
+    for (int i = 0; i < num_unique; ++i)
+    {
+        if ((i == 0) || (entries[i].n22 != entries[i - 1].n22))
+            ++num_keys;
+    }
+
+    // A few keys per directory bucket on average
+    int dir_bits = 0;
+    while (((num_keys >> dir_bits) > 4) && (dir_bits < 22))
+    {
+        ++dir_bits;
+    }
+    index_layout_t layout;
+    get_layout(num_keys, dir_bits, &layout);
+    uint8_t* image = (uint8_t*)calloc(1, layout.size);
+    if (image == NULL)
+    {
+        free(entries);
+        return NULL;
+    }
+
+    index_header_t* header = (index_header_t*)image;
+    memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+    header->version = FTX_CALLSIGN_INDEX_VERSION;
+    header->byte_order = INDEX_BYTE_ORDER;
+    header->num_keys = num_keys;
+    header->dir_bits = dir_bits;
+
+    uint32_t* dir = (uint32_t*)(image + layout.dir);
+    uint32_t* short12 = (uint32_t*)(image + layout.short12);
+    uint32_t* short10 = (uint32_t*)(image + layout.short10);
+    ftx_callsign_index_entry_t* index_entries = (ftx_callsign_index_entry_t*)(image + layout.entries);
+    uint32_t key_idx = 0;
+    for (int i = 0; i < num_unique; ++i)
+    {
+        uint32_t n22 = entries[i].n22;
+        if ((i > 0) && (n22 == entries[i - 1].n22))
+            continue;
+        bool ambiguous = (i + 1 < num_unique) && (entries[i + 1].n22 == n22);
+        index_entries[key_idx].key = n22 | (ambiguous ? FTX_CALLSIGN_INDEX_AMBIGUOUS : 0);
+        index_entries[key_idx].call_hi = (uint32_t)(entries[i].n58 >> 32);
+        index_entries[key_idx].call_lo = (uint32_t)entries[i].n58;
+        add_short_key(short12, n22 >> 10, key_idx + 1, ambiguous);
+        add_short_key(short10, n22 >> 12, key_idx + 1, ambiguous);
+        ++key_idx;
+    }
+
+    // dir[b] is the first key of bucket b or a later one
+    const int dir_shift = 22 - dir_bits;
+    uint32_t next_key = 0;
+    for (uint32_t b = 0; b <= (1u << dir_bits); ++b)
+    {
+        while ((next_key < num_keys) && (((index_entries[next_key].key & 0x3FFFFFu) >> dir_shift) < b))
+        {
+            ++next_key;
+        }
+        dir[b] = next_key;
+    }
+
+    free(entries);
+    *size = layout.size;
+    return image;
+}
+
+bool ftx_callsign_index_init(ftx_callsign_index_t* index, const void* data, size_t size)
+{
+    const index_header_t* header = (const index_header_t*)data;
+    if ((size < sizeof(index_header_t)) || (0 != memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic))))
+        return false;
+    if ((header->version != FTX_CALLSIGN_INDEX_VERSION) || (header->byte_order != INDEX_BYTE_ORDER) || (header->dir_bits > 22) || (header->num_keys > (1u << 22)))
+        return false;
+    index_layout_t layout;
+    get_layout(header->num_keys, header->dir_bits, &layout);
+    if (layout.size > size)
+        return false;
+
+    const uint8_t* image = (const uint8_t*)data;
+    index->data = data;
+    index->size = size;
+    index->num_keys = header->num_keys;
+    index->dir_shift = 22 - header->dir_bits;
+    index->dir = (const uint32_t*)(image + layout.dir);
+    index->entries = (const ftx_callsign_index_entry_t*)(image + layout.entries);
+    index->short_keys[0] = (const uint32_t*)(image + layout.short12);
+    index->short_keys[1] = (const uint32_t*)(image + layout.short10);
+
+    // Lookups index the entries through the directory and the short keys without checks, so check them once here
+    const uint32_t num_dir = 1u << header->dir_bits;
+    if ((index->dir[0] > index->dir[num_dir]) || (index->dir[num_dir] != header->num_keys))
+        return false;
+    for (uint32_t b = 0; b < num_dir; ++b)
+    {
+        if (index->dir[b] > index->dir[b + 1])
+            return false;
+    }
+    const uint32_t num_short[2] = { 4096, 1024 };
+    for (int k = 0; k < 2; ++k)
+    {
+        for (uint32_t i = 0; i < num_short[k]; ++i)
+        {
+            uint32_t ref = index->short_keys[k][i];
+            if ((ref > header->num_keys) && (ref != FTX_CALLSIGN_INDEX_AMBIGUOUS))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool ftx_callsign_index_lookup(const ftx_callsign_index_t* index, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    uint32_t key_ref = 0;
+    if (hash_type == FTX_CALLSIGN_HASH_22_BITS)
+    {
+        hash &= 0x3FFFFFu;
+        uint32_t bucket = hash >> index->dir_shift;
+        for (uint32_t i = index->dir[bucket]; i < index->dir[bucket + 1]; ++i)
+        {
+            uint32_t key = index->entries[i].key & 0x3FFFFFu;
+            if (key >= hash)
+            {
+                if (key == hash)
+                    key_ref = (index->entries[i].key & FTX_CALLSIGN_INDEX_AMBIGUOUS) ? FTX_CALLSIGN_INDEX_AMBIGUOUS : (i + 1);
+                break;
+            }
+        }
+    }
+    else if (hash_type == FTX_CALLSIGN_HASH_12_BITS)
+    {
+        key_ref = index->short_keys[0][hash & 0xFFFu];
+    }
+    else
+    {
+        key_ref = index->short_keys[1][hash & 0x3FFu];
+    }
+
+    if ((key_ref == 0) || (key_ref == FTX_CALLSIGN_INDEX_AMBIGUOUS))
+    {
+        callsign[0] = '\0';
+        return false;
+    }
+    const ftx_callsign_index_entry_t* entry = &index->entries[key_ref - 1];
+    unpack_callsign(((uint64_t)entry->call_hi << 32) | entry->call_lo, callsign);
+    return true;
+}
+
+static bool lookup_hash(void* ctx, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    return ftx_callsign_index_lookup((const ftx_callsign_index_t*)ctx, hash_type, hash, callsign);
+}
+
+static void save_hash(void* ctx, const char* callsign, uint32_t n22)
+{
+    // The index is immutable
+    (void)ctx;
+    (void)callsign;
+    (void)n22;
+}
+
+void ftx_callsign_index_interface(const ftx_callsign_index_t* index, ftx_callsign_hash_interface_t* hash_if)
+{
+    hash_if->lookup_hash = lookup_hash;
+    hash_if->save_hash = save_hash;
+    hash_if->ctx = (void*)index;
+}
@@ -0,0 +1,76 @@
+#ifndef _INCLUDE_CALLSIGN_INDEX_H_
+#define _INCLUDE_CALLSIGN_INDEX_H_
+
+#include "message.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Version of the index image layout (images of other versions are rejected)
+#define FTX_CALLSIGN_INDEX_VERSION 1
+
+/// Marks a hash shared by several callsigns
+#define FTX_CALLSIGN_INDEX_AMBIGUOUS 0x80000000u
+
+/// Entry of a callsign index
+typedef struct
+{
+    uint32_t key;     ///< 22-bit hash, with FTX_CALLSIGN_INDEX_AMBIGUOUS if several callsigns share it
+    uint32_t call_hi; ///< Callsign packed in base 38 (11 characters, left aligned), upper 32 bits
+    uint32_t call_lo; ///< Lower 32 bits of the packed callsign
+} ftx_callsign_index_entry_t;
+
+/// Immutable index of known callsigns (e.g. a master list of active calls) by their 22, 12 and 10 bit hashes.
+/// The index is built once into a flat image, which is saved to a file and later used in place (e.g. mapped from
+/// the file), so that loading costs nothing.
+///
+/// All hashes are computed when the image is built. The entries (22-bit hash and packed callsign) are sorted by
+/// hash and split into buckets by its upper bits through a directory sized for a few entries per bucket, so a
+/// lookup reads the directory and one short run of entries: about two cache misses. The 12 and 10 bit hashes
+/// index direct tables, so their lookups also read one entry.
+///
+/// A hash shared by several callsigns of the list is ambiguous and is not resolved (a wrong callsign is worse than
+/// none). With a large list most 12 and 10 bit hashes are ambiguous, so these mostly help for short lists.
+typedef struct
+{
+    const void* data;                          ///< Index image
+    size_t size;                               ///< Size of the image in bytes
+    uint32_t num_keys;                         ///< Number of entries (distinct 22-bit hashes)
+    int dir_shift;                             ///< Shift from a 22-bit hash to its directory bucket
+    const uint32_t* dir;                       ///< First entry of every directory bucket, and the end of the last one
+    const ftx_callsign_index_entry_t* entries; ///< Entries sorted by 22-bit hash
+    const uint32_t* short_keys[2];             ///< Entry + 1 of every 12 and 10 bit hash, 0 if none, FTX_CALLSIGN_INDEX_AMBIGUOUS if shared
+} ftx_callsign_index_t;
+
+/// Build an index image from a list of callsigns. Duplicates are merged; callsigns with characters outside the
+/// allowed set (see ftx_callsign_hash22()) are skipped.
+/// @param[in] callsigns List of callsigns (uppercase, up to 11 characters)
+/// @param[out] size Size of the image in bytes
+/// @return Image allocated with malloc() (to be released with free()), NULL if out of memory
+void* ftx_callsign_index_build(const char* const* callsigns, int num_callsigns, size_t* size);
+
+/// Use an index image in place (it is not copied and must outlive the index)
+/// @param[in] data Image built by ftx_callsign_index_build(), aligned to 4 bytes (a mapped file always is)
+/// @return False if the image is truncated, of another version, written on a machine with another byte order or
+/// inconsistent (its directory and short keys are checked, so that lookups stay within the image)
+bool ftx_callsign_index_init(ftx_callsign_index_t* index, const void* data, size_t size);
+
+/// Look up a callsign by its 22, 12 or 10 bit hash
+/// @param[out] callsign Callsign found (up to 11 characters and a terminating zero), empty if none
+/// @return True if exactly one callsign of the list has the hash
+bool ftx_callsign_index_lookup(const ftx_callsign_index_t* index, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign);
+
+/// Fill a hash interface for the message codec that looks up callsigns in the index (saving does nothing)
+void ftx_callsign_index_interface(const ftx_callsign_index_t* index, ftx_callsign_hash_interface_t* hash_if);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_CALLSIGN_INDEX_H_
@@ -0,0 +1,273 @@
+#include "callsign_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Shift from a 22-bit hash to the hash of each index (by ftx_callsign_hash_type_t)
+static const int kHash_shift[3] = { 0, 10, 12 };
+
+static uint32_t get_bucket(const ftx_callsign_table_t* table, int hash_type, uint32_t hash)
+{
+    switch (hash_type)
+    {
+    case FTX_CALLSIGN_HASH_10_BITS:
+        return hash & (FTX_CALLSIGN_BUCKETS_10 - 1);
+    case FTX_CALLSIGN_HASH_12_BITS:
+        return hash & (FTX_CALLSIGN_BUCKETS_12 - 1);
+    default:
+        return hash & table->mask22;
+    }
+}
+
+/// Take the write lock and make the sequence counter odd, so that readers know to retry
+static void write_begin(ftx_callsign_table_t* table)
+{
+    while (atomic_flag_test_and_set_explicit(&table->write_lock, memory_order_acquire))
+    {
+        // spin
+    }
+    unsigned seq = atomic_load_explicit(&table->seq, memory_order_relaxed);
+    atomic_store_explicit(&table->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/// Publish the changes (the sequence counter is even again) and release the write lock
+static void write_end(ftx_callsign_table_t* table)
+{
+    unsigned seq = atomic_load_explicit(&table->seq, memory_order_relaxed);
+    atomic_store_explicit(&table->seq, seq + 1, memory_order_release);
+    atomic_flag_clear_explicit(&table->write_lock, memory_order_release);
+}
+
+static bool is_expired(const ftx_callsign_table_t* table, const ftx_callsign_entry_t* entry)
+{
+    return (table->epoch - entry->epoch) > table->expire_age;
+}
+
+/// Find the youngest unexpired callsign with a hash. May run concurrently with a writer: then the result is garbage (the
+/// caller retries), but every index is checked and the walk is bounded, so it stays within the table.
+static bool find_callsign(const ftx_callsign_table_t* table, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    const int shift = kHash_shift[hash_type];
+    bool found = false;
+    uint32_t found_age = 0;
+    int32_t idx = table->heads[hash_type][get_bucket(table, hash_type, hash)];
+    for (int steps = 0; (idx >= 0) && (idx < table->capacity) && (steps < table->capacity); ++steps)
+    {
+        const ftx_callsign_entry_t* entry = &table->entries[idx];
+        uint32_t age = table->epoch - entry->epoch;
+        if (((entry->n22 >> shift) == hash) && (age <= table->expire_age) && (!found || (age < found_age)))
+        {
+            memcpy(callsign, entry->callsign, sizeof(entry->callsign));
+            found_age = age;
+            found = true;
+        }
+        idx = entry->next[hash_type];
+    }
+    return found;
+}
+
+/// Remove an entry from the chains of all indexes and return it to the free list
+static void remove_entry(ftx_callsign_table_t* table, int32_t idx)
+{
+    ftx_callsign_entry_t* entry = &table->entries[idx];
+    for (int k = 0; k < 3; ++k)
+    {
+        if (entry->prev[k] >= 0)
+            table->entries[entry->prev[k]].next[k] = entry->next[k];
+        else
+            table->heads[k][get_bucket(table, k, entry->n22 >> kHash_shift[k])] = entry->next[k];
+        if (entry->next[k] >= 0)
+            table->entries[entry->next[k]].prev[k] = entry->prev[k];
+    }
+    entry->callsign[0] = '\0';
+    entry->next[0] = table->free_head;
+    table->free_head = idx;
+    --table->count;
+}
+
+/// Advance the clock hand over num_steps entries, removing the expired callsigns
+static void sweep(ftx_callsign_table_t* table, int num_steps)
+{
+    for (int step = 0; (step < num_steps) && (step < table->capacity); ++step)
+    {
+        ftx_callsign_entry_t* entry = &table->entries[table->clock_hand];
+        if ((entry->callsign[0] != '\0') && is_expired(table, entry))
+            remove_entry(table, table->clock_hand);
+        table->clock_hand = (table->clock_hand + 1) % table->capacity;
+    }
+}
+
+/// Make room in a full table: remove the first expired callsign among a few entries at the clock hand, or else the
+/// oldest of them
+static void evict(ftx_callsign_table_t* table)
+{
+    int32_t victim = -1;
+    for (int step = 0; (step < FTX_CALLSIGN_EVICT_SAMPLES) && (step < table->capacity); ++step)
+    {
+        int32_t idx = table->clock_hand;
+        table->clock_hand = (table->clock_hand + 1) % table->capacity;
+        if (is_expired(table, &table->entries[idx]))
+        {
+            victim = idx;
+            break;
+        }
+        if ((victim < 0) || ((table->epoch - table->entries[idx].epoch) > (table->epoch - table->entries[victim].epoch)))
+            victim = idx;
+    }
+    remove_entry(table, victim);
+}
+
+void ftx_callsign_table_init(ftx_callsign_table_t* table, int capacity)
+{
+    uint32_t num_buckets22 = 16;
+    while (num_buckets22 < (uint32_t)capacity)
+    {
+        num_buckets22 *= 2;
+    }
+    table->capacity = capacity;
+    table->mask22 = num_buckets22 - 1;
+    table->entries = (ftx_callsign_entry_t*)malloc(capacity * sizeof(table->entries[0]));
+    int32_t* heads = (int32_t*)malloc((FTX_CALLSIGN_BUCKETS_10 + FTX_CALLSIGN_BUCKETS_12 + num_buckets22) * sizeof(int32_t));
+    table->heads[FTX_CALLSIGN_HASH_22_BITS] = heads;
+    table->heads[FTX_CALLSIGN_HASH_12_BITS] = heads + num_buckets22;
+    table->heads[FTX_CALLSIGN_HASH_10_BITS] = heads + num_buckets22 + FTX_CALLSIGN_BUCKETS_12;
+    table->epoch = 0;
+    table->expire_age = UINT32_MAX;
+    atomic_init(&table->seq, 0);
+    atomic_flag_clear(&table->write_lock);
+    ftx_callsign_table_clear(table);
+}
+
+void ftx_callsign_table_free(ftx_callsign_table_t* table)
+{
+    free(table->entries);
+    free(table->heads[FTX_CALLSIGN_HASH_22_BITS]);
+    table->entries = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+void ftx_callsign_table_clear(ftx_callsign_table_t* table)
+{
+    write_begin(table);
+    int num_heads = FTX_CALLSIGN_BUCKETS_10 + FTX_CALLSIGN_BUCKETS_12 + (int)table->mask22 + 1;
+    for (int i = 0; i < num_heads; ++i)
+    {
+        table->heads[FTX_CALLSIGN_HASH_22_BITS][i] = -1;
+    }
+    for (int i = 0; i < table->capacity; ++i)
+    {
+        table->entries[i].callsign[0] = '\0';
+        table->entries[i].next[0] = (i + 1 < table->capacity) ? (i + 1) : -1;
+    }
+    table->free_head = (table->capacity > 0) ? 0 : -1;
+    table->count = 0;
+    table->clock_hand = 0;
+    write_end(table);
+}
+
+int ftx_callsign_table_size(ftx_callsign_table_t* table)
+{
+    return table->count;
+}
+
+bool ftx_callsign_table_add(ftx_callsign_table_t* table, const char* callsign, uint32_t n22)
+{
+    n22 &= 0x3FFFFFu;
+    bool saved = true;
+    write_begin(table);
+
+    int32_t idx = table->heads[FTX_CALLSIGN_HASH_22_BITS][get_bucket(table, FTX_CALLSIGN_HASH_22_BITS, n22)];
+    while ((idx >= 0) && !((table->entries[idx].n22 == n22) && (0 == strncmp(table->entries[idx].callsign, callsign, 11))))
+    {
+        idx = table->entries[idx].next[FTX_CALLSIGN_HASH_22_BITS];
+    }
+
+    if (table->capacity == 0)
+    {
+        saved = false;
+    }
+    else if (idx >= 0)
+    {
+        table->entries[idx].epoch = table->epoch;
+    }
+    else
+    {
+        if (table->free_head < 0)
+            evict(table);
+        idx = table->free_head;
+        ftx_callsign_entry_t* entry = &table->entries[idx];
+        table->free_head = entry->next[0];
+        strncpy(entry->callsign, callsign, 11);
+        entry->callsign[11] = '\0';
+        entry->n22 = n22;
+        entry->epoch = table->epoch;
+        for (int k = 0; k < 3; ++k)
+        {
+            int32_t* head = &table->heads[k][get_bucket(table, k, n22 >> kHash_shift[k])];
+            entry->next[k] = *head;
+            entry->prev[k] = -1;
+            if (*head >= 0)
+                table->entries[*head].prev[k] = idx;
+            *head = idx;
+        }
+        ++table->count;
+    }
+
+    write_end(table);
+    return saved;
+}
+
+bool ftx_callsign_table_lookup(ftx_callsign_table_t* table, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    char found_callsign[12];
+    bool found;
+    while (true)
+    {
+        unsigned seq = atomic_load_explicit(&table->seq, memory_order_acquire);
+        if (seq & 1)
+            continue; // a writer is busy
+        found = find_callsign(table, hash_type, hash, found_callsign);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&table->seq, memory_order_relaxed) == seq)
+            break;
+    }
+
+    if (found)
+    {
+        found_callsign[11] = '\0';
+        strcpy(callsign, found_callsign);
+    }
+    else
+    {
+        callsign[0] = '\0';
+    }
+    return found;
+}
+
+void ftx_callsign_table_cleanup(ftx_callsign_table_t* table, uint8_t max_age)
+{
+    write_begin(table);
+    ++table->epoch;
+    table->expire_age = (uint32_t)max_age + 1;
+    sweep(table, FTX_CALLSIGN_SWEEP_STEP);
+    write_end(table);
+}
+
+static bool lookup_hash(void* ctx, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign)
+{
+    return ftx_callsign_table_lookup((ftx_callsign_table_t*)ctx, hash_type, hash, callsign);
+}
+
+static void save_hash(void* ctx, const char* callsign, uint32_t n22)
+{
+    ftx_callsign_table_add((ftx_callsign_table_t*)ctx, callsign, n22);
+}
+
+void ftx_callsign_table_interface(ftx_callsign_table_t* table, ftx_callsign_hash_interface_t* hash_if)
+{
+    hash_if->lookup_hash = lookup_hash;
+    hash_if->save_hash = save_hash;
+    hash_if->ctx = table;
+}
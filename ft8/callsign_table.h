@@ -0,0 +1,96 @@
+#ifndef _INCLUDE_CALLSIGN_TABLE_H_
+#define _INCLUDE_CALLSIGN_TABLE_H_
+
+#include "message.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Number of buckets of the 10-bit and 12-bit indexes (one per hash value)
+#define FTX_CALLSIGN_BUCKETS_10 1024
+#define FTX_CALLSIGN_BUCKETS_12 4096
+
+/// Number of entries the clock hand visits per ftx_callsign_table_cleanup() call
+#define FTX_CALLSIGN_SWEEP_STEP 64
+/// Number of entries sampled from the clock hand to find one to evict when the table is full
+#define FTX_CALLSIGN_EVICT_SAMPLES 16
+
+/// Entry of a callsign table
+typedef struct
+{
+    char callsign[12]; ///< Up to 11 symbols of callsign + trailing zeros (empty if the entry is free)
+    uint32_t n22;      ///< 22-bit hash of the callsign
+    uint32_t epoch;    ///< Epoch in which the callsign was last saved
+    int32_t next[3];   ///< Next entry in the chain of each index (by ftx_callsign_hash_type_t), -1 at the end
+    int32_t prev[3];   ///< Previous entry in the chain of each index, -1 at the start
+} ftx_callsign_entry_t;
+
+/// Table of callsigns by their 22, 12 and 10 bit hashes, one instance per decoder (or shared between several).
+/// Each hash length has its own index (chained buckets: direct for 10 and 12 bits, by the low bits for 22 bits),
+/// so every lookup and save takes O(1) on average. If several callsigns share a short hash, the youngest one is
+/// found.
+///
+/// Ages are kept as epochs: every ftx_callsign_table_cleanup() starts a new one, and the age of a callsign is the
+/// number of epochs since it was last saved. Expired callsigns are ignored by lookups right away and removed
+/// lazily, by a clock hand that visits a fixed number of entries per cleanup, or when their entry is needed for a
+/// new callsign. So neither cleanup nor saves ever scan the whole table.
+///
+/// Lookups may run from any number of threads while one thread saves or cleans up: writers are serialized by a
+/// lock and publish through a sequence counter (seqlock), readers never block a writer and retry if one ran
+/// during their lookup.
+typedef struct
+{
+    ftx_callsign_entry_t* entries; ///< Entry storage (capacity entries)
+    int32_t* heads[3];             ///< First entry of every bucket of each index (by ftx_callsign_hash_type_t)
+    uint32_t mask22;               ///< Bucket mask of the 22-bit index (its number of buckets minus one)
+    int capacity;                  ///< Maximum number of callsigns
+    int count;                     ///< Number of callsigns in the table
+    int32_t free_head;             ///< First free entry, chained through next[0]
+    uint32_t epoch;                ///< Current epoch
+    uint32_t expire_age;           ///< Callsigns older than this many epochs are expired
+    int clock_hand;                ///< Next entry to visit for removal of expired callsigns
+    atomic_uint seq;               ///< Sequence counter, odd while a writer modifies the table
+    atomic_flag write_lock;        ///< Serializes the writers
+} ftx_callsign_table_t;
+
+/// Initialize an empty table, allocating room for capacity callsigns
+void ftx_callsign_table_init(ftx_callsign_table_t* table, int capacity);
+
+/// Release the memory of the table
+void ftx_callsign_table_free(ftx_callsign_table_t* table);
+
+/// Remove all callsigns
+void ftx_callsign_table_clear(ftx_callsign_table_t* table);
+
+/// Number of callsigns in the table (including expired ones that were not removed yet)
+int ftx_callsign_table_size(ftx_callsign_table_t* table);
+
+/// Save a callsign by its 22-bit hash (the 12 and 10 bit hashes are its upper bits). A callsign that is already
+/// in the table gets its age reset. If the table is full, an expired callsign, or else the oldest of a few
+/// callsigns at the clock hand, makes room.
+/// @return False if the table has no room at all (zero capacity)
+bool ftx_callsign_table_add(ftx_callsign_table_t* table, const char* callsign, uint32_t n22);
+
+/// Look up a callsign by its 22, 12 or 10 bit hash
+/// @param[out] callsign Callsign found (up to 11 characters and a terminating zero), empty if none
+/// @return True if a callsign was found
+bool ftx_callsign_table_lookup(ftx_callsign_table_t* table, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign);
+
+/// Start a new epoch, which ages all callsigns by one. Callsigns not saved during the last max_age + 1 epochs
+/// expire. Takes constant time, whatever the size of the table.
+void ftx_callsign_table_cleanup(ftx_callsign_table_t* table, uint8_t max_age);
+
+/// Fill a hash interface for the message codec that saves to and looks up in the table
+void ftx_callsign_table_interface(ftx_callsign_table_t* table, ftx_callsign_hash_interface_t* hash_if);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_CALLSIGN_TABLE_H_
@@ -14,6 +14,9 @@ extern "C"
 #define FT4_SYMBOL_PERIOD (0.048f) ///< FT4 symbol duration, defines tone deviation in Hz and symbol rate
 #define FT4_SLOT_TIME     (7.5f)   ///< FT4 slot period
 
+#define FT8_SYMBOL_BT (2.0f) ///< FT8 symbol smoothing filter bandwidth factor (BT)
+#define FT4_SYMBOL_BT (1.0f) ///< FT4 symbol smoothing filter bandwidth factor (BT)
+
 // Define FT8 symbol counts
 // FT8 message structure:
 //     S D1 S D2 S
@@ -1,7 +1,108 @@
 #include "crc.h"
 #include "constants.h"
 
-#define TOPBIT (1u << (FT8_CRC_WIDTH - 1))
+// The remainder is kept left aligned in 16 bits (the polynomial too), so that a whole remainder divides
+// with a pair of bytes through two table lookups: the CRC is the upper 14 bits at the end
+#define TOPBIT     0x8000u
+#define POLYNOMIAL ((uint16_t)(FT8_CRC_POLYNOMIAL << (16 - FT8_CRC_WIDTH)))
+
+/// Remainders after dividing a byte x (aligned to the top of the remainder) by the CRC polynomial:
+/// kCRC_table[0][x] is the result of 8 steps of the bitwise division on (x << 8), kCRC_table[1][x] of 16 steps
+static const uint16_t kCRC_table[2][256] = {
+    {
+        0x0000, 0x9d5c, 0xa7e4, 0x3ab8, 0xd294, 0x4fc8, 0x7570, 0xe82c,
+        0x3874, 0xa528, 0x9f90, 0x02cc, 0xeae0, 0x77bc, 0x4d04, 0xd058,
+        0x70e8, 0xedb4, 0xd70c, 0x4a50, 0xa27c, 0x3f20, 0x0598, 0x98c4,
+        0x489c, 0xd5c0, 0xef78, 0x7224, 0x9a08, 0x0754, 0x3dec, 0xa0b0,
+        0xe1d0, 0x7c8c, 0x4634, 0xdb68, 0x3344, 0xae18, 0x94a0, 0x09fc,
+        0xd9a4, 0x44f8, 0x7e40, 0xe31c, 0x0b30, 0x966c, 0xacd4, 0x3188,
+        0x9138, 0x0c64, 0x36dc, 0xab80, 0x43ac, 0xdef0, 0xe448, 0x7914,
+        0xa94c, 0x3410, 0x0ea8, 0x93f4, 0x7bd8, 0xe684, 0xdc3c, 0x4160,
+        0x5efc, 0xc3a0, 0xf918, 0x6444, 0x8c68, 0x1134, 0x2b8c, 0xb6d0,
+        0x6688, 0xfbd4, 0xc16c, 0x5c30, 0xb41c, 0x2940, 0x13f8, 0x8ea4,
+        0x2e14, 0xb348, 0x89f0, 0x14ac, 0xfc80, 0x61dc, 0x5b64, 0xc638,
+        0x1660, 0x8b3c, 0xb184, 0x2cd8, 0xc4f4, 0x59a8, 0x6310, 0xfe4c,
+        0xbf2c, 0x2270, 0x18c8, 0x8594, 0x6db8, 0xf0e4, 0xca5c, 0x5700,
+        0x8758, 0x1a04, 0x20bc, 0xbde0, 0x55cc, 0xc890, 0xf228, 0x6f74,
+        0xcfc4, 0x5298, 0x6820, 0xf57c, 0x1d50, 0x800c, 0xbab4, 0x27e8,
+        0xf7b0, 0x6aec, 0x5054, 0xcd08, 0x2524, 0xb878, 0x82c0, 0x1f9c,
+        0xbdf8, 0x20a4, 0x1a1c, 0x8740, 0x6f6c, 0xf230, 0xc888, 0x55d4,
+        0x858c, 0x18d0, 0x2268, 0xbf34, 0x5718, 0xca44, 0xf0fc, 0x6da0,
+        0xcd10, 0x504c, 0x6af4, 0xf7a8, 0x1f84, 0x82d8, 0xb860, 0x253c,
+        0xf564, 0x6838, 0x5280, 0xcfdc, 0x27f0, 0xbaac, 0x8014, 0x1d48,
+        0x5c28, 0xc174, 0xfbcc, 0x6690, 0x8ebc, 0x13e0, 0x2958, 0xb404,
+        0x645c, 0xf900, 0xc3b8, 0x5ee4, 0xb6c8, 0x2b94, 0x112c, 0x8c70,
+        0x2cc0, 0xb19c, 0x8b24, 0x1678, 0xfe54, 0x6308, 0x59b0, 0xc4ec,
+        0x14b4, 0x89e8, 0xb350, 0x2e0c, 0xc620, 0x5b7c, 0x61c4, 0xfc98,
+        0xe304, 0x7e58, 0x44e0, 0xd9bc, 0x3190, 0xaccc, 0x9674, 0x0b28,
+        0xdb70, 0x462c, 0x7c94, 0xe1c8, 0x09e4, 0x94b8, 0xae00, 0x335c,
+        0x93ec, 0x0eb0, 0x3408, 0xa954, 0x4178, 0xdc24, 0xe69c, 0x7bc0,
+        0xab98, 0x36c4, 0x0c7c, 0x9120, 0x790c, 0xe450, 0xdee8, 0x43b4,
+        0x02d4, 0x9f88, 0xa530, 0x386c, 0xd040, 0x4d1c, 0x77a4, 0xeaf8,
+        0x3aa0, 0xa7fc, 0x9d44, 0x0018, 0xe834, 0x7568, 0x4fd0, 0xd28c,
+        0x723c, 0xef60, 0xd5d8, 0x4884, 0xa0a8, 0x3df4, 0x074c, 0x9a10,
+        0x4a48, 0xd714, 0xedac, 0x70f0, 0x98dc, 0x0580, 0x3f38, 0xa264
+    },
+    {
+        0x0000, 0xe6ac, 0x5004, 0xb6a8, 0xa008, 0x46a4, 0xf00c, 0x16a0,
+        0xdd4c, 0x3be0, 0x8d48, 0x6be4, 0x7d44, 0x9be8, 0x2d40, 0xcbec,
+        0x27c4, 0xc168, 0x77c0, 0x916c, 0x87cc, 0x6160, 0xd7c8, 0x3164,
+        0xfa88, 0x1c24, 0xaa8c, 0x4c20, 0x5a80, 0xbc2c, 0x0a84, 0xec28,
+        0x4f88, 0xa924, 0x1f8c, 0xf920, 0xef80, 0x092c, 0xbf84, 0x5928,
+        0x92c4, 0x7468, 0xc2c0, 0x246c, 0x32cc, 0xd460, 0x62c8, 0x8464,
+        0x684c, 0x8ee0, 0x3848, 0xdee4, 0xc844, 0x2ee8, 0x9840, 0x7eec,
+        0xb500, 0x53ac, 0xe504, 0x03a8, 0x1508, 0xf3a4, 0x450c, 0xa3a0,
+        0x9f10, 0x79bc, 0xcf14, 0x29b8, 0x3f18, 0xd9b4, 0x6f1c, 0x89b0,
+        0x425c, 0xa4f0, 0x1258, 0xf4f4, 0xe254, 0x04f8, 0xb250, 0x54fc,
+        0xb8d4, 0x5e78, 0xe8d0, 0x0e7c, 0x18dc, 0xfe70, 0x48d8, 0xae74,
+        0x6598, 0x8334, 0x359c, 0xd330, 0xc590, 0x233c, 0x9594, 0x7338,
+        0xd098, 0x3634, 0x809c, 0x6630, 0x7090, 0x963c, 0x2094, 0xc638,
+        0x0dd4, 0xeb78, 0x5dd0, 0xbb7c, 0xaddc, 0x4b70, 0xfdd8, 0x1b74,
+        0xf75c, 0x11f0, 0xa758, 0x41f4, 0x5754, 0xb1f8, 0x0750, 0xe1fc,
+        0x2a10, 0xccbc, 0x7a14, 0x9cb8, 0x8a18, 0x6cb4, 0xda1c, 0x3cb0,
+        0xa37c, 0x45d0, 0xf378, 0x15d4, 0x0374, 0xe5d8, 0x5370, 0xb5dc,
+        0x7e30, 0x989c, 0x2e34, 0xc898, 0xde38, 0x3894, 0x8e3c, 0x6890,
+        0x84b8, 0x6214, 0xd4bc, 0x3210, 0x24b0, 0xc21c, 0x74b4, 0x9218,
+        0x59f4, 0xbf58, 0x09f0, 0xef5c, 0xf9fc, 0x1f50, 0xa9f8, 0x4f54,
+        0xecf4, 0x0a58, 0xbcf0, 0x5a5c, 0x4cfc, 0xaa50, 0x1cf8, 0xfa54,
+        0x31b8, 0xd714, 0x61bc, 0x8710, 0x91b0, 0x771c, 0xc1b4, 0x2718,
+        0xcb30, 0x2d9c, 0x9b34, 0x7d98, 0x6b38, 0x8d94, 0x3b3c, 0xdd90,
+        0x167c, 0xf0d0, 0x4678, 0xa0d4, 0xb674, 0x50d8, 0xe670, 0x00dc,
+        0x3c6c, 0xdac0, 0x6c68, 0x8ac4, 0x9c64, 0x7ac8, 0xcc60, 0x2acc,
+        0xe120, 0x078c, 0xb124, 0x5788, 0x4128, 0xa784, 0x112c, 0xf780,
+        0x1ba8, 0xfd04, 0x4bac, 0xad00, 0xbba0, 0x5d0c, 0xeba4, 0x0d08,
+        0xc6e4, 0x2048, 0x96e0, 0x704c, 0x66ec, 0x8040, 0x36e8, 0xd044,
+        0x73e4, 0x9548, 0x23e0, 0xc54c, 0xd3ec, 0x3540, 0x83e8, 0x6544,
+        0xaea8, 0x4804, 0xfeac, 0x1800, 0x0ea0, 0xe80c, 0x5ea4, 0xb808,
+        0x5420, 0xb28c, 0x0424, 0xe288, 0xf428, 0x1284, 0xa42c, 0x4280,
+        0x896c, 0x6fc0, 0xd968, 0x3fc4, 0x2964, 0xcfc8, 0x7960, 0x9fcc
+    }
+};
+
+/// Divide one more byte into the remainder
+static inline uint16_t crc_update_byte(uint16_t remainder, uint8_t byte)
+{
+    // The upper byte of the remainder and the new byte go through the division together,
+    // the lower byte is just shifted past it
+    return (uint16_t)(remainder << 8) ^ kCRC_table[0][(remainder >> 8) ^ byte];
+}
+
+/// Divide two more bytes into the remainder: both bytes of the remainder go through the division with them
+static inline uint16_t crc_update_pair(uint16_t remainder, uint8_t byte1, uint8_t byte2)
+{
+    uint16_t x = remainder ^ (uint16_t)((byte1 << 8) | byte2);
+    return kCRC_table[1][x >> 8] ^ kCRC_table[0][x & 0xFFu];
+}
+
+/// Divide single bits into the remainder, the byte holding them (aligned to its MSB) being already brought in
+static inline uint16_t crc_update_bits(uint16_t remainder, int num_bits)
+{
+    for (int i = 0; i < num_bits; ++i)
+    {
+        remainder = (remainder & TOPBIT) ? ((uint16_t)(remainder << 1) ^ POLYNOMIAL) : (uint16_t)(remainder << 1);
+    }
+    return remainder;
+}
 
 // Compute 14-bit CRC for a sequence of given number of bits
 // Adapted from https://barrgroup.com/Embedded-Systems/How-To/CRC-Calculation-C-Code
@@ -10,30 +111,38 @@
 uint16_t ftx_compute_crc(const uint8_t message[], int num_bits)
 {
     uint16_t remainder = 0;
-    int idx_byte = 0;
 
-    // Perform modulo-2 division, a bit at a time.
-    for (int idx_bit = 0; idx_bit < num_bits; ++idx_bit)
-    {
-        if (idx_bit % 8 == 0)
-        {
-            // Bring the next byte into the remainder.
-            remainder ^= (message[idx_byte] << (FT8_CRC_WIDTH - 8));
-            ++idx_byte;
-        }
-
-        // Try to divide the current data bit.
-        if (remainder & TOPBIT)
-        {
-            remainder = (remainder << 1) ^ FT8_CRC_POLYNOMIAL;
-        }
-        else
-        {
-            remainder = (remainder << 1);
-        }
+    // Perform modulo-2 division two bytes at a time, then the bits of the last partial byte one by one
+    int num_bytes = num_bits / 8;
+    int idx_byte = 0;
+    for (; idx_byte + 1 < num_bytes; idx_byte += 2)
+    {
+        remainder = crc_update_pair(remainder, message[idx_byte], message[idx_byte + 1]);
     }
+    if (idx_byte < num_bytes)
+    {
+        remainder = crc_update_byte(remainder, message[idx_byte]);
+    }
+    if (num_bits % 8 != 0)
+    {
+        remainder ^= (uint16_t)(message[num_bytes] << 8);
+        remainder = crc_update_bits(remainder, num_bits % 8);
+    }
+
+    return remainder >> (16 - FT8_CRC_WIDTH);
+}
 
-    return remainder & ((TOPBIT << 1) - 1u);
+uint16_t ftx_payload_crc(const uint8_t payload[])
+{
+    // 'The CRC is calculated on the source-encoded message, zero-extended from 77 to 82 bits':
+    // 9 whole bytes, the last 5 payload bits with 3 zeros, then 2 more zeros
+    uint16_t remainder = 0;
+    for (int i = 0; i < 8; i += 2)
+    {
+        remainder = crc_update_pair(remainder, payload[i], payload[i + 1]);
+    }
+    remainder = crc_update_pair(remainder, payload[8], payload[9] & 0xF8u);
+    return crc_update_bits(remainder, 2) >> (16 - FT8_CRC_WIDTH);
 }
 
 uint16_t ftx_extract_crc(const uint8_t a91[])
@@ -42,22 +151,34 @@ uint16_t ftx_extract_crc(const uint8_t a91[])
     return chksum;
 }
 
+bool ftx_check_crc(const uint8_t a91[])
+{
+    return ftx_payload_crc(a91) == ftx_extract_crc(a91);
+}
+
+int ftx_check_crc_many(const uint8_t a91[], int num_messages, bool valid[])
+{
+    int num_valid = 0;
+    for (int i = 0; i < num_messages; ++i)
+    {
+        const uint8_t* msg = a91 + i * FTX_LDPC_K_BYTES;
+        valid[i] = ftx_check_crc(msg);
+        num_valid += valid[i];
+    }
+    return num_valid;
+}
+
 void ftx_add_crc(const uint8_t payload[], uint8_t a91[])
 {
     // Copy 77 bits of payload data
     for (int i = 0; i < 10; i++)
         a91[i] = payload[i];
 
-    // Clear 3 bits after the payload to make 82 bits
-    a91[9] &= 0xF8u;
-    a91[10] = 0;
-
     // Calculate CRC of 82 bits (77 + 5 zeros)
-    // 'The CRC is calculated on the source-encoded message, zero-extended from 77 to 82 bits'
-    uint16_t checksum = ftx_compute_crc(a91, 96 - 14);
+    uint16_t checksum = ftx_payload_crc(payload);
 
     // Store the CRC at the end of 77 bit message
-    a91[9] |= (uint8_t)(checksum >> 11);
+    a91[9] = (a91[9] & 0xF8u) | (uint8_t)(checksum >> 11);
     a91[10] = (uint8_t)(checksum >> 3);
     a91[11] = (uint8_t)(checksum << 5);
 }
@@ -14,11 +14,28 @@ extern "C"
 // [IN] num_bits - number of bits in the sequence
 uint16_t ftx_compute_crc(const uint8_t message[], int num_bits);
 
+/// Compute the FT8/FT4 CRC of a payload: its 77 bits zero-extended to 82 bits, as the CRC is defined (the bits
+/// after the payload, e.g. the CRC of a packed message, are ignored, so this works on a91 in place)
+/// @param[in] payload 77 bits of payload data
+/// @return Computed CRC
+uint16_t ftx_payload_crc(const uint8_t payload[]);
+
 /// Extract the FT8/FT4 CRC of a packed message (during decoding)
 /// @param[in] a91 77 bits of payload data + CRC
 /// @return Extracted CRC
 uint16_t ftx_extract_crc(const uint8_t a91[]);
 
+/// Check the CRC of a packed message against its payload (during decoding)
+/// @param[in] a91 77 bits of payload data + CRC
+/// @return True if the CRC matches
+bool ftx_check_crc(const uint8_t a91[]);
+
+/// Check the CRCs of many packed messages
+/// @param[in] a91 num_messages packed messages of FTX_LDPC_K_BYTES (12) bytes each, one after another
+/// @param[out] valid Whether the CRC of every message matches
+/// @return Number of messages whose CRC matches
+int ftx_check_crc_many(const uint8_t a91[], int num_messages, bool valid[]);
+
 /// Add FT8/FT4 CRC to a packed message (during encoding)
 /// @param[in] payload 77 bits of payload data
 /// @param[out] a91 91 bits of payload data + CRC
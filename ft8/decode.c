@@ -4,25 +4,36 @@
 #include "ldpc.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 #include <math.h>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 // #define LOG_LEVEL LOG_DEBUG
 // #include "debug.h"
 
-// Lookup table for y = 10*log10(1 + 10^(x/10)), where
-//   y - increase in signal level dB when adding a weaker independent signal
-//   x - specific relative strength of the weaker signal in dB
-// Table index corresponds to x in dB (index 0: 0 dB, index 1: -1 dB etc)
-static const float db_power_sum[40] = {
-    3.01029995663981f, 2.53901891043867f, 2.1244260279434f, 1.76434862436485f, 1.45540463109294f,
-    1.19331048066095f, 0.973227937086954f, 0.790097496525665f, 0.638920341433796f, 0.514969420252302f,
-    0.413926851582251f, 0.331956199884278f, 0.265723755961025f, 0.212384019142551f, 0.16954289279533f,
-    0.135209221080382f, 0.10774225511957f, 0.085799992300358f, 0.06829128312453f, 0.054333142200458f,
-    0.043213737826426f, 0.034360947517284f, 0.027316043349389f, 0.021711921641451f, 0.017255250287928f,
-    0.013711928326833f, 0.010895305999614f, 0.008656680827934f, 0.006877654943187f, 0.005464004928574f,
-    0.004340774793186f, 0.003448354310253f, 0.002739348814965f, 0.002176083232619f, 0.001728613409904f,
-    0.001373142636584f, 0.001090761428665f, 0.000866444976964f, 0.000688255828734f, 0.000546709946839f
-};
+// Distance of the lowest 4-bit level below the per-block noise floor (in 0.5 dB units)
+#define FTX_WATERFALL_U4_FLOOR 8
+
+// Number of bins on either side searched for the lowest median when deriving the noise floor (100 Hz)
+#define FTX_NOISE_SPAN 16
+
+// SNR from the noise floor: ln(2), the lowest reported signal to noise ratio (linear), and the ratio of the noise
+// bandwidth of a waterfall bin to the 2500 Hz reference bandwidth in dB (about -27 dB, less some 5 dB because the
+// lowest nearby median reads low). The 5 dB are fit to WSJT-X over test/wav and test/wav/20m_busy together (mean
+// difference about 0 dB); the sets disagree, reading -3.5 dB and +1.3 dB on their own.
+#define FTX_LN2 0.693147f
+#define FTX_SNR_MIN_RATIO 0.001f
+#define FTX_SNR_BANDWIDTH_DB -32.0f
+
+// Variance of the normalized log likelihoods (experimentally found)
+#define FTX_LOGL_VARIANCE 24.0f
+
+// Variance of the normalized log likelihoods from multi-symbol metrics (experimentally found)
+#define MULTI_LOGL_VARIANCE 24.0f
 
 /// Compute log likelihood log(p(1) / p(0)) of 174 message bits for later use in soft-decision LDPC decoding
 /// @param[in] wf Waterfall data collected during message slot
@@ -40,30 +51,180 @@ static void ft8_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidat
 static void pack_bits(const uint8_t bit_array[], int num_bits, uint8_t packed[]);
 
 static float max2(float a, float b);
-static float max4(float a, float b, float c, float d);
 static void heapify_down(ftx_candidate_t heap[], int heap_size);
 static void heapify_up(ftx_candidate_t heap[], int heap_size);
+static void heap_insert(ftx_candidate_t heap[], int* heap_size, int num_candidates, const ftx_candidate_t* candidate);
 
-static void ftx_normalize_logl(float* log174);
-static void ft4_extract_symbol(const WF_ELEM_T* wf, float* logl);
-static void ft8_extract_symbol(const WF_ELEM_T* wf, float* logl);
-static void ft8_decode_multi_symbols(const WF_ELEM_T* wf, int num_bins, int n_syms, int bit_idx, float* log174);
+static void ft8_extract_likelihood_multi(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, int n_syms, float* log174);
+
+/// Run the LDPC decoder on normalized log likelihoods, check the CRC and fill the message payload
+static bool ftx_decode_logl(ftx_protocol_t protocol, float* log174, int max_iterations, uint8_t* plain174, ftx_message_t* message, ftx_decode_status_t* status);
+
+/// Turn the per-bin medians held in wf->noise into the noise floor map, in place
+static void noise_floor_from_medians(ftx_waterfall_t* wf)
+{
+    // Signals (and their keying sidebands) raise the medians of their own bins; take the lowest median nearby.
+    // The medians of the window are kept in a ring, as the floors overwrite them.
+    enum { kWindow = 2 * FTX_NOISE_SPAN + 1 };
+    uint8_t ring[kWindow];
+    for (int freq_sub = 0; freq_sub < wf->freq_osr; ++freq_sub)
+    {
+        uint8_t* noise = wf->noise + freq_sub * wf->num_bins;
+        for (int i = 0; (i < FTX_NOISE_SPAN) && (i < wf->num_bins); ++i)
+            ring[i % kWindow] = noise[i];
+        for (int bin = 0; bin < wf->num_bins; ++bin)
+        {
+            int lo = (bin > FTX_NOISE_SPAN) ? bin - FTX_NOISE_SPAN : 0;
+            int hi = (bin + FTX_NOISE_SPAN < wf->num_bins) ? bin + FTX_NOISE_SPAN : wf->num_bins - 1;
+            if (bin + FTX_NOISE_SPAN < wf->num_bins)
+                ring[hi % kWindow] = noise[hi];
+            int lowest = 255;
+            for (int i = lo; i <= hi; ++i)
+                lowest = (ring[i % kWindow] < lowest) ? ring[i % kWindow] : lowest;
+            noise[bin] = lowest;
+        }
+    }
+}
+
+void ftx_waterfall_set_noise(ftx_waterfall_t* wf, const uint8_t* medians)
+{
+    memcpy(wf->noise, medians, wf->freq_osr * wf->num_bins);
+    noise_floor_from_medians(wf);
+}
+
+void ftx_waterfall_update_noise(ftx_waterfall_t* wf)
+{
+    const int num_values = wf->num_blocks * wf->time_osr;
+    uint16_t histogram[256];
+    for (int freq_sub = 0; freq_sub < wf->freq_osr; ++freq_sub)
+    {
+        for (int bin = 0; bin < wf->num_bins; ++bin)
+        {
+            // Median of the history of the bin through a histogram of the magnitude codes
+            for (int i = 0; i < 256; ++i)
+                histogram[i] = 0;
+            for (int block = 0; block < wf->num_blocks; ++block)
+            {
+                for (int time_sub = 0; time_sub < wf->time_osr; ++time_sub)
+                {
+                    int idx = block * wf->block_stride + time_sub * wf->time_sub_stride + freq_sub * wf->freq_sub_stride + bin * wf->bin_stride;
+                    ++histogram[ftx_waterfall_get(wf, block, idx)];
+                }
+            }
+            int median = 0;
+            for (int count = 0; median < 255; ++median)
+            {
+                count += histogram[median];
+                if (2 * count > num_values)
+                    break;
+            }
+            wf->noise[freq_sub * wf->num_bins + bin] = median;
+        }
+    }
+    noise_floor_from_medians(wf);
+}
+
+/// Index of the magnitude of the lowest tone of the first symbol of a candidate.
+/// Further tones are bin_stride apart and further symbols block_stride apart, whatever the layout or format.
+static int get_cand_offset(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate)
+{
+    int offset = candidate->time_offset * wf->block_stride;
+    offset += candidate->time_sub * wf->time_sub_stride;
+    offset += candidate->freq_sub * wf->freq_sub_stride;
+    offset += candidate->freq_offset * wf->bin_stride;
+    return offset;
+}
+
+void ftx_waterfall_set(ftx_waterfall_t* wf, int block, int idx, int value)
+{
+    if (wf->format == FTX_WATERFALL_U4)
+    {
+        int scale = wf->block_scale[block];
+        int nibble = (value - wf->block_offset[block] + scale / 2) / scale;
+        nibble = (nibble < 0) ? 0 : ((nibble > 15) ? 15 : nibble);
+        int shift = (idx & 1) << 2;
+        wf->mag4[idx >> 1] = (wf->mag4[idx >> 1] & ~(0x0F << shift)) | (nibble << shift);
+    }
+    else
+    {
+        wf->mag[idx] = value;
+    }
+}
 
-static const WF_ELEM_T* get_cand_mag(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate)
+void ftx_waterfall_pack_block(ftx_waterfall_t* wf, int block, const uint8_t* values)
 {
-    int offset = candidate->time_offset;
-    offset = (offset * wf->time_osr) + candidate->time_sub;
-    offset = (offset * wf->freq_osr) + candidate->freq_sub;
-    offset = (offset * wf->num_bins) + candidate->freq_offset;
-    return wf->mag + offset;
+    const int num_values = wf->time_osr * wf->freq_osr * wf->num_bins;
+
+    // Place nibble 0 somewhat below the noise floor (the median of the block), so that the 16 levels
+    // are spent on the range where signals and their neighbors differ
+    int histogram[256] = { 0 };
+    int max_val = 0;
+    for (int i = 0; i < num_values; ++i)
+    {
+        ++histogram[values[i]];
+        if (values[i] > max_val)
+            max_val = values[i];
+    }
+    int median = 0;
+    for (int count = 0; median < 255; ++median)
+    {
+        count += histogram[median];
+        if (2 * count >= num_values)
+            break;
+    }
+    int offset = median - FTX_WATERFALL_U4_FLOOR;
+    if (offset < 0)
+        offset = 0;
+    int scale = (max_val - offset + 14) / 15;
+    if (scale < 1)
+        scale = 1;
+    // Keep the top nibble within the U8 range (readers index 256-entry tables with the decoded values)
+    if (offset + 15 * scale > 255)
+        offset = 255 - 15 * scale;
+    wf->block_offset[block] = offset;
+    wf->block_scale[block] = scale;
+
+    int i = 0;
+    for (int time_sub = 0; time_sub < wf->time_osr; ++time_sub)
+    {
+        for (int freq_sub = 0; freq_sub < wf->freq_osr; ++freq_sub)
+        {
+            int idx = (block * wf->block_stride) + (time_sub * wf->time_sub_stride) + (freq_sub * wf->freq_sub_stride);
+            for (int bin = 0; bin < wf->num_bins; ++bin)
+            {
+                ftx_waterfall_set(wf, block, idx, values[i++]);
+                idx += wf->bin_stride;
+            }
+        }
+    }
 }
 
 int ftx_get_snr(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate, uint8_t *tones, uint8_t n_tones) {
+    int n_items = (wf->protocol == FTX_PROTOCOL_FT8) ? 8 : 4;
+    int mag_cand = get_cand_offset(wf, candidate);
+    if (wf->noise != NULL)
+    {
+        // Average power of the transmitted tones relative to the noise floor of their bins
+        const uint8_t* noise = wf->noise + candidate->freq_sub * wf->num_bins + candidate->freq_offset;
+        float power = 0;
+        int num_average = 0;
+        for (int i = 0; i < n_tones; i++)
+        {
+            int block_abs = candidate->time_offset + i;
+            if ((block_abs < 0) || (block_abs >= wf->num_blocks))
+                continue;
+            int val = ftx_waterfall_get(wf, block_abs, mag_cand + (i * wf->block_stride) + tones[i] * wf->bin_stride);
+            power += powf(10.0f, (val - noise[tones[i]]) * 0.05f);
+            num_average++;
+        }
+        // The median of noise power is ln(2) times its mean; subtract the noise within the tone bins
+        float snr = (num_average > 0) ? (power / num_average) * FTX_LN2 - 1 : 0;
+        return (int)lrintf(10 * log10f((snr > FTX_SNR_MIN_RATIO) ? snr : FTX_SNR_MIN_RATIO) + FTX_SNR_BANDWIDTH_DB);
+    }
+
     int signal = 0;
     int noise = 0;
     int num_average = 0;
-    int n_items = (wf->protocol == FTX_PROTOCOL_FT8) ? 8 : 4;
-    const WF_ELEM_T* mag_cand = get_cand_mag(wf, candidate);
     for (int i = 0; i < n_tones; i++) {
 
         int block_abs = candidate->time_offset + i; // relative to the captured signal
@@ -73,16 +234,17 @@ int ftx_get_snr(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate, uin
         if (block_abs >= wf->num_blocks)
             break;
 
-        // Get the pointer to symbol 'block' of the candidate
-        const WF_ELEM_T* wf_el = mag_cand + (i * wf->block_stride);
+        // Get the index of symbol 'block' of the candidate
+        int wf_el = mag_cand + (i * wf->block_stride);
 
         int min_val = 255;
         for (int s = 0; s < n_items; s++) {
+            int val = ftx_waterfall_get(wf, block_abs, wf_el + s * wf->bin_stride);
             if (s == tones[i]) {
-                signal += wf_el[s];
+                signal += val;
             } else {
-                if (min_val > wf_el[s]) {
-                    min_val = wf_el[s];
+                if (min_val > val) {
+                    min_val = val;
                 }
             }
         }
@@ -93,11 +255,8 @@ int ftx_get_snr(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate, uin
 }
 
 int ftx_get_snr_and_mute(ftx_waterfall_t* wf, const ftx_candidate_t* candidate, uint8_t *tones, uint8_t n_tones) {
-    int signal = 0;
-    int noise = 0;
-    int num_average = 0;
-    int n_items = (wf->protocol == FTX_PROTOCOL_FT8) ? 8 : 4;
-    WF_ELEM_T* mag_cand = get_cand_mag(wf, candidate);
+    int snr = ftx_get_snr(wf, candidate, tones, n_tones);
+    int mag_cand = get_cand_offset(wf, candidate);
     for (int i = 0; i < n_tones; i++) {
 
         int block_abs = candidate->time_offset + i; // relative to the captured signal
@@ -107,40 +266,30 @@ int ftx_get_snr_and_mute(ftx_waterfall_t* wf, const ftx_candidate_t* candidate,
         if (block_abs >= wf->num_blocks)
             break;
 
-        // Get the pointer to symbol 'block' of the candidate
-        WF_ELEM_T* wf_el = mag_cand + (i * wf->block_stride);
-
-        int min_val = 255;
-        for (int s = 0; s < n_items; s++) {
-            if (s == tones[i]) {
-                signal += wf_el[s];
-            } else {
-                if (min_val > wf_el[s]) {
-                    min_val = wf_el[s];
-                }
-            }
-        }
-        noise += min_val;
-        num_average++;
+        // Get the index of symbol 'block' of the candidate
+        int wf_el = mag_cand + (i * wf->block_stride);
 
         // Mute
+        const int bs = wf->bin_stride;
+        int muted;
         if (tones[i] == 0)
-            wf_el[0] = wf_el[1];
+            muted = ftx_waterfall_get(wf, block_abs, wf_el + bs);
         else if (tones[i] == 7)
-            wf_el[7] = wf_el[6];
+            muted = ftx_waterfall_get(wf, block_abs, wf_el + 6 * bs);
         else
-            wf_el[tones[i]] = wf_el[tones[i]+1] / 2 + wf_el[tones[i]-1] / 2;
+            muted = ftx_waterfall_get(wf, block_abs, wf_el + (tones[i] + 1) * bs) / 2 + ftx_waterfall_get(wf, block_abs, wf_el + (tones[i] - 1) * bs) / 2;
+        ftx_waterfall_set(wf, block_abs, wf_el + tones[i] * bs, muted);
     }
-    return (signal - noise) / (2 * num_average) - 26;
+    return snr;
 }
 
-static int ft8_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate)
+static inline int ft8_sync_score_as(const ftx_waterfall_t* wf, ftx_waterfall_format_t format, const ftx_candidate_t* candidate)
 {
     int score = 0;
     int num_average = 0;
 
-    // Get the pointer to symbol 0 of the candidate
-    const WF_ELEM_T* mag_cand = get_cand_mag(wf, candidate);
+    // Get the index of symbol 0 of the candidate
+    int mag_cand = get_cand_offset(wf, candidate);
 
     // Compute average score over sync symbols (m+k = 0-7, 36-43, 72-79)
     for (int m = 0; m < FT8_NUM_SYNC; ++m)
@@ -155,8 +304,8 @@ static int ft8_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
             if (block_abs >= wf->num_blocks)
                 break;
 
-            // Get the pointer to symbol 'block' of the candidate
-            const WF_ELEM_T* p8 = mag_cand + (block * wf->block_stride);
+            // Get the index of symbol 'block' of the candidate
+            int p8 = mag_cand + (block * wf->block_stride);
 
             // Weighted difference between the expected and all other symbols
             // Does not work as well as the alternative score below
@@ -167,28 +316,30 @@ static int ft8_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
 
             // Check only the neighbors of the expected symbol frequency- and time-wise
             int sm = kFT8_Costas_pattern[k]; // Index of the expected bin
+            int sm_offset = sm * wf->bin_stride;
+            int sm_mag = ftx_waterfall_get_as(wf, format, block_abs, p8 + sm_offset);
             if (sm > 0)
             {
                 // look at one frequency bin lower
-                score += WF_ELEM_MAG_INT(p8[sm]) - WF_ELEM_MAG_INT(p8[sm - 1]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs, p8 + sm_offset - wf->bin_stride);
                 ++num_average;
             }
             if (sm < 7)
             {
                 // look at one frequency bin higher
-                score += WF_ELEM_MAG_INT(p8[sm]) - WF_ELEM_MAG_INT(p8[sm + 1]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs, p8 + sm_offset + wf->bin_stride);
                 ++num_average;
             }
             if ((k > 0) && (block_abs > 0))
             {
                 // look one symbol back in time
-                score += WF_ELEM_MAG_INT(p8[sm]) - WF_ELEM_MAG_INT(p8[sm - wf->block_stride]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs - 1, p8 + sm_offset - wf->block_stride);
                 ++num_average;
             }
             if (((k + 1) < FT8_LENGTH_SYNC) && ((block_abs + 1) < wf->num_blocks))
             {
                 // look one symbol forward in time
-                score += WF_ELEM_MAG_INT(p8[sm]) - WF_ELEM_MAG_INT(p8[sm + wf->block_stride]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs + 1, p8 + sm_offset + wf->block_stride);
                 ++num_average;
             }
         }
@@ -199,13 +350,13 @@ static int ft8_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
     return score;
 }
 
-static int ft4_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate)
+static inline int ft4_sync_score_as(const ftx_waterfall_t* wf, ftx_waterfall_format_t format, const ftx_candidate_t* candidate)
 {
     int score = 0;
     int num_average = 0;
 
-    // Get the pointer to symbol 0 of the candidate
-    const WF_ELEM_T* mag_cand = get_cand_mag(wf, candidate);
+    // Get the index of symbol 0 of the candidate
+    int mag_cand = get_cand_offset(wf, candidate);
 
     // Compute average score over sync symbols (block = 1-4, 34-37, 67-70, 100-103)
     for (int m = 0; m < FT4_NUM_SYNC; ++m)
@@ -220,10 +371,12 @@ static int ft4_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
             if (block_abs >= wf->num_blocks)
                 break;
 
-            // Get the pointer to symbol 'block' of the candidate
-            const WF_ELEM_T* p4 = mag_cand + (block * wf->block_stride);
+            // Get the index of symbol 'block' of the candidate
+            int p4 = mag_cand + (block * wf->block_stride);
 
             int sm = kFT4_Costas_pattern[m][k]; // Index of the expected bin
+            int sm_offset = sm * wf->bin_stride;
+            int sm_mag = ftx_waterfall_get_as(wf, format, block_abs, p4 + sm_offset);
 
             // score += (4 * p4[sm]) - p4[0] - p4[1] - p4[2] - p4[3];
             // num_average += 4;
@@ -232,25 +385,25 @@ static int ft4_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
             if (sm > 0)
             {
                 // look at one frequency bin lower
-                score += WF_ELEM_MAG_INT(p4[sm]) - WF_ELEM_MAG_INT(p4[sm - 1]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs, p4 + sm_offset - wf->bin_stride);
                 ++num_average;
             }
             if (sm < 3)
             {
                 // look at one frequency bin higher
-                score += WF_ELEM_MAG_INT(p4[sm]) - WF_ELEM_MAG_INT(p4[sm + 1]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs, p4 + sm_offset + wf->bin_stride);
                 ++num_average;
             }
             if ((k > 0) && (block_abs > 0))
             {
                 // look one symbol back in time
-                score += WF_ELEM_MAG_INT(p4[sm]) - WF_ELEM_MAG_INT(p4[sm - wf->block_stride]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs - 1, p4 + sm_offset - wf->block_stride);
                 ++num_average;
             }
             if (((k + 1) < FT4_LENGTH_SYNC) && ((block_abs + 1) < wf->num_blocks))
             {
                 // look one symbol forward in time
-                score += WF_ELEM_MAG_INT(p4[sm]) - WF_ELEM_MAG_INT(p4[sm + wf->block_stride]);
+                score += sm_mag - ftx_waterfall_get_as(wf, format, block_abs + 1, p4 + sm_offset + wf->block_stride);
                 ++num_average;
             }
         }
@@ -262,24 +415,114 @@ static int ft4_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
     return score;
 }
 
-int ftx_find_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candidate_t heap[], int min_score)
+/// Dispatch on the storage format once per candidate rather than once per element
+static int ft8_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate)
 {
-    int (*sync_fun)(const ftx_waterfall_t*, const ftx_candidate_t*) = (wf->protocol == FTX_PROTOCOL_FT4) ? ft4_sync_score : ft8_sync_score;
-    int num_tones;
-    int time_offset_min;
-    int time_offset_max;
+    if (wf->format == FTX_WATERFALL_U4)
+        return ft8_sync_score_as(wf, FTX_WATERFALL_U4, candidate);
+    return ft8_sync_score_as(wf, FTX_WATERFALL_U8, candidate);
+}
 
+static int ft4_sync_score(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate)
+{
+    if (wf->format == FTX_WATERFALL_U4)
+        return ft4_sync_score_as(wf, FTX_WATERFALL_U4, candidate);
+    return ft4_sync_score_as(wf, FTX_WATERFALL_U8, candidate);
+}
+
+/// Number of tones and range of time offsets searched for candidates
+static void get_search_range(const ftx_waterfall_t* wf, int* num_tones, int* time_offset_min, int* time_offset_max)
+{
     if (wf->protocol == FTX_PROTOCOL_FT4) {
-        num_tones = 4;
-        time_offset_min = -FT4_LENGTH_SYNC;
-        time_offset_max = FT4_SLOT_TIME / FT4_SYMBOL_PERIOD - FT4_NN + FT4_LENGTH_SYNC;
+        *num_tones = 4;
+        *time_offset_min = -FT4_LENGTH_SYNC;
+        *time_offset_max = FT4_SLOT_TIME / FT4_SYMBOL_PERIOD - FT4_NN + FT4_LENGTH_SYNC;
     } else {
-        num_tones = 8;
-        time_offset_min = -FT8_LENGTH_SYNC;
-        time_offset_max = FT8_SLOT_TIME / FT8_SYMBOL_PERIOD - FT8_NN + FT8_LENGTH_SYNC;
+        *num_tones = 8;
+        *time_offset_min = -FT8_LENGTH_SYNC;
+        *time_offset_max = FT8_SLOT_TIME / FT8_SYMBOL_PERIOD - FT8_NN + FT8_LENGTH_SYNC;
     }
+}
+
+/// Bit mask of the time tiles within a range of blocks
+static uint32_t dirty_time_mask(int first_block, int last_block)
+{
+    uint32_t first_bit = ftx_waterfall_dirty_bit(first_block);
+    uint32_t last_bit = ftx_waterfall_dirty_bit(last_block);
+    return (last_bit - first_bit) | last_bit;
+}
+
+/// Union of the time tile masks of the frequency tiles covering a range of bins
+static uint32_t dirty_freq_mask(const ftx_waterfall_t* wf, int first_bin, int last_bin)
+{
+    first_bin = (first_bin < 0) ? 0 : first_bin;
+    last_bin = (last_bin >= wf->num_bins) ? (wf->num_bins - 1) : last_bin;
+    uint32_t mask = 0;
+    for (int tile = first_bin / FTX_DIRTY_TILE_BINS; tile <= last_bin / FTX_DIRTY_TILE_BINS; ++tile)
+    {
+        mask |= wf->dirty[tile];
+    }
+    return mask;
+}
+
+void ftx_waterfall_mark_dirty(ftx_waterfall_t* wf, int first_block, int last_block, int first_bin, int last_bin)
+{
+    if (wf->dirty == NULL)
+        return;
+    first_bin = (first_bin < 0) ? 0 : first_bin;
+    last_bin = (last_bin >= wf->num_bins) ? (wf->num_bins - 1) : last_bin;
+    uint32_t mask = dirty_time_mask(first_block, last_block);
+    for (int tile = first_bin / FTX_DIRTY_TILE_BINS; tile <= last_bin / FTX_DIRTY_TILE_BINS; ++tile)
+    {
+        wf->dirty[tile] |= mask;
+    }
+}
+
+void ftx_waterfall_clear_dirty(ftx_waterfall_t* wf)
+{
+    if (wf->dirty == NULL)
+        return;
+    const int num_tiles = (wf->num_bins + FTX_DIRTY_TILE_BINS - 1) / FTX_DIRTY_TILE_BINS;
+    for (int tile = 0; tile < num_tiles; ++tile)
+    {
+        wf->dirty[tile] = 0;
+    }
+}
+
+bool ftx_waterfall_is_dirty(const ftx_waterfall_t* wf, int first_block, int last_block, int first_bin, int last_bin)
+{
+    if (wf->dirty == NULL)
+        return true;
+    return (dirty_freq_mask(wf, first_bin, last_bin) & dirty_time_mask(first_block, last_block)) != 0;
+}
+
+bool ftx_candidate_is_dirty(const ftx_waterfall_t* wf, const ftx_candidate_t* cand)
+{
+    // Sync scores and symbol metrics only look at the candidate's own tones during its own message
+    int num_tones, time_offset_min, time_offset_max;
+    get_search_range(wf, &num_tones, &time_offset_min, &time_offset_max);
+    const int num_symbols = (wf->protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
+    return ftx_waterfall_is_dirty(wf, cand->time_offset, cand->time_offset + num_symbols - 1, cand->freq_offset, cand->freq_offset + num_tones - 1);
+}
+
+/// Dirty time tiles of a range of bins that spans at most two frequency tiles (the tones of a candidate, or of all
+/// candidates that start within one tile)
+static inline uint32_t span_dirty_mask(const uint32_t* dirty, int first_bin, int num_bins)
+{
+    return dirty[first_bin / FTX_DIRTY_TILE_BINS] | dirty[(first_bin + num_bins - 1) / FTX_DIRTY_TILE_BINS];
+}
+
+/// Score candidate positions into the heap, either all of them or (only_dirty) those that depend on dirty tiles
+static void scan_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candidate_t heap[], int* heap_size, int min_score, bool only_dirty)
+{
+    int (*sync_fun)(const ftx_waterfall_t*, const ftx_candidate_t*) = (wf->protocol == FTX_PROTOCOL_FT4) ? ft4_sync_score : ft8_sync_score;
+    const int num_symbols = (wf->protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
+    int num_tones;
+    int time_offset_min;
+    int time_offset_max;
+    get_search_range(wf, &num_tones, &time_offset_min, &time_offset_max);
+    const uint32_t* dirty = wf->dirty;
 
-    int heap_size = 0;
     ftx_candidate_t candidate;
 
     // Here we allow time offsets that exceed signal boundaries, as long as we still have all data bits.
@@ -289,36 +532,54 @@ int ftx_find_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candi
     {
         for (candidate.freq_sub = 0; candidate.freq_sub < wf->freq_osr; ++candidate.freq_sub)
         {
-            for (candidate.time_offset = time_offset_min; candidate.time_offset < time_offset_max; ++candidate.time_offset)
+            if (wf->layout == FTX_WATERFALL_FREQ_MAJOR)
             {
+                // Walk along time at a fixed frequency, following the memory order
                 for (candidate.freq_offset = 0; (candidate.freq_offset + num_tones - 1) < wf->num_bins; ++candidate.freq_offset)
                 {
-                    candidate.score = sync_fun(wf, &candidate);
-                    if (candidate.score < min_score)
+                    uint32_t freq_mask = only_dirty ? span_dirty_mask(dirty, candidate.freq_offset, num_tones) : ~0u;
+                    if (freq_mask == 0)
                         continue;
-
-                    // If the heap is full AND the current candidate is better than
-                    // the worst in the heap, we remove the worst and make space
-                    if ((heap_size == num_candidates) && (candidate.score > heap[0].score))
+                    for (candidate.time_offset = time_offset_min; candidate.time_offset < time_offset_max; ++candidate.time_offset)
                     {
-                        --heap_size;
-                        heap[0] = heap[heap_size];
-                        heapify_down(heap, heap_size);
+                        if (!(freq_mask & dirty_time_mask(candidate.time_offset, candidate.time_offset + num_symbols - 1)))
+                            continue;
+                        candidate.score = sync_fun(wf, &candidate);
+                        if (candidate.score >= min_score)
+                            heap_insert(heap, heap_size, num_candidates, &candidate);
                     }
-
-                    // If there's free space in the heap, we add the current candidate
-                    if (heap_size < num_candidates)
+                }
+            }
+            else
+            {
+                const int num_freq_offsets = wf->num_bins - num_tones + 1;
+                for (candidate.time_offset = time_offset_min; candidate.time_offset < time_offset_max; ++candidate.time_offset)
+                {
+                    uint32_t time_mask = dirty_time_mask(candidate.time_offset, candidate.time_offset + num_symbols - 1);
+                    // A frequency tile at a time: the candidates starting in it reach at most into the next one
+                    for (int tile_start = 0; tile_start < num_freq_offsets; tile_start += FTX_DIRTY_TILE_BINS)
                     {
-                        heap[heap_size] = candidate;
-                        ++heap_size;
-                        heapify_up(heap, heap_size);
+                        const int tile_end = (tile_start + FTX_DIRTY_TILE_BINS < num_freq_offsets) ? (tile_start + FTX_DIRTY_TILE_BINS) : num_freq_offsets;
+                        if (only_dirty && !(span_dirty_mask(dirty, tile_start, tile_end - tile_start + num_tones - 1) & time_mask))
+                            continue;
+                        for (candidate.freq_offset = tile_start; candidate.freq_offset < tile_end; ++candidate.freq_offset)
+                        {
+                            if (only_dirty && !(span_dirty_mask(dirty, candidate.freq_offset, num_tones) & time_mask))
+                                continue;
+                            candidate.score = sync_fun(wf, &candidate);
+                            if (candidate.score >= min_score)
+                                heap_insert(heap, heap_size, num_candidates, &candidate);
+                        }
                     }
                 }
             }
         }
     }
+}
 
-    // Sort the candidates by sync strength - here we benefit from the heap structure
+/// Sort the candidates by sync strength - here we benefit from the heap structure
+static void sort_candidates(ftx_candidate_t heap[], int heap_size)
+{
     int len_unsorted = heap_size;
     while (len_unsorted > 1)
     {
@@ -332,87 +593,173 @@ int ftx_find_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candi
         len_unsorted--;
         heapify_down(heap, len_unsorted);
     }
+}
 
+int ftx_find_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candidate_t heap[], int min_score)
+{
+    int heap_size = 0;
+    scan_candidates(wf, num_candidates, heap, &heap_size, min_score, false);
+    sort_candidates(heap, heap_size);
     return heap_size;
 }
 
-static void ft4_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174)
+int ftx_update_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candidate_t heap[], int num_found, int min_score)
 {
-    const WF_ELEM_T* mag = get_cand_mag(wf, cand); // Pointer to 4 magnitude bins of the first symbol
+    if (wf->dirty == NULL)
+        return ftx_find_candidates(wf, num_candidates, heap, min_score);
 
-    // Go over FSK tones and skip Costas sync symbols
-    for (int k = 0; k < FT4_ND; ++k)
+    // Keep the candidates whose scores still hold. The heap grows behind the read position, so it is rebuilt in place.
+    int heap_size = 0;
+    for (int i = 0; i < num_found; ++i)
     {
-        // Skip either 5, 9 or 13 sync symbols
-        // TODO: replace magic numbers with constants
-        int sym_idx = k + ((k < 29) ? 5 : ((k < 58) ? 9 : 13));
-        int bit_idx = 2 * k;
+        ftx_candidate_t candidate = heap[i];
+        if (!ftx_candidate_is_dirty(wf, &candidate))
+            heap_insert(heap, &heap_size, num_candidates, &candidate);
+    }
 
-        // Check for time boundaries
-        int block = cand->time_offset + sym_idx;
+    scan_candidates(wf, num_candidates, heap, &heap_size, min_score, true);
+    sort_candidates(heap, heap_size);
+    return heap_size;
+}
+
+#define MAX2I(a, b) (((a) >= (b)) ? (a) : (b))
+
+/// Gather the magnitudes (in 0.5 dB units) of a candidate's data symbols in tone-major order: s2[j * num_data + k]
+/// holds the tone with Gray code j of data symbol k. Symbols outside the waterfall read as zero, which makes
+/// their bit metrics zero.
+static inline void gather_data_symbols(const ftx_waterfall_t* wf, ftx_waterfall_format_t format, const ftx_candidate_t* cand,
+    const uint8_t* sym_pos, int num_data, const uint8_t* gray_map, int num_tones, int16_t* s2)
+{
+    const int base = get_cand_offset(wf, cand);
+    // Magnitudes below the noise floor of their bin carry no information about the tone: clip them to the floor
+    int tone_floor[8] = { 0 };
+    if (wf->noise != NULL)
+    {
+        const uint8_t* noise = wf->noise + cand->freq_sub * wf->num_bins + cand->freq_offset;
+        for (int j = 0; j < num_tones; ++j)
+            tone_floor[j] = noise[gray_map[j]];
+    }
+    for (int k = 0; k < num_data; ++k)
+    {
+        int block = cand->time_offset + sym_pos[k];
         if ((block < 0) || (block >= wf->num_blocks))
         {
-            log174[bit_idx + 0] = 0;
-            log174[bit_idx + 1] = 0;
+            for (int j = 0; j < num_tones; ++j)
+                s2[j * num_data + k] = 0;
+            continue;
         }
-        else
+        int idx = base + sym_pos[k] * wf->block_stride;
+        for (int j = 0; j < num_tones; ++j)
         {
-            ft4_extract_symbol(mag + (sym_idx * wf->block_stride), log174 + bit_idx);
+            int value = ftx_waterfall_get_as(wf, format, block, idx + gray_map[j] * wf->bin_stride);
+            s2[j * num_data + k] = MAX2I(value, tone_floor[j]);
         }
     }
 }
 
-static void ft8_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174)
+static void gather_data_symbols_any(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, const uint8_t* sym_pos, int num_data,
+    const uint8_t* gray_map, int num_tones, int16_t* s2)
 {
-    const WF_ELEM_T* mag = get_cand_mag(wf, cand); // Pointer to 8 magnitude bins of the first symbol
+    if (wf->format == FTX_WATERFALL_U4)
+        gather_data_symbols(wf, FTX_WATERFALL_U4, cand, sym_pos, num_data, gray_map, num_tones, s2);
+    else
+        gather_data_symbols(wf, FTX_WATERFALL_U8, cand, sym_pos, num_data, gray_map, num_tones, s2);
+}
 
-    // Go over FSK tones and skip Costas sync symbols
-    for (int k = 0; k < FT8_ND; ++k)
+/// Convert integer bit metrics (in 0.5 dB units) into normalized log likelihoods. Same as scaling by 0.5 and normalizing
+/// the variance in float, with bit-identical results: the metric sums are exact in integers,
+/// and in float they are exact as well for the possible magnitude range.
+/// The scale comes from the candidate's own metrics, not from the noise floor map: scaling by the level over the
+/// floor lost 1-4% recall at every setting tried. The map only clips the tone magnitudes (gather_data_symbols()).
+/// @param[in] metric Bit metrics, metric[b * num_symbols + k] for bit b of symbol k
+static void ftx_scale_logl(const int16_t* metric, int num_symbols, int bits_per_symbol, int32_t sum, int32_t sum2, float* log174)
+{
+    float fsum = 0.5f * sum;
+    float fsum2 = 0.25f * sum2;
+    float inv_n = 1.0f / FTX_LDPC_N;
+    float variance = (fsum2 - (fsum * fsum * inv_n)) * inv_n;
+    float norm_factor = sqrtf(FTX_LOGL_VARIANCE / variance);
+    for (int k = 0; k < num_symbols; ++k)
     {
-        // Skip either 7 or 14 sync symbols
-        // TODO: replace magic numbers with constants
-        int sym_idx = k + ((k < 29) ? 7 : 14);
-        int bit_idx = 3 * k;
-
-        // Check for time boundaries
-        int block = cand->time_offset + sym_idx;
-        if ((block < 0) || (block >= wf->num_blocks))
+        for (int b = 0; b < bits_per_symbol; ++b)
         {
-            log174[bit_idx + 0] = 0;
-            log174[bit_idx + 1] = 0;
-            log174[bit_idx + 2] = 0;
-        }
-        else
-        {
-            ft8_extract_symbol(mag + (sym_idx * wf->block_stride), log174 + bit_idx);
+            log174[bits_per_symbol * k + b] = (0.5f * metric[b * num_symbols + k]) * norm_factor;
         }
     }
 }
 
-static void ftx_normalize_logl(float* log174)
+// The magnitude codes are affine in dB (0.5 dB per step), so the max/difference metrics are computed on the codes
+// themselves, in int16 arrays laid out for vector max instructions, and converted to float once at the end.
+
+static void ft4_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174)
 {
-    // Compute the variance of log174
-    float sum = 0;
-    float sum2 = 0;
-    for (int i = 0; i < FTX_LDPC_N; ++i)
+    // Data symbols follow the ramp symbol and skip 4 sync symbols after every 29 of them
+    uint8_t sym_pos[FT4_ND];
+    for (int k = 0; k < FT4_ND; ++k)
+        sym_pos[k] = k + ((k < 29) ? 5 : ((k < 58) ? 9 : 13));
+
+    int16_t s2[4 * FT4_ND];
+    gather_data_symbols_any(wf, cand, sym_pos, FT4_ND, kFT4_Gray_map, 4, s2);
+
+    int16_t metric[2 * FT4_ND];
+    int32_t sum = 0;
+    int32_t sum2 = 0;
+    const int16_t* t0 = s2;
+    const int16_t* t1 = s2 + FT4_ND;
+    const int16_t* t2 = s2 + 2 * FT4_ND;
+    const int16_t* t3 = s2 + 3 * FT4_ND;
+    for (int k = 0; k < FT4_ND; ++k)
     {
-        sum += log174[i];
-        sum2 += log174[i] * log174[i];
+        int16_t m0 = MAX2I(t2[k], t3[k]) - MAX2I(t0[k], t1[k]);
+        int16_t m1 = MAX2I(t1[k], t3[k]) - MAX2I(t0[k], t2[k]);
+        metric[k] = m0;
+        metric[FT4_ND + k] = m1;
+        sum += m0 + m1;
+        sum2 += m0 * m0 + m1 * m1;
     }
-    float inv_n = 1.0f / FTX_LDPC_N;
-    float variance = (sum2 - (sum * sum * inv_n)) * inv_n;
+    ftx_scale_logl(metric, FT4_ND, 2, sum, sum2, log174);
+}
 
-    // Normalize log174 distribution and scale it with experimentally found coefficient
-    float norm_factor = sqrtf(24.0f / variance);
-    for (int i = 0; i < FTX_LDPC_N; ++i)
+static void ft8_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174)
+{
+    // Data symbols skip the 7 Costas sync symbols before, between and after the two halves of 29
+    uint8_t sym_pos[FT8_ND];
+    for (int k = 0; k < FT8_ND; ++k)
+        sym_pos[k] = k + ((k < 29) ? 7 : 14);
+
+    int16_t s2[8 * FT8_ND];
+    gather_data_symbols_any(wf, cand, sym_pos, FT8_ND, kFT8_Gray_map, 8, s2);
+
+    int16_t metric[3 * FT8_ND];
+    int32_t sum = 0;
+    int32_t sum2 = 0;
+    const int16_t* t[8];
+    for (int j = 0; j < 8; ++j)
+        t[j] = s2 + j * FT8_ND;
+    for (int k = 0; k < FT8_ND; ++k)
     {
-        log174[i] *= norm_factor;
+        int16_t max01 = MAX2I(t[0][k], t[1][k]);
+        int16_t max23 = MAX2I(t[2][k], t[3][k]);
+        int16_t max45 = MAX2I(t[4][k], t[5][k]);
+        int16_t max67 = MAX2I(t[6][k], t[7][k]);
+        int16_t max02 = MAX2I(t[0][k], t[2][k]);
+        int16_t max13 = MAX2I(t[1][k], t[3][k]);
+        int16_t max46 = MAX2I(t[4][k], t[6][k]);
+        int16_t max57 = MAX2I(t[5][k], t[7][k]);
+        int16_t m0 = MAX2I(max45, max67) - MAX2I(max01, max23);
+        int16_t m1 = MAX2I(max23, max67) - MAX2I(max01, max45);
+        int16_t m2 = MAX2I(max13, max57) - MAX2I(max02, max46);
+        metric[k] = m0;
+        metric[FT8_ND + k] = m1;
+        metric[2 * FT8_ND + k] = m2;
+        sum += m0 + m1 + m2;
+        sum2 += m0 * m0 + m1 * m1 + m2 * m2;
     }
+    ftx_scale_logl(metric, FT8_ND, 3, sum, sum2, log174);
 }
 
-bool ftx_decode_candidate(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, int max_iterations, ftx_message_t* message, ftx_decode_status_t* status)
+void ftx_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174)
 {
-    float log174[FTX_LDPC_N]; // message bits encoded as likelihood
     if (wf->protocol == FTX_PROTOCOL_FT4)
     {
         ft4_extract_likelihood(wf, cand, log174);
@@ -421,10 +768,138 @@ bool ftx_decode_candidate(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
     {
         ft8_extract_likelihood(wf, cand, log174);
     }
+}
+
+bool ftx_decode_candidate(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, int max_iterations, ftx_message_t* message, ftx_decode_status_t* status)
+{
+    float log174[FTX_LDPC_N]; // message bits encoded as likelihood
+    ftx_extract_likelihood(wf, cand, log174);
+
+    uint8_t plain174[FTX_LDPC_N]; // message bits (0/1)
+    return ftx_decode_logl(wf->protocol, log174, max_iterations, plain174, message, status);
+}
+
+bool ftx_decode_candidate_multi(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, int num_symbols, int max_iterations, ftx_message_t* message, ftx_decode_status_t* status)
+{
+    status->ldpc_errors = 0;
+    status->crc_extracted = 0;
+    status->crc_calculated = 0;
+    if ((wf->cpx == NULL) || (wf->protocol != FTX_PROTOCOL_FT8) || (num_symbols < 1) || (num_symbols > 3))
+    {
+        return false;
+    }
 
-    ftx_normalize_logl(log174);
+    float log174[FTX_LDPC_N]; // message bits encoded as likelihood
+    ft8_extract_likelihood_multi(wf, cand, num_symbols, log174);
 
     uint8_t plain174[FTX_LDPC_N]; // message bits (0/1)
+    return ftx_decode_logl(wf->protocol, log174, max_iterations, plain174, message, status);
+}
+
+ftx_message_rc_t ftx_ap_hypothesis_std(ftx_ap_hypothesis_t* hyp, ftx_callsign_hash_interface_t* hash_if, const char* call_to, const char* call_de, const char* extra)
+{
+    // Pack the known fields, with placeholders for the unknown ones
+    ftx_message_t msg;
+    ftx_message_rc_t rc = ftx_message_encode_std(&msg, hash_if, (call_to != NULL) ? call_to : "CQ", (call_de != NULL) ? call_de : "K1ABC", (extra != NULL) ? extra : "");
+    if (rc != FTX_MESSAGE_RC_OK)
+    {
+        return rc;
+    }
+
+    // Payload bits: n29a 0..28, n29b 29..57, ir + igrid4 58..73, i3 74..76
+    uint8_t bits[FTX_PAYLOAD_LENGTH_BYTES * 8] = { 0 };
+    for (int i = 0; i < 29; ++i)
+    {
+        bits[i] = (call_to != NULL);
+        bits[29 + i] = (call_de != NULL);
+    }
+    for (int i = 58; i < 74; ++i)
+    {
+        bits[i] = (extra != NULL);
+    }
+    for (int i = 74; i < 77; ++i)
+    {
+        bits[i] = 1;
+    }
+    memcpy(hyp->payload, msg.payload, FTX_PAYLOAD_LENGTH_BYTES);
+    pack_bits(bits, FTX_PAYLOAD_LENGTH_BYTES * 8, hyp->mask);
+    return FTX_MESSAGE_RC_OK;
+}
+
+int ftx_decode_candidate_ap(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, const ftx_ap_hypothesis_t* hyps, int num_hyps,
+    int max_iterations, ftx_message_t* message, ftx_decode_status_t* status)
+{
+    float log174[FTX_LDPC_N]; // message bits encoded as likelihood
+    ftx_extract_likelihood(wf, cand, log174);
+
+    // Known bits get a likelihood above any measured one, so that LDPC trusts them over the others
+    float ap_mag = 0;
+    for (int i = 0; i < FTX_LDPC_N; ++i)
+    {
+        ap_mag = max2(ap_mag, fabsf(log174[i]));
+    }
+    ap_mag *= 1.01f;
+
+    int best_idx = -1;
+    int best_errors = FTX_AP_MAX_HARD_ERRORS + 1;
+    for (int k = 0; k < num_hyps; ++k)
+    {
+        const ftx_ap_hypothesis_t* hyp = &hyps[k];
+
+        // The codeword carries the payload as it is (for FT4 scrambled), MSB first
+        float log174_ap[FTX_LDPC_N];
+        memcpy(log174_ap, log174, sizeof(log174));
+        for (int i = 0; i < 77; ++i)
+        {
+            uint8_t bit_mask = 0x80u >> (i % 8);
+            if (hyp->mask[i / 8] & bit_mask)
+            {
+                uint8_t value = hyp->payload[i / 8];
+                if (wf->protocol == FTX_PROTOCOL_FT4)
+                {
+                    value ^= kFT4_XOR_sequence[i / 8];
+                }
+                log174_ap[i] = (value & bit_mask) ? ap_mag : -ap_mag;
+            }
+        }
+
+        ftx_message_t hyp_message;
+        ftx_decode_status_t hyp_status;
+        uint8_t plain174[FTX_LDPC_N];
+        bool ok = ftx_decode_logl(wf->protocol, log174_ap, max_iterations, plain174, &hyp_message, &hyp_status);
+
+        // The decode must keep the known bits...
+        for (int i = 0; ok && (i < FTX_PAYLOAD_LENGTH_BYTES); ++i)
+        {
+            ok = (((hyp_message.payload[i] ^ hyp->payload[i]) & hyp->mask[i]) == 0);
+        }
+        // ... and stay close to what was received
+        int num_errors = 0;
+        for (int i = 0; ok && (i < FTX_LDPC_N); ++i)
+        {
+            if ((log174[i] > 0) != (plain174[i] != 0))
+            {
+                ++num_errors;
+            }
+        }
+
+        if (ok && (num_errors < best_errors))
+        {
+            best_idx = k;
+            best_errors = num_errors;
+            *message = hyp_message;
+            *status = hyp_status;
+        }
+        else if (best_idx < 0)
+        {
+            *status = hyp_status;
+        }
+    }
+    return best_idx;
+}
+
+static bool ftx_decode_logl(ftx_protocol_t protocol, float* log174, int max_iterations, uint8_t* plain174, ftx_message_t* message, ftx_decode_status_t* status)
+{
     bp_decode(log174, max_iterations, plain174, &status->ldpc_errors);
     // ldpc_decode(log174, max_iterations, plain174, &status->ldpc_errors);
 
@@ -439,10 +914,7 @@ bool ftx_decode_candidate(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
 
     // Extract CRC and check it
     status->crc_extracted = ftx_extract_crc(a91);
-    // [1]: 'The CRC is calculated on the source-encoded message, zero-extended from 77 to 82 bits.'
-    a91[9] &= 0xF8;
-    a91[10] &= 0x00;
-    status->crc_calculated = ftx_compute_crc(a91, 96 - 14);
+    status->crc_calculated = ftx_payload_crc(a91);
 
     if (status->crc_extracted != status->crc_calculated)
     {
@@ -451,8 +923,9 @@ bool ftx_decode_candidate(const ftx_waterfall_t* wf, const ftx_candidate_t* cand
 
     // Reuse CRC value as a hash for the message (TODO: 14 bits only, should perhaps use full 16 or 32 bits?)
     message->hash = status->crc_calculated;
+    a91[9] &= 0xF8u; // the payload ends with 5 bits of this byte, the CRC follows
 
-    if (wf->protocol == FTX_PROTOCOL_FT4)
+    if (protocol == FTX_PROTOCOL_FT4)
     {
         // '[..] for FT4 only, in order to avoid transmitting a long string of zeros when sending CQ messages,
         // the assembled 77-bit message is bitwise exclusive-OR’ed with [a] pseudorandom sequence before computing the CRC and FEC parity bits'
@@ -488,11 +961,6 @@ static float max2(float a, float b)
     return (a >= b) ? a : b;
 }
 
-static float max4(float a, float b, float c, float d)
-{
-    return max2(max2(a, b), max2(c, d));
-}
-
 static inline float sum4(float a, float b, float c, float d) {
     return a + b + c + d;
 }
@@ -550,117 +1018,228 @@ static void heapify_up(ftx_candidate_t heap[], int heap_size)
     }
 }
 
-// Compute unnormalized log likelihood log(p(1) / p(0)) of 2 message bits (1 FSK symbol)
-static void ft4_extract_symbol(const WF_ELEM_T* wf, float* logl)
+// Keep the best num_candidates candidates in the min-heap
+static void heap_insert(ftx_candidate_t heap[], int* heap_size, int num_candidates, const ftx_candidate_t* candidate)
 {
-    // Cleaned up code for the simple case of n_syms==1
-    float s2[4];
+    // If the heap is full AND the current candidate is better than
+    // the worst in the heap, we remove the worst and make space
+    if ((*heap_size == num_candidates) && (candidate->score > heap[0].score))
+    {
+        --(*heap_size);
+        heap[0] = heap[*heap_size];
+        heapify_down(heap, *heap_size);
+    }
 
-    for (int j = 0; j < 4; ++j)
+    // If there's free space in the heap, we add the current candidate
+    if (*heap_size < num_candidates)
     {
-        s2[j] = WF_ELEM_MAG(wf[kFT4_Gray_map[j]]);
+        heap[*heap_size] = *candidate;
+        ++(*heap_size);
+        heapify_up(heap, *heap_size);
     }
+}
+
+typedef struct
+{
+    float re;
+    float im;
+} cpx_t;
 
-    logl[0] = max2(s2[2], s2[3]) - max2(s2[0], s2[1]);
-    logl[1] = max2(s2[1], s2[3]) - max2(s2[0], s2[2]);
+/// Complex spectrum value of waterfall element idx (zero outside of the stored blocks)
+static cpx_t get_cpx(const ftx_waterfall_t* wf, int block, int idx)
+{
+    cpx_t result = { 0, 0 };
+    if ((block >= 0) && (block < wf->num_blocks))
+    {
+        const ftx_waterfall_cpx_t* el = &wf->cpx[idx];
+        float mag = powf(10.0f, el->mag / (20.0f * FTX_WATERFALL_CPX_MAG_SCALE));
+        float phase = el->phase * ((float)M_PI / 32767.0f);
+        result.re = mag * cosf(phase);
+        result.im = mag * sinf(phase);
+    }
+    return result;
 }
 
-// Compute unnormalized log likelihood log(p(1) / p(0)) of 3 message bits (1 FSK symbol)
-static void ft8_extract_symbol(const WF_ELEM_T* wf, float* logl)
+// Grid of the phase alignment search (per-symbol phase step and tone phase slope), in steps over a full turn
+#define MULTI_STEP_GRID 32
+#define MULTI_SLOPE_GRID 32
+
+/// Estimate the phase alignment of a candidate from its Costas symbols. Within a block of symbols, the stored
+/// spectrum of tone t in symbol i has phase phi + 2 pi (t * slope + i * step): the step comes from the residual
+/// frequency offset (and frequency subdivision) and the slope from where the analysis frame sits within the symbol.
+/// Both are searched on a grid, maximizing the coherent energy of the three Costas arrays.
+static void ft8_estimate_alignment(const cpx_t sync[FT8_NUM_SYNC][FT8_LENGTH_SYNC], float* step, float* slope)
 {
-    // Cleaned up code for the simple case of n_syms==1
-#if 1
-    float s2[8];
+    cpx_t step_rot[MULTI_STEP_GRID];
+    for (int i = 0; i < MULTI_STEP_GRID; ++i)
+    {
+        step_rot[i].re = cosf(-2 * (float)M_PI * i / MULTI_STEP_GRID);
+        step_rot[i].im = sinf(-2 * (float)M_PI * i / MULTI_STEP_GRID);
+    }
 
-    for (int j = 0; j < 8; ++j)
+    // No alignment unless some trial beats it (e.g. all energies NaN from a corrupted waterfall)
+    *step = 0;
+    *slope = 0;
+    float best_energy = -1;
+    for (int l = 0; l < MULTI_SLOPE_GRID; ++l)
     {
-        s2[j] = WF_ELEM_MAG(wf[kFT8_Gray_map[j]]);
-    }
-
-    logl[0] = max4(s2[4], s2[5], s2[6], s2[7]) - max4(s2[0], s2[1], s2[2], s2[3]);
-    logl[1] = max4(s2[2], s2[3], s2[6], s2[7]) - max4(s2[0], s2[1], s2[4], s2[5]);
-    logl[2] = max4(s2[1], s2[3], s2[5], s2[7]) - max4(s2[0], s2[2], s2[4], s2[6]);
-#else
-    float a[7] = {
-        // (float)wf[7] - (float)wf[0], // 0: p(111) / p(000)
-        (float)wf[5] - (float)wf[2], // 0: p(100) / p(011)
-        (float)wf[3] - (float)wf[0], // 1: p(010) / p(000)
-        (float)wf[6] - (float)wf[3], // 2: p(101) / p(010)
-        (float)wf[6] - (float)wf[2], // 3: p(101) / p(011)
-        (float)wf[7] - (float)wf[4], // 4: p(111) / p(110)
-        (float)wf[4] - (float)wf[1], // 5: p(110) / p(001)
-        (float)wf[5] - (float)wf[1]  // 6: p(100) / p(001)
-    };
-    float k = 1.0f;
-
-    // logl[0] = k * (a[0] + a[2] + a[3] + a[5] + a[6]) / 5;
-    // logl[1] = k * (a[0] / 4 + (a[1] - a[3]) * 5 / 24 + (a[5] - a[2]) / 6 + (a[4] - a[6]) / 24);
-    // logl[2] = k * (a[0] / 4 + (a[1] - a[3]) / 24 + (a[2] - a[5]) / 6 + (a[4] - a[6]) * 5 / 24);
-    logl[0] = k * (a[1] / 6 + a[2] / 3 + a[3] / 6 + a[4] / 6 + a[5] / 3 + a[6] / 6);
-    logl[1] = k * (-a[0] / 4 + a[1] * 7 / 24 + (a[4] - a[3]) / 8 + a[5] / 3 + a[6] / 24);
-    logl[2] = k * (-a[0] / 4 + (a[1] - a[6]) / 8 + a[2] / 3 + a[3] / 24 + a[4] * 7 / 24 - a[5] * 5 / 18);
-#endif
-    // for (int i = 0; i < 8; ++i)
-    //     printf("%d ", WF_ELEM_MAG_INT(wf[kFT8_Gray_map[i]]));
-    // for (int i = 0; i < 3; ++i)
-    //     printf("%.1f ", logl[i]);
-    // printf("\n");
+        // Remove the tone-dependent phase of the trial slope
+        cpx_t derot[FT8_NUM_SYNC][FT8_LENGTH_SYNC];
+        for (int k = 0; k < FT8_LENGTH_SYNC; ++k)
+        {
+            float angle = -2 * (float)M_PI * l * kFT8_Costas_pattern[k] / MULTI_SLOPE_GRID;
+            float c = cosf(angle);
+            float s = sinf(angle);
+            for (int m = 0; m < FT8_NUM_SYNC; ++m)
+            {
+                derot[m][k].re = sync[m][k].re * c - sync[m][k].im * s;
+                derot[m][k].im = sync[m][k].re * s + sync[m][k].im * c;
+            }
+        }
+        for (int n = 0; n < MULTI_STEP_GRID; ++n)
+        {
+            float energy = 0;
+            for (int m = 0; m < FT8_NUM_SYNC; ++m)
+            {
+                // Sum the symbols, rotating by the trial step (Horner scheme, last symbol first)
+                cpx_t acc = { 0, 0 };
+                for (int k = FT8_LENGTH_SYNC - 1; k >= 0; --k)
+                {
+                    cpx_t r = { acc.re * step_rot[n].re - acc.im * step_rot[n].im, acc.re * step_rot[n].im + acc.im * step_rot[n].re };
+                    acc.re = r.re + derot[m][k].re;
+                    acc.im = r.im + derot[m][k].im;
+                }
+                energy += sqrtf(acc.re * acc.re + acc.im * acc.im);
+            }
+            if (energy > best_energy)
+            {
+                best_energy = energy;
+                *step = (float)n / MULTI_STEP_GRID;
+                *slope = (float)l / MULTI_SLOPE_GRID;
+            }
+        }
+    }
 }
 
-// Compute unnormalized log likelihood log(p(1) / p(0)) of bits corresponding to several FSK symbols at once
-static void ft8_decode_multi_symbols(const WF_ELEM_T* wf, int num_bins, int n_syms, int bit_idx, float* log174)
+/// Bit metrics of a block of n_syms consecutive data symbols by noncoherent block detection: for each of the
+/// 8^n_syms tone hypotheses, the magnitude of the coherent sum of the (phase aligned) spectra, then for every bit
+/// the best hypothesis with the bit set minus the best one with the bit clear.
+/// @param[in] z Aligned spectra, z[i * 8 + t] for tone t of symbol i of the block
+/// @param[out] metric n_syms * 3 bit metrics, most significant bit of the first symbol first
+static void ft8_block_metrics(const cpx_t* z, int n_syms, float* metric)
 {
     const int n_bits = 3 * n_syms;
-    const int n_tones = (1 << n_bits);
+    const int n_hyp = 1 << n_bits;
 
-    float s2[n_tones];
+    // Partial sums over the first symbols, then the squared magnitude of every hypothesis; laid out as plain
+    // arrays so that the inner loops vectorize
+    float sum_re[512];
+    float sum_im[512];
+    float power[512];
+    for (int j = 0; j < 8; ++j)
+    {
+        sum_re[j] = z[kFT8_Gray_map[j]].re;
+        sum_im[j] = z[kFT8_Gray_map[j]].im;
+    }
+    int n_partial = 8;
+    for (int i = 1; i < n_syms; ++i)
+    {
+        // Extend every partial hypothesis by the 8 tones of symbol i (in place, from the end)
+        for (int h = n_partial - 1; h >= 0; --h)
+        {
+            float re = sum_re[h];
+            float im = sum_im[h];
+            for (int j = 0; j < 8; ++j)
+            {
+                sum_re[h * 8 + j] = re + z[i * 8 + kFT8_Gray_map[j]].re;
+                sum_im[h * 8 + j] = im + z[i * 8 + kFT8_Gray_map[j]].im;
+            }
+        }
+        n_partial *= 8;
+    }
+    for (int h = 0; h < n_hyp; ++h)
+    {
+        power[h] = sum_re[h] * sum_re[h] + sum_im[h] * sum_im[h];
+    }
 
-    for (int j = 0; j < n_tones; ++j)
+    // Hypotheses with bit b set come in runs of 'half' entries, alternating with runs where it is clear
+    for (int b = 0; b < n_bits; ++b)
     {
-        int j1 = j & 0x07;
-        if (n_syms == 1)
+        const int half = n_hyp >> (b + 1);
+        float max_zero = 0;
+        float max_one = 0;
+        for (int start = 0; start < n_hyp; start += 2 * half)
         {
-            s2[j] = WF_ELEM_MAG(wf[kFT8_Gray_map[j1]]);
-            continue;
+            for (int h = 0; h < half; ++h)
+            {
+                max_zero = max2(max_zero, power[start + h]);
+                max_one = max2(max_one, power[start + half + h]);
+            }
         }
-        int j2 = (j >> 3) & 0x07;
-        if (n_syms == 2)
+        metric[b] = sqrtf(max_one) - sqrtf(max_zero);
+    }
+}
+
+static void ft8_extract_likelihood_multi(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, int n_syms, float* log174)
+{
+    const int base = get_cand_offset(wf, cand);
+
+    // Spectra of the expected Costas tones
+    cpx_t sync[FT8_NUM_SYNC][FT8_LENGTH_SYNC];
+    for (int m = 0; m < FT8_NUM_SYNC; ++m)
+    {
+        for (int k = 0; k < FT8_LENGTH_SYNC; ++k)
         {
-            s2[j] = WF_ELEM_MAG(wf[kFT8_Gray_map[j2]]);
-            s2[j] += WF_ELEM_MAG(wf[kFT8_Gray_map[j1] + 4 * num_bins]);
-            continue;
+            int sym = (FT8_SYNC_OFFSET * m) + k;
+            int idx = base + sym * wf->block_stride + kFT8_Costas_pattern[k] * wf->bin_stride;
+            sync[m][k] = get_cpx(wf, cand->time_offset + sym, idx);
         }
-        int j3 = (j >> 6) & 0x07;
-        s2[j] = WF_ELEM_MAG(wf[kFT8_Gray_map[j3]]);
-        s2[j] += WF_ELEM_MAG(wf[kFT8_Gray_map[j2] + 4 * num_bins]);
-        s2[j] += WF_ELEM_MAG(wf[kFT8_Gray_map[j1] + 8 * num_bins]);
     }
+    float step, slope;
+    ft8_estimate_alignment(sync, &step, &slope);
 
-    // Extract bit significance (and convert them to float)
-    // 8 FSK tones = 3 bits
-    for (int i = 0; i < n_bits; ++i)
+    // Phase aligned spectra of all data symbols
+    cpx_t z[FT8_ND * 8];
+    for (int k = 0; k < FT8_ND; ++k)
     {
-        if (bit_idx + i >= FTX_LDPC_N)
+        int sym = k + ((k < 29) ? 7 : 14);
+        int idx = base + sym * wf->block_stride;
+        for (int t = 0; t < 8; ++t)
         {
-            // Respect array size
-            break;
+            cpx_t v = get_cpx(wf, cand->time_offset + sym, idx + t * wf->bin_stride);
+            float angle = -2 * (float)M_PI * (sym * step + t * slope);
+            float c = cosf(angle);
+            float s = sinf(angle);
+            z[k * 8 + t].re = v.re * c - v.im * s;
+            z[k * 8 + t].im = v.re * s + v.im * c;
         }
+    }
 
-        uint16_t mask = (n_tones >> (i + 1));
-        float max_zero = -1000, max_one = -1000;
-        for (int n = 0; n < n_tones; ++n)
+    // Blocks of n_syms symbols within each half of 29 data symbols (the last block of a half may be shorter)
+    for (int half = 0; half < 2; ++half)
+    {
+        for (int k = 0; k < 29; k += n_syms)
         {
-            if (n & mask)
-            {
-                max_one = max2(max_one, s2[n]);
-            }
-            else
-            {
-                max_zero = max2(max_zero, s2[n]);
-            }
+            int k_abs = half * 29 + k;
+            int n = (k + n_syms <= 29) ? n_syms : (29 - k);
+            ft8_block_metrics(z + k_abs * 8, n, log174 + 3 * k_abs);
         }
+    }
 
-        log174[bit_idx + i] = max_one - max_zero;
+    // Normalize the distribution like the single-symbol metrics
+    float sum = 0;
+    float sum2 = 0;
+    for (int i = 0; i < FTX_LDPC_N; ++i)
+    {
+        sum += log174[i];
+        sum2 += log174[i] * log174[i];
+    }
+    float inv_n = 1.0f / FTX_LDPC_N;
+    float variance = (sum2 - (sum * sum * inv_n)) * inv_n;
+    float norm_factor = sqrtf(MULTI_LOGL_VARIANCE / variance);
+    for (int i = 0; i < FTX_LDPC_N; ++i)
+    {
+        log174[i] *= norm_factor;
     }
 }
 
@@ -12,23 +12,31 @@ extern "C"
 {
 #endif
 
+/// Complex spectrum element of a phase-preserving waterfall
 typedef struct
 {
-    float mag;
-    float phase;
-} waterfall_cpx_t;
-
-// #define WATERFALL_USE_PHASE
-
-#ifdef WATERFALL_USE_PHASE
-#define WF_ELEM_T          waterfall_cpx_t
-#define WF_ELEM_MAG(x)     ((x).mag)
-#define WF_ELEM_MAG_INT(x) (int)(2 * ((x).mag + 120.0f))
-#else
-#define WF_ELEM_T          uint8_t
-#define WF_ELEM_MAG(x)     ((float)(x)*0.5f - 120.0f)
-#define WF_ELEM_MAG_INT(x) (int)(x)
-#endif
+    int16_t mag;   ///< Magnitude in units of 1/FTX_WATERFALL_CPX_MAG_SCALE dB
+    int16_t phase; ///< Phase in units of pi/32768 radians
+} ftx_waterfall_cpx_t;
+
+#define FTX_WATERFALL_CPX_MAG_SCALE 100 ///< ftx_waterfall_cpx_t magnitude steps per dB
+
+#define FTX_DIRTY_TILE_BLOCKS 16 ///< Time extent of a dirty tracking tile in blocks
+#define FTX_DIRTY_TILE_BINS   8  ///< Frequency extent of a dirty tracking tile in bins (50 Hz, all frequency subdivisions)
+
+/// Memory layout of the magnitude data in a waterfall
+typedef enum
+{
+    FTX_WATERFALL_TIME_MAJOR, ///< mag[blocks][time_osr][freq_osr][num_bins]: all bins of a block are contiguous
+    FTX_WATERFALL_FREQ_MAJOR  ///< mag[time_osr][freq_osr][num_bins][max_blocks]: the history of a bin is contiguous
+} ftx_waterfall_layout_t;
+
+/// Storage format of the magnitude data in a waterfall
+typedef enum
+{
+    FTX_WATERFALL_U8, ///< One byte per element: 0.5 dB steps over -120..0 dB
+    FTX_WATERFALL_U4  ///< Two elements per byte (low nibble first): offset + nibble * scale, with offset/scale kept per block
+} ftx_waterfall_format_t;
 
 /// Input structure to ftx_find_sync() function. This structure describes stored waterfall data over the whole message slot.
 /// Fields time_osr and freq_osr specify additional oversampling rate for time and frequency resolution.
@@ -36,18 +44,89 @@ typedef struct
 /// Values time_osr > 1 mean each symbol is further subdivided in time.
 /// If freq_osr=1, each bin in the FFT magnitude data corresponds to 6.25 Hz, which is the tone spacing.
 /// Values freq_osr > 1 mean the tone spacing is further subdivided by FFT analysis.
+/// The element for (block, time_sub, freq_sub, bin) is found at mag[block * block_stride + time_sub * time_sub_stride
+/// + freq_sub * freq_sub_stride + bin * bin_stride], which holds for either layout.
+/// In the FTX_WATERFALL_U4 format the same index addresses a nibble of mag4, and the value in 0.5 dB units
+/// is block_offset[block] + nibble * block_scale[block] (see ftx_waterfall_get()), never more than 255.
 typedef struct
 {
-    int max_blocks;          ///< number of blocks (symbols) allocated in the mag array
-    int num_blocks;          ///< number of blocks (symbols) stored in the mag array
-    int num_bins;            ///< number of FFT bins in terms of 6.25 Hz
-    int time_osr;            ///< number of time subdivisions
-    int freq_osr;            ///< number of frequency subdivisions
-    WF_ELEM_T* mag;          ///< FFT magnitudes stored as uint8_t[blocks][time_osr][freq_osr][num_bins]
-    int block_stride;        ///< Helper value = time_osr * freq_osr * num_bins
-    ftx_protocol_t protocol; ///< Indicate if using FT4 or FT8
+    int max_blocks;                ///< number of blocks (symbols) allocated in the mag array
+    int num_blocks;                ///< number of blocks (symbols) stored in the mag array
+    int num_bins;                  ///< number of FFT bins in terms of 6.25 Hz
+    int time_osr;                  ///< number of time subdivisions
+    int freq_osr;                  ///< number of frequency subdivisions
+    uint8_t* mag;                  ///< FFT magnitudes stored as uint8_t, arranged according to layout (FTX_WATERFALL_U8)
+    uint8_t* mag4;                 ///< FFT magnitudes packed as 4-bit values, arranged according to layout (FTX_WATERFALL_U4)
+    uint8_t* block_offset;         ///< Per-block value of nibble 0 in 0.5 dB units (FTX_WATERFALL_U4)
+    uint8_t* block_scale;          ///< Per-block step of one nibble unit in 0.5 dB units (FTX_WATERFALL_U4)
+    ftx_waterfall_format_t format; ///< Storage format of the magnitudes
+    ftx_waterfall_cpx_t* cpx;      ///< Complex spectra indexed like the magnitudes (NULL unless phase is kept)
+    uint8_t* noise;                ///< Noise floor per frequency in 0.5 dB units, noise[freq_sub * num_bins + bin] (NULL if not kept)
+    uint32_t* dirty;               ///< Changed tiles: per FTX_DIRTY_TILE_BINS bins, a bit per FTX_DIRTY_TILE_BLOCKS blocks (NULL if not tracked)
+    ftx_waterfall_layout_t layout; ///< Memory layout of the mag array
+    int block_stride;              ///< Distance between consecutive blocks (time-major: time_osr * freq_osr * num_bins)
+    int time_sub_stride;           ///< Distance between consecutive time subdivisions
+    int freq_sub_stride;           ///< Distance between consecutive frequency subdivisions
+    int bin_stride;                ///< Distance between consecutive bins (time-major: 1)
+    ftx_protocol_t protocol;       ///< Indicate if using FT4 or FT8
 } ftx_waterfall_t;
 
+/// Same as ftx_waterfall_get(), with the storage format passed explicitly so that loops calling it
+/// with a constant format compile to straight-line code for that format
+static inline int ftx_waterfall_get_as(const ftx_waterfall_t* wf, ftx_waterfall_format_t format, int block, int idx)
+{
+    if (format == FTX_WATERFALL_U4)
+    {
+        int nibble = (wf->mag4[idx >> 1] >> ((idx & 1) << 2)) & 0x0F;
+        return wf->block_offset[block] + nibble * wf->block_scale[block];
+    }
+    return wf->mag[idx];
+}
+
+/// Magnitude of element idx (which belongs to time block 'block') in 0.5 dB units, 0 meaning -120 dB
+static inline int ftx_waterfall_get(const ftx_waterfall_t* wf, int block, int idx)
+{
+    return ftx_waterfall_get_as(wf, wf->format, block, idx);
+}
+
+/// Overwrite element idx (which belongs to time block 'block') with a value in 0.5 dB units.
+/// In the FTX_WATERFALL_U4 format the value is rounded to the nearest step of the block.
+void ftx_waterfall_set(ftx_waterfall_t* wf, int block, int idx, int value);
+
+/// Quantize one block of magnitudes into a FTX_WATERFALL_U4 waterfall.
+/// @param[in,out] wf Waterfall in the FTX_WATERFALL_U4 format
+/// @param[in] block Index of the block to store
+/// @param[in] values Magnitudes of the block in 0.5 dB units, ordered as [time_sub][freq_sub][bin]
+void ftx_waterfall_pack_block(ftx_waterfall_t* wf, int block, const uint8_t* values);
+
+/// Recompute the noise floor map (wf->noise) from all stored blocks. The median over time of every bin follows the
+/// noise underneath the signals, which occupy a given bin only part of the time; as strong signals still lift the
+/// medians of their own bins with their keying sidebands, the floor of a bin is the lowest median within 100 Hz.
+void ftx_waterfall_update_noise(ftx_waterfall_t* wf);
+
+/// Set the noise floor map (wf->noise) from per-bin medians estimated elsewhere, e.g. incrementally while streaming
+/// @param[in] medians Median magnitude of every bin in 0.5 dB units, medians[freq_sub * num_bins + bin]
+void ftx_waterfall_set_noise(ftx_waterfall_t* wf, const uint8_t* medians);
+
+/// Bit of the time tile holding a block in the masks of wf->dirty (the last bit also covers any later blocks)
+static inline uint32_t ftx_waterfall_dirty_bit(int block)
+{
+    int tile = (block < 0) ? 0 : (block / FTX_DIRTY_TILE_BLOCKS);
+    return 1u << ((tile < 31) ? tile : 31);
+}
+
+/// Mark a region of the waterfall as changed, e.g. after a signal was removed from it (no-op if wf->dirty is NULL).
+/// The marks are kept per tile of FTX_DIRTY_TILE_BLOCKS x FTX_DIRTY_TILE_BINS, so they may cover a larger region.
+/// @param[in] first_block, last_block Range of blocks, inclusive
+/// @param[in] first_bin, last_bin Range of bins, inclusive (out of range parts are ignored)
+void ftx_waterfall_mark_dirty(ftx_waterfall_t* wf, int first_block, int last_block, int first_bin, int last_bin);
+
+/// Clear all dirty marks
+void ftx_waterfall_clear_dirty(ftx_waterfall_t* wf);
+
+/// Check whether any tile of a region is marked as changed (always true if wf->dirty is NULL)
+bool ftx_waterfall_is_dirty(const ftx_waterfall_t* wf, int first_block, int last_block, int first_bin, int last_bin);
+
 /// Output structure of ftx_find_sync() and input structure of ftx_decode().
 /// Holds the position of potential start of a message in time and frequency.
 typedef struct
@@ -80,6 +159,27 @@ typedef struct
 /// @return Number of candidates filled in the heap
 int ftx_find_candidates(const ftx_waterfall_t* power, int num_candidates, ftx_candidate_t heap[], int min_score);
 
+/// Check whether the waterfall changed anywhere a candidate's sync score or message depends on (see ftx_waterfall_is_dirty())
+bool ftx_candidate_is_dirty(const ftx_waterfall_t* wf, const ftx_candidate_t* cand);
+
+/// Bring a candidate list from ftx_find_candidates() up to date after the dirty tiles of the waterfall changed.
+/// Candidates that depend on dirty tiles are dropped, only the positions that depend on them are scored again, and the
+/// new best ones are merged in. The work is proportional to the dirty area; if wf->dirty is NULL the search is redone.
+/// Candidates that scored below the last one before the change are not recovered from the clean area.
+/// @param[in] num_candidates Maximum number of candidates (size of the heap array)
+/// @param[in,out] heap Candidates sorted by descending score, as returned by ftx_find_candidates()
+/// @param[in] num_found Number of candidates in the list
+/// @param[in] min_score Minimal score of the new candidates
+/// @return Number of candidates in the updated list, again sorted by descending score
+int ftx_update_candidates(const ftx_waterfall_t* wf, int num_candidates, ftx_candidate_t heap[], int num_found, int min_score);
+
+/// Extract the normalized log likelihoods of the 174 codeword bits of a candidate, one symbol at a time,
+/// as ftx_decode_candidate() passes them to the LDPC decoder
+/// @param[in] wf Waterfall data collected during message slot
+/// @param[in] cand Candidate to extract
+/// @param[out] log174 Log likelihood of each bit (positive for 1), FTX_LDPC_N entries
+void ftx_extract_likelihood(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174);
+
 /// Attempt to decode a message candidate. Extracts the bit probabilities, runs LDPC decoder, checks CRC and unpacks the message in plain text.
 /// @param[in] power Waterfall data collected during message slot
 /// @param[in] cand Candidate to decode
@@ -89,8 +189,48 @@ int ftx_find_candidates(const ftx_waterfall_t* power, int num_candidates, ftx_ca
 /// @return True if the decoding was successful, false otherwise (check status for details)
 bool ftx_decode_candidate(const ftx_waterfall_t* power, const ftx_candidate_t* cand, int max_iterations, ftx_message_t* message, ftx_decode_status_t* status);
 
+/// Attempt to decode a message candidate with bit metrics from noncoherent detection over blocks of num_symbols
+/// consecutive symbols. This needs the complex spectra (wf->cpx) and FT8; meant as a second pass for candidates
+/// that ftx_decode_candidate() could not decode.
+/// @param[in] num_symbols Number of symbols per block (1..3)
+/// @return True if the decoding was successful, false otherwise (also if the waterfall has no phase or is FT4)
+bool ftx_decode_candidate_multi(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, int num_symbols, int max_iterations, ftx_message_t* message, ftx_decode_status_t* status);
+
+/// A-priori (AP) knowledge of a message for ftx_decode_candidate_ap(): the values of some payload bits, e.g. our own
+/// callsign in a reply to us, or the callsign of the station we are working
+typedef struct
+{
+    uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES]; ///< Payload holding the known bits (the other bits are ignored)
+    uint8_t mask[FTX_PAYLOAD_LENGTH_BYTES];    ///< Set bits mark the known bits of the payload
+} ftx_ap_hypothesis_t;
+
+/// Maximum number of hard decisions of a candidate (over all 174 bits) that an AP decode may contradict.
+/// AP decodes with more errors are rejected, as the known bits can pull LDPC to a valid but wrong codeword.
+#define FTX_AP_MAX_HARD_ERRORS 36
+
+/// Make an AP hypothesis for a standard message (as ftx_message_encode_std() packs it) with some fields known.
+/// An unknown field is NULL, e.g. (MYCALL, NULL, NULL) for any reply to us, (MYCALL, DXCALL, NULL) within a QSO
+/// or ("CQ", NULL, NULL) for any CQ. The message type (i3) is always known.
+/// @param[in] hash_if Callsign hash interface for hashed callsigns in angle brackets (can be NULL)
+/// @return FTX_MESSAGE_RC_OK, or the error of ftx_message_encode_std() for an invalid field
+ftx_message_rc_t ftx_ap_hypothesis_std(ftx_ap_hypothesis_t* hyp, ftx_callsign_hash_interface_t* hash_if, const char* call_to, const char* call_de, const char* extra);
+
+/// Attempt to decode a message candidate under several AP hypotheses. The bit likelihoods are extracted once; for
+/// every hypothesis the known bits are clamped to likelihoods stronger than any measured one before LDPC. A decode
+/// must agree with the known bits and contradict at most FTX_AP_MAX_HARD_ERRORS hard decisions of the candidate;
+/// if several hypotheses decode, the one contradicting the fewest wins.
+/// Meant for candidates that ftx_decode_candidate() could not decode, as the known bits buy a few dB of sensitivity.
+/// @param[in] hyps AP hypotheses, e.g. from ftx_ap_hypothesis_std()
+/// @param[in] num_hyps Number of hypotheses
+/// @return Index of the hypothesis that decoded the message, -1 if none did (then status is from the last attempt)
+int ftx_decode_candidate_ap(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, const ftx_ap_hypothesis_t* hyps, int num_hyps,
+    int max_iterations, ftx_message_t* message, ftx_decode_status_t* status);
+
 void ftx_delete_candidates(int *idx, int idx_size, ftx_candidate_t heap[], int *heap_size);
 
+/// Estimate the SNR (in dB over the 2500 Hz reference bandwidth) of a decoded candidate with the given tone sequence.
+/// With a noise floor map (wf->noise) this is the power of the tones over the floor of their bins, otherwise the
+/// level of the tones over the weakest other tone of each symbol.
 int ftx_get_snr(const ftx_waterfall_t* wf, const ftx_candidate_t* candidate, uint8_t *tones, uint8_t n_tones);
 int ftx_get_snr_and_mute(ftx_waterfall_t* wf, const ftx_candidate_t* candidate, uint8_t *tones, uint8_t n_tones);
 
@@ -0,0 +1,185 @@
+#include "dedup.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The last byte of a payload holds 5 of its 77 bits
+#define PAYLOAD_LAST_BYTE_MASK 0xF8u
+
+/// Copy a payload with its unused bits cleared, so that they do not make otherwise equal messages differ
+static void payload_key(const ftx_message_t* message, uint8_t* key)
+{
+    memcpy(key, message->payload, FTX_PAYLOAD_LENGTH_BYTES);
+    key[FTX_PAYLOAD_LENGTH_BYTES - 1] &= PAYLOAD_LAST_BYTE_MASK;
+}
+
+/// FNV-1a hash of a payload key
+static uint32_t payload_hash(const uint8_t* key)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < FTX_PAYLOAD_LENGTH_BYTES; ++i)
+    {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+/// Index of the entry holding a key, or of the empty entry where it would go
+static int find_entry(const ftx_decoded_entry_t* entries, int capacity, const uint8_t* key)
+{
+    const int mask = capacity - 1;
+    int idx = (int)(payload_hash(key) & (uint32_t)mask);
+    while (entries[idx].used && (0 != memcmp(entries[idx].payload, key, FTX_PAYLOAD_LENGTH_BYTES)))
+    {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+/// Empty entry idx. The following entries of its probe sequence are shifted back, so that lookups still find them.
+static void remove_entry(ftx_decoded_set_t* set, int idx)
+{
+    ftx_decoded_entry_t* entries = set->entries;
+    const int mask = set->capacity - 1;
+    int hole = idx;
+    for (int j = (idx + 1) & mask; entries[j].used; j = (j + 1) & mask)
+    {
+        // An entry may fill the hole if its home position is not after the hole (cyclically)
+        int home = (int)(payload_hash(entries[j].payload) & (uint32_t)mask);
+        if (((j - home) & mask) >= ((j - hole) & mask))
+        {
+            entries[hole] = entries[j];
+            hole = j;
+        }
+    }
+    entries[hole].used = false;
+    --set->count;
+}
+
+/// Move all messages into a new table of twice the size
+/// @return False if out of memory (the old table is kept)
+static bool grow(ftx_decoded_set_t* set)
+{
+    ftx_decoded_entry_t* old_entries = set->entries;
+    const int old_capacity = set->capacity;
+    const int new_capacity = 2 * old_capacity;
+    ftx_decoded_entry_t* new_entries = (ftx_decoded_entry_t*)calloc(new_capacity, sizeof(new_entries[0]));
+    if (new_entries == NULL)
+        return false;
+    for (int i = 0; i < old_capacity; ++i)
+    {
+        if (old_entries[i].used)
+        {
+            new_entries[find_entry(new_entries, new_capacity, old_entries[i].payload)] = old_entries[i];
+        }
+    }
+    free(old_entries);
+    set->entries = new_entries;
+    set->capacity = new_capacity;
+    return true;
+}
+
+bool ftx_decoded_set_init(ftx_decoded_set_t* set, int capacity, int retention)
+{
+    int size = 4;
+    while (size < capacity)
+    {
+        size *= 2;
+    }
+    ftx_decoded_entry_t* entries = (ftx_decoded_entry_t*)malloc(size * sizeof(ftx_decoded_entry_t));
+    if (entries == NULL)
+    {
+        memset(set, 0, sizeof(*set));
+        return false;
+    }
+    ftx_decoded_set_init_static(set, entries, size, retention);
+    set->growable = true;
+    return true;
+}
+
+void ftx_decoded_set_init_static(ftx_decoded_set_t* set, ftx_decoded_entry_t* entries, int capacity, int retention)
+{
+    set->entries = entries;
+    set->capacity = capacity;
+    set->retention = retention;
+    set->slot = 0;
+    set->growable = false;
+    ftx_decoded_set_clear(set);
+}
+
+void ftx_decoded_set_free(ftx_decoded_set_t* set)
+{
+    if (set->growable)
+    {
+        free(set->entries);
+    }
+    set->entries = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+void ftx_decoded_set_clear(ftx_decoded_set_t* set)
+{
+    memset(set->entries, 0, set->capacity * sizeof(set->entries[0]));
+    set->count = 0;
+}
+
+void ftx_decoded_set_next_slot(ftx_decoded_set_t* set)
+{
+    ++set->slot;
+    if (set->count == 0)
+        return;
+    if (set->retention == 0)
+    {
+        ftx_decoded_set_clear(set);
+        return;
+    }
+    int idx = 0;
+    while (idx < set->capacity)
+    {
+        if (set->entries[idx].used && (set->slot - set->entries[idx].slot > (uint32_t)set->retention))
+            remove_entry(set, idx); // another entry may have moved here, check it too
+        else
+            ++idx;
+    }
+}
+
+ftx_decoded_rc_t ftx_decoded_set_insert(ftx_decoded_set_t* set, const ftx_message_t* message)
+{
+    uint8_t key[FTX_PAYLOAD_LENGTH_BYTES];
+    payload_key(message, key);
+    int idx = find_entry(set->entries, set->capacity, key);
+    if (set->entries[idx].used)
+    {
+        set->entries[idx].slot = set->slot;
+        return FTX_DECODED_DUPLICATE;
+    }
+
+    // Keep at least one entry empty, so that probing always ends
+    if (4 * (set->count + 1) > 3 * set->capacity)
+    {
+        if (set->growable)
+        {
+            if (!grow(set))
+                return FTX_DECODED_FULL;
+            idx = find_entry(set->entries, set->capacity, key);
+        }
+        else if (set->count + 1 >= set->capacity)
+        {
+            return FTX_DECODED_FULL;
+        }
+    }
+
+    memcpy(set->entries[idx].payload, key, FTX_PAYLOAD_LENGTH_BYTES);
+    set->entries[idx].used = true;
+    set->entries[idx].slot = set->slot;
+    ++set->count;
+    return FTX_DECODED_NEW;
+}
+
+bool ftx_decoded_set_contains(const ftx_decoded_set_t* set, const ftx_message_t* message)
+{
+    uint8_t key[FTX_PAYLOAD_LENGTH_BYTES];
+    payload_key(message, key);
+    return set->entries[find_entry(set->entries, set->capacity, key)].used;
+}
@@ -0,0 +1,78 @@
+#ifndef _INCLUDE_DEDUP_H_
+#define _INCLUDE_DEDUP_H_
+
+#include "message.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Entry of a decoded message set
+typedef struct
+{
+    uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES]; ///< 77-bit payload, unused bits cleared
+    bool used;                                 ///< True if the entry holds a message
+    uint32_t slot;                             ///< Slot number of the last time the message was decoded
+} ftx_decoded_entry_t;
+
+/// Set of decoded messages for duplicate checking, keyed on the full 77-bit payload.
+/// Open addressing with linear probing; lookups and inserts take O(1) on average.
+/// Messages can be remembered across time slots: with a retention of R slots, a message decoded in slot s is
+/// reported as a duplicate until slot s + R (retention 0 checks within the current slot only).
+typedef struct
+{
+    ftx_decoded_entry_t* entries; ///< Hash table (capacity entries)
+    int capacity;                 ///< Number of entries, a power of two
+    int count;                    ///< Number of messages in the set
+    int retention;                ///< Number of slots a message is remembered after the one it was last decoded in
+    uint32_t slot;                ///< Current slot number
+    bool growable;                ///< True if the table was allocated by ftx_decoded_set_init() and grows as needed
+} ftx_decoded_set_t;
+
+/// Result of ftx_decoded_set_insert()
+typedef enum
+{
+    FTX_DECODED_NEW,       ///< The message was not in the set and has been added
+    FTX_DECODED_DUPLICATE, ///< The message was already in the set (its retention starts again)
+    FTX_DECODED_FULL       ///< The message was not in the set and there is no room for it (fixed size sets, or growing failed)
+} ftx_decoded_rc_t;
+
+/// Initialize an empty set that allocates its table and doubles it whenever it gets three quarters full
+/// @param[in] capacity Initial number of entries (rounded up to a power of two)
+/// @param[in] retention Number of slots a message is remembered after the one it was last decoded in
+/// @return False if out of memory (then only ftx_decoded_set_free() may be called on the set)
+bool ftx_decoded_set_init(ftx_decoded_set_t* set, int capacity, int retention);
+
+/// Initialize an empty set over a caller-provided table, which never grows. It holds up to capacity - 1 messages,
+/// then ftx_decoded_set_insert() returns FTX_DECODED_FULL for new ones.
+/// @param[in] entries Table of capacity entries, owned by the caller
+/// @param[in] capacity Number of entries, a power of two
+/// @param[in] retention Number of slots a message is remembered after the one it was last decoded in
+void ftx_decoded_set_init_static(ftx_decoded_set_t* set, ftx_decoded_entry_t* entries, int capacity, int retention);
+
+/// Release the table allocated by ftx_decoded_set_init() (no-op for ftx_decoded_set_init_static())
+void ftx_decoded_set_free(ftx_decoded_set_t* set);
+
+/// Remove all messages (the slot number is kept)
+void ftx_decoded_set_clear(ftx_decoded_set_t* set);
+
+/// Move on to the next time slot and forget the messages whose retention ran out
+void ftx_decoded_set_next_slot(ftx_decoded_set_t* set);
+
+/// Add a decoded message to the set, or find it there
+/// @return FTX_DECODED_NEW for a new message, FTX_DECODED_DUPLICATE for one already in the set, FTX_DECODED_FULL if a
+/// new message does not fit (the caller should still treat it as new)
+ftx_decoded_rc_t ftx_decoded_set_insert(ftx_decoded_set_t* set, const ftx_message_t* message);
+
+/// Check if a message is in the set
+bool ftx_decoded_set_contains(const ftx_decoded_set_t* set, const ftx_message_t* message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _INCLUDE_DEDUP_H_
@@ -3,6 +3,15 @@
 #include "crc.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define GFSK_CONST_K 5.336446f ///< == pi * sqrt(2 / log(2))
 
 // Returns 1 if an odd number of bits are set in x, zero otherwise
 static uint8_t parity8(uint8_t x)
@@ -193,3 +202,402 @@ void ft4_encode(const uint8_t* payload, uint8_t* tones)
         }
     }
 }
+
+/// Number of 4-bit groups in the 91 message bits
+#define LDPC_NIBBLES ((FTX_LDPC_K + 3) / 4)
+
+/// Codeword bits 64..173 (MSB first in two words) computed by a batch encoder: the message bits 64..90
+/// followed by the checksum bits, or the checksum bits contributed by part of the message
+typedef struct
+{
+    uint64_t w1; ///< Codeword bits 64..127
+    uint64_t w2; ///< Codeword bits 128..173 (the lower 18 bits are zero)
+} codeword_tail_t;
+
+/// Tables of a batch encoder: the checksum bits of every value of every 4-bit group of the message. The code is
+/// linear, so the checksum of a message is the XOR of the entries of its groups, 23 lookups instead of
+/// 83 dot products.
+typedef struct
+{
+    codeword_tail_t parity[LDPC_NIBBLES][16];
+} batch_encoder_t;
+
+static void batch_encoder_init(batch_encoder_t* enc)
+{
+    // Checksum bits of every single message bit (the columns of the generator matrix)
+    codeword_tail_t column[LDPC_NIBBLES * 4] = { { 0 } };
+    for (int i = 0; i < FTX_LDPC_M; ++i)
+    {
+        int pos = FTX_LDPC_K + i; // position of the checksum bit in the codeword
+        uint64_t bit1 = (pos < 128) ? (1ull << (127 - pos)) : 0;
+        uint64_t bit2 = (pos < 128) ? 0 : (1ull << (191 - pos));
+        for (int j = 0; j < FTX_LDPC_K; ++j)
+        {
+            if (kFTX_LDPC_generator[i][j / 8] & (0x80u >> (j % 8)))
+            {
+                column[j].w1 |= bit1;
+                column[j].w2 |= bit2;
+            }
+        }
+    }
+
+    // Every value of a group is a smaller one plus its lowest set bit
+    for (int g = 0; g < LDPC_NIBBLES; ++g)
+    {
+        enc->parity[g][0].w1 = 0;
+        enc->parity[g][0].w2 = 0;
+        for (int v = 1; v < 16; ++v)
+        {
+            int low = (v & 1) ? 0 : ((v & 2) ? 1 : ((v & 4) ? 2 : 3));
+            const codeword_tail_t* rest = &enc->parity[g][v & (v - 1)];
+            const codeword_tail_t* col = &column[4 * g + 3 - low];
+            enc->parity[g][v].w1 = rest->w1 ^ col->w1;
+            enc->parity[g][v].w2 = rest->w2 ^ col->w2;
+        }
+    }
+}
+
+/// Encode a 91-bit message into a codeword of 174 bits held in three words (MSB first)
+static void batch_encode174(const batch_encoder_t* enc, const uint8_t* a91, uint64_t* codeword)
+{
+    uint64_t w0 = 0;
+    for (int j = 0; j < 8; ++j)
+    {
+        w0 = (w0 << 8) | a91[j];
+    }
+    uint64_t w1 = ((uint64_t)a91[8] << 56) | ((uint64_t)a91[9] << 48) | ((uint64_t)a91[10] << 40) | ((uint64_t)(a91[11] & 0xE0u) << 32);
+    uint64_t w2 = 0;
+    for (int g = 0; g < LDPC_NIBBLES; ++g)
+    {
+        uint8_t nibble = (g % 2) ? (a91[g / 2] & 0x0Fu) : (a91[g / 2] >> 4);
+        w1 ^= enc->parity[g][nibble].w1;
+        w2 ^= enc->parity[g][nibble].w2;
+    }
+    codeword[0] = w0;
+    codeword[1] = w1;
+    codeword[2] = w2;
+}
+
+/// Read n bits (n < 64) at a bit position of a codeword from batch_encode174()
+static inline unsigned get_codeword_bits(const uint64_t* codeword, int pos, int n)
+{
+    int offset = pos % 64;
+    uint64_t x = codeword[pos / 64] << offset;
+    if (offset + n > 64)
+    {
+        x |= codeword[pos / 64 + 1] >> (64 - offset);
+    }
+    return (unsigned)(x >> (64 - n));
+}
+
+void ft8_encode_many(const uint8_t* payloads, int num_messages, uint8_t* tones)
+{
+    batch_encoder_t enc;
+    batch_encoder_init(&enc);
+
+    // Sync symbols are the same for all messages; data symbols skip them: S7 D29 S7 D29 S7
+    uint8_t sync_tones[FT8_NN] = { 0 };
+    for (int i = 0; i < FT8_LENGTH_SYNC; ++i)
+    {
+        sync_tones[i] = sync_tones[36 + i] = sync_tones[72 + i] = kFT8_Costas_pattern[i];
+    }
+    uint8_t data_pos[FT8_ND];
+    for (int k = 0; k < FT8_ND; ++k)
+    {
+        data_pos[k] = k + ((k < 29) ? 7 : 14);
+    }
+
+    for (int m = 0; m < num_messages; ++m)
+    {
+        uint8_t a91[FTX_LDPC_K_BYTES];
+        ftx_add_crc(payloads + m * 10, a91);
+        uint64_t codeword[3];
+        batch_encode174(&enc, a91, codeword);
+
+        uint8_t* msg_tones = tones + m * FT8_NN;
+        memcpy(msg_tones, sync_tones, FT8_NN);
+        for (int k = 0; k < FT8_ND; ++k)
+        {
+            msg_tones[data_pos[k]] = kFT8_Gray_map[get_codeword_bits(codeword, 3 * k, 3)];
+        }
+    }
+}
+
+void ft4_encode_many(const uint8_t* payloads, int num_messages, uint8_t* tones)
+{
+    batch_encoder_t enc;
+    batch_encoder_init(&enc);
+
+    // Ramp and sync symbols are the same for all messages; data symbols skip them: R S4_1 D29 S4_2 D29 S4_3 D29 S4_4 R
+    uint8_t sync_tones[FT4_NN] = { 0 };
+    for (int i = 0; i < FT4_LENGTH_SYNC; ++i)
+    {
+        sync_tones[1 + i] = kFT4_Costas_pattern[0][i];
+        sync_tones[34 + i] = kFT4_Costas_pattern[1][i];
+        sync_tones[67 + i] = kFT4_Costas_pattern[2][i];
+        sync_tones[100 + i] = kFT4_Costas_pattern[3][i];
+    }
+    uint8_t data_pos[FT4_ND];
+    for (int k = 0; k < FT4_ND; ++k)
+    {
+        data_pos[k] = k + ((k < 29) ? 5 : ((k < 58) ? 9 : 13));
+    }
+
+    for (int m = 0; m < num_messages; ++m)
+    {
+        uint8_t payload_xor[10];
+        for (int i = 0; i < 10; ++i)
+        {
+            payload_xor[i] = payloads[m * 10 + i] ^ kFT4_XOR_sequence[i];
+        }
+        uint8_t a91[FTX_LDPC_K_BYTES];
+        ftx_add_crc(payload_xor, a91);
+        uint64_t codeword[3];
+        batch_encode174(&enc, a91, codeword);
+
+        uint8_t* msg_tones = tones + m * FT4_NN;
+        memcpy(msg_tones, sync_tones, FT4_NN);
+        for (int k = 0; k < FT4_ND; ++k)
+        {
+            msg_tones[data_pos[k]] = kFT4_Gray_map[get_codeword_bits(codeword, 2 * k, 2)];
+        }
+    }
+}
+
+/// Entry i of the GFSK pulse of ftx_gfsk_pulse()
+static float gfsk_pulse_entry(int n_spsym, float symbol_bt, int i)
+{
+    float t = i / (float)n_spsym - 1.5f;
+    float arg1 = GFSK_CONST_K * symbol_bt * (t + 0.5f);
+    float arg2 = GFSK_CONST_K * symbol_bt * (t - 0.5f);
+    return (erff(arg1) - erff(arg2)) / 2;
+}
+
+void ftx_gfsk_pulse(int n_spsym, float symbol_bt, float* pulse)
+{
+    for (int i = 0; i < 3 * n_spsym; ++i)
+    {
+        pulse[i] = gfsk_pulse_entry(n_spsym, symbol_bt, i);
+    }
+}
+
+void ftx_gfsk_phase(const uint8_t* symbols, int n_sym, float f0, float symbol_bt, float symbol_period, int signal_rate, float* phase)
+{
+    int n_spsym = (int)(0.5f + signal_rate * symbol_period); // Samples per symbol
+    int n_wave = n_sym * n_spsym;
+    float hmod = 1.0f;
+
+    float dphi_peak = 2 * M_PI * hmod / n_spsym;
+    float dphi_f0 = 2 * M_PI * f0 / signal_rate;
+
+    // The smoothed frequency of sample j of symbol i sums the pulses of symbols i - 1, i and i + 1, each of which starts
+    // one symbol before its symbol; dummy symbols before the first and after the last one repeat their tones.
+    // The phase steps are stored first, sample j of every symbol at once, so each pulse entry is computed only once
+    // and no pulse table is needed (it would take 3 * n_spsym floats).
+    for (int j = 0; j < n_spsym; ++j)
+    {
+        // Pulses of the next, the current and the previous symbol at this sample
+        float pulse[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            pulse[k] = gfsk_pulse_entry(n_spsym, symbol_bt, j + k * n_spsym);
+        }
+        for (int i = 0; i < n_sym; ++i)
+        {
+            int tone_prev = symbols[(i > 0) ? (i - 1) : 0];
+            int tone = symbols[i];
+            int tone_next = symbols[(i + 1 < n_sym) ? (i + 1) : (n_sym - 1)];
+            float dphi = dphi_f0;
+            dphi += dphi_peak * tone_prev * pulse[2];
+            dphi += dphi_peak * tone * pulse[1];
+            dphi += dphi_peak * tone_next * pulse[0];
+            phase[i * n_spsym + j] = dphi;
+        }
+    }
+
+    // Accumulate the steps in place. A step is always below 2 pi, so wrapping takes one (exact) subtraction.
+    const float two_pi = 2 * M_PI;
+    float phi = 0;
+    for (int k = 0; k < n_wave; ++k)
+    {
+        float dphi = phase[k];
+        phase[k] = phi;
+        phi += dphi;
+        if (phi >= two_pi)
+            phi -= two_pi;
+    }
+}
+
+float ftx_gfsk_envelope(int k, int n_wave, int n_spsym)
+{
+    int n_ramp = n_spsym / 8;
+    int i = (k < n_wave - 1 - k) ? k : (n_wave - 1 - k); // distance from the nearest end
+    if (i >= n_ramp)
+        return 1.0f;
+    return (1 - cosf(2 * M_PI * i / (2 * n_ramp))) / 2;
+}
+
+void ftx_synth_gfsk(const uint8_t* symbols, int n_sym, float f0, float symbol_bt, float symbol_period, int signal_rate, float* signal)
+{
+    int n_spsym = (int)(0.5f + signal_rate * symbol_period); // Samples per symbol
+    int n_wave = n_sym * n_spsym;                            // Number of output samples
+
+    // Calculate the phase in place, then the audio waveform with envelope shaping of the first and last symbols
+    ftx_gfsk_phase(symbols, n_sym, f0, symbol_bt, symbol_period, signal_rate, signal);
+    for (int k = 0; k < n_wave; ++k)
+    {
+        signal[k] = sinf(signal[k]) * ftx_gfsk_envelope(k, n_wave, n_spsym);
+    }
+}
+
+#define SINE_SIZE (1 << FTX_ENCODER_SINE_BITS)
+
+static int encoder_spsym(ftx_protocol_t protocol, int signal_rate)
+{
+    return (int)(0.5f + signal_rate * ((protocol == FTX_PROTOCOL_FT4) ? FT4_SYMBOL_PERIOD : FT8_SYMBOL_PERIOD));
+}
+
+size_t ftx_encoder_get_memory_size(ftx_protocol_t protocol, int signal_rate)
+{
+    // The pulse is computed in place of its phase steps, as both are 32 bits per entry
+    return 3 * encoder_spsym(protocol, signal_rate) * sizeof(uint32_t) + (SINE_SIZE + 1) * sizeof(float);
+}
+
+void ftx_encoder_init_static(ftx_encoder_t* enc, ftx_protocol_t protocol, int signal_rate, void* buffer)
+{
+    const bool is_ft4 = (protocol == FTX_PROTOCOL_FT4);
+    enc->protocol = protocol;
+    enc->signal_rate = signal_rate;
+    enc->n_spsym = encoder_spsym(protocol, signal_rate);
+    enc->num_tones = is_ft4 ? FT4_NN : FT8_NN;
+    enc->num_samples = enc->num_tones * enc->n_spsym;
+    enc->pulse_step = (uint32_t*)buffer;
+    enc->sine = (float*)(enc->pulse_step + 3 * enc->n_spsym);
+    enc->buffer = NULL;
+
+    // With modulation index 1, the pulse of a unit tone advances the phase by one cycle per symbol
+    ftx_gfsk_pulse(enc->n_spsym, is_ft4 ? FT4_SYMBOL_BT : FT8_SYMBOL_BT, (float*)enc->pulse_step);
+    for (int i = 0; i < 3 * enc->n_spsym; ++i)
+    {
+        float pulse;
+        memcpy(&pulse, &enc->pulse_step[i], sizeof(pulse));
+        enc->pulse_step[i] = (uint32_t)llrint(pulse * 4294967296.0 / enc->n_spsym);
+    }
+
+    for (int i = 0; i <= SINE_SIZE; ++i)
+    {
+        enc->sine[i] = (float)sin(2 * M_PI * i / SINE_SIZE);
+    }
+
+    memset(enc->tones, 0, sizeof(enc->tones));
+    enc->f0_step = 0;
+    enc->phase = 0;
+    enc->pos = enc->num_samples; // no message yet
+}
+
+bool ftx_encoder_init(ftx_encoder_t* enc, ftx_protocol_t protocol, int signal_rate)
+{
+    void* buffer = malloc(ftx_encoder_get_memory_size(protocol, signal_rate));
+    if (buffer == NULL)
+        return false;
+    ftx_encoder_init_static(enc, protocol, signal_rate, buffer);
+    enc->buffer = buffer;
+    return true;
+}
+
+void ftx_encoder_free(ftx_encoder_t* enc)
+{
+    free(enc->buffer);
+    enc->buffer = NULL;
+}
+
+void ftx_encoder_set_tones(ftx_encoder_t* enc, const uint8_t* tones, float f0)
+{
+    memcpy(enc->tones, tones, enc->num_tones);
+    enc->f0_step = (uint32_t)llrint((double)f0 / enc->signal_rate * 4294967296.0);
+    enc->phase = 0;
+    enc->pos = 0;
+}
+
+void ftx_encoder_set_message(ftx_encoder_t* enc, const uint8_t* payload, float f0)
+{
+    uint8_t tones[FT4_NN]; // enough for either protocol
+    if (enc->protocol == FTX_PROTOCOL_FT4)
+    {
+        ft4_encode(payload, tones);
+    }
+    else
+    {
+        ft8_encode(payload, tones);
+    }
+    ftx_encoder_set_tones(enc, tones, f0);
+}
+
+/// Sine of an NCO phase, interpolated linearly between the table entries
+static inline float encoder_sine(const float* sine, uint32_t phase)
+{
+    uint32_t idx = phase >> (32 - FTX_ENCODER_SINE_BITS);
+    float frac = (phase & ((1u << (32 - FTX_ENCODER_SINE_BITS)) - 1)) * (1.0f / (1u << (32 - FTX_ENCODER_SINE_BITS)));
+    return sine[idx] + frac * (sine[idx + 1] - sine[idx]);
+}
+
+/// Advance the NCO over up to num_samples samples, writing sin(phase) to out[k * stride] and, with iq, cos(phase) to
+/// out[k * stride - 1]. Each run stays within a symbol, so the three tones that shape its frequency are fixed.
+static int encoder_run(ftx_encoder_t* enc, float* out, int stride, bool iq, bool envelope, int num_samples)
+{
+    const int n_spsym = enc->n_spsym;
+    const int n_ramp = n_spsym / 8;
+    int num_done = 0;
+    while ((num_done < num_samples) && (enc->pos < enc->num_samples))
+    {
+        // The frequency of sample j of symbol i sums the pulses of symbols i - 1, i and i + 1 (see ftx_gfsk_phase())
+        int i = enc->pos / n_spsym;
+        int j = enc->pos % n_spsym;
+        int run = n_spsym - j;
+        if (run > num_samples - num_done)
+        {
+            run = num_samples - num_done;
+        }
+        const uint32_t tone_prev = enc->tones[(i > 0) ? (i - 1) : 0];
+        const uint32_t tone = enc->tones[i];
+        const uint32_t tone_next = enc->tones[(i + 1 < enc->num_tones) ? (i + 1) : (enc->num_tones - 1)];
+        const uint32_t* pulse = enc->pulse_step + j;
+        uint32_t phase = enc->phase;
+        float* dst = out + num_done * stride;
+        for (int k = 0; k < run; ++k)
+        {
+            dst[k * stride] = encoder_sine(enc->sine, phase);
+            if (iq)
+            {
+                dst[k * stride - 1] = encoder_sine(enc->sine, phase + (1u << 30));
+            }
+            phase += enc->f0_step + tone_prev * pulse[k + 2 * n_spsym] + tone * pulse[k + n_spsym] + tone_next * pulse[k];
+        }
+        if (envelope)
+        {
+            // Amplitude ramps within the first and last symbols only
+            for (int k = 0; k < run; ++k)
+            {
+                int pos = enc->pos + k;
+                if ((pos < n_ramp) || (pos >= enc->num_samples - n_ramp))
+                {
+                    dst[k * stride] *= ftx_gfsk_envelope(pos, enc->num_samples, n_spsym);
+                }
+            }
+        }
+        enc->phase = phase;
+        enc->pos += run;
+        num_done += run;
+    }
+    return num_done;
+}
+
+int ftx_encoder_generate(ftx_encoder_t* enc, float* signal, int num_samples)
+{
+    return encoder_run(enc, signal, 1, false, true, num_samples);
+}
+
+int ftx_encoder_generate_iq(ftx_encoder_t* enc, float* iq, int num_samples)
+{
+    return encoder_run(enc, iq + 1, 2, true, false, num_samples);
+}
@@ -2,27 +2,75 @@
 #define _INCLUDE_ENCODE_H_
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "constants.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-// typedef struct
-// {
-//     uint8_t tones[FT8_NN];
-//     // for waveform readout:
-//     int n_spsym;       // Number of waveform samples per symbol
-//     float *pulse;      // [3 * n_spsym]
-//     int idx_symbol;    // Index of the current symbol
-//     float f0;          // Base frequency, Hertz
-//     float signal_rate; // Waveform sample rate, Hertz
-// } encoder_t;
-
-// void encoder_init(float signal_rate, float *pulse_buffer);
-// void encoder_set_f0(float f0);
-// void encoder_process(const message_t *message); // in: message
-// void encoder_generate(float *block);            // out: block of waveforms
+#define FTX_ENCODER_SINE_BITS 10 ///< log2 of the size of the sine table of ftx_encoder_t
+
+/// GFSK waveform synthesizer that streams a message in blocks of any size, e.g. for transmitting as the audio
+/// device asks for it or for regenerating a decoded signal. The GFSK pulse is tabulated as phase steps once at
+/// init; per sample the phase of an integer NCO advances by the sum of three table entries and its sine is
+/// interpolated from a table, so neither erff() nor sinf() is called while generating. The phase steps are rounded
+/// to 2^-32 of a cycle and accumulate exactly, so the output stays within 3e-3 of the exact waveform over the whole
+/// message (ftx_synth_gfsk(), accumulating in float, drifts further).
+typedef struct
+{
+    ftx_protocol_t protocol;
+    int signal_rate;       ///< Sample rate of the output, Hertz
+    int n_spsym;           ///< Samples per symbol
+    int num_tones;         ///< Symbols per message
+    int num_samples;       ///< Samples per message
+    uint32_t* pulse_step;  ///< GFSK pulse as NCO phase steps per unit of tone [3 * n_spsym]
+    float* sine;           ///< Sine over a period, plus the first entry again [2^FTX_ENCODER_SINE_BITS + 1]
+    void* buffer;          ///< Memory of the tables if allocated by ftx_encoder_init() (NULL after ftx_encoder_init_static())
+    uint8_t tones[FT4_NN]; ///< Tones of the current message
+    uint32_t f0_step;      ///< NCO phase step of the base frequency (2^32 per cycle)
+    uint32_t phase;        ///< NCO phase of the next sample (2^32 per cycle)
+    int pos;               ///< Index of the next sample within the message
+} ftx_encoder_t;
+
+/// Set up an encoder for a protocol and output sample rate
+/// @return False if out of memory
+bool ftx_encoder_init(ftx_encoder_t* enc, ftx_protocol_t protocol, int signal_rate);
+
+/// Number of bytes ftx_encoder_init_static() needs for the given protocol and sample rate
+size_t ftx_encoder_get_memory_size(ftx_protocol_t protocol, int signal_rate);
+
+/// Set up an encoder without any heap allocation, with its tables in a caller-provided buffer of
+/// ftx_encoder_get_memory_size() bytes (aligned to 4 bytes), which must outlive the encoder
+void ftx_encoder_init_static(ftx_encoder_t* enc, ftx_protocol_t protocol, int signal_rate, void* buffer);
+
+/// Release the tables of an encoder (a no-op after ftx_encoder_init_static())
+void ftx_encoder_free(ftx_encoder_t* enc);
+
+/// Start a message given as tones, from its first sample at zero phase
+/// @param[in] tones Tone sequence (FT8_NN or FT4_NN tones as from ft8_encode() or ft4_encode())
+/// @param[in] f0 Audio frequency in Hertz for the tone 0 (base frequency)
+void ftx_encoder_set_tones(ftx_encoder_t* enc, const uint8_t* tones, float f0);
+
+/// Start a message given as payload, encoding it into tones first
+/// @param[in] payload 10 byte array consisting of 77 bit payload
+/// @param[in] f0 Audio frequency in Hertz for the tone 0 (base frequency)
+void ftx_encoder_set_message(ftx_encoder_t* enc, const uint8_t* payload, float f0);
+
+/// Generate the next block of the waveform, with the amplitude ramps of ftx_synth_gfsk() in the first and last symbols
+/// @param[out] signal Output samples
+/// @param[in] num_samples Size of the block
+/// @return Number of samples written, less than num_samples once the message ends (0 after it)
+int ftx_encoder_generate(ftx_encoder_t* enc, float* signal, int num_samples);
+
+/// Generate the next block of the complex waveform exp(j phase), without amplitude ramps (see ftx_gfsk_envelope()),
+/// e.g. as a reference to correlate against
+/// @param[out] iq Output samples, interleaved cos(phase), sin(phase) (space for 2 * num_samples values)
+/// @return Number of samples written, less than num_samples once the message ends (0 after it)
+int ftx_encoder_generate_iq(ftx_encoder_t* enc, float* iq, int num_samples);
 
 /// Generate FT8 tone sequence from payload data
 /// @param[in] payload - 10 byte array consisting of 77 bit payload
@@ -34,6 +82,52 @@ void ft8_encode(const uint8_t* payload, uint8_t* tones);
 /// @param[out] tones  - array of FT4_NN (105) bytes to store the generated tones (encoded as 0..3)
 void ft4_encode(const uint8_t* payload, uint8_t* tones);
 
+/// Generate the FT8 tone sequences of many payloads at once, as ft8_encode() does for each of them. The LDPC
+/// checksums come from tables set up once per call, so this pays off from a few dozen payloads (e.g. when
+/// generating test signals or templates); use ft8_encode() for a single payload.
+/// @param[in] payloads - num_messages payloads of 10 bytes each, one after another
+/// @param[in] num_messages - number of payloads
+/// @param[out] tones - num_messages tone sequences of FT8_NN (79) bytes each, one after another
+void ft8_encode_many(const uint8_t* payloads, int num_messages, uint8_t* tones);
+
+/// Generate the FT4 tone sequences of many payloads at once, as ft4_encode() does for each of them (see ft8_encode_many())
+/// @param[out] tones - num_messages tone sequences of FT4_NN (105) bytes each, one after another
+void ft4_encode_many(const uint8_t* payloads, int num_messages, uint8_t* tones);
+
+/// Computes a GFSK smoothing pulse.
+/// The pulse is theoretically infinitely long, however, here it's truncated at 3 times the symbol length.
+/// This means the pulse array has to have space for 3*n_spsym elements.
+/// @param[in] n_spsym Number of samples per symbol
+/// @param[in] symbol_bt Shape parameter (FT8_SYMBOL_BT or FT4_SYMBOL_BT)
+/// @param[out] pulse Output array of pulse samples
+void ftx_gfsk_pulse(int n_spsym, float symbol_bt, float* pulse);
+
+/// Compute the phase of a GFSK waveform (without the amplitude ramps of ftx_synth_gfsk()), e.g. to correlate
+/// against or to synthesize a complex signal. The output contains n_sym symbols.
+/// @param[in] symbols Array of symbols (tones) (0-7 for FT8)
+/// @param[in] n_sym Number of symbols in the symbol array
+/// @param[in] f0 Audio frequency in Hertz for the symbol 0 (base frequency)
+/// @param[in] symbol_bt Symbol smoothing filter bandwidth (2 for FT8, 1 for FT4)
+/// @param[in] symbol_period Symbol period (duration), seconds
+/// @param[in] signal_rate Sample rate of synthesized signal, Hertz
+/// @param[out] phase Phase of every sample in radians, 0..2 pi (space for n_sym*n_spsym samples)
+void ftx_gfsk_phase(const uint8_t* symbols, int n_sym, float f0, float symbol_bt, float symbol_period, int signal_rate, float* phase);
+
+/// Synthesize waveform data using GFSK phase shaping.
+/// The output waveform will contain n_sym symbols, with short amplitude ramps in the first and last symbols.
+/// @param[in] symbols Array of symbols (tones) (0-7 for FT8)
+/// @param[in] n_sym Number of symbols in the symbol array
+/// @param[in] f0 Audio frequency in Hertz for the symbol 0 (base frequency)
+/// @param[in] symbol_bt Symbol smoothing filter bandwidth (2 for FT8, 1 for FT4)
+/// @param[in] symbol_period Symbol period (duration), seconds
+/// @param[in] signal_rate Sample rate of synthesized signal, Hertz
+/// @param[out] signal Output array of signal waveform samples (should have space for n_sym*n_spsym samples)
+void ftx_synth_gfsk(const uint8_t* symbols, int n_sym, float f0, float symbol_bt, float symbol_period, int signal_rate, float* signal);
+
+/// Amplitude envelope of ftx_synth_gfsk() at sample k of n_wave samples: raised cosine ramps over the first and
+/// last eighth of a symbol, 1 elsewhere
+float ftx_gfsk_envelope(int k, int n_wave, int n_spsym);
+
 #ifdef __cplusplus
 }
 #endif
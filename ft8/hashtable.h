@@ -10,6 +10,9 @@ extern "C"
 {
 #endif
 
+// Single process-wide callsign table, kept for simple programs with one decoder.
+// Each decoder of a multi-decoder program should rather use its own ftx_callsign_table_t (see callsign_table.h).
+
 void hashtable_init(int hashtable_max_size);
 void hashtable_delete();
 int hashtable_get_size();
@@ -12,7 +12,6 @@
 
 ////////////////////////////////////////////////////// Static function prototypes //////////////////////////////////////////////////////////////
 
-static bool trim_brackets(char* result, const char* original, int length);
 static void add_brackets(char* result, const char* original, int length);
 
 /// Compute hash value for a callsign and save it in a hash table via the provided callsign hash interface.
@@ -30,12 +29,20 @@ static int32_t pack_basecall(const char* callsign, int length);
 /// Pack a special token, a 22-bit hash code, or a valid base call into a 29-bit integer.
 static int32_t pack28(const char* callsign, const ftx_callsign_hash_interface_t* hash_if, uint8_t* ip);
 
-/// Unpack a callsign from 28+1 bit field in the payload of the standard message (type 1 or type 2).
-/// @param[in] n29     29-bit integer, e.g. n29a or n29b, containing encoded callsign, plus suffix flag (1 bit) as LSB
-/// @param[in] i3      Payload type (3 bits), 1 or 2
+/// Unpack a callsign field from the 28+1 bits of the standard message (type 1 or type 2), without making its text.
+/// @param[in] n28   28-bit integer, e.g. n29a >> 1 or n29b >> 1
+/// @param[in] ip    Suffix flag (/R or /P after a standard callsign), e.g. n29a & 1
+/// @param[out] call Callsign field
+/// @return False if the field is not a valid callsign
+static bool unpack28(uint32_t n28, uint8_t ip, ftx_message_call_t* call);
+static void unpack_token(uint32_t n28, char* result);
+static void unpack_basecall(uint32_t n, char* result);
+
+/// Make the text of a callsign field: a hashed callsign is looked up, a full one is saved.
+/// @param[in] i3      Payload type (3 bits), 1 (/R suffix) or 2 (/P suffix) for standard callsigns
 /// @param[in] hash_if Callsign hash table interface (can be NULL)
-/// @param[out] result Unpacked callsign (max size: 13 characters including the terminating \0)
-static int unpack28(uint32_t n28, uint8_t ip, uint8_t i3, const ftx_callsign_hash_interface_t* hash_if, char* result);
+/// @param[out] result Callsign (max size: 13 characters including the terminating \0)
+static void format_call(const ftx_message_call_t* call, uint8_t i3, const ftx_callsign_hash_interface_t* hash_if, char* result);
 
 /// Pack a non-standard base call into a 28-bit integer.
 static bool pack58(const ftx_callsign_hash_interface_t* hash_if, const char* callsign, uint64_t* n58);
@@ -44,7 +51,14 @@ static bool pack58(const ftx_callsign_hash_interface_t* hash_if, const char* cal
 static bool unpack58(uint64_t n58, const ftx_callsign_hash_interface_t* hash_if, char* callsign);
 
 static uint16_t packgrid(const char* grid4);
-static int unpackgrid(uint16_t igrid4, uint8_t ir, char* extra);
+static void unpackgrid(uint16_t igrid4, uint8_t ir, ftx_message_fields_t* fields);
+
+static ftx_message_rc_t unpack_std(const ftx_message_t* msg, ftx_message_fields_t* fields);
+static void unpack_nonstd(const ftx_message_t* msg, ftx_message_fields_t* fields);
+static void format_calls(const ftx_message_fields_t* fields, const ftx_callsign_hash_interface_t* hash_if, char* call_to, char* call_de);
+static void format_extra(const ftx_message_fields_t* fields, char* extra);
+static void format_free_text(const uint8_t* data, char* text);
+static void format_telemetry_hex(const uint8_t* data, char* telemetry_hex);
 
 /////////////////////////////////////////////////////////// Exported functions /////////////////////////////////////////////////////////////////
 
@@ -306,30 +320,39 @@ ftx_message_rc_t ftx_message_encode_free(ftx_message_t* msg, const char* text)
         return FTX_MESSAGE_RC_ERROR_TYPE;
     }
 
-    uint8_t b71[9];
-    memset(b71, 0, 9);
-    int8_t cid;
-    char c;
-
+    // The text is a 13 digit number in base 42 (71 bits), accumulated in 32-bit words (w[0] holds the upper 8
+    // bits) by chunks of 4 digits after the first one
+    uint32_t w[3] = { 0, 0, 0 };
+    uint32_t chunk = 0;
     for (int idx = 0; idx < 13; idx++)
     {
-        if (idx < str_len) {
-            c = text[idx];
-        } else {
-            c = ' ';
-        }
-        cid = nchar(c, FT8_CHAR_TABLE_FULL);
+        char c = (idx < str_len) ? text[idx] : ' ';
+        int cid = nchar(c, FT8_CHAR_TABLE_FULL);
         if (cid == -1) {
             return FTX_MESSAGE_RC_ERROR_TYPE;
         }
-        uint16_t rem = cid;
-        for (int i = 8; i >= 0; i--)
+        chunk = chunk * 42 + cid;
+        if (idx % 4 == 0)
         {
-            rem += b71[i] * 42;
-            b71[i] = rem & 0xff;
-            rem = rem >> 8;
+            // w = w * 42^4 + chunk
+            uint64_t acc = chunk;
+            for (int i = 2; i >= 0; --i)
+            {
+                acc += (uint64_t)w[i] * (idx == 0 ? 0 : 3111696u);
+                w[i] = (uint32_t)acc;
+                acc >>= 32;
+            }
+            chunk = 0;
         }
     }
+
+    uint8_t b71[9];
+    b71[0] = (uint8_t)w[0];
+    for (int i = 0; i < 4; ++i)
+    {
+        b71[1 + i] = (uint8_t)(w[1] >> (24 - 8 * i));
+        b71[5 + i] = (uint8_t)(w[2] >> (24 - 8 * i));
+    }
     return ftx_message_encode_telemetry(msg, b71);
 }
 
@@ -347,209 +370,111 @@ ftx_message_rc_t ftx_message_encode_telemetry(ftx_message_t* msg, const uint8_t*
 
 ftx_message_rc_t ftx_message_decode(const ftx_message_t* msg, ftx_callsign_hash_interface_t* hash_if, char* message)
 {
-    ftx_message_rc_t rc;
+    ftx_message_fields_t fields;
+    ftx_message_rc_t rc = ftx_message_decode_fields(msg, &fields);
+    if (rc != FTX_MESSAGE_RC_OK)
+    {
+        message[0] = '\0';
+        return rc;
+    }
+    return ftx_message_format(&fields, hash_if, message);
+}
+
+ftx_message_rc_t ftx_message_decode_fields(const ftx_message_t* msg, ftx_message_fields_t* fields)
+{
+    memset((void*)fields, 0, sizeof(ftx_message_fields_t));
+    fields->type = ftx_message_get_type(msg);
+    fields->i3 = ftx_message_get_i3(msg);
+    fields->n3 = ftx_message_get_n3(msg);
 
-    char buf[35]; // 13 + 13 + 6 (std/nonstd) / 14 (free text) / 19 (telemetry)
-    char* field1 = buf;
-    char* field2 = buf + 14;
-    char* field3 = buf + 14 + 14;
+    switch (fields->type)
+    {
+    case FTX_MESSAGE_TYPE_STANDARD:
+        return unpack_std(msg, fields);
+    case FTX_MESSAGE_TYPE_NONSTD_CALL:
+        unpack_nonstd(msg, fields);
+        return FTX_MESSAGE_RC_OK;
+    case FTX_MESSAGE_TYPE_FREE_TEXT:
+    case FTX_MESSAGE_TYPE_TELEMETRY:
+        ftx_message_decode_telemetry(msg, fields->data);
+        return FTX_MESSAGE_RC_OK;
+    default:
+        // not handled yet
+        return FTX_MESSAGE_RC_ERROR_TYPE;
+    }
+}
 
+ftx_message_rc_t ftx_message_format(const ftx_message_fields_t* fields, ftx_callsign_hash_interface_t* hash_if, char* message)
+{
     message[0] = '\0';
 
-    ftx_message_type_t msg_type = ftx_message_get_type(msg);
-    switch (msg_type)
+    switch (fields->type)
     {
     case FTX_MESSAGE_TYPE_STANDARD:
-        rc = ftx_message_decode_std(msg, hash_if, field1, field2, field3);
-        break;
     case FTX_MESSAGE_TYPE_NONSTD_CALL:
-        rc = ftx_message_decode_nonstd(msg, hash_if, field1, field2, field3);
         break;
     case FTX_MESSAGE_TYPE_FREE_TEXT:
-        ftx_message_decode_free(msg, field1);
-        field2 = NULL;
-        field3 = NULL;
-        rc = FTX_MESSAGE_RC_OK;
-        break;
+        format_free_text(fields->data, message);
+        return FTX_MESSAGE_RC_OK;
     case FTX_MESSAGE_TYPE_TELEMETRY:
-        ftx_message_decode_telemetry_hex(msg, field1);
-        field2 = NULL;
-        field3 = NULL;
-        rc = FTX_MESSAGE_RC_OK;
-        break;
+        format_telemetry_hex(fields->data, message);
+        return FTX_MESSAGE_RC_OK;
     default:
-        // not handled yet
-        field1 = NULL;
-        rc = FTX_MESSAGE_RC_ERROR_TYPE;
-        break;
+        return FTX_MESSAGE_RC_ERROR_TYPE;
     }
 
-    if (field1 != NULL)
+    char call_to[14];
+    char call_de[14];
+    format_calls(fields, hash_if, call_to, call_de);
+    char* dst = append_string(message, call_to);
+    *dst++ = ' ';
+    dst = append_string(dst, call_de);
+    if (fields->extra != FTX_EXTRA_NONE)
     {
-        // TODO join fields via whitespace
-        message = append_string(message, field1);
-        if (field2 != NULL)
-        {
-            message = append_string(message, " ");
-            message = append_string(message, field2);
-            if ((field3 != NULL) && (field3[0] != NULL))
-            {
-                message = append_string(message, " ");
-                message = append_string(message, field3);
-            }
-        }
+        *dst++ = ' ';
+        format_extra(fields, dst);
     }
-
-    return rc;
+    return FTX_MESSAGE_RC_OK;
 }
 
 ftx_message_rc_t ftx_message_decode_std(const ftx_message_t* msg, ftx_callsign_hash_interface_t* hash_if, char* call_to, char* call_de, char* extra)
 {
-    uint32_t n29a, n29b;
-    uint16_t igrid4;
-    uint8_t ir;
-
-    // Extract packed fields
-    n29a = (msg->payload[0] << 21);
-    n29a |= (msg->payload[1] << 13);
-    n29a |= (msg->payload[2] << 5);
-    n29a |= (msg->payload[3] >> 3);
-    n29b = ((msg->payload[3] & 0x07u) << 26);
-    n29b |= (msg->payload[4] << 18);
-    n29b |= (msg->payload[5] << 10);
-    n29b |= (msg->payload[6] << 2);
-    n29b |= (msg->payload[7] >> 6);
-    ir = ((msg->payload[7] & 0x20u) >> 5);
-    igrid4 = ((msg->payload[7] & 0x1Fu) << 10);
-    igrid4 |= (msg->payload[8] << 2);
-    igrid4 |= (msg->payload[9] >> 6);
-
-    // Extract i3 (bits 74..76)
-    uint8_t i3 = (msg->payload[9] >> 3) & 0x07u;
-    LOG(LOG_DEBUG, "decode_std() n28a=%d ipa=%d n28b=%d ipb=%d ir=%d igrid4=%d i3=%d\n", n29a >> 1, n29a & 1u, n29b >> 1, n29b & 1u, ir, igrid4, i3);
-
     call_to[0] = call_de[0] = extra[0] = '\0';
 
-    // Unpack both callsigns
-    if (unpack28(n29a >> 1, n29a & 1u, i3, hash_if, call_to) < 0)
-    {
-        return FTX_MESSAGE_RC_ERROR_CALLSIGN1;
-    }
-    if (unpack28(n29b >> 1, n29b & 1u, i3, hash_if, call_de) < 0)
-    {
-        return FTX_MESSAGE_RC_ERROR_CALLSIGN2;
-    }
-    if (unpackgrid(igrid4, ir, extra) < 0)
-    {
-        return FTX_MESSAGE_RC_ERROR_GRID;
-    }
+    ftx_message_fields_t fields;
+    ftx_message_rc_t rc = unpack_std(msg, &fields);
+    if (rc != FTX_MESSAGE_RC_OK)
+        return rc;
+    format_calls(&fields, hash_if, call_to, call_de);
+    format_extra(&fields, extra);
 
-    LOG(LOG_INFO, "Decoded standard (type %d) message [%s] [%s] [%s]\n", i3, call_to, call_de, extra);
+    LOG(LOG_INFO, "Decoded standard (type %d) message [%s] [%s] [%s]\n", fields.i3, call_to, call_de, extra);
     return FTX_MESSAGE_RC_OK;
 }
 
-// non-standard messages, code originally by KD8CEC
 ftx_message_rc_t ftx_message_decode_nonstd(const ftx_message_t* msg, ftx_callsign_hash_interface_t* hash_if, char* call_to, char* call_de, char* extra)
 {
-    uint16_t n12, iflip, nrpt, icq;
-    uint64_t n58;
-    n12 = (msg->payload[0] << 4);  // 11 ~ 4 : 8
-    n12 |= (msg->payload[1] >> 4); // 3 ~ 0  : 12
-
-    n58 = ((uint64_t)(msg->payload[1] & 0x0Fu) << 54); // 57 ~ 54 : 4
-    n58 |= ((uint64_t)msg->payload[2] << 46);          // 53 ~ 46 : 12
-    n58 |= ((uint64_t)msg->payload[3] << 38);          // 45 ~ 38 : 12
-    n58 |= ((uint64_t)msg->payload[4] << 30);          // 37 ~ 30 : 12
-    n58 |= ((uint64_t)msg->payload[5] << 22);          // 29 ~ 22 : 12
-    n58 |= ((uint64_t)msg->payload[6] << 14);          // 21 ~ 14 : 12
-    n58 |= ((uint64_t)msg->payload[7] << 6);           // 13 ~ 6  : 12
-    n58 |= ((uint64_t)msg->payload[8] >> 2);           // 5 ~ 0   : 765432 10
-
-    iflip = (msg->payload[8] >> 1) & 0x01u; // 76543210
-    nrpt = ((msg->payload[8] & 0x01u) << 1);
-    nrpt |= (msg->payload[9] >> 7); // 76543210
-    icq = ((msg->payload[9] >> 6) & 0x01u);
+    ftx_message_fields_t fields;
+    unpack_nonstd(msg, &fields);
+    format_calls(&fields, hash_if, call_to, call_de);
+    format_extra(&fields, extra);
 
-    // Extract i3 (bits 74..76)
-    uint8_t i3 = (msg->payload[9] >> 3) & 0x07u;
-    LOG(LOG_DEBUG, "decode_nonstd() n12=%04x n58=%08llx iflip=%d nrpt=%d icq=%d i3=%d\n", n12, n58, iflip, nrpt, icq, i3);
-
-    // Decode one of the calls from 58 bit encoded string
-    char call_decoded[14];
-    unpack58(n58, hash_if, call_decoded);
-
-    // Decode the other call from hash lookup table
-    char call_3[14];
-    lookup_callsign(hash_if, FTX_CALLSIGN_HASH_12_BITS, n12, call_3);
-
-    // Possibly flip them around
-    char* call_1 = (iflip) ? call_decoded : call_3;
-    char* call_2 = (iflip) ? call_3 : call_decoded;
-
-    if (icq == 0)
-    {
-        strcpy(call_to, call_1);
-        if (nrpt == 1)
-            strcpy(extra, "RRR");
-        else if (nrpt == 2)
-            strcpy(extra, "RR73");
-        else if (nrpt == 3)
-            strcpy(extra, "73");
-        else
-            extra[0] = '\0';
-    }
-    else
-    {
-        strcpy(call_to, "CQ");
-        extra[0] = '\0';
-    }
-    strcpy(call_de, call_2);
-    LOG(LOG_INFO, "Decoded non-standard (type %d) message [%s] [%s] [%s]\n", i3, call_to, call_de, extra);
+    LOG(LOG_INFO, "Decoded non-standard (type %d) message [%s] [%s] [%s]\n", fields.i3, call_to, call_de, extra);
     return FTX_MESSAGE_RC_OK;
 }
 
 void ftx_message_decode_free(const ftx_message_t* msg, char* text)
 {
     uint8_t b71[9];
-
     ftx_message_decode_telemetry(msg, b71);
-
-    char c14[14];
-    c14[13] = 0;
-    for (int idx = 12; idx >= 0; --idx)
-    {
-        // Divide the long integer in b71 by 42
-        uint16_t rem = 0;
-        for (int i = 0; i < 9; ++i)
-        {
-            rem = (rem << 8) | b71[i];
-            b71[i] = rem / 42;
-            rem = rem % 42;
-        }
-        c14[idx] = charn(rem, FT8_CHAR_TABLE_FULL);
-    }
-
-    strcpy(text, trim(c14));
+    format_free_text(b71, text);
 }
 
 void ftx_message_decode_telemetry_hex(const ftx_message_t* msg, char* telemetry_hex)
 {
     uint8_t b71[9];
-
     ftx_message_decode_telemetry(msg, b71);
-
-    // Convert b71 to hexadecimal string
-    for (int i = 0; i < 9; ++i)
-    {
-        uint8_t nibble1 = (b71[i] >> 4);
-        uint8_t nibble2 = (b71[i] & 0x0Fu);
-        char c1 = (nibble1 > 9) ? (nibble1 - 10 + 'A') : nibble1 + '0';
-        char c2 = (nibble2 > 9) ? (nibble2 - 10 + 'A') : nibble2 + '0';
-        telemetry_hex[i * 2] = c1;
-        telemetry_hex[i * 2 + 1] = c2;
-    }
-
-    telemetry_hex[18] = '\0';
+    format_telemetry_hex(b71, telemetry_hex);
 }
 
 void ftx_message_decode_telemetry(const ftx_message_t* msg, uint8_t* telemetry)
@@ -581,22 +506,6 @@ void ftx_message_print(ftx_message_t* msg)
 
 /////////////////////////////////////////////////////////// Static functions /////////////////////////////////////////////////////////////////
 
-static bool trim_brackets(char* result, const char* original, int length)
-{
-    if (original[0] == '<' && original[length - 1] == '>')
-    {
-        memcpy(result, original + 1, length - 2);
-        result[length - 2] = '\0';
-        return true;
-    }
-    else
-    {
-        memcpy(result, original, length);
-        result[length] = '\0';
-        return false;
-    }
-}
-
 static void add_brackets(char* result, const char* original, int length)
 {
     result[0] = '<';
@@ -605,7 +514,7 @@ static void add_brackets(char* result, const char* original, int length)
     result[length + 2] = '\0';
 }
 
-static bool save_callsign(const ftx_callsign_hash_interface_t* hash_if, const char* callsign, uint32_t* n22_out, uint16_t* n12_out, uint16_t* n10_out)
+bool ftx_callsign_hash22(const char* callsign, uint32_t* n22)
 {
     uint64_t n58 = 0;
     int i = 0;
@@ -624,7 +533,15 @@ static bool save_callsign(const ftx_callsign_hash_interface_t* hash_if, const ch
         i++;
     }
 
-    uint32_t n22 = ((47055833459ull * n58) >> (64 - 22)) & (0x3FFFFFul);
+    *n22 = ((47055833459ull * n58) >> (64 - 22)) & (0x3FFFFFul);
+    return true;
+}
+
+static bool save_callsign(const ftx_callsign_hash_interface_t* hash_if, const char* callsign, uint32_t* n22_out, uint16_t* n12_out, uint16_t* n10_out)
+{
+    uint32_t n22;
+    if (!ftx_callsign_hash22(callsign, &n22))
+        return false;
     uint32_t n12 = n22 >> 10;
     uint32_t n10 = n22 >> 12;
     LOG(LOG_DEBUG, "save_callsign('%s') = [n22=%d, n12=%d, n10=%d]\n", callsign, n22, n12, n10);
@@ -637,7 +554,7 @@ static bool save_callsign(const ftx_callsign_hash_interface_t* hash_if, const ch
         *n10_out = n10;
 
     if (hash_if != NULL)
-        hash_if->save_hash(callsign, n22);
+        hash_if->save_hash(hash_if->ctx, callsign, n22);
 
     return true;
 }
@@ -648,7 +565,7 @@ static bool lookup_callsign(const ftx_callsign_hash_interface_t* hash_if, ftx_ca
 
     bool found;
     if (hash_if != NULL)
-        found = hash_if->lookup_hash(hash_type, hash, c11);
+        found = hash_if->lookup_hash(hash_if->ctx, hash_type, hash, c11);
     else
         found = false;
 
@@ -743,7 +660,7 @@ static int32_t pack28(const char* callsign, const ftx_callsign_hash_interface_t*
     {
         int nlet = 0;
 
-        char *rest = callsign + 3;
+        const char *rest = callsign + 3;
         uint8_t rest_len = strlen(rest);
         uint8_t correct = 1;
         if (rest_len == 3) {
@@ -808,63 +725,77 @@ static int32_t pack28(const char* callsign, const ftx_callsign_hash_interface_t*
     return -1; // Error
 }
 
-static int unpack28(uint32_t n28, uint8_t ip, uint8_t i3, const ftx_callsign_hash_interface_t* hash_if, char* result)
+static bool unpack28(uint32_t n28, uint8_t ip, ftx_message_call_t* call)
 {
-    LOG(LOG_DEBUG, "unpack28() n28=%d i3=%d\n", n28, i3);
+    LOG(LOG_DEBUG, "unpack28() n28=%d\n", n28);
+    call->suffix = false;
+
     // Check for special tokens DE, QRZ, CQ, CQ_nnn, CQ_aaaa
     if (n28 < NTOKENS)
     {
-        if (n28 <= 2u)
-        {
-            if (n28 == 0)
-                strcpy(result, "DE");
-            else if (n28 == 1)
-                strcpy(result, "QRZ");
-            else /* if (n28 == 2) */
-                strcpy(result, "CQ");
-            return 0; // Success
-        }
-        if (n28 <= 1002u)
-        {
-            // CQ nnn with 3 digits
-            strcpy(result, "CQ ");
-            int_to_dd(result + 3, n28 - 3, 3, false);
-            return 0; // Success
-        }
-        if (n28 <= 532443ul)
-        {
-            // CQ ABCD with 4 alphanumeric symbols
-            uint32_t n = n28 - 1003u;
-            char aaaa[5];
-
-            aaaa[4] = '\0';
-            for (int i = 3; /* no condition */; --i)
-            {
-                aaaa[i] = charn(n % 27u, FT8_CHAR_TABLE_LETTERS_SPACE);
-                if (i == 0)
-                    break;
-                n /= 27u;
-            }
-
-            strcpy(result, "CQ ");
-            strcat(result, trim_front(aaaa));
-            return 0; // Success
-        }
-        // unspecified
-        return -1;
+        call->kind = FTX_CALL_TOKEN;
+        call->value = n28;
+        return (n28 <= 532443ul); // the rest is unspecified
     }
 
     n28 = n28 - NTOKENS;
     if (n28 < MAX22)
     {
-        // This is a 22-bit hash of a result
-        lookup_callsign(hash_if, FTX_CALLSIGN_HASH_22_BITS, n28, result);
-        return 0; // Success
+        // This is a 22-bit hash of a callsign
+        call->kind = FTX_CALL_HASH22;
+        call->value = n28;
+        return true;
     }
 
-    // Standard callsign
+    // Standard callsign (only it can have the /R or /P suffix)
     uint32_t n = n28 - MAX22;
+    call->kind = FTX_CALL_STANDARD;
+    call->value = n;
+    call->suffix = (ip != 0);
+
+    // The callsign is too short (less than 3 characters) if its first character and its last 3 are all spaces
+    return ((n / (36 * 10 * 27 * 27 * 27)) != 0) || ((n % (27 * 27 * 27)) != 0);
+}
 
+static void unpack_token(uint32_t n28, char* result)
+{
+    if (n28 <= 2u)
+    {
+        if (n28 == 0)
+            strcpy(result, "DE");
+        else if (n28 == 1)
+            strcpy(result, "QRZ");
+        else /* if (n28 == 2) */
+            strcpy(result, "CQ");
+        return;
+    }
+    if (n28 <= 1002u)
+    {
+        // CQ nnn with 3 digits
+        strcpy(result, "CQ ");
+        int_to_dd(result + 3, n28 - 3, 3, false);
+        return;
+    }
+
+    // CQ ABCD with 4 alphanumeric symbols
+    uint32_t n = n28 - 1003u;
+    char aaaa[5];
+
+    aaaa[4] = '\0';
+    for (int i = 3; /* no condition */; --i)
+    {
+        aaaa[i] = charn(n % 27u, FT8_CHAR_TABLE_LETTERS_SPACE);
+        if (i == 0)
+            break;
+        n /= 27u;
+    }
+
+    strcpy(result, "CQ ");
+    strcat(result, trim_front(aaaa));
+}
+
+static void unpack_basecall(uint32_t n, char* result)
+{
     char callsign[7];
     callsign[6] = '\0';
     callsign[5] = charn(n % 27, FT8_CHAR_TABLE_LETTERS_SPACE);
@@ -897,26 +828,36 @@ static int unpack28(uint32_t n28, uint8_t ip, uint8_t i3, const ftx_callsign_has
         // Skip trailing and leading whitespace in case of a short callsign
         trim_copy(result, callsign);
     }
+}
 
-    int length = strlen(result);
-    if (length < 3)
-        return -1; // Callsign too short
-
-    // Check if we should append /R or /P suffix
-    if (ip != 0)
+static void format_call(const ftx_message_call_t* call, uint8_t i3, const ftx_callsign_hash_interface_t* hash_if, char* result)
+{
+    switch (call->kind)
     {
-        if (i3 == 1)
-            strcat(result, "/R");
-        else if (i3 == 2)
-            strcat(result, "/P");
-        else
-            return -2;
+    case FTX_CALL_TOKEN:
+        unpack_token((uint32_t)call->value, result);
+        break;
+    case FTX_CALL_STANDARD:
+        unpack_basecall((uint32_t)call->value, result);
+        // Append /R or /P suffix
+        if (call->suffix)
+            strcat(result, (i3 == 1) ? "/R" : "/P");
+        // Save the result to hash table
+        save_callsign(hash_if, result, NULL, NULL, NULL);
+        break;
+    case FTX_CALL_HASH22:
+        lookup_callsign(hash_if, FTX_CALLSIGN_HASH_22_BITS, (uint32_t)call->value, result);
+        break;
+    case FTX_CALL_HASH12:
+        lookup_callsign(hash_if, FTX_CALLSIGN_HASH_12_BITS, (uint32_t)call->value, result);
+        break;
+    case FTX_CALL_NONSTD:
+        unpack58(call->value, hash_if, result);
+        break;
+    default:
+        result[0] = '\0';
+        break;
     }
-
-    // Save the result to hash table
-    save_callsign(hash_if, result, NULL, NULL, NULL);
-
-    return 0; // Success
 }
 
 static bool pack58(const ftx_callsign_hash_interface_t* hash_if, const char* callsign, uint64_t* n58)
@@ -944,7 +885,7 @@ static bool pack58(const ftx_callsign_hash_interface_t* hash_if, const char* cal
         return false;
 
     *n58 = result;
-    LOG(LOG_DEBUG, "pack58('%s')=%016llx\n", callsign, *n58);
+    LOG(LOG_DEBUG, "pack58('%s')=%016llx\n", callsign, (unsigned long long)*n58);
     return true;
 }
 
@@ -953,18 +894,23 @@ static bool unpack58(uint64_t n58, const ftx_callsign_hash_interface_t* hash_if,
     // Decode one of the calls from 58 bit encoded string
     char c11[12];
     c11[11] = '\0';
-    uint64_t n58_backup = n58;
-    for (int i = 10; /* no condition */; --i)
+    // Split into the last 5 characters and the first 6 ones (below 38^5 and 38^6 < 2^32), then use 32-bit divisions
+    uint32_t lo = (uint32_t)(n58 % 79235168u);
+    uint32_t hi = (uint32_t)(n58 / 79235168u);
+    for (int i = 10; i >= 6; --i)
     {
-        c11[i] = charn(n58 % 38, FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH);
-        if (i == 0)
-            break;
-        n58 /= 38;
+        c11[i] = charn(lo % 38, FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH);
+        lo /= 38;
+    }
+    for (int i = 5; i >= 0; --i)
+    {
+        c11[i] = charn(hi % 38, FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH);
+        hi /= 38;
     }
     // The decoded string will be right-aligned, so trim all whitespace (also from back just in case)
     trim_copy(callsign, c11);
 
-    LOG(LOG_DEBUG, "unpack58(%016llx)=%s\n", n58_backup, callsign);
+    LOG(LOG_DEBUG, "unpack58(%016llx)=%s\n", (unsigned long long)n58, callsign);
 
     // Save the decoded call in a hash table for later
     if (strlen(callsign) >= 3)
@@ -1019,20 +965,167 @@ static uint16_t packgrid(const char* grid4)
     return MAXGRID4 + 1;
 }
 
-static int unpackgrid(uint16_t igrid4, uint8_t ir, char* extra)
+static void unpackgrid(uint16_t igrid4, uint8_t ir, ftx_message_fields_t* fields)
 {
-    char* dst = extra;
-
     if (igrid4 <= MAXGRID4)
     {
-        // Extract 4 symbol grid locator
+        // 4 symbol grid locator (with an "R " before it in case of ir=1)
+        fields->extra = FTX_EXTRA_GRID;
+        fields->extra_value = igrid4;
+        if (ir > 0)
+            fields->flags |= FTX_MESSAGE_FLAG_ROGER;
+        return;
+    }
+
+    // Check special cases first (irpt > 0 always)
+    int irpt = igrid4 - MAXGRID4;
+    if (irpt == 1)
+        fields->extra = FTX_EXTRA_NONE;
+    else if (irpt == 2)
+        fields->extra = FTX_EXTRA_RRR;
+    else if (irpt == 3)
+        fields->extra = FTX_EXTRA_RR73;
+    else if (irpt == 4)
+        fields->extra = FTX_EXTRA_73;
+    else
+    {
+        // Signal report (with an "R" before it in case of ir=1)
+        fields->extra = FTX_EXTRA_REPORT;
+        fields->extra_value = irpt - 35;
         if (ir > 0)
+            fields->flags |= FTX_MESSAGE_FLAG_ROGER;
+    }
+}
+
+static ftx_message_rc_t unpack_std(const ftx_message_t* msg, ftx_message_fields_t* fields)
+{
+    uint32_t n29a, n29b;
+    uint16_t igrid4;
+    uint8_t ir;
+
+    // Extract packed fields
+    n29a = (msg->payload[0] << 21);
+    n29a |= (msg->payload[1] << 13);
+    n29a |= (msg->payload[2] << 5);
+    n29a |= (msg->payload[3] >> 3);
+    n29b = ((msg->payload[3] & 0x07u) << 26);
+    n29b |= (msg->payload[4] << 18);
+    n29b |= (msg->payload[5] << 10);
+    n29b |= (msg->payload[6] << 2);
+    n29b |= (msg->payload[7] >> 6);
+    ir = ((msg->payload[7] & 0x20u) >> 5);
+    igrid4 = ((msg->payload[7] & 0x1Fu) << 10);
+    igrid4 |= (msg->payload[8] << 2);
+    igrid4 |= (msg->payload[9] >> 6);
+
+    // Extract i3 (bits 74..76)
+    uint8_t i3 = (msg->payload[9] >> 3) & 0x07u;
+    LOG(LOG_DEBUG, "decode_std() n28a=%d ipa=%d n28b=%d ipb=%d ir=%d igrid4=%d i3=%d\n", n29a >> 1, n29a & 1u, n29b >> 1, n29b & 1u, ir, igrid4, i3);
+
+    fields->i3 = i3;
+    fields->flags = 0;
+    fields->extra = FTX_EXTRA_NONE;
+    fields->extra_value = 0;
+
+    // Unpack both callsigns
+    if (!unpack28(n29a >> 1, n29a & 1u, &fields->calls[0]))
+    {
+        return FTX_MESSAGE_RC_ERROR_CALLSIGN1;
+    }
+    if (!unpack28(n29b >> 1, n29b & 1u, &fields->calls[1]))
+    {
+        return FTX_MESSAGE_RC_ERROR_CALLSIGN2;
+    }
+    if ((fields->calls[0].kind == FTX_CALL_TOKEN) && (fields->calls[0].value >= 2))
+    {
+        fields->flags |= FTX_MESSAGE_FLAG_CQ;
+    }
+    unpackgrid(igrid4, ir, fields);
+    return FTX_MESSAGE_RC_OK;
+}
+
+// non-standard messages, code originally by KD8CEC
+static void unpack_nonstd(const ftx_message_t* msg, ftx_message_fields_t* fields)
+{
+    uint16_t n12, iflip, nrpt, icq;
+    uint64_t n58;
+    n12 = (msg->payload[0] << 4);  // 11 ~ 4 : 8
+    n12 |= (msg->payload[1] >> 4); // 3 ~ 0  : 12
+
+    n58 = ((uint64_t)(msg->payload[1] & 0x0Fu) << 54); // 57 ~ 54 : 4
+    n58 |= ((uint64_t)msg->payload[2] << 46);          // 53 ~ 46 : 12
+    n58 |= ((uint64_t)msg->payload[3] << 38);          // 45 ~ 38 : 12
+    n58 |= ((uint64_t)msg->payload[4] << 30);          // 37 ~ 30 : 12
+    n58 |= ((uint64_t)msg->payload[5] << 22);          // 29 ~ 22 : 12
+    n58 |= ((uint64_t)msg->payload[6] << 14);          // 21 ~ 14 : 12
+    n58 |= ((uint64_t)msg->payload[7] << 6);           // 13 ~ 6  : 12
+    n58 |= ((uint64_t)msg->payload[8] >> 2);           // 5 ~ 0   : 765432 10
+
+    iflip = (msg->payload[8] >> 1) & 0x01u; // 76543210
+    nrpt = ((msg->payload[8] & 0x01u) << 1);
+    nrpt |= (msg->payload[9] >> 7); // 76543210
+    icq = ((msg->payload[9] >> 6) & 0x01u);
+
+    // Extract i3 (bits 74..76)
+    uint8_t i3 = (msg->payload[9] >> 3) & 0x07u;
+    LOG(LOG_DEBUG, "decode_nonstd() n12=%04x n58=%08llx iflip=%d nrpt=%d icq=%d i3=%d\n", n12, (unsigned long long)n58, iflip, nrpt, icq, i3);
+
+    fields->i3 = i3;
+    fields->flags = 0;
+    fields->extra = FTX_EXTRA_NONE;
+    fields->extra_value = 0;
+
+    // One of the calls is encoded in 58 bits, the other one is hashed; possibly flip them around
+    ftx_message_call_t call_decoded = { FTX_CALL_NONSTD, false, n58 };
+    ftx_message_call_t call_hashed = { FTX_CALL_HASH12, false, n12 };
+    fields->calls[1] = (iflip) ? call_hashed : call_decoded;
+
+    if (icq == 0)
+    {
+        fields->calls[0] = (iflip) ? call_decoded : call_hashed;
+        if (nrpt == 1)
+            fields->extra = FTX_EXTRA_RRR;
+        else if (nrpt == 2)
+            fields->extra = FTX_EXTRA_RR73;
+        else if (nrpt == 3)
+            fields->extra = FTX_EXTRA_73;
+    }
+    else
+    {
+        ftx_message_call_t call_cq = { FTX_CALL_TOKEN, false, 2 };
+        fields->calls[0] = call_cq;
+        fields->flags |= FTX_MESSAGE_FLAG_CQ;
+    }
+}
+
+static void format_calls(const ftx_message_fields_t* fields, const ftx_callsign_hash_interface_t* hash_if, char* call_to, char* call_de)
+{
+    if (fields->calls[0].kind == FTX_CALL_HASH12)
+    {
+        // Save the full callsign before looking up the hashed one
+        format_call(&fields->calls[1], fields->i3, hash_if, call_de);
+        format_call(&fields->calls[0], fields->i3, hash_if, call_to);
+    }
+    else
+    {
+        format_call(&fields->calls[0], fields->i3, hash_if, call_to);
+        format_call(&fields->calls[1], fields->i3, hash_if, call_de);
+    }
+}
+
+static void format_extra(const ftx_message_fields_t* fields, char* extra)
+{
+    char* dst = extra;
+    bool roger = (fields->flags & FTX_MESSAGE_FLAG_ROGER) != 0;
+
+    switch (fields->extra)
+    {
+    case FTX_EXTRA_GRID: {
+        if (roger)
         {
-            // In case of ir=1 add an "R " before grid
-            dst = stpcpy(dst, "R ");
+            dst = append_string(dst, "R ");
         }
-
-        uint16_t n = igrid4;
+        uint16_t n = fields->extra_value;
         dst[4] = '\0';
         dst[3] = '0' + (n % 10); // 0..9
         n /= 10;
@@ -1041,33 +1134,75 @@ static int unpackgrid(uint16_t igrid4, uint8_t ir, char* extra)
         dst[1] = 'A' + (n % 18); // A..R
         n /= 18;
         dst[0] = 'A' + (n % 18); // A..R
-        // if (ir > 0 && strncmp(call_to, "CQ", 2) == 0) return -1;
+        break;
     }
-    else
+    case FTX_EXTRA_REPORT:
+        // Signal report as a two digit number with a + or - sign
+        if (roger)
+        {
+            *dst++ = 'R';
+        }
+        int_to_dd(dst, fields->extra_value, 2, true);
+        break;
+    case FTX_EXTRA_RRR:
+        strcpy(dst, "RRR");
+        break;
+    case FTX_EXTRA_RR73:
+        strcpy(dst, "RR73");
+        break;
+    case FTX_EXTRA_73:
+        strcpy(dst, "73");
+        break;
+    default:
+        dst[0] = '\0';
+        break;
+    }
+}
+
+static void format_free_text(const uint8_t* data, char* text)
+{
+    // Load the 71 bits into 32-bit words (w[0] holds the upper 8 bits)
+    uint32_t w[3];
+    w[0] = data[0];
+    w[1] = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | data[4];
+    w[2] = ((uint32_t)data[5] << 24) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 8) | data[8];
+
+    char c14[14];
+    c14[13] = 0;
+    for (int idx = 12; idx > 0; idx -= 4)
     {
-        // Extract report
-        int irpt = igrid4 - MAXGRID4;
-
-        // Check special cases first (irpt > 0 always)
-        if (irpt == 1)
-            dst[0] = '\0';
-        else if (irpt == 2)
-            strcpy(dst, "RRR");
-        else if (irpt == 3)
-            strcpy(dst, "RR73");
-        else if (irpt == 4)
-            strcpy(dst, "73");
-        else
+        // Divide the long integer by 42^4, then split the remainder into 4 characters
+        uint64_t rem = 0;
+        for (int i = 0; i < 3; ++i)
         {
-            // Extract signal report as a two digit number with a + or - sign
-            if (ir > 0)
-            {
-                *dst++ = 'R'; // Add "R" before report
-            }
-            int_to_dd(dst, irpt - 35, 2, true);
+            uint64_t cur = (rem << 32) | w[i];
+            w[i] = (uint32_t)(cur / 3111696u);
+            rem = cur % 3111696u;
+        }
+        uint32_t chunk = (uint32_t)rem;
+        for (int j = 0; j < 4; ++j)
+        {
+            c14[idx - j] = charn(chunk % 42, FT8_CHAR_TABLE_FULL);
+            chunk /= 42;
         }
-        // if (irpt >= 2 && strncmp(call_to, "CQ", 2) == 0) return -1;
+    }
+    c14[0] = charn(w[2] % 42, FT8_CHAR_TABLE_FULL);
+
+    strcpy(text, trim(c14));
+}
+
+static void format_telemetry_hex(const uint8_t* data, char* telemetry_hex)
+{
+    // Convert b71 to hexadecimal string
+    for (int i = 0; i < 9; ++i)
+    {
+        uint8_t nibble1 = (data[i] >> 4);
+        uint8_t nibble2 = (data[i] & 0x0Fu);
+        char c1 = (nibble1 > 9) ? (nibble1 - 10 + 'A') : nibble1 + '0';
+        char c2 = (nibble2 > 9) ? (nibble2 - 10 + 'A') : nibble2 + '0';
+        telemetry_hex[i * 2] = c1;
+        telemetry_hex[i * 2 + 1] = c2;
     }
 
-    return 0;
+    telemetry_hex[18] = '\0';
 }
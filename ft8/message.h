@@ -63,9 +63,11 @@ typedef enum
 typedef struct
 {
     /// Called when a callsign is looked up by its 22/12/10 bit hash code
-    bool (*lookup_hash)(ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign);
+    bool (*lookup_hash)(void* ctx, ftx_callsign_hash_type_t hash_type, uint32_t hash, char* callsign);
     /// Called when a callsign should hashed and stored (by its 22, 12 and 10 bit hash codes)
-    void (*save_hash)(const char* callsign, uint32_t n22);
+    void (*save_hash)(void* ctx, const char* callsign, uint32_t n22);
+    /// Passed to both callbacks, e.g. the callsign table (see ftx_callsign_table_interface())
+    void* ctx;
 } ftx_callsign_hash_interface_t;
 
 typedef enum
@@ -78,6 +80,53 @@ typedef enum
     FTX_MESSAGE_RC_ERROR_TYPE
 } ftx_message_rc_t;
 
+/// Kind of a callsign field of a decoded message
+typedef enum
+{
+    FTX_CALL_NONE,     ///< No callsign
+    FTX_CALL_TOKEN,    ///< DE (value 0), QRZ (1), CQ (2), CQ nnn (3 + nnn) or CQ ABCD (1003 + ABCD in base 27)
+    FTX_CALL_STANDARD, ///< Standard callsign (value: the 28-bit field less the tokens and hashes, i.e. n28 - 6257896)
+    FTX_CALL_HASH22,   ///< Callsign known by its 22-bit hash only (value: the hash)
+    FTX_CALL_HASH12,   ///< Callsign known by its 12-bit hash only (value: the hash)
+    FTX_CALL_NONSTD    ///< Nonstandard callsign, 11 characters in base 38 (value: n58)
+} ftx_call_kind_t;
+
+/// Callsign field of a decoded message
+typedef struct
+{
+    uint8_t kind;   ///< ftx_call_kind_t
+    bool suffix;    ///< Standard callsign followed by /R (i3 = 1) or /P (i3 = 2)
+    uint64_t value; ///< Packed callsign, token or hash (see ftx_call_kind_t)
+} ftx_message_call_t;
+
+/// Kind of the grid/report field of a decoded message
+typedef enum
+{
+    FTX_EXTRA_NONE,   ///< Nothing
+    FTX_EXTRA_GRID,   ///< 4-character grid locator (value: 0..32400, AA00 = 0, ((A * 18 + B) * 10 + 0) * 10 + 0)
+    FTX_EXTRA_REPORT, ///< Signal report (value: dB)
+    FTX_EXTRA_RRR,    ///< RRR
+    FTX_EXTRA_RR73,   ///< RR73
+    FTX_EXTRA_73      ///< 73
+} ftx_extra_kind_t;
+
+#define FTX_MESSAGE_FLAG_ROGER 0x01u ///< "R" before the grid or report
+#define FTX_MESSAGE_FLAG_CQ    0x02u ///< The first callsign is CQ, CQ nnn or CQ ABCD
+
+/// Fields of a decoded message, as they are packed in the payload: no callsign is looked up and no text is made.
+/// Messages are compared, filtered or logged from these directly; ftx_message_format() makes the text when needed.
+typedef struct
+{
+    uint8_t type;                ///< ftx_message_type_t
+    uint8_t i3;                  ///< Payload type
+    uint8_t n3;                  ///< Payload subtype (i3 = 0)
+    uint8_t flags;               ///< FTX_MESSAGE_FLAG_*
+    ftx_message_call_t calls[2]; ///< Callsigns (to, de)
+    uint8_t extra;               ///< ftx_extra_kind_t
+    int16_t extra_value;         ///< Grid or report (see ftx_extra_kind_t)
+    uint8_t data[9];             ///< Free text and telemetry: 71 bits, right aligned (as ftx_message_decode_telemetry())
+} ftx_message_fields_t;
+
 // Callsign types and sizes:
 // * Std. call (basecall) - 1-2 letter/digit prefix (at least one letter), 1 digit area code, 1-3 letter suffix,
 //                          total 3-6 chars (exception: 7 character calls with prefixes 3DA0- and 3XA..3XZ-)
@@ -91,6 +140,12 @@ uint8_t ftx_message_get_i3(const ftx_message_t* msg);
 uint8_t ftx_message_get_n3(const ftx_message_t* msg);
 ftx_message_type_t ftx_message_get_type(const ftx_message_t* msg);
 
+/// Compute the 22-bit hash of a callsign (up to 11 characters: letters, digits, space and '/'), under which it is
+/// saved and looked up through ftx_callsign_hash_interface_t. The 12 and 10 bit hashes are its upper bits
+/// (n22 >> 10 and n22 >> 12).
+/// @return False if the callsign has characters outside the allowed set
+bool ftx_callsign_hash22(const char* callsign, uint32_t* n22);
+
 // bool ftx_message_check_recipient(const ftx_message_t* msg, const char* callsign);
 
 /// Pack (encode) a text message
@@ -109,6 +164,17 @@ ftx_message_rc_t ftx_message_encode_free(ftx_message_t* msg, const char* text);
 ftx_message_rc_t ftx_message_encode_telemetry(ftx_message_t* msg, const uint8_t* telemetry);
 
 ftx_message_rc_t ftx_message_decode(const ftx_message_t* msg, ftx_callsign_hash_interface_t* hash_if, char* message);
+
+/// Unpack the fields of a message without making any text (standard, nonstandard call, free text and telemetry
+/// messages). Hashed callsigns are not looked up and full callsigns are not saved: ftx_message_format() does both.
+/// @return FTX_MESSAGE_RC_ERROR_TYPE for other message types, FTX_MESSAGE_RC_ERROR_CALLSIGN1/2 for invalid callsigns
+ftx_message_rc_t ftx_message_decode_fields(const ftx_message_t* msg, ftx_message_fields_t* fields);
+
+/// Make the text of decoded message fields, as ftx_message_decode() does: hashed callsigns are looked up and full
+/// callsigns are saved through the hash interface (can be NULL)
+/// @param[out] message Message text (up to FTX_MAX_MESSAGE_LENGTH characters including the terminating zero)
+ftx_message_rc_t ftx_message_format(const ftx_message_fields_t* fields, ftx_callsign_hash_interface_t* hash_if, char* message);
+
 ftx_message_rc_t ftx_message_decode_std(const ftx_message_t* msg, ftx_callsign_hash_interface_t* hash_if, char* call_to, char* call_de, char* extra);
 ftx_message_rc_t ftx_message_decode_nonstd(const ftx_message_t* msg, ftx_callsign_hash_interface_t* hash_if, char* call_to, char* call_de, char* extra);
 void ftx_message_decode_free(const ftx_message_t* msg, char* text);
@@ -212,83 +212,35 @@ void int_to_dd(char* str, int value, int width, bool full_sign)
     *str = 0; // Add zero terminator
 }
 
-char charn(int c, ft8_char_table_e table)
-{
-    if ((table != FT8_CHAR_TABLE_ALPHANUM) && (table != FT8_CHAR_TABLE_NUMERIC))
-    {
-        if (c == 0)
-            return ' ';
-        c -= 1;
-    }
-    if (table != FT8_CHAR_TABLE_LETTERS_SPACE)
-    {
-        if (c < 10)
-            return '0' + c;
-        c -= 10;
-    }
-    if (table != FT8_CHAR_TABLE_NUMERIC)
-    {
-        if (c < 26)
-            return 'A' + c;
-        c -= 26;
-    }
-
-    if (table == FT8_CHAR_TABLE_FULL)
-    {
-        if (c < 5)
-            return "+-./?"[c];
-    }
-    else if (table == FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH)
-    {
-        if (c == 0)
-            return '/';
-    }
-
-    return '_'; // unknown character, should never get here
-}
-
-// Convert character to its index (charn in reverse) according to a table
-int nchar(char c, ft8_char_table_e table)
-{
-    int n = 0;
-    if ((table != FT8_CHAR_TABLE_ALPHANUM) && (table != FT8_CHAR_TABLE_NUMERIC))
-    {
-        if (c == ' ')
-            return n + 0;
-        n += 1;
-    }
-    if (table != FT8_CHAR_TABLE_LETTERS_SPACE)
-    {
-        if (c >= '0' && c <= '9')
-            return n + (c - '0');
-        n += 10;
-    }
-    if (table != FT8_CHAR_TABLE_NUMERIC)
-    {
-        if (c >= 'A' && c <= 'Z')
-            return n + (c - 'A');
-        n += 26;
-    }
-
-    if (table == FT8_CHAR_TABLE_FULL)
-    {
-        if (c == '+')
-            return n + 0;
-        if (c == '-')
-            return n + 1;
-        if (c == '.')
-            return n + 2;
-        if (c == '/')
-            return n + 3;
-        if (c == '?')
-            return n + 4;
-    }
-    else if (table == FT8_CHAR_TABLE_ALPHANUM_SPACE_SLASH)
-    {
-        if (c == '/')
-            return n + 0;
-    }
-
-    // Character not found
-    return -1;
-}
+const char* const kFT8_char_tables[] = {
+    " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ+-./?",
+    " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ/",
+    " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    " ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    "0123456789",
+};
+
+const uint8_t kFT8_char_table_sizes[] = { 42, 38, 37, 27, 36, 10 };
+
+#define DIGITS(n) \
+    ['0'] = (n) + 1, ['1'] = (n) + 2, ['2'] = (n) + 3, ['3'] = (n) + 4, ['4'] = (n) + 5, ['5'] = (n) + 6, ['6'] = (n) + 7, \
+    ['7'] = (n) + 8, ['8'] = (n) + 9, ['9'] = (n) + 10
+#define LETTERS(n) \
+    ['A'] = (n) + 1, ['B'] = (n) + 2, ['C'] = (n) + 3, ['D'] = (n) + 4, ['E'] = (n) + 5, ['F'] = (n) + 6, ['G'] = (n) + 7, \
+    ['H'] = (n) + 8, ['I'] = (n) + 9, ['J'] = (n) + 10, ['K'] = (n) + 11, ['L'] = (n) + 12, ['M'] = (n) + 13, \
+    ['N'] = (n) + 14, ['O'] = (n) + 15, ['P'] = (n) + 16, ['Q'] = (n) + 17, ['R'] = (n) + 18, ['S'] = (n) + 19, \
+    ['T'] = (n) + 20, ['U'] = (n) + 21, ['V'] = (n) + 22, ['W'] = (n) + 23, ['X'] = (n) + 24, ['Y'] = (n) + 25, \
+    ['Z'] = (n) + 26
+
+const uint8_t kFT8_char_index[][256] = {
+    { [' '] = 1, DIGITS(1), LETTERS(11), ['+'] = 38, ['-'] = 39, ['.'] = 40, ['/'] = 41, ['?'] = 42 },
+    { [' '] = 1, DIGITS(1), LETTERS(11), ['/'] = 38 },
+    { [' '] = 1, DIGITS(1), LETTERS(11) },
+    { [' '] = 1, LETTERS(1) },
+    { DIGITS(0), LETTERS(10) },
+    { DIGITS(0) },
+};
+
+#undef DIGITS
+#undef LETTERS
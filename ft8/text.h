@@ -63,11 +63,27 @@ typedef enum
     FT8_CHAR_TABLE_NUMERIC,              // table[10] "0123456789"
 } ft8_char_table_e;
 
+/// Characters of every table (by ft8_char_table_e)
+extern const char* const kFT8_char_tables[];
+/// Number of characters in every table
+extern const uint8_t kFT8_char_table_sizes[];
+/// Index + 1 of every character in every table (by ft8_char_table_e), 0 if the character is not in the table
+extern const uint8_t kFT8_char_index[][256];
+
 /// Convert integer index to ASCII character according to one of character tables
-char charn(int c, ft8_char_table_e table);
+static inline char charn(int c, ft8_char_table_e table)
+{
+    if ((c < 0) || (c >= kFT8_char_table_sizes[table]))
+        return '_'; // unknown character, should never get here
+    return kFT8_char_tables[table][c];
+}
 
 /// Look up the index of an ASCII character in one of character tables
-int nchar(char c, ft8_char_table_e table);
+/// @return -1 if the character is not in the table
+static inline int nchar(char c, ft8_char_table_e table)
+{
+    return (int)kFT8_char_index[table][(uint8_t)c] - 1;
+}
 
 #ifdef __cplusplus
 }
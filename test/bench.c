@@ -0,0 +1,1105 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "ft8/decode.h"
+#include "ft8/constants.h"
+#include "ft8/encode.h"
+#include "ft8/crc.h"
+#include "ft8/callsign_table.h"
+#include "ft8/callsign_index.h"
+
+#include "common/common.h"
+#include "common/monitor.h"
+#include "common/resample.h"
+#include "common/channel.h"
+#include "common/wave.h"
+#include "common/callsign_store.h"
+#include "fft/kiss_fft.h"
+
+// Micro-benchmarks for the DSP and decoding building blocks.
+// Build with optimizations and without sanitizers for meaningful numbers, e.g.:
+//   make clean && make CFLAGS="-O3 -march=native -fPIC" LDFLAGS="-Wl,--no-as-needed -lm" run_bench
+
+static double now_sec(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (double)spec.tv_sec + (spec.tv_nsec / 1e9);
+}
+
+// Deterministic pseudo-random noise (xorshift32), uniform in -1..+1
+static float noise_sample(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(int32_t)x / 2147483648.0f;
+}
+
+static void fill_noise(float* signal, int num_samples, uint32_t seed)
+{
+    for (int i = 0; i < num_samples; ++i)
+    {
+        signal[i] = 0.1f * noise_sample(&seed);
+    }
+}
+
+/// Rate conversion cost alone, and the cost of a whole FT8 slot of STFT analysis at native 48 kHz
+/// compared to resampling to 12 kHz first.
+static void bench_resampler(void)
+{
+    const int in_rates[] = { 48000, 44100, 8000 };
+    const int out_rate = 12000;
+    const float duration = 60.0f;
+
+    printf("== Resampler ==\n");
+    for (int r = 0; r < (int)(sizeof(in_rates) / sizeof(in_rates[0])); ++r)
+    {
+        int num_in = (int)(duration * in_rates[r]);
+        int max_out = (int)(duration * out_rate) + 16;
+        float* input = (float*)malloc(num_in * sizeof(float));
+        float* output = (float*)malloc(max_out * sizeof(float));
+        fill_noise(input, num_in, 1);
+
+        resampler_t rs;
+        resampler_init(&rs, in_rates[r], out_rate);
+        double t0 = now_sec();
+        int num_out = 0;
+        const int chunk = 1000; // feed in chunks like an audio callback would
+        for (int pos = 0; pos < num_in; pos += chunk)
+        {
+            int n = (pos + chunk <= num_in) ? chunk : (num_in - pos);
+            num_out += resampler_process(&rs, input + pos, n, NULL, output + num_out, max_out - num_out);
+        }
+        double dt = now_sec() - t0;
+        printf("%5d -> %d Hz: %d taps/phase, %.2f ns/input sample, %.0fx realtime\n",
+            in_rates[r], out_rate, rs.taps_per_phase, 1e9 * dt / num_in, duration / dt);
+        resampler_free(&rs);
+        free(output);
+        free(input);
+    }
+
+    // Full STFT front end over one FT8 slot
+    const int sample_rate = 48000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    fill_noise(signal, num_samples, 2);
+    const int proc_rates[] = { 48000, 12000 };
+    for (int r = 0; r < 2; ++r)
+    {
+        monitor_config_t cfg = {
+            .f_min = 200,
+            .f_max = 3000,
+            .sample_rate = sample_rate,
+            .proc_rate = proc_rates[r],
+            .time_osr = 2,
+            .freq_osr = 2,
+            .protocol = FTX_PROTOCOL_FT8
+        };
+        monitor_t mon;
+        monitor_init(&mon, &cfg);
+        const int num_runs = 5;
+        double t0 = now_sec();
+        for (int run = 0; run < num_runs; ++run)
+        {
+            monitor_reset(&mon);
+            monitor_feed(&mon, signal, num_samples);
+        }
+        double dt = (now_sec() - t0) / num_runs;
+        printf("Monitor, 48 kHz input, processing at %5d Hz (nfft %5d): %.2f ms per slot\n", proc_rates[r], mon.nfft, 1e3 * dt);
+        monitor_free(&mon);
+    }
+    free(signal);
+    printf("\n");
+}
+
+// Recording used by the waterfall benchmarks (relative to the repository root)
+static const char* kBench_wav = "test/wav/20m_busy/test_01.wav";
+
+/// Load the benchmark recording and run it through a monitor with the given configuration
+static bool load_monitor(monitor_t* mon, monitor_config_t* cfg)
+{
+    int sample_rate = 12000;
+    int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    if (load_wav(signal, &num_samples, &sample_rate, kBench_wav) < 0)
+    {
+        printf("Cannot load %s (run from the repository root)\n", kBench_wav);
+        free(signal);
+        return false;
+    }
+    cfg->sample_rate = sample_rate;
+    monitor_init(mon, cfg);
+    monitor_feed(mon, signal, num_samples);
+    free(signal);
+    return true;
+}
+
+/// Time the candidate search and likelihood extraction (LDPC with zero iterations) on the benchmark recording
+static void bench_search(const char* name, monitor_config_t* cfg)
+{
+    const int num_runs = 20;
+    enum
+    {
+        kMax_candidates = 200
+    };
+
+    monitor_t mon;
+    if (!load_monitor(&mon, cfg))
+        return;
+
+    ftx_candidate_t candidates[kMax_candidates];
+    int num_candidates = 0;
+    double t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        num_candidates = ftx_find_candidates(&mon.wf, kMax_candidates, candidates, 10);
+    }
+    double dt_search = (now_sec() - t0) / num_runs;
+
+    int checksum = 0;
+    t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        for (int i = 0; i < num_candidates; ++i)
+        {
+            ftx_message_t message;
+            ftx_decode_status_t status;
+            ftx_decode_candidate(&mon.wf, &candidates[i], 0, &message, &status);
+            checksum += status.ldpc_errors;
+        }
+    }
+    double dt_extract = (now_sec() - t0) / (num_runs * num_candidates);
+
+    int score_sum = 0;
+    for (int i = 0; i < num_candidates; ++i)
+    {
+        score_sum += candidates[i].score;
+    }
+    int num_elements = mon.wf.max_blocks * mon.wf.time_osr * mon.wf.freq_osr * mon.wf.num_bins;
+    int mag_bytes = (mon.wf.format == FTX_WATERFALL_U4) ? ((num_elements + 1) / 2 + 2 * mon.wf.max_blocks) : num_elements;
+    printf("%s: %d bytes (arena %zu), candidate search %.2f ms, extraction %.2f us/candidate (%d candidates, score sum %d, check %d)\n",
+        name, mag_bytes, monitor_get_memory_size(cfg), 1e3 * dt_search, 1e6 * dt_extract, num_candidates, score_sum, checksum);
+    monitor_free(&mon);
+}
+
+/// Waterfall layouts and storage formats
+static void bench_waterfall(void)
+{
+    printf("== Waterfall layout and format ==\n");
+    const char* names[] = { "time-major u8", "freq-major u8", "time-major u4", "freq-major u4" };
+    for (int i = 0; i < 4; ++i)
+    {
+        monitor_config_t cfg = {
+            .f_min = 200,
+            .f_max = 3000,
+            .time_osr = 4,
+            .freq_osr = 2,
+            .protocol = FTX_PROTOCOL_FT8,
+            .wf_layout = (i & 1) ? FTX_WATERFALL_FREQ_MAJOR : FTX_WATERFALL_TIME_MAJOR,
+            .wf_format = (i & 2) ? FTX_WATERFALL_U4 : FTX_WATERFALL_U8
+        };
+        bench_search(names[i], &cfg);
+    }
+    printf("\n");
+}
+
+/// Monitor startup cost and per-instance memory with the shared plan cache and with private plans
+static void bench_monitor_init(void)
+{
+    enum
+    {
+        kNum_monitors = 64
+    };
+    monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .sample_rate = 12000,
+        .time_osr = 2,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8
+    };
+    static monitor_t monitors[kNum_monitors];
+    void* arenas[kNum_monitors];
+
+    printf("== Monitor startup ==\n");
+    monitor_plan_cache_purge();
+    double t0 = now_sec();
+    for (int i = 0; i < kNum_monitors; ++i)
+    {
+        monitor_init(&monitors[i], &cfg);
+    }
+    double dt_shared = (now_sec() - t0) / kNum_monitors;
+    size_t shared_size = monitors[0].arena_size;
+    for (int i = 0; i < kNum_monitors; ++i)
+    {
+        monitor_free(&monitors[i]);
+    }
+    monitor_plan_cache_purge();
+
+    size_t private_size = monitor_get_memory_size(&cfg);
+    t0 = now_sec();
+    for (int i = 0; i < kNum_monitors; ++i)
+    {
+        arenas[i] = aligned_alloc(MONITOR_ARENA_ALIGN, private_size);
+        monitor_init_static(&monitors[i], &cfg, arenas[i]);
+    }
+    double dt_private = (now_sec() - t0) / kNum_monitors;
+    for (int i = 0; i < kNum_monitors; ++i)
+    {
+        monitor_free(&monitors[i]);
+        free(arenas[i]);
+    }
+    printf("%d monitors, shared plan:   %6.1f us per monitor, %zu bytes per monitor\n", kNum_monitors, 1e6 * dt_shared, shared_size);
+    printf("%d monitors, private plans: %6.1f us per monitor, %zu bytes per monitor\n", kNum_monitors, 1e6 * dt_private, private_size);
+    printf("\n");
+}
+
+/// Reconstruction of a candidate from the complex spectra: accuracy on a known tone (with an interferer outside
+/// the candidate's band) and cost per candidate
+static void bench_resynth(void)
+{
+    const int sample_rate = 12000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    const float amp = 0.1f;
+    const float phase0 = 0.7f;
+    monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .sample_rate = sample_rate,
+        .time_osr = 2,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8,
+        .wf_phase = true
+    };
+    monitor_t mon;
+    monitor_init(&mon, &cfg);
+
+    // Candidate with tone 0 at bin 160 (1000 Hz), test tone between tones 3 and 4, interferer 150 Hz higher
+    ftx_candidate_t cand = { .freq_offset = 160 - mon.min_bin, .freq_sub = 0 };
+    const float f0 = (float)(mon.min_bin + cand.freq_offset) / mon.symbol_period;
+    const float f_tone = f0 + 3.3f / FT8_SYMBOL_PERIOD;
+    const float f_other = f_tone + 150.0f;
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    for (int i = 0; i < num_samples; ++i)
+    {
+        float t = (float)i / sample_rate;
+        signal[i] = amp * cosf(2 * (float)M_PI * f_tone * t + phase0) + amp * cosf(2 * (float)M_PI * f_other * t);
+    }
+    monitor_feed(&mon, signal, num_samples);
+    free(signal);
+
+    int max_samples = mon.wf.max_blocks * mon.wf.time_osr * mon.nifft / (mon.wf.time_osr * mon.wf.freq_osr);
+    kiss_fft_cpx* baseband = (kiss_fft_cpx*)malloc(max_samples * sizeof(kiss_fft_cpx));
+    const int num_runs = 50;
+    int num_out = 0;
+    double t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        num_out = monitor_resynth(&mon, &cand, baseband);
+    }
+    double dt = (now_sec() - t0) / num_runs;
+
+    // Compare against the ideal downconverted tone, away from the edges of the slot
+    double err2 = 0, ref2 = 0;
+    for (int i = num_out / 10; i < num_out * 9 / 10; ++i)
+    {
+        float t = i / mon.resynth_rate;
+        float arg = 2 * (float)M_PI * (f_tone - f0) * t + phase0;
+        float ref_r = amp * cosf(arg);
+        float ref_i = amp * sinf(arg);
+        err2 += (baseband[i].r - ref_r) * (baseband[i].r - ref_r) + (baseband[i].i - ref_i) * (baseband[i].i - ref_i);
+        ref2 += ref_r * ref_r + ref_i * ref_i;
+    }
+    printf("== Resynthesis ==\n");
+    printf("%d samples at %.0f Hz, error %.1f dB relative to the tone, %.1f us per candidate\n",
+        num_out, mon.resynth_rate, 10 * log10(err2 / ref2), 1e6 * dt);
+    printf("\n");
+    free(baseband);
+    monitor_free(&mon);
+}
+
+/// Noise floor map: exact recomputation once per slot, and the per-block update of the streaming estimate
+static void bench_noise(void)
+{
+    printf("== Noise floor ==\n");
+    monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .time_osr = 4,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8
+    };
+    monitor_t mon;
+    if (!load_monitor(&mon, &cfg))
+        return;
+
+    const int num_runs = 20;
+    double t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        ftx_waterfall_update_noise(&mon.wf);
+    }
+    double dt_update = (now_sec() - t0) / num_runs;
+
+    t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        ftx_waterfall_set_noise(&mon.wf, mon.noise_median);
+    }
+    double dt_set = (now_sec() - t0) / num_runs;
+
+    int floor_sum = 0;
+    for (int i = 0; i < mon.wf.freq_osr * mon.wf.num_bins; ++i)
+    {
+        floor_sum += mon.wf.noise[i];
+    }
+    printf("Exact median per slot %.2f ms, streaming update %.1f us per block (%d blocks, mean floor %.1f dB)\n",
+        1e3 * dt_update, 1e6 * dt_set, mon.wf.num_blocks, 0.5f * floor_sum / (mon.wf.freq_osr * mon.wf.num_bins) - 120);
+    monitor_free(&mon);
+    printf("\n");
+}
+
+/// Candidate list update after a change of one 50 Hz strip (one decode), against a full search
+/// (test_dirty_refresh() in test/test.c checks that the two agree)
+static void bench_update_candidates(void)
+{
+    enum
+    {
+        kMax_candidates = 140
+    };
+    monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .time_osr = 2,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8
+    };
+    monitor_t mon;
+    if (!load_monitor(&mon, &cfg))
+        return;
+
+    const int num_runs = 20;
+    ftx_candidate_t full[kMax_candidates];
+    int num_full = 0;
+    double t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        num_full = ftx_find_candidates(&mon.wf, kMax_candidates, full, 10);
+    }
+    double dt_full = (now_sec() - t0) / num_runs;
+
+    // The strip of a decode at 1000 Hz: its 8 tones and the sideband margin, over the whole message
+    const int first_bin = (int)(1000 * FT8_SYMBOL_PERIOD) - mon.min_bin - 2;
+    ftx_candidate_t updated[kMax_candidates];
+    int num_updated = 0;
+    double dt_update = 0;
+    for (int run = 0; run < num_runs; ++run)
+    {
+        memcpy(updated, full, num_full * sizeof(full[0]));
+        ftx_waterfall_clear_dirty(&mon.wf);
+        ftx_waterfall_mark_dirty(&mon.wf, 0, mon.wf.num_blocks - 1, first_bin, first_bin + 11);
+        t0 = now_sec();
+        num_updated = ftx_update_candidates(&mon.wf, kMax_candidates, updated, num_full, 10);
+        dt_update += now_sec() - t0;
+    }
+    dt_update /= num_runs;
+
+    printf("== Candidate update ==\n");
+    printf("Full search %.2f ms, update after one decode %.2f ms (%d / %d candidates)\n",
+        1e3 * dt_full, 1e3 * dt_update, num_updated, num_full);
+    printf("\n");
+    monitor_free(&mon);
+}
+
+/// Channel simulator: cost per sample of each impairment, and the mean power (1 if kept) over a minute of tones
+/// spread over the FT8 band
+static void bench_channel(void)
+{
+    printf("== Channel simulator ==\n");
+    const int sample_rate = 12000;
+    const int num_samples = 60 * sample_rate;
+    float* input = (float*)malloc(num_samples * sizeof(float));
+    float* output = (float*)malloc(2 * num_samples * sizeof(float));
+    for (int i = 0; i < num_samples; ++i)
+    {
+        input[i] = 0;
+        for (int f = 300; f < 3000; f += 290)
+        {
+            input[i] += sinf(2 * (float)M_PI * fmodf((float)f * i / sample_rate + 0.37f * f, 1.0f));
+        }
+    }
+    double in2 = 0;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        in2 += input[i] * input[i];
+    }
+
+    const struct
+    {
+        const char* name;
+        channel_config_t cfg;
+    } cases[] = {
+        { "passthrough", { sample_rate, 0, 0, 0, 0, 0, 1 } },
+        { "fading 1 Hz", { sample_rate, 1, 0, 0, 0, 0, 1 } },
+        { "fading 1 Hz, 2 paths 2 ms", { sample_rate, 1, 2, 0, 0, 0, 1 } },
+        { "fading, drift 0.1 Hz/s", { sample_rate, 1, 2, 0, 0.1f, 0, 1 } },
+        { "fading, drift, clock 100 ppm", { sample_rate, 1, 2, 0, 0.1f, 100, 1 } },
+    };
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); ++c)
+    {
+        channel_t channel;
+        channel_init(&channel, &cases[c].cfg);
+        double t0 = now_sec();
+        int num_out = 0;
+        const int chunk = 1000;
+        for (int pos = 0; pos < num_samples; pos += chunk)
+        {
+            int n = (pos + chunk <= num_samples) ? chunk : (num_samples - pos);
+            num_out += channel_process(&channel, input + pos, n, NULL, output + num_out, 2 * num_samples - num_out);
+        }
+        double dt = now_sec() - t0;
+        double out2 = 0;
+        for (int i = 0; i < num_out; ++i)
+        {
+            out2 += output[i] * output[i];
+        }
+        printf("%-30s %.2f ns/sample, %.0fx realtime, power %.2f\n", cases[c].name, 1e9 * dt / num_samples,
+            60 / dt, (out2 / num_out) / (in2 / num_samples));
+        channel_free(&channel);
+    }
+    free(output);
+    free(input);
+    printf("\n");
+}
+
+/// WAV reader: one channel of a 60-second stereo recording in memory converted block by block, in every sample format
+static void bench_wav_reader(void)
+{
+    printf("== WAV reader ==\n");
+    const int sample_rate = 12000;
+    const int num_samples = 60 * sample_rate;
+    const int num_channels = 2;
+    const int block_size = 1920;
+    float* input = (float*)malloc(num_samples * sizeof(float));
+    fill_noise(input, num_samples, 7);
+    float* output = (float*)malloc(num_samples * sizeof(float));
+
+    const struct
+    {
+        const char* name;
+        uint16_t format;
+        int bits;
+    } cases[] = {
+        { "8-bit unsigned", 1, 8 },
+        { "16-bit", 1, 16 },
+        { "24-bit", 1, 24 },
+        { "32-bit", 1, 32 },
+        { "32-bit float", 3, 32 },
+    };
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); ++c)
+    {
+        // Minimal RIFF layout: 16-byte fmt chunk, then the samples (the wanted channel second)
+        const int sample_size = cases[c].bits / 8;
+        const uint16_t block_align = num_channels * sample_size;
+        const uint32_t data_size = num_samples * block_align;
+        const uint32_t byte_rate = sample_rate * block_align;
+        const uint16_t channels = num_channels;
+        const uint16_t bits = cases[c].bits;
+        const uint32_t fmt_size = 16;
+        const uint32_t riff_size = 4 + (8 + fmt_size) + (8 + data_size);
+        const uint32_t rate = sample_rate;
+        uint8_t* wav = (uint8_t*)calloc(44 + data_size, 1);
+        memcpy(wav, "RIFF", 4);
+        memcpy(wav + 4, &riff_size, 4);
+        memcpy(wav + 8, "WAVEfmt ", 8);
+        memcpy(wav + 16, &fmt_size, 4);
+        memcpy(wav + 20, &cases[c].format, 2);
+        memcpy(wav + 22, &channels, 2);
+        memcpy(wav + 24, &rate, 4);
+        memcpy(wav + 28, &byte_rate, 4);
+        memcpy(wav + 32, &block_align, 2);
+        memcpy(wav + 34, &bits, 2);
+        memcpy(wav + 36, "data", 4);
+        memcpy(wav + 40, &data_size, 4);
+        for (int i = 0; i < num_samples; ++i)
+        {
+            float x = fmaxf(-1.0f, fminf(input[i], 0.999f));
+            uint8_t* dst = wav + 44 + i * block_align + sample_size;
+            if (cases[c].format == 3)
+            {
+                memcpy(dst, &x, 4);
+            }
+            else if (cases[c].bits == 8)
+            {
+                dst[0] = (uint8_t)lrintf(128 + 127 * x);
+            }
+            else
+            {
+                int32_t v = (int32_t)lrint(x * 2147483647.0) >> (32 - cases[c].bits);
+                memcpy(dst, &v, sample_size); // little-endian
+            }
+        }
+
+        wav_reader_t reader;
+        if (!wav_reader_init(&reader, wav, 44 + data_size, 1))
+        {
+            printf("%-30s cannot parse\n", cases[c].name);
+            free(wav);
+            continue;
+        }
+        double t0 = now_sec();
+        int num_read = 0;
+        for (int n; (n = wav_reader_read(&reader, output + num_read, block_size)) > 0;)
+        {
+            num_read += n;
+        }
+        double dt = now_sec() - t0;
+        double err2 = 0;
+        for (int i = 0; i < num_read; ++i)
+        {
+            float e = output[i] - fmaxf(-1.0f, fminf(input[i], 0.999f));
+            err2 += e * e;
+        }
+        printf("%-30s %.2f ns/sample, %d samples, error %.1f dB\n", cases[c].name, 1e9 * dt / num_samples, num_read,
+            10 * log10(err2 / num_samples + 1e-30));
+        wav_reader_close(&reader);
+        free(wav);
+    }
+    free(output);
+    free(input);
+    printf("\n");
+}
+
+/// Signal subtraction: a synthesized message in noise is subtracted from the kept audio and the waterfall refreshed
+static void bench_subtract(void)
+{
+    const int sample_rate = 12000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    const int start = sample_rate / 2; // 0.5 s into the slot
+    const float amp = 0.1f;
+    monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .sample_rate = sample_rate,
+        .time_osr = 2,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8,
+        .keep_audio = true
+    };
+    monitor_t mon;
+    monitor_init(&mon, &cfg);
+
+    uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES] = { 0x1C, 0x3F, 0x8A, 0x6A, 0xE2, 0x07, 0x10, 0xFE, 0x4C, 0xA0 };
+    uint8_t tones[FT8_NN];
+    ft8_encode(payload, tones);
+    const int n_wave = FT8_NN * mon.block_size;
+    float* wave = (float*)malloc(n_wave * sizeof(float));
+    ftx_synth_gfsk(tones, FT8_NN, 1003.0f, FT8_SYMBOL_BT, FT8_SYMBOL_PERIOD, sample_rate, wave);
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    fill_noise(signal, num_samples, 1);
+    double sig2 = 0;
+    for (int i = 0; i < n_wave; ++i)
+    {
+        signal[start + i] += amp * wave[i];
+        sig2 += amp * wave[i] * amp * wave[i];
+    }
+    monitor_feed(&mon, signal, num_samples);
+
+    ftx_candidate_t cand;
+    if (ftx_find_candidates(&mon.wf, 1, &cand, 0) < 1)
+    {
+        printf("No candidate found\n");
+    }
+    else
+    {
+        const int audio_len = mon.wf.num_blocks * mon.block_size;
+        float* audio = (float*)malloc(audio_len * sizeof(float));
+        memcpy(audio, mon.audio, audio_len * sizeof(float));
+
+        const int num_runs = 20;
+        double dt_subtract = 0;
+        double dt_refresh = 0;
+        for (int run = 0; run < num_runs; ++run)
+        {
+            memcpy(mon.audio, audio, audio_len * sizeof(float));
+            double t0 = now_sec();
+            monitor_subtract(&mon, &cand, tones);
+            double t1 = now_sec();
+            monitor_refresh(&mon);
+            dt_subtract += t1 - t0;
+            dt_refresh += now_sec() - t1;
+        }
+
+        // What is left of the signal: audio after subtraction against the noise alone
+        double res2 = 0;
+        for (int i = 0; i < n_wave; ++i)
+        {
+            float noise = signal[start + i] - amp * wave[i];
+            float diff = mon.audio[start + i] - noise;
+            res2 += diff * diff;
+        }
+        printf("== Subtraction ==\n");
+        printf("Residual %.1f dB relative to the signal, subtract %.2f ms, refresh %.2f ms per message\n",
+            10 * log10(res2 / sig2), 1e3 * dt_subtract / num_runs, 1e3 * dt_refresh / num_runs);
+        printf("\n");
+        free(audio);
+    }
+    free(signal);
+    free(wave);
+    monitor_free(&mon);
+}
+
+/// Random standard callsign: 1-2 character prefix, digit, 1-3 letter suffix
+static void make_callsign(uint32_t* state, char* callsign)
+{
+    const char* letters = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    uint32_t x = *state = *state * 1664525u + 1013904223u;
+    int n = 0;
+    callsign[n++] = letters[(x >> 8) % 26];
+    if ((x >> 13) & 1)
+        callsign[n++] = ((x >> 14) & 1) ? letters[(x >> 15) % 26] : (char)('0' + (x >> 15) % 10);
+    callsign[n++] = '0' + (x >> 20) % 10;
+    int suffix_length = 1 + (x >> 24) % 3;
+    for (int i = 0; i < suffix_length; ++i)
+    {
+        callsign[n++] = letters[(x >> (26 - 2 * i)) % 26];
+    }
+    callsign[n] = '\0';
+}
+
+static void bench_message_codec(void)
+{
+    printf("== Message pack/unpack ==\n");
+    // Corpus of typical traffic between a few thousand stations: CQs, grids, reports, acknowledgements,
+    // nonstandard calls and free text
+    const int num_messages = 65536;
+    const int num_callsigns = 2048;
+    char(*callsigns)[12] = malloc(num_callsigns * sizeof(callsigns[0]));
+    char(*texts)[FTX_MAX_MESSAGE_LENGTH] = malloc(num_messages * sizeof(texts[0]));
+    uint32_t state = 1;
+    for (int i = 0; i < num_callsigns; ++i)
+    {
+        make_callsign(&state, callsigns[i]);
+    }
+    for (int i = 0; i < num_messages; ++i)
+    {
+        state = state * 1664525u + 1013904223u;
+        const char* call1 = callsigns[(state >> 8) % num_callsigns];
+        const char* call2 = callsigns[(state >> 20) % num_callsigns];
+        state = state * 1664525u + 1013904223u;
+        uint32_t x = state >> 8;
+        char grid[5] = { 'A' + x % 18, 'A' + (x >> 5) % 18, '0' + (x >> 10) % 10, '0' + (x >> 14) % 10, '\0' };
+        int report = -24 + (int)((x >> 18) % 40);
+        switch (i % 8)
+        {
+        case 0:
+            snprintf(texts[i], sizeof(texts[0]), "CQ %s %s", call1, grid);
+            break;
+        case 1:
+            snprintf(texts[i], sizeof(texts[0]), "%s %s %s", call1, call2, grid);
+            break;
+        case 2:
+            snprintf(texts[i], sizeof(texts[0]), "%s %s %+03d", call1, call2, report);
+            break;
+        case 3:
+            snprintf(texts[i], sizeof(texts[0]), "%s %s R%+03d", call1, call2, report);
+            break;
+        case 4:
+            snprintf(texts[i], sizeof(texts[0]), "%s %s %s", call1, call2, ((x >> 24) & 1) ? "RR73" : "RRR");
+            break;
+        case 5:
+            snprintf(texts[i], sizeof(texts[0]), "%s %s 73", call1, call2);
+            break;
+        case 6:
+            snprintf(texts[i], sizeof(texts[0]), "CQ PJ4/%s", call1);
+            break;
+        default:
+            snprintf(texts[i], sizeof(texts[0]), "TNX %.4s 73 GL", call1);
+            break;
+        }
+    }
+
+    ftx_callsign_table_t table;
+    ftx_callsign_hash_interface_t hash_if;
+    ftx_callsign_table_init(&table, 4096);
+    ftx_callsign_table_interface(&table, &hash_if);
+    ftx_message_t* msgs = malloc(num_messages * sizeof(msgs[0]));
+
+    const int num_rounds = 8;
+    double t0 = now_sec();
+    for (int round = 0; round < num_rounds; ++round)
+    {
+        for (int i = 0; i < num_messages; ++i)
+        {
+            ftx_message_init(&msgs[i]);
+            if (i % 8 == 7)
+                ftx_message_encode_free(&msgs[i], texts[i]);
+            else
+                ftx_message_encode(&msgs[i], &hash_if, texts[i]);
+        }
+    }
+    double dt_encode = (now_sec() - t0) / (num_rounds * num_messages);
+
+    char text[FTX_MAX_MESSAGE_LENGTH];
+    t0 = now_sec();
+    for (int round = 0; round < num_rounds; ++round)
+    {
+        for (int i = 0; i < num_messages; ++i)
+        {
+            ftx_message_decode(&msgs[i], &hash_if, text);
+        }
+    }
+    double dt_decode = (now_sec() - t0) / (num_rounds * num_messages);
+
+    ftx_message_fields_t fields;
+    int num_cq = 0;
+    t0 = now_sec();
+    for (int round = 0; round < num_rounds; ++round)
+    {
+        for (int i = 0; i < num_messages; ++i)
+        {
+            ftx_message_decode_fields(&msgs[i], &fields);
+            num_cq += (fields.flags & FTX_MESSAGE_FLAG_CQ) != 0;
+        }
+    }
+    double dt_fields = (now_sec() - t0) / (num_rounds * num_messages);
+
+    printf("%d messages: encode %.0f ns (%.1f M/s), decode to text %.0f ns (%.1f M/s), to fields %.0f ns (%d%% CQ)\n",
+        num_messages, 1e9 * dt_encode, 1e-6 / dt_encode, 1e9 * dt_decode, 1e-6 / dt_decode, 1e9 * dt_fields,
+        num_cq / (num_rounds * num_messages / 100));
+    ftx_callsign_table_free(&table);
+    free(msgs);
+    free(texts);
+    free(callsigns);
+    printf("\n");
+}
+
+/// Bitwise CRC-14, the division one bit at a time (reference for the table-driven one)
+static uint16_t crc_bitwise(const uint8_t* message, int num_bits)
+{
+    uint16_t remainder = 0;
+    for (int i = 0; i < num_bits; ++i)
+    {
+        if (i % 8 == 0)
+            remainder ^= message[i / 8] << (FT8_CRC_WIDTH - 8);
+        remainder = (remainder & (1u << (FT8_CRC_WIDTH - 1))) ? ((remainder << 1) ^ FT8_CRC_POLYNOMIAL) : (remainder << 1);
+    }
+    return remainder & ((1u << FT8_CRC_WIDTH) - 1);
+}
+
+static void bench_crc(void)
+{
+    printf("== CRC ==\n");
+    const int num_messages = 65536;
+    uint8_t* a91 = malloc(num_messages * FTX_LDPC_K_BYTES);
+    bool* valid = malloc(num_messages * sizeof(valid[0]));
+    uint32_t state = 1;
+    for (int i = 0; i < num_messages; ++i)
+    {
+        uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES];
+        for (int j = 0; j < FTX_PAYLOAD_LENGTH_BYTES; ++j)
+        {
+            state = state * 1664525u + 1013904223u;
+            payload[j] = (uint8_t)(state >> 24);
+        }
+        ftx_add_crc(payload, a91 + i * FTX_LDPC_K_BYTES);
+        // Like LDPC output, a few codewords converge to a wrong message
+        if (i % 16 == 0)
+            a91[i * FTX_LDPC_K_BYTES] ^= 0x01u;
+    }
+
+    const int num_rounds = 16;
+    uint32_t sum = 0;
+    double t0 = now_sec();
+    for (int round = 0; round < num_rounds; ++round)
+    {
+        for (int i = 0; i < num_messages; ++i)
+        {
+            // What checking a message took before: copy, clear the CRC bits and divide bit by bit
+            uint8_t copy[FTX_LDPC_K_BYTES];
+            memcpy(copy, a91 + i * FTX_LDPC_K_BYTES, sizeof(copy));
+            uint16_t crc = ftx_extract_crc(copy);
+            copy[9] &= 0xF8u;
+            copy[10] = 0;
+            sum += (crc == crc_bitwise(copy, 82));
+        }
+    }
+    double dt_bitwise = (now_sec() - t0) / (num_rounds * num_messages);
+
+    t0 = now_sec();
+    for (int round = 0; round < num_rounds; ++round)
+    {
+        for (int i = 0; i < num_messages; ++i)
+        {
+            sum += ftx_check_crc(a91 + i * FTX_LDPC_K_BYTES);
+        }
+    }
+    double dt_check = (now_sec() - t0) / (num_rounds * num_messages);
+
+    t0 = now_sec();
+    for (int round = 0; round < num_rounds; ++round)
+    {
+        sum += ftx_check_crc_many(a91, num_messages, valid);
+    }
+    double dt_many = (now_sec() - t0) / (num_rounds * num_messages);
+
+    printf("%d messages (%u valid): bitwise %.1f ns, ftx_check_crc %.1f ns, ftx_check_crc_many %.1f ns per message (%.0f M/s)\n",
+        num_messages, sum / (3 * num_rounds), 1e9 * dt_bitwise, 1e9 * dt_check, 1e9 * dt_many, 1e-6 / dt_many);
+    free(valid);
+    free(a91);
+    printf("\n");
+}
+
+static void bench_encode(void)
+{
+    printf("== Tone encoding ==\n");
+    const int num_messages = 65536;
+    uint8_t* payloads = malloc(num_messages * FTX_PAYLOAD_LENGTH_BYTES);
+    uint8_t* tones = malloc(num_messages * FT4_NN);
+    uint32_t state = 1;
+    for (int i = 0; i < num_messages * FTX_PAYLOAD_LENGTH_BYTES; ++i)
+    {
+        state = state * 1664525u + 1013904223u;
+        payloads[i] = (uint8_t)(state >> 24);
+        if (i % FTX_PAYLOAD_LENGTH_BYTES == FTX_PAYLOAD_LENGTH_BYTES - 1)
+            payloads[i] &= 0xF8u;
+    }
+
+    for (int protocol = 0; protocol < 2; ++protocol)
+    {
+        const bool is_ft4 = (protocol == 1);
+        const int num_tones = is_ft4 ? FT4_NN : FT8_NN;
+        const int num_rounds = 4;
+        double t0 = now_sec();
+        for (int round = 0; round < num_rounds; ++round)
+        {
+            for (int i = 0; i < num_messages; ++i)
+            {
+                if (is_ft4)
+                    ft4_encode(payloads + i * FTX_PAYLOAD_LENGTH_BYTES, tones + i * num_tones);
+                else
+                    ft8_encode(payloads + i * FTX_PAYLOAD_LENGTH_BYTES, tones + i * num_tones);
+            }
+        }
+        double dt_single = (now_sec() - t0) / (num_rounds * num_messages);
+
+        t0 = now_sec();
+        for (int round = 0; round < num_rounds; ++round)
+        {
+            if (is_ft4)
+                ft4_encode_many(payloads, num_messages, tones);
+            else
+                ft8_encode_many(payloads, num_messages, tones);
+        }
+        double dt_many = (now_sec() - t0) / (num_rounds * num_messages);
+
+        printf("%s %d messages: one at a time %.0f ns, batched %.0f ns per message (%.1fx)\n", is_ft4 ? "FT4" : "FT8",
+            num_messages, 1e9 * dt_single, 1e9 * dt_many, dt_single / dt_many);
+    }
+    free(tones);
+    free(payloads);
+    printf("\n");
+}
+
+/// Waveform synthesis: ftx_synth_gfsk() against the streaming encoder, for one FT8 message at 12 kHz
+static void bench_synth(void)
+{
+    printf("== Waveform synthesis ==\n");
+    const int sample_rate = 12000;
+    uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES] = { 0x1C, 0x3F, 0x8A, 0x6A, 0xE2, 0x07, 0x10, 0xFE, 0x4C, 0xA0 };
+    uint8_t tones[FT8_NN];
+    ft8_encode(payload, tones);
+    ftx_encoder_t enc;
+    ftx_encoder_init(&enc, FTX_PROTOCOL_FT8, sample_rate);
+    float* wave = (float*)malloc(enc.num_samples * sizeof(float));
+    float* iq = (float*)malloc(2 * enc.num_samples * sizeof(float));
+
+    const int num_runs = 20;
+    double t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        ftx_synth_gfsk(tones, FT8_NN, 1003.0f, FT8_SYMBOL_BT, FT8_SYMBOL_PERIOD, sample_rate, wave);
+    }
+    double dt_synth = (now_sec() - t0) / num_runs;
+
+    // Blocks of 480 samples (40 ms), as an audio device might ask for them
+    const int block = 480;
+    t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        ftx_encoder_set_tones(&enc, tones, 1003.0f);
+        for (int pos = 0; pos < enc.num_samples; pos += block)
+        {
+            ftx_encoder_generate(&enc, wave + pos, block);
+        }
+    }
+    double dt_enc = (now_sec() - t0) / num_runs;
+
+    t0 = now_sec();
+    for (int run = 0; run < num_runs; ++run)
+    {
+        ftx_encoder_set_tones(&enc, tones, 1003.0f);
+        ftx_encoder_generate_iq(&enc, iq, enc.num_samples);
+    }
+    double dt_iq = (now_sec() - t0) / num_runs;
+
+    printf("ftx_synth_gfsk %.2f ms, encoder %.2f ms (%.1fx, %.1f ns per sample), complex %.2f ms per message\n",
+        1e3 * dt_synth, 1e3 * dt_enc, dt_synth / dt_enc, 1e9 * dt_enc / enc.num_samples, 1e3 * dt_iq);
+    free(iq);
+    free(wave);
+    ftx_encoder_free(&enc);
+    printf("\n");
+}
+
+static void bench_callsign_table(void)
+{
+    printf("== Callsign table ==\n");
+    char callsign[12];
+    for (int capacity = 1024; capacity <= 65536; capacity *= 8)
+    {
+        ftx_callsign_table_t table;
+        ftx_callsign_table_init(&table, capacity);
+        for (int i = 0; i < capacity; ++i)
+        {
+            sprintf(callsign, "K%dX", i);
+            ftx_callsign_table_add(&table, callsign, (uint32_t)i * 2654435761u >> 10);
+        }
+
+        const int num_lookups = 100000;
+        int num_found = 0;
+        double t0 = now_sec();
+        for (int i = 0; i < num_lookups; ++i)
+        {
+            num_found += ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_12_BITS, (uint32_t)i * 2654435761u >> 20, callsign);
+        }
+        double dt_lookup = (now_sec() - t0) / num_lookups;
+
+        // One cleanup per slot; after max_age + 1 slots every callsign has expired and the sweep starts removing
+        const int num_slots = 1000;
+        t0 = now_sec();
+        for (int slot = 0; slot < num_slots; ++slot)
+        {
+            ftx_callsign_table_cleanup(&table, 10);
+        }
+        double dt_cleanup = (now_sec() - t0) / num_slots;
+        printf("%5d callsigns: 12-bit lookup %.0f ns (%d%% found), cleanup %.2f us\n", capacity, 1e9 * dt_lookup, num_found / (num_lookups / 100), 1e6 * dt_cleanup);
+        ftx_callsign_table_free(&table);
+    }
+    printf("\n");
+}
+
+static void bench_callsign_store(void)
+{
+    printf("== Callsign store ==\n");
+    const char* path = "/tmp/bench_callsign_store.bin";
+    const int num_callsigns = 50000;
+    char callsign[12];
+    callsign_store_t store;
+    remove(path);
+    if (!callsign_store_open(&store, path, 65536))
+        return;
+    double t0 = now_sec();
+    for (int i = 0; i < num_callsigns; ++i)
+    {
+        sprintf(callsign, "K%dX", i);
+        callsign_store_add(&store, callsign, (uint32_t)i * 2654435761u >> 10, 1000 + i);
+    }
+    double dt_add = (now_sec() - t0) / num_callsigns;
+    callsign_store_close(&store);
+
+    // A restart: everything saved is found right after opening
+    t0 = now_sec();
+    callsign_store_open(&store, path, 0);
+    double dt_open = now_sec() - t0;
+    int num_found = 0;
+    t0 = now_sec();
+    for (int i = 0; i < num_callsigns; ++i)
+    {
+        char expected[12];
+        sprintf(expected, "K%dX", i);
+        num_found += callsign_store_lookup(&store, FTX_CALLSIGN_HASH_22_BITS, (uint32_t)i * 2654435761u >> 10, callsign) && (0 == strcmp(callsign, expected));
+    }
+    double dt_lookup = (now_sec() - t0) / num_callsigns;
+
+    t0 = now_sec();
+    callsign_store_compact(&store, 1000 + num_callsigns / 2);
+    double dt_compact = now_sec() - t0;
+    printf("%d callsigns: add %.0f ns, reopen %.2f ms, 22-bit lookup %.0f ns (%d restored), compact %.1f ms (%d kept)\n",
+        num_callsigns, 1e9 * dt_add, 1e3 * dt_open, 1e9 * dt_lookup, num_found, 1e3 * dt_compact, callsign_store_size(&store));
+    callsign_store_close(&store);
+    remove(path);
+    printf("\n");
+}
+
+static void bench_callsign_index(void)
+{
+    printf("== Callsign index ==\n");
+    const int num_callsigns = 300000;
+    char(*calls)[12] = malloc(num_callsigns * sizeof(calls[0]));
+    const char** list = malloc(num_callsigns * sizeof(list[0]));
+    uint32_t* n22 = malloc(num_callsigns * sizeof(n22[0]));
+    for (int i = 0; i < num_callsigns; ++i)
+    {
+        // Two-letter prefix, digit, three-letter suffix
+        uint32_t x = (uint32_t)i * 2654435761u;
+        snprintf(calls[i], sizeof(calls[0]), "%c%c%d%c%c%c", 'A' + x % 26, 'A' + (x >> 5) % 26, (x >> 10) % 10,
+            'A' + (i / 676) % 26, 'A' + (i / 26) % 26, 'A' + i % 26);
+        list[i] = calls[i];
+        ftx_callsign_hash22(calls[i], &n22[i]);
+    }
+
+    double t0 = now_sec();
+    size_t size;
+    void* image = ftx_callsign_index_build(list, num_callsigns, &size);
+    double dt_build = now_sec() - t0;
+    ftx_callsign_index_t index;
+    ftx_callsign_index_init(&index, image, size);
+
+    // Lookups in random order, so that they miss the cache
+    const int num_lookups = 1000000;
+    int num_found = 0;
+    char callsign[12];
+    t0 = now_sec();
+    for (int i = 0; i < num_lookups; ++i)
+    {
+        int k = (int)(((uint32_t)i * 2246822519u) % (uint32_t)num_callsigns);
+        num_found += ftx_callsign_index_lookup(&index, FTX_CALLSIGN_HASH_22_BITS, n22[k], callsign);
+    }
+    double dt_lookup = (now_sec() - t0) / num_lookups;
+    printf("%d callsigns: build %.0f ms, %.1f MB, 22-bit lookup %.0f ns (%.1f%% resolved, the rest share their hash)\n",
+        num_callsigns, 1e3 * dt_build, size / 1048576.0, 1e9 * dt_lookup, 100.0 * num_found / num_lookups);
+    free(image);
+    free(n22);
+    free(list);
+    free(calls);
+    printf("\n");
+}
+
+int main()
+{
+    bench_resampler();
+    bench_waterfall();
+    bench_noise();
+    bench_monitor_init();
+    bench_resynth();
+    bench_update_candidates();
+    bench_subtract();
+    bench_channel();
+    bench_wav_reader();
+    bench_message_codec();
+    bench_crc();
+    bench_encode();
+    bench_synth();
+    bench_callsign_table();
+    bench_callsign_store();
+    bench_callsign_index();
+    return 0;
+}
@@ -4,14 +4,26 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "ft8/text.h"
 #include "ft8/encode.h"
+#include "ft8/crc.h"
+#include "ft8/decode.h"
 #include "ft8/constants.h"
 #include "ft8/hashtable.h"
+#include "ft8/dedup.h"
+#include "ft8/callsign_table.h"
+#include "ft8/callsign_index.h"
 
 #include "fft/kiss_fftr.h"
 #include "common/common.h"
+#include "common/callsign_store.h"
+#include "common/wave.h"
+#include "common/resample.h"
+#include "common/monitor.h"
+#include "common/channel.h"
 #include "ft8/message.h"
 
 #define LOG_LEVEL LOG_INFO
@@ -103,11 +115,11 @@ void test3() {
 }
 */
 
-#define CHECK(condition)                                       \
-    if (!(condition))                                          \
-    {                                                          \
-        printf("FAIL: Condition \'" #condition "' failed!\n"); \
-        return;                                                \
+#define CHECK(condition)                                          \
+    if (!(condition))                                             \
+    {                                                             \
+        printf("FAIL: Condition '%s' failed!\n", #condition);     \
+        return;                                                   \
     }
 
 #define TEST_END printf("Test OK\n\n")
@@ -156,7 +168,1875 @@ void test_msg(const char* message_text, const char* expected, ftx_callsign_hash_
     TEST_END;
 }
 
-#define SIZEOF_ARRAY(x) (sizeof(x) / sizeof((x)[0]))
+void test_message_fields()
+{
+    printf("Testing message fields\n");
+    ftx_message_t msg;
+    ftx_message_fields_t fields;
+    char text[FTX_MAX_MESSAGE_LENGTH];
+
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg, NULL, "CQ K1ABC/R FN42"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode_fields(&msg, &fields));
+    CHECK(fields.type == FTX_MESSAGE_TYPE_STANDARD && fields.i3 == 1);
+    CHECK(fields.calls[0].kind == FTX_CALL_TOKEN && fields.calls[0].value == 2);
+    CHECK(fields.calls[1].kind == FTX_CALL_STANDARD && fields.calls[1].suffix);
+    CHECK(fields.flags == FTX_MESSAGE_FLAG_CQ);
+    CHECK(fields.extra == FTX_EXTRA_GRID && fields.extra_value == ((5 * 18 + 13) * 10 + 4) * 10 + 2);
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_format(&fields, NULL, text));
+    CHECK(0 == strcmp(text, "CQ K1ABC/R FN42"));
+
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg, NULL, "W9XYZ K1ABC R-07"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode_fields(&msg, &fields));
+    CHECK(fields.flags == FTX_MESSAGE_FLAG_ROGER);
+    CHECK(fields.extra == FTX_EXTRA_REPORT && fields.extra_value == -7);
+
+    // The hashed callsign stays a hash in the fields; formatting looks it up
+    ftx_callsign_table_t table;
+    ftx_callsign_hash_interface_t table_if;
+    ftx_callsign_table_init(&table, 16);
+    ftx_callsign_table_interface(&table, &table_if);
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg, &table_if, "PJ4/K1ABC W9XYZ RR73"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode_fields(&msg, &fields));
+    uint32_t n22;
+    ftx_callsign_hash22("PJ4/K1ABC", &n22);
+    CHECK(fields.calls[0].kind == FTX_CALL_HASH22 && fields.calls[0].value == n22);
+    CHECK(fields.extra == FTX_EXTRA_RR73);
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_format(&fields, NULL, text));
+    CHECK(0 == strcmp(text, "<...> W9XYZ RR73"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_format(&fields, &table_if, text));
+    CHECK(0 == strcmp(text, "<PJ4/K1ABC> W9XYZ RR73"));
+
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode_nonstd(&msg, &table_if, "W9XYZ", "PJ4/K1ABC", "73"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode_fields(&msg, &fields));
+    CHECK(fields.type == FTX_MESSAGE_TYPE_NONSTD_CALL);
+    CHECK(fields.calls[0].kind == FTX_CALL_HASH12 && fields.calls[1].kind == FTX_CALL_NONSTD);
+    CHECK(fields.extra == FTX_EXTRA_73);
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_format(&fields, &table_if, text));
+    CHECK(0 == strcmp(text, "<W9XYZ> PJ4/K1ABC 73"));
+    ftx_callsign_table_free(&table);
+
+    ftx_message_init(&msg);
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode_free(&msg, "TNX BOB 73 GL"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode_fields(&msg, &fields));
+    CHECK(fields.type == FTX_MESSAGE_TYPE_FREE_TEXT);
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_format(&fields, NULL, text));
+    CHECK(0 == strcmp(text, "TNX BOB 73 GL"));
+    TEST_END;
+}
+
+/// Message with a payload made from a number (only the 77 payload bits are set)
+static void make_test_message(ftx_message_t* msg, uint32_t n)
+{
+    ftx_message_init(msg);
+    for (int i = 0; i < FTX_PAYLOAD_LENGTH_BYTES; ++i)
+    {
+        msg->payload[i] = (uint8_t)((n * 2654435761u) >> (i % 4 * 8)) ^ (uint8_t)(i * 37);
+    }
+    msg->payload[FTX_PAYLOAD_LENGTH_BYTES - 1] &= 0xF8u;
+}
+
+void test_decoded_set()
+{
+    printf("Testing decoded message set\n");
+    ftx_decoded_set_t set;
+    ftx_message_t msg;
+
+    // Far more messages than the initial size, including payloads that share the 14-bit hash field
+    CHECK(ftx_decoded_set_init(&set, 8, 0));
+    for (uint32_t n = 0; n < 500; ++n)
+    {
+        make_test_message(&msg, n);
+        msg.hash = 0x1234;
+        CHECK(ftx_decoded_set_insert(&set, &msg) == FTX_DECODED_NEW);
+    }
+    CHECK(set.count == 500);
+    for (uint32_t n = 0; n < 500; ++n)
+    {
+        make_test_message(&msg, n);
+        CHECK(ftx_decoded_set_insert(&set, &msg) == FTX_DECODED_DUPLICATE);
+    }
+    make_test_message(&msg, 7);
+    msg.payload[FTX_PAYLOAD_LENGTH_BYTES - 1] |= 0x07u; // bits beyond the 77 do not count
+    CHECK(ftx_decoded_set_contains(&set, &msg));
+    make_test_message(&msg, 500);
+    CHECK(!ftx_decoded_set_contains(&set, &msg));
+    ftx_decoded_set_next_slot(&set);
+    CHECK(set.count == 0);
+    ftx_decoded_set_free(&set);
+
+    // A fixed table reports when it is full instead of looping
+    ftx_decoded_entry_t entries[16];
+    ftx_decoded_set_init_static(&set, entries, 16, 0);
+    for (uint32_t n = 0; n < 15; ++n)
+    {
+        make_test_message(&msg, n);
+        CHECK(ftx_decoded_set_insert(&set, &msg) == FTX_DECODED_NEW);
+    }
+    make_test_message(&msg, 15);
+    CHECK(ftx_decoded_set_insert(&set, &msg) == FTX_DECODED_FULL);
+    make_test_message(&msg, 3);
+    CHECK(ftx_decoded_set_insert(&set, &msg) == FTX_DECODED_DUPLICATE);
+
+    // Retention: messages seen again stay, the others are forgotten after 2 more slots
+    ftx_decoded_set_init_static(&set, entries, 16, 2);
+    for (uint32_t n = 0; n < 10; ++n)
+    {
+        make_test_message(&msg, n);
+        ftx_decoded_set_insert(&set, &msg);
+    }
+    for (int slot = 0; slot < 3; ++slot)
+    {
+        ftx_decoded_set_next_slot(&set);
+        for (uint32_t n = 0; n < 10; n += 3)
+        {
+            make_test_message(&msg, n);
+            CHECK(ftx_decoded_set_insert(&set, &msg) == FTX_DECODED_DUPLICATE);
+        }
+    }
+    CHECK(set.count == 4);
+    for (uint32_t n = 0; n < 10; ++n)
+    {
+        make_test_message(&msg, n);
+        CHECK(ftx_decoded_set_contains(&set, &msg) == (n % 3 == 0));
+    }
+    TEST_END;
+}
+
+void test_callsign_table()
+{
+    printf("Testing callsign table\n");
+    ftx_callsign_table_t table, table2;
+    char callsign[12];
+
+    // K1ABC and W9XYZ share the 10-bit hash, K1ABC and N0CALL share the 12-bit hash, N0CALL and Q1QQQ the bucket
+    // of the 22-bit index (but not the hash)
+    const uint32_t n22_k1abc = (0x155u << 12) | (0x2u << 10) | 0x3Au;
+    const uint32_t n22_w9xyz = (0x155u << 12) | (0x1u << 10) | 0x3Au;
+    const uint32_t n22_n0call = (0x155u << 12) | (0x2u << 10) | 0x10Bu;
+    const uint32_t n22_q1qqq = (0x0AAu << 12) | 0x10Bu;
+    ftx_callsign_table_init(&table, 4);
+    ftx_callsign_table_init(&table2, 4);
+    CHECK(ftx_callsign_table_add(&table, "K1ABC", n22_k1abc));
+    CHECK(ftx_callsign_table_add(&table, "N0CALL", n22_n0call));
+    CHECK(ftx_callsign_table_add(&table, "Q1QQQ", n22_q1qqq));
+    CHECK(ftx_callsign_table_add(&table2, "W9XYZ", n22_w9xyz));
+    CHECK(ftx_callsign_table_size(&table) == 3);
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, n22_k1abc, callsign) && !strcmp(callsign, "K1ABC"));
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, n22_n0call, callsign) && !strcmp(callsign, "N0CALL"));
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, n22_q1qqq, callsign) && !strcmp(callsign, "Q1QQQ"));
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_12_BITS, n22_k1abc >> 10, callsign) && !strcmp(callsign, "N0CALL"));
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_10_BITS, n22_q1qqq >> 12, callsign) && !strcmp(callsign, "Q1QQQ"));
+    CHECK(!ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, n22_w9xyz, callsign) && callsign[0] == '\0');
+    CHECK(!ftx_callsign_table_lookup(&table2, FTX_CALLSIGN_HASH_22_BITS, n22_k1abc, callsign));
+    CHECK(ftx_callsign_table_lookup(&table2, FTX_CALLSIGN_HASH_10_BITS, n22_k1abc >> 12, callsign) && !strcmp(callsign, "W9XYZ"));
+
+    // Aging: the youngest of the callsigns sharing a hash is found, old ones are removed
+    ftx_callsign_table_cleanup(&table, 10);
+    CHECK(ftx_callsign_table_add(&table, "N0CALL", n22_n0call));
+    CHECK(ftx_callsign_table_size(&table) == 3);
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_12_BITS, n22_k1abc >> 10, callsign) && !strcmp(callsign, "N0CALL"));
+    CHECK(ftx_callsign_table_add(&table, "W9XYZ", n22_w9xyz));
+    CHECK(ftx_callsign_table_add(&table, "AB1CD", 12345)); // full, evicts the oldest (K1ABC)
+    CHECK(ftx_callsign_table_size(&table) == 4);
+    CHECK(!ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, n22_k1abc, callsign));
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_10_BITS, n22_k1abc >> 12, callsign) && !strcmp(callsign, "W9XYZ"));
+    CHECK(ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, 12345, callsign) && !strcmp(callsign, "AB1CD"));
+    ftx_callsign_table_cleanup(&table, 0);
+    CHECK(ftx_callsign_table_size(&table) == 3);
+    CHECK(!ftx_callsign_table_lookup(&table, FTX_CALLSIGN_HASH_22_BITS, n22_q1qqq, callsign));
+
+    // Expired callsigns are not found even before the clock hand gets to them
+    ftx_callsign_table_t large;
+    ftx_callsign_table_init(&large, 4 * FTX_CALLSIGN_SWEEP_STEP);
+    for (uint32_t n = 0; n < 4 * FTX_CALLSIGN_SWEEP_STEP; ++n)
+    {
+        sprintf(callsign, "K%dAA", n);
+        CHECK(ftx_callsign_table_add(&large, callsign, n * 977u));
+    }
+    ftx_callsign_table_cleanup(&large, 0);
+    CHECK(ftx_callsign_table_lookup(&large, FTX_CALLSIGN_HASH_22_BITS, 100 * 977u, callsign) && !strcmp(callsign, "K100AA"));
+    ftx_callsign_table_cleanup(&large, 0);
+    CHECK(ftx_callsign_table_size(&large) == 3 * FTX_CALLSIGN_SWEEP_STEP);
+    CHECK(!ftx_callsign_table_lookup(&large, FTX_CALLSIGN_HASH_22_BITS, 100 * 977u, callsign));
+    ftx_callsign_table_free(&large);
+
+    // Two decoders with their own tables through the message codec
+    ftx_callsign_hash_interface_t hash_if1, hash_if2;
+    ftx_callsign_table_clear(&table);
+    ftx_callsign_table_clear(&table2);
+    ftx_callsign_table_interface(&table, &hash_if1);
+    ftx_callsign_table_interface(&table2, &hash_if2);
+    test_msg("EA8/G5LSI R2RFE RR73", "<EA8/G5LSI> R2RFE RR73", &hash_if1);
+    CHECK(ftx_callsign_table_size(&table) == 2 && ftx_callsign_table_size(&table2) == 0);
+    test_msg("R2RFE/P EA8/G5LSI R+12", "R2RFE/P <EA8/G5LSI> R+12", &hash_if2);
+
+    ftx_callsign_table_free(&table);
+    ftx_callsign_table_free(&table2);
+    TEST_END;
+}
+
+/// Shared state of the callsign table stress test
+typedef struct
+{
+    ftx_callsign_table_t* table;
+    atomic_bool done;     ///< Set by the writer when it has finished
+    atomic_int num_hits;  ///< Lookups that found a callsign
+    atomic_int num_wrong; ///< Hits that returned a callsign not matching the hash
+} table_stress_t;
+
+/// Callsigns of the stress test: a distinct 22-bit hash each (odd multiplier), short hashes shared by some
+static uint32_t stress_n22(int i)
+{
+    return ((uint32_t)i * 0x9E3779B1u) & 0x3FFFFFu;
+}
+
+static void* table_stress_writer(void* arg)
+{
+    table_stress_t* stress = (table_stress_t*)arg;
+    uint32_t state = 1;
+    char callsign[12];
+    for (int n = 0; n < 200000; ++n)
+    {
+        state = state * 1664525u + 1013904223u;
+        int i = (state >> 16) % 512;
+        sprintf(callsign, "K%dZZ", i);
+        ftx_callsign_table_add(stress->table, callsign, stress_n22(i));
+        if (n % 100 == 0)
+        {
+            ftx_callsign_table_cleanup(stress->table, 2);
+        }
+    }
+    atomic_store(&stress->done, true);
+    return NULL;
+}
+
+static void* table_stress_reader(void* arg)
+{
+    table_stress_t* stress = (table_stress_t*)arg;
+    uint32_t state = (uint32_t)(uintptr_t)&state;
+    const int shift[3] = { 0, 10, 12 }; // by ftx_callsign_hash_type_t
+    char callsign[12];
+    while (!atomic_load(&stress->done))
+    {
+        state = state * 1664525u + 1013904223u;
+        int i = (state >> 16) % 512;
+        ftx_callsign_hash_type_t hash_type = (ftx_callsign_hash_type_t)((state >> 8) % 3);
+        uint32_t hash = stress_n22(i) >> shift[hash_type];
+        if (!ftx_callsign_table_lookup(stress->table, hash_type, hash, callsign))
+            continue;
+        // The callsign must be whole and its own hash must match the one looked up
+        int j = -1;
+        char tail[4] = "";
+        bool ok = (2 == sscanf(callsign, "K%d%3s", &j, tail)) && (0 == strcmp(tail, "ZZ")) && (j >= 0) && (j < 512) && ((stress_n22(j) >> shift[hash_type]) == hash);
+        atomic_fetch_add(&stress->num_hits, 1);
+        if (!ok)
+            atomic_fetch_add(&stress->num_wrong, 1);
+    }
+    return NULL;
+}
+
+void test_callsign_table_threads()
+{
+    printf("Testing callsign table with concurrent readers\n");
+    enum { kNum_readers = 3 };
+    ftx_callsign_table_t table;
+    // Far smaller than the set of callsigns, so that nearly every add evicts and rewrites an entry while the
+    // readers look up
+    ftx_callsign_table_init(&table, 16);
+    table_stress_t stress = { .table = &table };
+    atomic_init(&stress.done, false);
+    atomic_init(&stress.num_hits, 0);
+    atomic_init(&stress.num_wrong, 0);
+
+    pthread_t readers[kNum_readers];
+    pthread_t writer;
+    for (int r = 0; r < kNum_readers; ++r)
+    {
+        pthread_create(&readers[r], NULL, table_stress_reader, &stress);
+    }
+    pthread_create(&writer, NULL, table_stress_writer, &stress);
+    pthread_join(writer, NULL);
+    for (int r = 0; r < kNum_readers; ++r)
+    {
+        pthread_join(readers[r], NULL);
+    }
+    ftx_callsign_table_free(&table);
+
+    CHECK(atomic_load(&stress.num_hits) > 0);
+    CHECK(atomic_load(&stress.num_wrong) == 0);
+    TEST_END;
+}
+
+void test_callsign_index()
+{
+    printf("Testing callsign index\n");
+    char calls[200][12];
+    const char* list[202];
+    uint32_t n22[200];
+    int num_calls = 0;
+
+    // Callsigns up to the first pair that shares a 10-bit hash
+    int pair = -1;
+    while (pair < 0)
+    {
+        snprintf(calls[num_calls], sizeof(calls[0]), "K%dAB", num_calls);
+        CHECK(ftx_callsign_hash22(calls[num_calls], &n22[num_calls]));
+        list[num_calls] = calls[num_calls];
+        for (int i = 0; i < num_calls; ++i)
+        {
+            if ((n22[i] >> 12) == (n22[num_calls] >> 12))
+                pair = i;
+        }
+        ++num_calls;
+        CHECK(num_calls < 200);
+    }
+    list[num_calls] = "EA8/G5LSI";
+    list[num_calls + 1] = "K0AB"; // duplicate
+
+    size_t size;
+    void* image = ftx_callsign_index_build(list, num_calls + 2, &size);
+    ftx_callsign_index_t index;
+    CHECK(image != NULL && ftx_callsign_index_init(&index, image, size));
+    CHECK(!ftx_callsign_index_init(&index, image, size - 8));
+    CHECK(ftx_callsign_index_init(&index, image, size));
+    CHECK(index.num_keys == (uint32_t)num_calls + 1);
+
+    // A corrupt directory or short key is rejected, as lookups would read past the entries
+    uint32_t* dir = (uint32_t*)((uint8_t*)image + ((const uint8_t*)index.dir - (const uint8_t*)image));
+    uint32_t* short12 = (uint32_t*)((uint8_t*)image + ((const uint8_t*)index.short_keys[0] - (const uint8_t*)image));
+    uint32_t saved = dir[1];
+    dir[1] = index.num_keys + 1;
+    CHECK(!ftx_callsign_index_init(&index, image, size));
+    dir[1] = saved;
+    saved = short12[7];
+    short12[7] = index.num_keys + 1;
+    CHECK(!ftx_callsign_index_init(&index, image, size));
+    short12[7] = saved;
+    CHECK(ftx_callsign_index_init(&index, image, size));
+
+    char callsign[12];
+    for (int i = 0; i < num_calls; ++i)
+    {
+        CHECK(ftx_callsign_index_lookup(&index, FTX_CALLSIGN_HASH_22_BITS, n22[i], callsign) && !strcmp(callsign, calls[i]));
+        CHECK(!ftx_callsign_index_lookup(&index, FTX_CALLSIGN_HASH_22_BITS, n22[i] ^ 1, callsign) && callsign[0] == '\0');
+    }
+    const int last = num_calls - 1;
+    CHECK(!ftx_callsign_index_lookup(&index, FTX_CALLSIGN_HASH_10_BITS, n22[last] >> 12, callsign)); // ambiguous
+    CHECK(ftx_callsign_index_lookup(&index, FTX_CALLSIGN_HASH_12_BITS, n22[last] >> 10, callsign) == ((n22[last] >> 10) != (n22[pair] >> 10)));
+
+    // A hashed callsign never heard is resolved from the index
+    ftx_callsign_hash_interface_t hash_if_index;
+    ftx_callsign_index_interface(&index, &hash_if_index);
+    ftx_message_t msg;
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg, NULL, "EA8/G5LSI R2RFE RR73"));
+    char text[FTX_MAX_MESSAGE_LENGTH];
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode(&msg, &hash_if_index, text));
+    CHECK(0 == strcmp(text, "<EA8/G5LSI> R2RFE RR73"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg, NULL, "EA8/G5LSJ R2RFE RR73"));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_decode(&msg, &hash_if_index, text));
+    CHECK(0 == strcmp(text, "<...> R2RFE RR73"));
+
+    free(image);
+    TEST_END;
+}
+
+/// Reference bitwise CRC-14 (the division one bit at a time)
+static uint16_t crc_bitwise(const uint8_t* message, int num_bits)
+{
+    uint16_t remainder = 0;
+    for (int i = 0; i < num_bits; ++i)
+    {
+        if (i % 8 == 0)
+            remainder ^= message[i / 8] << (FT8_CRC_WIDTH - 8);
+        remainder = (remainder & (1u << (FT8_CRC_WIDTH - 1))) ? ((remainder << 1) ^ FT8_CRC_POLYNOMIAL) : (remainder << 1);
+    }
+    return remainder & ((1u << FT8_CRC_WIDTH) - 1);
+}
+
+/// Callsigns of the store test: all in the same bucket of the 22-bit index, so that they form a single chain
+static void make_store_callsign(int i, char* callsign, uint32_t* n22)
+{
+    sprintf(callsign, "K%dABC", i);
+    *n22 = ((uint32_t)i << 12) | 5;
+}
+
+/// Check a reopened store that had its last two records (of num_calls) torn, then add to it
+static void check_store_recovery(callsign_store_t* store, int num_calls)
+{
+    char callsign[12];
+    char expected[12];
+    uint32_t n22;
+    CHECK(callsign_store_size(store) == num_calls - 2);
+    for (int i = 0; i < num_calls; ++i)
+    {
+        make_store_callsign(i, expected, &n22);
+        bool found = callsign_store_lookup(store, FTX_CALLSIGN_HASH_22_BITS, n22, callsign);
+        CHECK(found == (i < num_calls - 2));
+        CHECK(!found || (0 == strcmp(callsign, expected)));
+        found = callsign_store_lookup(store, FTX_CALLSIGN_HASH_12_BITS, n22 >> 10, callsign);
+        CHECK(found == (i < num_calls - 2));
+    }
+
+    // A new record goes at the head of the rebuilt chain, with the older ones still behind it
+    make_store_callsign(100, expected, &n22);
+    CHECK(callsign_store_add(store, expected, n22, 2000));
+    CHECK(callsign_store_size(store) == num_calls - 1);
+    CHECK(callsign_store_lookup(store, FTX_CALLSIGN_HASH_22_BITS, n22, callsign) && (0 == strcmp(callsign, expected)));
+    for (int i = 0; i < num_calls - 2; ++i)
+    {
+        make_store_callsign(i, expected, &n22);
+        CHECK(callsign_store_lookup(store, FTX_CALLSIGN_HASH_22_BITS, n22, callsign) && (0 == strcmp(callsign, expected)));
+    }
+    make_store_callsign(99, expected, &n22);
+    CHECK(!callsign_store_lookup(store, FTX_CALLSIGN_HASH_22_BITS, n22, callsign));
+}
+
+void test_callsign_store()
+{
+    printf("Testing callsign store recovery\n");
+    const char* path = "/tmp/test_callsign_store.bin";
+    const int num_calls = 10;
+    char callsign[12];
+    uint32_t n22;
+    callsign_store_t store;
+    remove(path);
+    CHECK(callsign_store_open(&store, path, 64));
+    int num_added = 0;
+    for (int i = 0; i < num_calls; ++i)
+    {
+        make_store_callsign(i, callsign, &n22);
+        num_added += callsign_store_add(&store, callsign, n22, 1000 + i);
+    }
+    callsign_store_close(&store);
+    CHECK(num_added == num_calls);
+
+    // A power loss that kept the header and the links of the last two records, but not the count of linked records
+    // nor the first of the two records. Layout of a store of capacity 64: a 64-byte header (the count of linked
+    // records at offset 36), the heads of 1024 + 4096 + 64 buckets, then records of 40 bytes.
+    FILE* f = fopen(path, "r+b");
+    CHECK(f != NULL);
+    uint32_t indexed = num_calls - 2;
+    fseek(f, 36, SEEK_SET);
+    fwrite(&indexed, sizeof(indexed), 1, f);
+    fseek(f, 64 + (1024 + 4096 + 64) * 4 + (num_calls - 2) * 40, SEEK_SET);
+    fputc('X', f);
+    fclose(f);
+
+    CHECK(callsign_store_open(&store, path, 0));
+    check_store_recovery(&store, num_calls);
+    callsign_store_close(&store);
+    remove(path);
+    TEST_END;
+}
+
+void test_waterfall_u4()
+{
+    printf("Testing 4-bit waterfall with a saturated block\n");
+    enum { kNum_bins = 16, kNum_blocks = 2 };
+    uint8_t mag4[kNum_blocks * kNum_bins / 2];
+    uint8_t block_offset[kNum_blocks];
+    uint8_t block_scale[kNum_blocks];
+    uint8_t noise[kNum_bins];
+    ftx_waterfall_t wf = {
+        .max_blocks = kNum_blocks,
+        .num_blocks = kNum_blocks,
+        .num_bins = kNum_bins,
+        .time_osr = 1,
+        .freq_osr = 1,
+        .mag4 = mag4,
+        .block_offset = block_offset,
+        .block_scale = block_scale,
+        .format = FTX_WATERFALL_U4,
+        .noise = noise,
+        .layout = FTX_WATERFALL_TIME_MAJOR,
+        .block_stride = kNum_bins,
+        .time_sub_stride = kNum_bins,
+        .freq_sub_stride = kNum_bins,
+        .bin_stride = 1,
+    };
+
+    // A low median (nibble 0 placed at 1) with a full-scale peak: the top nibble must not decode past 255
+    uint8_t values[kNum_bins];
+    for (int block = 0; block < kNum_blocks; ++block)
+    {
+        for (int bin = 0; bin < kNum_bins; ++bin)
+        {
+            values[bin] = (bin == 3) ? 255 : 9;
+        }
+        ftx_waterfall_pack_block(&wf, block, values);
+        for (int bin = 0; bin < kNum_bins; ++bin)
+        {
+            int value = ftx_waterfall_get(&wf, block, block * wf.block_stride + bin);
+            CHECK(value >= 0 && value <= 255);
+            CHECK(abs(value - values[bin]) <= wf.block_scale[block] / 2);
+        }
+        CHECK(ftx_waterfall_get(&wf, block, block * wf.block_stride + 3) == 255);
+    }
+
+    // The noise histogram is indexed by the decoded values
+    ftx_waterfall_update_noise(&wf);
+    CHECK(abs(noise[8] - 9) <= wf.block_scale[0] / 2);
+    TEST_END;
+}
+
+/// True if the n bytes at ptr lie within the arena
+static bool in_arena(const void* ptr, size_t n, const uint8_t* arena, size_t arena_size)
+{
+    const uint8_t* p = (const uint8_t*)ptr;
+    return p != NULL && p >= arena && p + n <= arena + arena_size;
+}
+
+void test_monitor_arena()
+{
+    printf("Testing monitor arena size\n");
+    const monitor_config_t configs[] = {
+        { .f_min = 100, .f_max = 3000, .sample_rate = 12000, .time_osr = 2, .freq_osr = 2, .protocol = FTX_PROTOCOL_FT8 },
+        { .f_min = 100, .f_max = 3000, .sample_rate = 12000, .time_osr = 2, .freq_osr = 2, .protocol = FTX_PROTOCOL_FT4, .wf_layout = FTX_WATERFALL_FREQ_MAJOR, .wf_format = FTX_WATERFALL_U4, .keep_audio = true },
+        { .f_min = 200, .f_max = 3000, .sample_rate = 48000, .proc_rate = 12000, .time_osr = 2, .freq_osr = 2, .protocol = FTX_PROTOCOL_FT8, .wf_phase = true, .keep_audio = true },
+        { .f_min = 200, .f_max = 3000, .sample_rate = 44100, .proc_rate = 12000, .time_osr = 4, .freq_osr = 2, .protocol = FTX_PROTOCOL_FT8, .wf_format = FTX_WATERFALL_U4, .wf_phase = true },
+    };
+    enum { kGuard = 4096 };
+
+    for (int c = 0; c < (int)(sizeof(configs) / sizeof(configs[0])); ++c)
+    {
+        const monitor_config_t* cfg = &configs[c];
+        const size_t size = monitor_get_memory_size(cfg);
+        CHECK(size % MONITOR_ARENA_ALIGN == 0);
+        uint8_t* arena = (uint8_t*)aligned_alloc(MONITOR_ARENA_ALIGN, size + kGuard);
+        memset(arena + size, 0xA5, kGuard);
+        monitor_t mon;
+        monitor_init_static(&mon, cfg, arena);
+
+        // Every buffer the monitor uses is carved from exactly the bytes that were asked for
+        const int num_elements = mon.wf.max_blocks * mon.wf.time_osr * mon.wf.freq_osr * mon.wf.num_bins;
+        const int num_noise = mon.wf.freq_osr * mon.wf.num_bins;
+        const int num_tones = (cfg->protocol == FTX_PROTOCOL_FT4) ? FT4_NN : FT8_NN;
+        bool inside = (mon.arena_size == size);
+        inside = inside && in_arena(mon.last_frame, mon.nfft * sizeof(float), arena, size);
+        inside = inside && in_arena(mon.timedata, mon.nfft * sizeof(kiss_fft_scalar), arena, size);
+        inside = inside && in_arena(mon.freqdata, (mon.nfft / 2 + 1) * sizeof(kiss_fft_cpx), arena, size);
+        inside = inside && in_arena(mon.window, mon.nfft * sizeof(float), arena, size);
+        inside = inside && in_arena(mon.fft_work, 1, arena, size);
+        inside = inside && in_arena(mon.proc_frame, mon.block_size * sizeof(float), arena, size);
+        inside = inside && in_arena(mon.wf.noise, num_noise, arena, size);
+        inside = inside && in_arena(mon.noise_median, num_noise, arena, size);
+        inside = inside && in_arena(mon.wf.dirty, sizeof(uint32_t), arena, size);
+        if (cfg->wf_format == FTX_WATERFALL_U4)
+        {
+            inside = inside && in_arena(mon.wf.mag4, (num_elements + 1) / 2, arena, size);
+            inside = inside && in_arena(mon.wf.block_offset, mon.wf.max_blocks, arena, size);
+            inside = inside && in_arena(mon.wf.block_scale, mon.wf.max_blocks, arena, size);
+            inside = inside && in_arena(mon.block_mag, num_elements / mon.wf.max_blocks, arena, size);
+        }
+        else
+        {
+            inside = inside && in_arena(mon.wf.mag, num_elements, arena, size);
+        }
+        if (cfg->wf_phase)
+        {
+            inside = inside && in_arena(mon.wf.cpx, num_elements * sizeof(ftx_waterfall_cpx_t), arena, size);
+            inside = inside && in_arena(mon.ifft_work, 1, arena, size);
+            inside = inside && in_arena(mon.ifft_freqdata, mon.nifft * sizeof(kiss_fft_cpx), arena, size);
+            inside = inside && in_arena(mon.ifft_timedata, mon.nifft * sizeof(kiss_fft_cpx), arena, size);
+        }
+        if (cfg->keep_audio)
+        {
+            inside = inside && in_arena(mon.audio, mon.wf.max_blocks * mon.block_size * sizeof(float), arena, size);
+            inside = inside && in_arena(mon.subtract_audio, num_tones * mon.block_size * sizeof(float), arena, size);
+            inside = inside && in_arena(mon.subtract_amp, num_tones * mon.block_size * sizeof(kiss_fft_cpx), arena, size);
+            inside = inside && in_arena(mon.subtract_seg, num_tones * sizeof(kiss_fft_cpx), arena, size);
+            inside = inside && in_arena(mon.subtract_enc.pulse_step, 3 * mon.subtract_enc.n_spsym * sizeof(uint32_t), arena, size);
+            inside = inside && in_arena(mon.subtract_enc.sine, sizeof(float), arena, size);
+        }
+        if (mon.use_resampler)
+        {
+            const resampler_t* rs = &mon.resampler;
+            inside = inside && in_arena(rs->coeffs, rs->up * rs->taps_per_phase * sizeof(float), arena, size);
+            inside = inside && in_arena(rs->history, 2 * rs->taps_per_phase * sizeof(float), arena, size);
+        }
+        CHECK(inside);
+
+        // A whole slot through every path that touches the arena must stay within it
+        const float slot_time = (cfg->protocol == FTX_PROTOCOL_FT4) ? FT4_SLOT_TIME : FT8_SLOT_TIME;
+        const int num_samples = (int)(slot_time * cfg->sample_rate);
+        float* signal = (float*)malloc(num_samples * sizeof(float));
+        uint32_t seed = 1;
+        for (int i = 0; i < num_samples; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            signal[i] = 0.1f * sinf(2 * (float)M_PI * 1000.0f * i / cfg->sample_rate) + (float)(seed >> 8) / (1 << 24) - 0.5f;
+        }
+        monitor_feed(&mon, signal, num_samples);
+        ftx_waterfall_update_noise(&mon.wf);
+        ftx_candidate_t cand = { .freq_offset = (int16_t)(1000 * mon.symbol_period - mon.min_bin) };
+        if (cfg->keep_audio)
+        {
+            uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES] = { 0 };
+            uint8_t tones[FT4_NN];
+            if (cfg->protocol == FTX_PROTOCOL_FT4)
+                ft4_encode(payload, tones);
+            else
+                ft8_encode(payload, tones);
+            CHECK(monitor_subtract(&mon, &cand, tones));
+            monitor_refresh(&mon);
+        }
+        if (cfg->wf_phase)
+        {
+            kiss_fft_cpx* baseband = (kiss_fft_cpx*)malloc(mon.wf.max_blocks * mon.nifft / mon.wf.freq_osr * sizeof(kiss_fft_cpx));
+            CHECK(monitor_resynth(&mon, &cand, baseband) > 0);
+            free(baseband);
+        }
+        monitor_free(&mon);
+        free(signal);
+
+        bool guard_intact = true;
+        for (int i = 0; i < kGuard; ++i)
+        {
+            guard_intact = guard_intact && (arena[size + i] == 0xA5);
+        }
+        free(arena);
+        CHECK(guard_intact);
+    }
+    TEST_END;
+}
+
+void test_monitor_subtract()
+{
+    printf("Testing signal subtraction\n");
+    const int sample_rate = 12000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    const int start = sample_rate / 2; // 0.5 s into the slot
+    const float amp = 0.1f;
+    const monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .sample_rate = sample_rate,
+        .time_osr = 2,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8,
+        .keep_audio = true
+    };
+    monitor_t mon;
+    monitor_init(&mon, &cfg);
+
+    // One FT8 signal, off the bin grid, in white noise about as strong as the signal
+    uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES] = { 0x1C, 0x3F, 0x8A, 0x6A, 0xE2, 0x07, 0x10, 0xFE, 0x4C, 0xA0 };
+    uint8_t tones[FT8_NN];
+    ft8_encode(payload, tones);
+    const int num_wave = FT8_NN * mon.block_size;
+    float* wave = (float*)malloc(num_wave * sizeof(float));
+    ftx_synth_gfsk(tones, FT8_NN, 1003.0f, FT8_SYMBOL_BT, FT8_SYMBOL_PERIOD, sample_rate, wave);
+    float* noise = (float*)malloc(num_samples * sizeof(float));
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    uint32_t seed = 7;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        float sum = 0;
+        for (int k = 0; k < 12; ++k)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            sum += (float)(seed >> 8) / (1 << 24);
+        }
+        noise[i] = 0.1f * (sum - 6);
+        signal[i] = noise[i];
+    }
+    double sig2 = 0;
+    for (int i = 0; i < num_wave; ++i)
+    {
+        signal[start + i] += amp * wave[i];
+        sig2 += amp * wave[i] * amp * wave[i];
+    }
+    monitor_feed(&mon, signal, num_samples);
+
+    ftx_candidate_t cand;
+    CHECK(ftx_find_candidates(&mon.wf, 1, &cand, 0) == 1);
+    CHECK(monitor_subtract(&mon, &cand, tones));
+
+    // What is left of the signal: kept audio after the subtraction against the noise alone
+    double res2 = 0;
+    for (int i = 0; i < num_wave; ++i)
+    {
+        float diff = mon.audio[start + i] - noise[start + i];
+        res2 += diff * diff;
+    }
+    CHECK(res2 < sig2 * 1e-2); // at least 20 dB down
+
+    // Within the tiles marked dirty, the refreshed waterfall is the one of the audio without the signal
+    // (outside them, the faint broadband residual of the subtraction is deliberately not reanalyzed)
+    monitor_refresh(&mon);
+    monitor_t clean;
+    monitor_init(&clean, &cfg);
+    monitor_feed(&clean, mon.audio, mon.wf.num_blocks * mon.block_size);
+    CHECK(clean.wf.num_blocks == mon.wf.num_blocks);
+    const int num_elements = mon.wf.num_blocks * mon.wf.block_stride;
+    int max_diff = 0;
+    int num_dirty = 0;
+    for (int i = 0; i < num_elements; ++i)
+    {
+        // Time-major layout: the bin is the fastest index
+        const int block = i / mon.wf.block_stride;
+        const int bin = (i % mon.wf.block_stride) % mon.wf.num_bins;
+        if (!(mon.wf.dirty[bin / FTX_DIRTY_TILE_BINS] & ftx_waterfall_dirty_bit(block)))
+            continue;
+        int diff = abs((int)mon.wf.mag[i] - (int)clean.wf.mag[i]);
+        max_diff = (diff > max_diff) ? diff : max_diff;
+        ++num_dirty;
+    }
+    CHECK(num_dirty > 0);
+    CHECK(max_diff == 0);
+
+    monitor_free(&clean);
+    monitor_free(&mon);
+    free(signal);
+    free(noise);
+    free(wave);
+    TEST_END;
+}
+
+void test_channel()
+{
+    printf("Testing channel simulator\n");
+    const int sample_rate = 12000;
+    const int num_samples = 60 * sample_rate;
+    const int max_output = num_samples + num_samples / 1000;
+    float* input = (float*)malloc(num_samples * sizeof(float));
+    float* output = (float*)malloc(max_output * sizeof(float));
+    // Tones across the passband, where the Hilbert transformer is flat
+    double in2 = 0;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        input[i] = 0;
+        for (int f = 300; f < 3000; f += 290)
+        {
+            input[i] += sinf(2 * (float)M_PI * fmodf((float)f * i / sample_rate + 0.37f * f, 1.0f));
+        }
+        in2 += input[i] * input[i];
+    }
+
+    const channel_config_t configs[] = {
+        { sample_rate, 0, 0, 0, 0, 0, 1 },       // passthrough
+        { sample_rate, 1, 0, 0, 0, 0, 1 },       // 1 Hz fading
+        { sample_rate, 10, 0, 0, 0, 0, 1 },      // 10 Hz fading
+        { sample_rate, 1, 2, 0, 0, 0, 1 },       // 2 paths 2 ms apart
+        { sample_rate, 10, 2, 0, 0.1f, 0, 1 },   // and drift
+        { sample_rate, 10, 2, 0, 0.1f, 100, 1 }, // and a 100 ppm clock offset
+    };
+    const int num_seeds = 4;
+    for (int c = 0; c < (int)(sizeof(configs) / sizeof(configs[0])); ++c)
+    {
+        // The mean power of a single fading realization scatters by about 1 / sqrt(spread * duration)
+        double power = 0;
+        for (int seed = 1; seed <= num_seeds; ++seed)
+        {
+            channel_config_t cfg = configs[c];
+            cfg.seed = seed;
+            channel_t channel;
+            channel_init(&channel, &cfg);
+            int num_output = 0;
+            const int chunk = 777;
+            for (int pos = 0; pos < num_samples; pos += chunk)
+            {
+                int n = (pos + chunk <= num_samples) ? chunk : (num_samples - pos);
+                num_output += channel_process(&channel, input + pos, n, NULL, output + num_output, max_output - num_output);
+            }
+            const int latency = channel.latency;
+            channel_free(&channel);
+
+            const int expected = (int)(num_samples * (1 + 1e-6 * cfg.clock_ppm) + 0.5);
+            CHECK(abs(num_output - expected) <= 2);
+            double out2 = 0;
+            for (int i = 0; i < num_output; ++i)
+            {
+                out2 += output[i] * output[i];
+            }
+            power += (out2 / num_output) / (in2 / num_samples) / num_seeds;
+
+            if (c == 0)
+            {
+                // Without impairments the output is the input, delayed by the documented latency
+                bool exact = true;
+                for (int i = 0; i < num_output; ++i)
+                {
+                    exact = exact && (output[i] == ((i < latency) ? 0.0f : input[i - latency]));
+                }
+                CHECK(latency > 0);
+                CHECK(exact);
+            }
+        }
+        CHECK(fabs(power - 1) < 0.1);
+    }
+    free(output);
+    free(input);
+    TEST_END;
+}
+
+typedef struct
+{
+    const monitor_config_t* cfg;
+    monitor_t mon;
+} plan_thread_t;
+
+static void* plan_thread(void* arg)
+{
+    plan_thread_t* t = (plan_thread_t*)arg;
+    monitor_init(&t->mon, t->cfg);
+    return NULL;
+}
+
+void test_monitor_plan_cache()
+{
+    printf("Testing shared monitor plans\n");
+    const monitor_config_t cfg_ft8 = { .f_min = 200, .f_max = 3000, .sample_rate = 12000, .time_osr = 2, .freq_osr = 2, .protocol = FTX_PROTOCOL_FT8 };
+    const monitor_config_t cfg_ft4 = { .f_min = 200, .f_max = 3000, .sample_rate = 12000, .time_osr = 2, .freq_osr = 2, .protocol = FTX_PROTOCOL_FT4 };
+    monitor_plan_cache_purge(); // plans left over by earlier tests
+
+    // Monitors with the same FFT size share one window and FFT plan, others get their own
+    monitor_t a, b, c;
+    monitor_init(&a, &cfg_ft8);
+    monitor_init(&b, &cfg_ft8);
+    monitor_init(&c, &cfg_ft4);
+    CHECK(a.plan != NULL && a.plan == b.plan && a.window == b.window);
+    CHECK(c.plan != NULL && c.plan != a.plan);
+
+    // A plan is released only once no monitor uses it
+    CHECK(monitor_plan_cache_purge() == 0);
+    monitor_free(&a);
+    CHECK(monitor_plan_cache_purge() == 0);
+    monitor_free(&b);
+    monitor_free(&c);
+    CHECK(monitor_plan_cache_purge() == 2);
+    CHECK(monitor_plan_cache_purge() == 0);
+
+    // Monitors created concurrently end up with a single plan, whichever thread builds it first
+    enum { kNum_threads = 4 };
+    pthread_t threads[kNum_threads];
+    static plan_thread_t states[kNum_threads];
+    for (int i = 0; i < kNum_threads; ++i)
+    {
+        states[i].cfg = &cfg_ft8;
+        pthread_create(&threads[i], NULL, plan_thread, &states[i]);
+    }
+    for (int i = 0; i < kNum_threads; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    bool shared = true;
+    for (int i = 0; i < kNum_threads; ++i)
+    {
+        shared = shared && (states[i].mon.plan == states[0].mon.plan);
+        monitor_free(&states[i].mon);
+    }
+    CHECK(shared);
+    CHECK(monitor_plan_cache_purge() == 1);
+    TEST_END;
+}
+
+/// Little-endian field of a test WAVE image
+static void put_le(uint8_t* dst, uint32_t value, int num_bytes)
+{
+    for (int i = 0; i < num_bytes; ++i)
+    {
+        dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/// Sample of channel ch at position i of a test WAVE image as an offset binary code of the given bits, spanning
+/// the full range (the first one is the most negative value, -1.0)
+static uint32_t wav_test_code(int bits, int i, int ch)
+{
+    return (i == 0) ? 0 : ((((uint32_t)i * 2654435761u) ^ ((uint32_t)ch * 0x5bd1e995u)) >> (32 - bits));
+}
+
+/// Value of a test sample as read (-1 .. +1)
+static float wav_test_value(int bits, int i, int ch)
+{
+    double half = (double)(1u << (bits - 1));
+    return (float)((wav_test_code(bits, i, ch) - half) / half);
+}
+
+/// Build a WAVE image: an odd-sized chunk before the format (padded), the fmt chunk (extensible or not), then the data
+/// chunk with its size field given (data_size_field < 0 for the actual size)
+static size_t make_test_wav(uint8_t* image, int format, int bits, int num_channels, bool extensible, int num_samples, int64_t data_size_field)
+{
+    const int sample_size = bits / 8;
+    const int block_align = num_channels * sample_size;
+    uint8_t* p = image + 12;
+    memcpy(p, "LIST", 4);
+    put_le(p + 4, 3, 4);
+    memcpy(p + 8, "abc", 3);
+    p[11] = 0; // pad byte
+    p += 12;
+    const int fmt_size = extensible ? 40 : ((format == 3) ? 18 : 16);
+    memcpy(p, "fmt ", 4);
+    put_le(p + 4, fmt_size, 4);
+    memset(p + 8, 0, fmt_size);
+    put_le(p + 8, extensible ? 0xFFFE : format, 2);
+    put_le(p + 10, num_channels, 2);
+    put_le(p + 12, 12000, 4);
+    put_le(p + 16, 12000 * block_align, 4);
+    put_le(p + 20, block_align, 2);
+    put_le(p + 22, bits, 2);
+    if (extensible)
+    {
+        put_le(p + 24, 22, 2);
+        put_le(p + 26, bits, 2);
+        put_le(p + 32, format, 2); // SubFormat GUID, first two bytes
+    }
+    p += 8 + fmt_size;
+    const uint32_t data_size = num_samples * block_align;
+    memcpy(p, "data", 4);
+    put_le(p + 4, (data_size_field < 0) ? data_size : (uint32_t)data_size_field, 4);
+    p += 8;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        for (int ch = 0; ch < num_channels; ++ch)
+        {
+            // Unsigned 8-bit samples are stored as offset binary, the others in two's complement
+            uint32_t value = wav_test_code(bits, i, ch);
+            if (format == 3)
+            {
+                float x = wav_test_value(bits, i, ch);
+                memcpy(&value, &x, 4);
+            }
+            else if (bits > 8)
+            {
+                value ^= 1u << (bits - 1);
+            }
+            put_le(p, value, sample_size);
+            p += sample_size;
+        }
+    }
+    memcpy(image, "RIFF", 4);
+    put_le(image + 4, (uint32_t)(p - image - 8), 4);
+    memcpy(image + 8, "WAVE", 4);
+    return p - image;
+}
+
+void test_wav_reader()
+{
+    printf("Testing WAV reader\n");
+    enum { kNum_samples = 1001, kMax_channels = 3 };
+    static uint8_t image[256 + kNum_samples * kMax_channels * 4];
+    float block[kNum_samples];
+
+    const struct
+    {
+        int format; // 1 = PCM, 3 = IEEE float
+        int bits;
+        int num_channels;
+        bool extensible;
+        int64_t data_size_field;
+    } cases[] = {
+        { 1, 8, 1, false, -1 },
+        { 1, 16, 2, false, -1 },
+        { 1, 24, 3, true, -1 },
+        { 1, 32, 2, true, -1 },
+        { 3, 32, 1, false, -1 },
+        { 3, 32, 2, true, -1 },
+        { 1, 16, 1, false, 0 },           // streamed: the data ends with the file
+        { 1, 16, 2, false, 0xFFFFFFFF },  // streamed
+        { 1, 24, 1, false, 1000000 },     // truncated file
+    };
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); ++c)
+    {
+        const int bits = cases[c].bits;
+        size_t size = make_test_wav(image, cases[c].format, bits, cases[c].num_channels, cases[c].extensible, kNum_samples, cases[c].data_size_field);
+        wav_reader_t reader;
+        CHECK(!wav_reader_init(&reader, image, size, cases[c].num_channels)); // no such channel
+        for (int ch = 0; ch < cases[c].num_channels; ++ch)
+        {
+            CHECK(wav_reader_init(&reader, image, size, ch));
+            CHECK(reader.sample_rate == 12000 && reader.num_channels == cases[c].num_channels && reader.bits_per_sample == bits);
+            CHECK(reader.is_float == (cases[c].format == 3));
+            CHECK(reader.num_samples == kNum_samples);
+
+            // Blocks of odd sizes, then nothing more at the end
+            int pos = 0;
+            for (int n = 1; pos < kNum_samples; n = n * 2 + 1)
+            {
+                int num_read = wav_reader_read(&reader, block + pos, n);
+                CHECK(num_read == ((pos + n <= kNum_samples) ? n : (kNum_samples - pos)));
+                pos += num_read;
+            }
+            CHECK(0 == wav_reader_read(&reader, block, 10));
+
+            for (int i = 0; i < kNum_samples; ++i)
+            {
+                CHECK(block[i] == wav_test_value(bits, i, ch));
+            }
+            CHECK(block[0] == -1.0f);
+        }
+    }
+
+    // Not a WAVE image, unsupported formats, and a file without samples
+    size_t size = make_test_wav(image, 1, 16, 1, false, kNum_samples, -1);
+    wav_reader_t reader;
+    image[8] = 'X';
+    CHECK(!wav_reader_init(&reader, image, size, 0));
+    size = make_test_wav(image, 1, 12, 1, false, kNum_samples, -1);
+    CHECK(!wav_reader_init(&reader, image, size, 0));
+    size = make_test_wav(image, 3, 16, 1, false, kNum_samples, -1);
+    CHECK(!wav_reader_init(&reader, image, size, 0));
+    size = make_test_wav(image, 2, 16, 1, false, kNum_samples, -1); // ADPCM
+    CHECK(!wav_reader_init(&reader, image, size, 0));
+    size = make_test_wav(image, 1, 16, 1, false, kNum_samples, -1);
+    CHECK(!wav_reader_init(&reader, image, 36, 0));
+
+    // A file written by save_wav() reads back within its 16-bit rounding (it scales by 32767 and rounds negative
+    // values toward zero)
+    const char* path = "/tmp/test_wav_reader.wav";
+    for (int i = 0; i < kNum_samples; ++i)
+    {
+        block[i] = sinf(0.01f * i) * 0.9f;
+    }
+    CHECK(0 == save_wav(block, kNum_samples, 12000, path));
+    CHECK(wav_reader_open(&reader, path, 0));
+    float readback[kNum_samples];
+    bool same = (kNum_samples == wav_reader_read(&reader, readback, kNum_samples)) && (reader.num_samples == kNum_samples);
+    wav_reader_close(&reader);
+    remove(path);
+    CHECK(same);
+    for (int i = 0; i < kNum_samples; ++i)
+    {
+        CHECK(fabsf(readback[i] - block[i]) <= 3.0f / 32768);
+    }
+    TEST_END;
+}
+
+/// Amplitude of the best fitting sinusoid of a frequency (cycles per sample) and the RMS of what remains of the signal
+static void fit_tone(const float* signal, int num_samples, double freq, double* amplitude, double* residual_rms)
+{
+    double re = 0, im = 0;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        re += signal[i] * cos(2 * M_PI * freq * i);
+        im += signal[i] * sin(2 * M_PI * freq * i);
+    }
+    re *= 2.0 / num_samples;
+    im *= 2.0 / num_samples;
+    double residual2 = 0;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        double e = signal[i] - re * cos(2 * M_PI * freq * i) - im * sin(2 * M_PI * freq * i);
+        residual2 += e * e;
+    }
+    *amplitude = sqrt(re * re + im * im);
+    *residual_rms = sqrt(residual2 / num_samples);
+}
+
+void test_resampler()
+{
+    printf("Testing resampler\n");
+    const int in_rates[] = { 48000, 44100, 8000 };
+    const int out_rate = 12000;
+    enum { kMax_input = 2 * 48000, kMax_output = 2 * 12000 + 16 };
+    static float input[kMax_input];
+    static float output[kMax_output];
+
+    for (int r = 0; r < 3; ++r)
+    {
+        // 1 kHz in the passband, and for 48 kHz also 9 kHz, which would alias to 3 kHz without the filter
+        for (int tone = 0; tone < ((in_rates[r] == 48000) ? 2 : 1); ++tone)
+        {
+            const double freq = (tone == 0) ? 1000 : 9000;
+            const int num_input = 2 * in_rates[r];
+            for (int i = 0; i < num_input; ++i)
+            {
+                input[i] = 0.5f * (float)sin(2 * M_PI * freq * i / in_rates[r]);
+            }
+            resampler_t rs;
+            resampler_init(&rs, in_rates[r], out_rate);
+            // Chunks of odd sizes, as an audio callback would deliver them
+            int num_output = 0;
+            for (int pos = 0, chunk = 1; pos < num_input; pos += chunk, chunk = (chunk * 7 + 3) % 1000 + 1)
+            {
+                int n = (pos + chunk <= num_input) ? chunk : (num_input - pos);
+                int num_used;
+                num_output += resampler_process(&rs, input + pos, n, &num_used, output + num_output, kMax_output - num_output);
+                if (num_used != n)
+                    break;
+            }
+            resampler_free(&rs);
+
+            // One output sample per down/up input samples, and the tone (past the filter delay) at the same
+            // frequency and amplitude
+            CHECK(abs(num_output - 2 * out_rate) <= 1);
+            const int skip = 100;
+            double amplitude, residual_rms;
+            fit_tone(output + skip, num_output - skip, ((tone == 0) ? freq : 3000.0) / out_rate, &amplitude, &residual_rms);
+            if (tone == 0)
+            {
+                CHECK(fabs(amplitude - 0.5) < 0.002);
+                CHECK(residual_rms < 0.5 * 3e-4); // -70 dB
+            }
+            else
+            {
+                CHECK(amplitude < 0.5 * 1e-3); // -60 dB
+            }
+        }
+    }
+    TEST_END;
+}
+
+void test_crc()
+{
+    printf("Testing CRC\n");
+    enum { NUM_MESSAGES = 1000 };
+    static uint8_t a91[NUM_MESSAGES * FTX_LDPC_K_BYTES];
+    static bool valid[NUM_MESSAGES];
+    uint32_t state = 1;
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        uint8_t data[12];
+        for (int j = 0; j < 12; ++j)
+        {
+            state = state * 1664525u + 1013904223u;
+            data[j] = (uint8_t)(state >> 24);
+        }
+        // Any number of bits
+        int num_bits = 1 + i % 96;
+        CHECK(ftx_compute_crc(data, num_bits) == crc_bitwise(data, num_bits));
+
+        // Payload CRC as defined: 77 bits zero-extended to 82
+        uint8_t payload[12];
+        memcpy(payload, data, 10);
+        payload[9] &= 0xF8u;
+        payload[10] = 0;
+        CHECK(ftx_payload_crc(data) == crc_bitwise(payload, 82));
+
+        // Every other message has one of its 91 bits flipped after the CRC is added
+        uint8_t* msg = a91 + i * FTX_LDPC_K_BYTES;
+        ftx_add_crc(data, msg);
+        CHECK(ftx_extract_crc(msg) == crc_bitwise(payload, 82));
+        CHECK(ftx_check_crc(msg));
+        if (i % 2)
+        {
+            int bit = (i * 7) % FTX_LDPC_K;
+            msg[bit / 8] ^= 0x80u >> (bit % 8);
+            CHECK(!ftx_check_crc(msg));
+        }
+    }
+    int num_valid = ftx_check_crc_many(a91, NUM_MESSAGES, valid);
+    CHECK(num_valid == NUM_MESSAGES / 2);
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        CHECK(valid[i] == ftx_check_crc(a91 + i * FTX_LDPC_K_BYTES));
+        num_valid -= valid[i];
+    }
+    CHECK(num_valid == 0);
+
+    TEST_END;
+}
+
+void test_encode_many()
+{
+    printf("Testing batch encoding\n");
+    enum { NUM_MESSAGES = 1000 };
+    static uint8_t payloads[NUM_MESSAGES * FTX_PAYLOAD_LENGTH_BYTES];
+    static uint8_t tones8[NUM_MESSAGES * FT8_NN];
+    static uint8_t tones4[NUM_MESSAGES * FT4_NN];
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        ftx_message_t msg;
+        make_test_message(&msg, i);
+        memcpy(payloads + i * FTX_PAYLOAD_LENGTH_BYTES, msg.payload, FTX_PAYLOAD_LENGTH_BYTES);
+    }
+    ft8_encode_many(payloads, NUM_MESSAGES, tones8);
+    ft4_encode_many(payloads, NUM_MESSAGES, tones4);
+
+    // Same tones as one message at a time
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        uint8_t tones[FT4_NN];
+        ft8_encode(payloads + i * FTX_PAYLOAD_LENGTH_BYTES, tones);
+        CHECK(0 == memcmp(tones, tones8 + i * FT8_NN, FT8_NN));
+        ft4_encode(payloads + i * FTX_PAYLOAD_LENGTH_BYTES, tones);
+        CHECK(0 == memcmp(tones, tones4 + i * FT4_NN, FT4_NN));
+    }
+
+    TEST_END;
+}
+
+/// Exact waveform of ftx_synth_gfsk() with the phase accumulated in double precision (no envelope)
+static void synth_gfsk_exact(const uint8_t* tones, int num_tones, float f0, int n_spsym, const float* pulse, int sample_rate, double* phase)
+{
+    double phi = 0;
+    for (int i = 0; i < num_tones; ++i)
+    {
+        int tone_prev = tones[(i > 0) ? (i - 1) : 0];
+        int tone_next = tones[(i + 1 < num_tones) ? (i + 1) : (num_tones - 1)];
+        for (int j = 0; j < n_spsym; ++j)
+        {
+            phase[i * n_spsym + j] = phi;
+            double f = tone_prev * (double)pulse[j + 2 * n_spsym] + tones[i] * (double)pulse[j + n_spsym] + tone_next * (double)pulse[j];
+            phi += 2 * M_PI * (f0 / sample_rate + f / n_spsym);
+        }
+    }
+}
+
+/// Stream one message of a protocol through an encoder set up in caller-provided memory and compare it against
+/// the exact waveform. All buffers are owned by the caller, so a failed check leaks nothing.
+static void test_encoder_protocol(ftx_protocol_t protocol, void* enc_buffer, float* pulse, double* exact, float* expected, float* signal, float* iq)
+{
+    const int sample_rate = 12000;
+    const bool is_ft4 = (protocol == FTX_PROTOCOL_FT4);
+    ftx_message_t msg;
+    make_test_message(&msg, 7 + is_ft4);
+    uint8_t tones[FT4_NN];
+    int num_tones = is_ft4 ? FT4_NN : FT8_NN;
+    float symbol_period = is_ft4 ? FT4_SYMBOL_PERIOD : FT8_SYMBOL_PERIOD;
+    float symbol_bt = is_ft4 ? FT4_SYMBOL_BT : FT8_SYMBOL_BT;
+    if (is_ft4)
+        ft4_encode(msg.payload, tones);
+    else
+        ft8_encode(msg.payload, tones);
+
+    int n_spsym = (int)(0.5f + sample_rate * symbol_period);
+    int num_samples = num_tones * n_spsym;
+    ftx_synth_gfsk(tones, num_tones, 1234.5f, symbol_bt, symbol_period, sample_rate, expected);
+    ftx_gfsk_pulse(n_spsym, symbol_bt, pulse);
+    synth_gfsk_exact(tones, num_tones, 1234.5f, n_spsym, pulse, sample_rate, exact);
+
+    ftx_encoder_t enc;
+    ftx_encoder_init_static(&enc, protocol, sample_rate, enc_buffer);
+    CHECK(0 == ftx_encoder_generate(&enc, signal, 100)); // no message yet
+    ftx_encoder_set_message(&enc, msg.payload, 1234.5f);
+    CHECK(enc.num_samples == num_samples);
+
+    // Blocks of odd sizes, crossing symbol boundaries, until the message ends
+    int pos = 0;
+    for (int block = 1; pos < num_samples + 100; block = (block * 3 + 1) % 4096 + 1)
+    {
+        int n = ftx_encoder_generate(&enc, signal + pos, block);
+        if (n == 0)
+            break;
+        pos += n;
+    }
+    CHECK(pos == num_samples);
+    float max_error = 0;
+    float max_error_synth = 0;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        float exact_sample = (float)sin(exact[i]) * ftx_gfsk_envelope(i, num_samples, n_spsym);
+        max_error = fmaxf(max_error, fabsf(signal[i] - exact_sample));
+        max_error_synth = fmaxf(max_error_synth, fabsf(expected[i] - exact_sample));
+    }
+    // The rounded NCO steps add up to about 1.6e-3 rad over an FT8 message; ftx_synth_gfsk() accumulates the phase
+    // in float, which drifts further
+    CHECK(max_error < 3e-3f);
+    CHECK(max_error_synth < 1e-2f);
+
+    // The complex output has no envelope and the same phase
+    ftx_encoder_set_tones(&enc, tones, 1234.5f);
+    CHECK(num_samples == ftx_encoder_generate_iq(&enc, iq, num_samples + 100));
+    max_error = 0;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        max_error = fmaxf(max_error, fabsf(iq[2 * i] - (float)cos(exact[i])));
+        max_error = fmaxf(max_error, fabsf(iq[2 * i + 1] - (float)sin(exact[i])));
+    }
+    CHECK(max_error < 3e-3f);
+    ftx_encoder_free(&enc);
+}
+
+void test_encoder()
+{
+    printf("Testing waveform encoder\n");
+    const int sample_rate = 12000;
+    // Room for the longer message (FT8) and the larger tables (FT4 has the shorter symbols, FT8 the longer ones)
+    const int max_spsym = (int)(0.5f + sample_rate * FT8_SYMBOL_PERIOD);
+    const int max_samples = FT8_NN * max_spsym;
+    size_t enc_size = ftx_encoder_get_memory_size(FTX_PROTOCOL_FT8, sample_rate);
+    size_t enc_size_ft4 = ftx_encoder_get_memory_size(FTX_PROTOCOL_FT4, sample_rate);
+    void* enc_buffer = malloc((enc_size > enc_size_ft4) ? enc_size : enc_size_ft4);
+    float* pulse = (float*)malloc(3 * max_spsym * sizeof(float));
+    double* exact = (double*)malloc(max_samples * sizeof(double));
+    float* expected = (float*)malloc(max_samples * sizeof(float));
+    float* signal = (float*)malloc((max_samples + 100) * sizeof(float));
+    float* iq = (float*)malloc(2 * max_samples * sizeof(float));
+
+    test_encoder_protocol(FTX_PROTOCOL_FT8, enc_buffer, pulse, exact, expected, signal, iq);
+    test_encoder_protocol(FTX_PROTOCOL_FT4, enc_buffer, pulse, exact, expected, signal, iq);
+
+    free(iq);
+    free(signal);
+    free(expected);
+    free(exact);
+    free(pulse);
+    free(enc_buffer);
+    TEST_END;
+}
+
+/// Gaussian noise from a fixed sequence (Box-Muller over a linear congruential generator)
+static float test_gauss(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    float u1 = ((*state >> 8) + 1.0f) / 16777217.0f;
+    *state = *state * 1664525u + 1013904223u;
+    float u2 = (*state >> 8) / 16777216.0f;
+    return sqrtf(-2.0f * logf(u1)) * cosf(2 * (float)M_PI * u2);
+}
+
+/// Fill a waterfall (one element per symbol and tone) with the power of an FT8 signal of the given amplitude in
+/// complex Gaussian noise of unit power, as 0.5 dB steps
+static void make_test_waterfall(ftx_waterfall_t* wf, const uint8_t* tones, float amplitude, uint32_t seed)
+{
+    for (int block = 0; block < wf->num_blocks; ++block)
+    {
+        for (int bin = 0; bin < wf->num_bins; ++bin)
+        {
+            float re = test_gauss(&seed) * sqrtf(0.5f);
+            float im = test_gauss(&seed) * sqrtf(0.5f);
+            if (bin == tones[block])
+            {
+                re += amplitude;
+            }
+            float db = 10.0f * log10f(re * re + im * im + 1e-12f);
+            int value = (int)lrintf(2 * (db + 60));
+            wf->mag[block * wf->block_stride + bin] = (uint8_t)((value < 0) ? 0 : ((value > 255) ? 255 : value));
+        }
+    }
+}
+
+void test_ap_decode()
+{
+    printf("Testing a-priori decoding\n");
+
+    // Known bits of the hypotheses
+    ftx_ap_hypothesis_t hyps[3];
+    CHECK(FTX_MESSAGE_RC_OK == ftx_ap_hypothesis_std(&hyps[0], NULL, "K1ABC", NULL, NULL));
+    const uint8_t mask_to[FTX_PAYLOAD_LENGTH_BYTES] = { 0xFF, 0xFF, 0xFF, 0xF8, 0, 0, 0, 0, 0, 0x38 };
+    CHECK(0 == memcmp(hyps[0].mask, mask_to, sizeof(mask_to)));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_ap_hypothesis_std(&hyps[1], NULL, "W9XYZ", "K1ABC", NULL));
+    const uint8_t mask_both[FTX_PAYLOAD_LENGTH_BYTES] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xC0, 0, 0x38 };
+    CHECK(0 == memcmp(hyps[1].mask, mask_both, sizeof(mask_both)));
+    CHECK(FTX_MESSAGE_RC_OK == ftx_ap_hypothesis_std(&hyps[2], NULL, "CQ", NULL, NULL));
+    CHECK(FTX_MESSAGE_RC_ERROR_CALLSIGN1 == ftx_ap_hypothesis_std(&hyps[2], NULL, "K1", NULL, NULL));
+
+    // A signal too weak to decode on its own
+    ftx_message_t msg_tx;
+    CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg_tx, NULL, "W9XYZ K1ABC -21"));
+    uint8_t tones[FT8_NN];
+    ft8_encode(msg_tx.payload, tones);
+
+    uint8_t mag[FT8_NN * 8];
+    ftx_waterfall_t wf = {
+        .max_blocks = FT8_NN,
+        .num_blocks = FT8_NN,
+        .num_bins = 8,
+        .time_osr = 1,
+        .freq_osr = 1,
+        .mag = mag,
+        .format = FTX_WATERFALL_U8,
+        .layout = FTX_WATERFALL_TIME_MAJOR,
+        .block_stride = 8,
+        .time_sub_stride = 8,
+        .freq_sub_stride = 8,
+        .bin_stride = 1,
+        .protocol = FTX_PROTOCOL_FT8
+    };
+    ftx_candidate_t cand = { 0 };
+    make_test_waterfall(&wf, tones, 1.6f, 26);
+
+    ftx_message_t msg_rx;
+    ftx_decode_status_t status;
+    CHECK(!ftx_decode_candidate(&wf, &cand, 25, &msg_rx, &status));
+
+    // Knowing both callsigns decodes it; knowing only a wrong one does not
+    CHECK(1 == ftx_decode_candidate_ap(&wf, &cand, hyps, 3, 25, &msg_rx, &status));
+    CHECK(0 == memcmp(msg_rx.payload, msg_tx.payload, FTX_PAYLOAD_LENGTH_BYTES));
+    CHECK(-1 == ftx_decode_candidate_ap(&wf, &cand, &hyps[2], 1, 25, &msg_rx, &status));
+
+    TEST_END;
+}
+
+/// White noise of rms 0.1 from a fixed sequence (sum of 12 uniform values)
+static void fill_test_noise(float* signal, int num_samples, uint32_t seed)
+{
+    for (int i = 0; i < num_samples; ++i)
+    {
+        float sum = 0;
+        for (int k = 0; k < 12; ++k)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            sum += (float)(seed >> 8) / (1 << 24);
+        }
+        signal[i] = 0.1f * (sum - 6);
+    }
+}
+
+/// Add an FT8 signal of the given amplitude and frequency to the audio of a slot, starting 0.5 s in
+static void add_test_signal(const uint8_t* tones, float freq, float amp, int sample_rate, float* signal)
+{
+    const int start = sample_rate / 2;
+    const int num_wave = (int)(FT8_NN * FT8_SYMBOL_PERIOD * sample_rate);
+    float* wave = (float*)malloc(num_wave * sizeof(float));
+    ftx_synth_gfsk(tones, FT8_NN, freq, FT8_SYMBOL_BT, FT8_SYMBOL_PERIOD, sample_rate, wave);
+    for (int i = 0; i < num_wave; ++i)
+    {
+        signal[start + i] += amp * wave[i];
+    }
+    free(wave);
+}
+
+void test_decode_multi()
+{
+    printf("Testing multi-symbol decoding\n");
+    const int sample_rate = 12000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    monitor_config_t cfg = {
+        .f_min = 200,
+        .f_max = 3000,
+        .sample_rate = sample_rate,
+        .time_osr = 2,
+        .freq_osr = 2,
+        .protocol = FTX_PROTOCOL_FT8,
+        .wf_phase = true
+    };
+    uint8_t payload[FTX_PAYLOAD_LENGTH_BYTES] = { 0x1C, 0x3F, 0x8A, 0x6A, 0xE2, 0x07, 0x10, 0xFE, 0x4C, 0xA0 };
+    uint8_t tones[FT8_NN];
+    ft8_encode(payload, tones);
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    enum { kMax_candidates = 20 };
+    ftx_candidate_t cand[kMax_candidates];
+    ftx_message_t message;
+    ftx_decode_status_t status;
+
+    // A clean signal decodes without LDPC errors over blocks of every length
+    fill_test_noise(signal, num_samples, 7);
+    add_test_signal(tones, 1003.0f, 0.1f, sample_rate, signal);
+    monitor_t mon;
+    monitor_init(&mon, &cfg);
+    monitor_feed(&mon, signal, num_samples);
+    CHECK(ftx_find_candidates(&mon.wf, 1, cand, 0) == 1);
+    for (int num_symbols = 1; num_symbols <= 3; ++num_symbols)
+    {
+        CHECK(ftx_decode_candidate_multi(&mon.wf, &cand[0], num_symbols, 25, &message, &status));
+        CHECK(status.ldpc_errors == 0);
+        CHECK(0 == memcmp(message.payload, payload, FTX_PAYLOAD_LENGTH_BYTES));
+    }
+    CHECK(!ftx_decode_candidate_multi(&mon.wf, &cand[0], 4, 25, &message, &status));
+    monitor_free(&mon);
+
+    // Without the complex spectra there is nothing to combine
+    cfg.wf_phase = false;
+    monitor_init(&mon, &cfg);
+    monitor_feed(&mon, signal, num_samples);
+    CHECK(ftx_find_candidates(&mon.wf, 1, cand, 0) == 1);
+    CHECK(!ftx_decode_candidate_multi(&mon.wf, &cand[0], 2, 25, &message, &status));
+    monitor_free(&mon);
+
+    // A signal too weak for the single-symbol metrics, which the 2-symbol ones recover
+    cfg.wf_phase = true;
+    fill_test_noise(signal, num_samples, 1);
+    add_test_signal(tones, 1003.0f, 0.01f, sample_rate, signal);
+    monitor_init(&mon, &cfg);
+    monitor_feed(&mon, signal, num_samples);
+    int num_candidates = ftx_find_candidates(&mon.wf, kMax_candidates, cand, 0);
+    int num_single = 0;
+    int num_multi = 0;
+    for (int i = 0; i < num_candidates; ++i)
+    {
+        if (ftx_decode_candidate(&mon.wf, &cand[i], 25, &message, &status))
+            ++num_single;
+        if (ftx_decode_candidate_multi(&mon.wf, &cand[i], 2, 25, &message, &status))
+        {
+            CHECK(0 == memcmp(message.payload, payload, FTX_PAYLOAD_LENGTH_BYTES));
+            ++num_multi;
+        }
+    }
+    CHECK(num_single == 0);
+    CHECK(num_multi > 0);
+    monitor_free(&mon);
+
+    free(signal);
+    TEST_END;
+}
+
+/// Compare the waterfall elements (magnitudes, and phases if kept) of two monitors with the same configuration
+static bool same_waterfall(const ftx_waterfall_t* a, const ftx_waterfall_t* b)
+{
+    if (a->num_blocks != b->num_blocks)
+        return false;
+    for (int block = 0; block < a->num_blocks; ++block)
+    {
+        for (int sub = 0; sub < a->time_osr * a->freq_osr; ++sub)
+        {
+            int offset = (block * a->block_stride) + ((sub / a->freq_osr) * a->time_sub_stride) + ((sub % a->freq_osr) * a->freq_sub_stride);
+            for (int bin = 0; bin < a->num_bins; ++bin)
+            {
+                int idx = offset + bin * a->bin_stride;
+                if (ftx_waterfall_get(a, block, idx) != ftx_waterfall_get(b, block, idx))
+                    return false;
+                if ((a->cpx != NULL) && ((a->cpx[idx].mag != b->cpx[idx].mag) || (a->cpx[idx].phase != b->cpx[idx].phase)))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+void test_dirty_refresh()
+{
+    printf("Testing waterfall refresh and candidate update\n");
+    const int sample_rate = 12000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    enum { kMax_candidates = 200, kMin_score = 10 };
+    const char* messages[] = { "CQ K1ABC FN42", "W9XYZ K1ABC -11", "K1ABC W9XYZ R-09" };
+    const float freqs[] = { 1003.0f, 1512.5f, 2200.0f };
+    ftx_message_t msg[3];
+    uint8_t tones[3][FT8_NN];
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    fill_test_noise(signal, num_samples, 36);
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg[i], NULL, messages[i]));
+        ft8_encode(msg[i].payload, tones[i]);
+        add_test_signal(tones[i], freqs[i], 0.05f, sample_rate, signal);
+    }
+
+    for (int layout = 0; layout < 2; ++layout)
+    {
+        const monitor_config_t cfg = {
+            .f_min = 200,
+            .f_max = 3000,
+            .sample_rate = sample_rate,
+            .time_osr = 2,
+            .freq_osr = 2,
+            .protocol = FTX_PROTOCOL_FT8,
+            .wf_layout = (layout == 0) ? FTX_WATERFALL_TIME_MAJOR : FTX_WATERFALL_FREQ_MAJOR,
+            .wf_phase = true,
+            .keep_audio = true
+        };
+        monitor_t mon;
+        monitor_init(&mon, &cfg);
+        monitor_feed(&mon, signal, num_samples);
+        ftx_waterfall_clear_dirty(&mon.wf);
+
+        // Wipe a strip of the waterfall: refreshing its tiles restores what monitor_process() made of the audio
+        monitor_t full;
+        monitor_init(&full, &cfg);
+        monitor_feed(&full, signal, num_samples);
+        const int first_bin = (int)(1512.5f * FT8_SYMBOL_PERIOD) - mon.min_bin - 2;
+        for (int block = 10; block < 40; ++block)
+        {
+            for (int sub = 0; sub < mon.wf.time_osr * mon.wf.freq_osr; ++sub)
+            {
+                int offset = (block * mon.wf.block_stride) + ((sub / mon.wf.freq_osr) * mon.wf.time_sub_stride) + ((sub % mon.wf.freq_osr) * mon.wf.freq_sub_stride);
+                for (int bin = first_bin; bin < first_bin + 12; ++bin)
+                {
+                    ftx_waterfall_set(&mon.wf, block, offset + bin * mon.wf.bin_stride, 0);
+                }
+            }
+        }
+        CHECK(!same_waterfall(&mon.wf, &full.wf));
+        ftx_waterfall_mark_dirty(&mon.wf, 10, 39, first_bin, first_bin + 11);
+        monitor_refresh(&mon);
+        CHECK(same_waterfall(&mon.wf, &full.wf));
+        ftx_waterfall_clear_dirty(&mon.wf);
+        monitor_free(&full);
+
+        // Subtract one signal: the updated candidate list is the one a full search of the refreshed waterfall finds
+        ftx_candidate_t updated[kMax_candidates];
+        int num_updated = ftx_find_candidates(&mon.wf, kMax_candidates, updated, kMin_score);
+        CHECK(num_updated > 0 && num_updated < kMax_candidates);
+        int idx_signal = -1;
+        for (int i = 0; (idx_signal < 0) && (i < num_updated); ++i)
+        {
+            ftx_message_t message;
+            ftx_decode_status_t status;
+            if (ftx_decode_candidate(&mon.wf, &updated[i], 25, &message, &status) && (0 == memcmp(message.payload, msg[1].payload, FTX_PAYLOAD_LENGTH_BYTES)))
+                idx_signal = i;
+        }
+        CHECK(idx_signal >= 0);
+        CHECK(monitor_subtract(&mon, &updated[idx_signal], tones[1]));
+        monitor_refresh(&mon);
+        num_updated = ftx_update_candidates(&mon.wf, kMax_candidates, updated, num_updated, kMin_score);
+
+        ftx_candidate_t found[kMax_candidates];
+        int num_found = ftx_find_candidates(&mon.wf, kMax_candidates, found, kMin_score);
+        CHECK(num_found < kMax_candidates);
+        CHECK(num_updated == num_found);
+        // Equal scores may come in any order
+        for (int i = 0; i < num_found; ++i)
+        {
+            CHECK(updated[i].score == found[i].score);
+        }
+        monitor_free(&mon);
+    }
+
+    free(signal);
+    TEST_END;
+}
+
+/// Order candidates by score, then by position, so that lists with ties in a different order can be compared
+static int compare_candidates(const void* a, const void* b)
+{
+    const ftx_candidate_t* ca = (const ftx_candidate_t*)a;
+    const ftx_candidate_t* cb = (const ftx_candidate_t*)b;
+    if (ca->score != cb->score)
+        return cb->score - ca->score;
+    if (ca->time_offset != cb->time_offset)
+        return ca->time_offset - cb->time_offset;
+    if (ca->freq_offset != cb->freq_offset)
+        return ca->freq_offset - cb->freq_offset;
+    if (ca->time_sub != cb->time_sub)
+        return ca->time_sub - cb->time_sub;
+    return ca->freq_sub - cb->freq_sub;
+}
+
+void test_waterfall_layouts()
+{
+    printf("Testing time-major and frequency-major waterfalls\n");
+    const int sample_rate = 12000;
+    const int num_samples = (int)(FT8_SLOT_TIME * sample_rate);
+    enum { kMax_candidates = 100, kMin_score = 10 };
+    const char* messages[] = { "CQ K1ABC FN42", "W9XYZ K1ABC -11", "K1ABC W9XYZ R-09" };
+    const float freqs[] = { 1003.0f, 1512.5f, 2200.0f };
+    float* signal = (float*)malloc(num_samples * sizeof(float));
+    fill_test_noise(signal, num_samples, 27);
+    for (int i = 0; i < 3; ++i)
+    {
+        ftx_message_t msg;
+        uint8_t tones[FT8_NN];
+        CHECK(FTX_MESSAGE_RC_OK == ftx_message_encode(&msg, NULL, messages[i]));
+        ft8_encode(msg.payload, tones);
+        add_test_signal(tones, freqs[i], 0.02f + 0.02f * i, sample_rate, signal);
+    }
+
+    for (int format = 0; format < 2; ++format)
+    {
+        monitor_config_t cfg = {
+            .f_min = 200,
+            .f_max = 3000,
+            .sample_rate = sample_rate,
+            .time_osr = 2,
+            .freq_osr = 2,
+            .protocol = FTX_PROTOCOL_FT8,
+            .wf_format = (format == 0) ? FTX_WATERFALL_U8 : FTX_WATERFALL_U4,
+            .wf_layout = FTX_WATERFALL_TIME_MAJOR
+        };
+        monitor_t time_major;
+        monitor_init(&time_major, &cfg);
+        monitor_feed(&time_major, signal, num_samples);
+        cfg.wf_layout = FTX_WATERFALL_FREQ_MAJOR;
+        monitor_t freq_major;
+        monitor_init(&freq_major, &cfg);
+        monitor_feed(&freq_major, signal, num_samples);
+
+        // The same candidates, up to the order of equal scores
+        ftx_candidate_t cand_t[kMax_candidates];
+        ftx_candidate_t cand_f[kMax_candidates];
+        int num_t = ftx_find_candidates(&time_major.wf, kMax_candidates, cand_t, kMin_score);
+        int num_f = ftx_find_candidates(&freq_major.wf, kMax_candidates, cand_f, kMin_score);
+        CHECK(num_t > 0);
+        CHECK(num_t == num_f);
+        qsort(cand_t, num_t, sizeof(cand_t[0]), compare_candidates);
+        qsort(cand_f, num_f, sizeof(cand_f[0]), compare_candidates);
+        CHECK(0 == memcmp(cand_t, cand_f, num_t * sizeof(cand_t[0])));
+
+        // The same decodes
+        int num_decoded = 0;
+        for (int i = 0; i < num_t; ++i)
+        {
+            ftx_message_t msg_t;
+            ftx_message_t msg_f;
+            ftx_decode_status_t status_t;
+            ftx_decode_status_t status_f;
+            bool ok_t = ftx_decode_candidate(&time_major.wf, &cand_t[i], 25, &msg_t, &status_t);
+            bool ok_f = ftx_decode_candidate(&freq_major.wf, &cand_f[i], 25, &msg_f, &status_f);
+            CHECK(ok_t == ok_f);
+            CHECK(status_t.ldpc_errors == status_f.ldpc_errors);
+            if (ok_t)
+            {
+                CHECK(0 == memcmp(msg_t.payload, msg_f.payload, FTX_PAYLOAD_LENGTH_BYTES));
+                ++num_decoded;
+            }
+        }
+        CHECK(num_decoded > 0);
+        monitor_free(&freq_major);
+        monitor_free(&time_major);
+    }
+
+    free(signal);
+    TEST_END;
+}
+
+#define SIZEOF_ARRAY(x) ((int)(sizeof(x) / sizeof((x)[0])))
+
+static float max2f(float a, float b)
+{
+    return (a >= b) ? a : b;
+}
+
+static float max4f(float a, float b, float c, float d)
+{
+    return max2f(max2f(a, b), max2f(c, d));
+}
+
+/// Scalar reference of ftx_extract_likelihood(): bit metrics computed per symbol in floats from ftx_waterfall_get(),
+/// then normalized to a variance of 24
+static void extract_likelihood_ref(const ftx_waterfall_t* wf, const ftx_candidate_t* cand, float* log174)
+{
+    const bool is_ft4 = (wf->protocol == FTX_PROTOCOL_FT4);
+    const int num_tones = is_ft4 ? 4 : 8;
+    const int bits_per_symbol = is_ft4 ? 2 : 3;
+    const int num_data = is_ft4 ? FT4_ND : FT8_ND;
+    const uint8_t* gray_map = is_ft4 ? kFT4_Gray_map : kFT8_Gray_map;
+
+    for (int k = 0; k < num_data; ++k)
+    {
+        int sym_idx = is_ft4 ? (k + ((k < 29) ? 5 : ((k < 58) ? 9 : 13))) : (k + ((k < 29) ? 7 : 14));
+        int block = cand->time_offset + sym_idx;
+        float* logl = log174 + bits_per_symbol * k;
+        if ((block < 0) || (block >= wf->num_blocks))
+        {
+            for (int b = 0; b < bits_per_symbol; ++b)
+                logl[b] = 0;
+            continue;
+        }
+
+        float s2[8];
+        for (int j = 0; j < num_tones; ++j)
+        {
+            int bin = cand->freq_offset + gray_map[j];
+            int idx = (block * wf->block_stride) + (cand->time_sub * wf->time_sub_stride) + (cand->freq_sub * wf->freq_sub_stride) + (bin * wf->bin_stride);
+            int value = ftx_waterfall_get(wf, block, idx);
+            if (wf->noise != NULL && value < wf->noise[cand->freq_sub * wf->num_bins + bin])
+                value = wf->noise[cand->freq_sub * wf->num_bins + bin];
+            s2[j] = 0.5f * value;
+        }
+        if (is_ft4)
+        {
+            logl[0] = max2f(s2[2], s2[3]) - max2f(s2[0], s2[1]);
+            logl[1] = max2f(s2[1], s2[3]) - max2f(s2[0], s2[2]);
+        }
+        else
+        {
+            logl[0] = max4f(s2[4], s2[5], s2[6], s2[7]) - max4f(s2[0], s2[1], s2[2], s2[3]);
+            logl[1] = max4f(s2[2], s2[3], s2[6], s2[7]) - max4f(s2[0], s2[1], s2[4], s2[5]);
+            logl[2] = max4f(s2[1], s2[3], s2[5], s2[7]) - max4f(s2[0], s2[2], s2[4], s2[6]);
+        }
+    }
+
+    float sum = 0;
+    float sum2 = 0;
+    for (int i = 0; i < FTX_LDPC_N; ++i)
+    {
+        sum += log174[i];
+        sum2 += log174[i] * log174[i];
+    }
+    float variance = (sum2 - (sum * sum / FTX_LDPC_N)) / FTX_LDPC_N;
+    float norm_factor = sqrtf(24.0f / variance);
+    for (int i = 0; i < FTX_LDPC_N; ++i)
+        log174[i] *= norm_factor;
+}
+
+void test_extract_likelihood()
+{
+    printf("Testing likelihood extraction against the scalar reference\n");
+    enum { kNum_bins = 24, kTime_osr = 2, kFreq_osr = 2, kMax_blocks = FT4_NN };
+    enum { kBlock_size = kTime_osr * kFreq_osr * kNum_bins };
+    uint8_t mag[kMax_blocks * kBlock_size];
+    uint8_t mag4[kMax_blocks * kBlock_size / 2];
+    uint8_t block_offset[kMax_blocks];
+    uint8_t block_scale[kMax_blocks];
+    uint8_t noise[kFreq_osr * kNum_bins];
+    uint8_t values[kMax_blocks][kBlock_size];
+
+    // Random magnitudes around a floor, one in eight lifted well above it like a tone
+    uint32_t seed = 32;
+    for (int block = 0; block < kMax_blocks; ++block)
+    {
+        for (int i = 0; i < kBlock_size; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            int value = 100 + (int)((seed >> 24) % 40);
+            if ((seed >> 8) % 8 == 0)
+                value += 40 + (int)((seed >> 12) % 80);
+            values[block][i] = (uint8_t)value;
+        }
+    }
+
+    for (int protocol = 0; protocol < 2; ++protocol)
+    {
+        for (int format = 0; format < 2; ++format)
+        {
+            for (int layout = 0; layout < 2; ++layout)
+            {
+                ftx_waterfall_t wf = {
+                    .max_blocks = kMax_blocks,
+                    .num_blocks = (protocol == 0) ? FT8_NN : FT4_NN,
+                    .num_bins = kNum_bins,
+                    .time_osr = kTime_osr,
+                    .freq_osr = kFreq_osr,
+                    .mag = mag,
+                    .mag4 = mag4,
+                    .block_offset = block_offset,
+                    .block_scale = block_scale,
+                    .format = (format == 0) ? FTX_WATERFALL_U8 : FTX_WATERFALL_U4,
+                    .layout = (layout == 0) ? FTX_WATERFALL_TIME_MAJOR : FTX_WATERFALL_FREQ_MAJOR,
+                    .protocol = (protocol == 0) ? FTX_PROTOCOL_FT8 : FTX_PROTOCOL_FT4,
+                };
+                if (wf.layout == FTX_WATERFALL_TIME_MAJOR)
+                {
+                    wf.bin_stride = 1;
+                    wf.freq_sub_stride = kNum_bins;
+                    wf.time_sub_stride = kFreq_osr * kNum_bins;
+                    wf.block_stride = kBlock_size;
+                }
+                else
+                {
+                    wf.block_stride = 1;
+                    wf.bin_stride = kMax_blocks;
+                    wf.freq_sub_stride = kNum_bins * kMax_blocks;
+                    wf.time_sub_stride = kFreq_osr * kNum_bins * kMax_blocks;
+                }
+                for (int block = 0; block < wf.num_blocks; ++block)
+                {
+                    ftx_waterfall_pack_block(&wf, block, values[block]);
+                }
+
+                // Candidates at the edges of the waterfall in time and frequency, with every subdivision
+                const int num_tones = (protocol == 0) ? 8 : 4;
+                const int time_offsets[] = { -10, -1, 0, 3, 10 };
+                const int freq_offsets[] = { 0, 5, kNum_bins - num_tones };
+                for (int with_noise = 0; with_noise < 2; ++with_noise)
+                {
+                    wf.noise = with_noise ? noise : NULL;
+                    if (with_noise)
+                    {
+                        ftx_waterfall_update_noise(&wf);
+                    }
+                    for (int t = 0; t < SIZEOF_ARRAY(time_offsets); ++t)
+                    {
+                        for (int f = 0; f < SIZEOF_ARRAY(freq_offsets); ++f)
+                        {
+                            for (int sub = 0; sub < kTime_osr * kFreq_osr; ++sub)
+                            {
+                                ftx_candidate_t cand = {
+                                    .time_offset = time_offsets[t],
+                                    .freq_offset = freq_offsets[f],
+                                    .time_sub = sub / kFreq_osr,
+                                    .freq_sub = sub % kFreq_osr,
+                                };
+                                float log174[FTX_LDPC_N];
+                                float expected[FTX_LDPC_N];
+                                ftx_extract_likelihood(&wf, &cand, log174);
+                                extract_likelihood_ref(&wf, &cand, expected);
+                                for (int i = 0; i < FTX_LDPC_N; ++i)
+                                {
+                                    CHECK(fabsf(log174[i] - expected[i]) <= 1e-4f * (1 + fabsf(expected[i])));
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    TEST_END;
+}
 
 int main()
 {
@@ -190,5 +2070,27 @@ int main()
 
     // test_std_msg("YOMAMA", "MYMAMA/QRP", "73");
 
+    test_message_fields();
+    test_decoded_set();
+    test_callsign_table();
+    test_callsign_table_threads();
+    test_callsign_index();
+    test_callsign_store();
+    test_waterfall_u4();
+    test_monitor_arena();
+    test_monitor_subtract();
+    test_monitor_plan_cache();
+    test_resampler();
+    test_channel();
+    test_wav_reader();
+    test_crc();
+    test_encode_many();
+    test_encoder();
+    test_ap_decode();
+    test_extract_likelihood();
+    test_decode_multi();
+    test_dirty_refresh();
+    test_waterfall_layouts();
+
     return 0;
 }
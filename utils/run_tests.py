@@ -19,7 +19,7 @@ def parse(line):
         source = '<...>'
     return " ".join([dest, source, report]), snr
 
-def main(wav_dir, is_ft4, live):
+def main(wav_dir, is_ft4, live, packed, multi, subtract):
     wav_files = [os.path.join(wav_dir, f) for f in os.listdir(wav_dir)]
     wav_files = [f for f in wav_files if os.path.isfile(f) and os.path.splitext(f)[1] == '.wav']
     txt_files = [os.path.splitext(f)[0] + '.txt' for f in wav_files]
@@ -38,6 +38,12 @@ def main(wav_dir, is_ft4, live):
             cmd_args = ['./decode_ft8', wav_file]
         if is_ft4:
             cmd_args.append('-ft4')
+        if packed:
+            cmd_args.append('-packed')
+        if multi:
+            cmd_args.append('-multi')
+        if subtract:
+            cmd_args.append('-subtract')
         result = subprocess.run(cmd_args, stdout=subprocess.PIPE)
         result = result.stdout.decode('utf-8').split('\n')
         res_dict = {}
@@ -85,6 +91,9 @@ if __name__ == "__main__":
     parser.add_argument("wav_dir", help="Directory with wav files")
     parser.add_argument("--ft4", dest="is_ft4", action="store_true", default=False, help="Use FT4")
     parser.add_argument("--live", action="store_true", default=False, help="Use live decoder")
+    parser.add_argument("--packed", action="store_true", default=False, help="Use 4-bit waterfall storage")
+    parser.add_argument("--multi", action="store_true", default=False, help="Retry failed candidates with multi-symbol metrics")
+    parser.add_argument("--subtract", action="store_true", default=False, help="Subtract decoded signals and decode again")
     args = parser.parse_args()
     main(**vars(args))
 